@@ -4,6 +4,14 @@
 #define BIL_FILE_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include <unordered_map>
+
+
+// =======================================================================================
+// Useful constants
+
+#define BIL_MAX_RECT_PIXELS 4194304 // rectangles bigger than this are sampled sparsely
 
 
 // =======================================================================================
@@ -11,6 +19,12 @@
 ///
 /// The main purpose of this at the moment is reading data from the World Harmonized 
 /// Soil Database.  For more, see https://www.fao.org/3/aq361e/aq361e.pdf.
+///
+/// The raster is mapped read-only into memory when we are constructed, so looking up a
+/// point is just arithmetic and a load (with no system calls), and nothing is ever 
+/// changed after construction, so any number of threads can look up points at once 
+/// without locking.  The operating system pages in the parts of the raster that are 
+/// actually used.
 
 class BILFile
 {
@@ -22,27 +36,37 @@ public:
   BILFile(char* fileNameStub);
   ~BILFile(void);
   unsigned short valueAtPoint(float lat, float longt);
+  void valuesAtPoints(unsigned N, const float* lats, const float* longts, 
+                                                                  unsigned short* values);
+  unsigned valueAreas(float loLat, float hiLat, float loLong, float hiLong,
+                                          std::unordered_map<unsigned short, float>& areas);
 
 private:
   
   // Instance variables - private
-  int     byteOrder;
-  int     nRows;
-  int     nCols;
-  int     nBands;
-  int     nBits;
-  int     bandRowBytes;
-  int     totalRowBytes;
-  int     bandGapBytes;
-  double  latPixelDelta;
-  double  longPixelDelta;
-  double  latPixelStart;
-  double  longPixelStart;
-  FILE*   dataFile;
+  int       byteOrder;
+  int       nRows;
+  int       nCols;
+  int       nBands;
+  int       nBits;
+  int       bandRowBytes;
+  int       totalRowBytes;
+  int       bandGapBytes;
+  double    latPixelDelta;
+  double    longPixelDelta;
+  double    latPixelStart;
+  double    longPixelStart;
+  uint8_t*  data;       // the whole .bil file, mapped read-only
+  size_t    dataSize;
   
   // Member functions - private
   bool readHdrFile(char* fileNameStub);
   bool readBlwFile(char* fileNameStub);
+  bool mapDataFile(char* fileNameStub);
+  unsigned short valueAtOffset(size_t byteOffset);
+  bool pixelOffset(float lat, float longt, size_t& byteOffset);
+  bool pixelRange(float lo, float hi, double start, double delta, int n, 
+                                              int& first, int& last, bool nearest = true);
  
   /// @brief Prevent copy-construction.
   BILFile(const BILFile&);       
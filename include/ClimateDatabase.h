@@ -11,7 +11,10 @@
 
 class GHCNDatabase;
 class GHCNStation;
+class ClimateSynthesis;
 class HttpServThread;
+class HttpRouteTable;
+class HttpResponseCache;
 
 
 // =======================================================================================
@@ -27,29 +30,35 @@ public:
   // Instance variables - public
   
   // Member functions - public
-  ClimateDatabase(float fileSpacing = -1.0f);
+  ClimateDatabase(float fileSpacing = -1.0f, unsigned memoryBudgetMB = 0u);
   ~ClimateDatabase(void);
   bool processClimateRequest(HttpServThread* serv, char* url, bool diagnostic = false);
   bool indexPageTable(HttpServThread* serv);
   bool processHttpRequest(HttpServThread* serv, char* url);
+  void registerRoutes(HttpRouteTable& routes);
+  void setResponseCache(HttpResponseCache* cache);
   
 private:
   
   // Instance variables - private
-  GHCNDatabase* ghcnDatabase;
+  GHCNDatabase*     ghcnDatabase;
+  ClimateSynthesis* synthesis;
   
   // Member functions - private
   bool stationTableHeader(HttpServThread* serv, float* latLong,
                     std::vector<GHCNStation*>& relevantStations, std::vector<bool>& skipStations);
-  unsigned printClimateJson(char* buf, unsigned bufSize, 
-                                            float lat, float longt, unsigned yearCount);
+  bool stationsLoadingPage(HttpServThread* serv, const char* title, int N,
+                                                                  float lat, float longt);
+  unsigned printClimateJson(HttpServThread* serv, char* buf, unsigned bufSize, float lat,
+                                         float longt, unsigned yearCount, float elevation);
   bool printStationDiagnosticTable(HttpServThread* serv, 
                                             float lat, float longt, unsigned yearCount);
   bool processStationDiagnosticRequest(HttpServThread* serv, char* stationId);
+  bool processStationSummaryRequest(HttpServThread* serv, char* stationId);
   bool processStationComparisonRequest(HttpServThread* serv, char* url, char* urlStub, 
-                                       unsigned andMask, unsigned offset);
+                                                                      unsigned observable);
   bool processObservationCurvesRequest(HttpServThread* serv, char* url, char* urlStub,
-                            unsigned andFlagMask, unsigned obsOffset, char* titleObsName);
+                                                unsigned andFlagMask, char* titleObsName);
   bool processStationDataRequest(HttpServThread* serv, char* stationId, unsigned observable);
 
   /// @brief Prevent copy-construction.
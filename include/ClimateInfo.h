@@ -5,14 +5,18 @@
 
 #include "DynamicallyTypable.h"
 #include <vector>
+#include <stdint.h>
 
 
 // =======================================================================================
 // Forward declarations
 
 class GHCNDatabase;
+class GHCNBinaryCache;
 class HttpServThread;
 class ClimateDatabase;
+class ClimateYearSummary;
+class ClimateSynthesis;
 
 
 // =======================================================================================
@@ -35,27 +39,37 @@ class ClimateDatabase;
 
 
 // =======================================================================================
-// Flags for storage in a ClimateDay structure.
+// Flags for storage in a ClimateDay structure, also used to say which observable is 
+// wanted.
 
 #define LOW_TEMP_VALID  0x00000001
 #define HI_TEMP_VALID   0x00000002
 #define PRECIP_VALID    0x00000004
 #define ALL_OBS_VALID   0x00000007
 
+// Index of each observable in the arrays of a ClimateYear
+#define LOW_TEMP_INDEX  0
+#define HI_TEMP_INDEX   1
+#define PRECIP_INDEX    2
+#define OBSERVABLES     3
+#define obsIndex(flag)  __builtin_ctz(flag) // eg HI_TEMP_VALID -> HI_TEMP_INDEX
+
+#define DAY_MASK_WORDS  6   // 64 bit words needed for a bit per day of the year
+
 
 // =======================================================================================
 // Useful macros
 
-#define forAllDays(i, j)  int loopDays; for(int i=0; i < nYears; i++, \
-                              loopDays = DaysInYear(climateYears[(i<nYears?i:nYears-1)]->year)) \
-                                    for(int j=0; j < loopDays; j++)
+#define forAllDays(i, j)  for(int i=0; i < nYears; i++) \
+                              for(int j=0, loopDays = DaysInYear(climateYears[i]->year); \
+                                                                    j < loopDays; j++)
 
 #define tempInRange(T) (((T) >= MIN_TEMP_VALID) && ((T) <= MAX_TEMP_VALID))
 #define precipInRange(P) (((P) >= MIN_PRECIP) && ((P) <= MAX_PRECIP))
 
 
 // =======================================================================================
-/// @brief One day's worth of climate data.
+/// @brief One day's worth of climate data (as unpacked from a ClimateYear).
 
 class ClimateDay
 {
@@ -73,7 +87,14 @@ class ClimateDay
 
 
 // =======================================================================================
-/// @brief ClimateYear is an array of ClimateDays - always has space for a leap day.
+/// @brief ClimateYear holds a year of daily observations - always has space for a leap 
+/// day.
+///
+/// The data is laid out by observable rather than by day: each observable has an array
+/// of 366 values (in integer tenths of a degree C or mm, as in the GHCN files), and a
+/// bitmap of which days have a valid value.  This keeps a year small, and means that 
+/// counting valid days is a popcount, and comparing years is a loop over packed 
+/// integers that the compiler can vectorize.
 
 class ClimateYear
 {
@@ -81,15 +102,26 @@ class ClimateYear
   public:
   
   // Instance variables - public
-  int         year;
-  unsigned    flags;
-  ClimateDay  climateDays[366];
+  int       year;
+  unsigned  flags;
+  uint64_t  validDays[OBSERVABLES][DAY_MASK_WORDS];   // bit per day, by observable
+  int16_t   observations[OBSERVABLES][366];           // tenths, by observable
 
   // Member functions - public
   ClimateYear(int inYear);
   bool assessValidity(void);
-  bool diffObservable(ClimateYear* otherYear, float& difference,
-                                                unsigned andFlagMask, unsigned obsOffset);
+  bool diffObservable(ClimateYear* otherYear, float& difference, unsigned observable);
+  void setObservation(int index, int day, int tenths, bool valid);
+  unsigned countValid(int index);
+  unsigned dayFlags(int day);
+  ClimateDay getDay(int day);
+
+  /// @brief Check whether one observable is valid on some day.
+  inline bool isValid(int index, int day)
+                                {return (validDays[index][day >> 6] >> (day & 63)) & 1u;}
+  
+  /// @brief The value of one observable on some day (degrees C or mm).
+  inline float value(int index, int day) {return observations[index][day]/10.0f;}
 };
 
 
@@ -100,11 +132,17 @@ class ClimateYear
 /// temperatures and precipitation data that is intended to be weather data for a 
 /// particular location.  This is the unit of data obtained by permaplan from
 /// permaserv, and then used in projections within permaplan.
+///
+/// Once all the years are in, summarize() works out a ClimateYearSummary for each of 
+/// them, after which summary questions (normals, valid day counts, etc) can be 
+/// answered a year at a time rather than a day at a time.
 
 class ClimateInfo: public DynamicallyTypable
 {
   friend GHCNDatabase;
+  friend GHCNBinaryCache;
   friend ClimateDatabase;
+  friend ClimateSynthesis;
   
 public:
   
@@ -116,18 +154,23 @@ public:
   // Member functions - public
   ClimateInfo(int start, int end);
   ~ClimateInfo(void);
+  size_t bytesUsed(void);
+  void summarize(void);
   void countValidDays(unsigned& totalDays, unsigned& validDays);
+  void monthlyNormals(float normals[12][OBSERVABLES]);
   bool diagnosticHTML(HttpServThread* serv);
+  bool summaryHTML(HttpServThread* serv);
   virtual DynamicType getDynamicType(void) {return TypeClimateInfo;}
   virtual int writeJsonFields(char* buf, unsigned bufSize);
   bool diffObservable(ClimateInfo* otherInfo, std::vector<int>& years,
-                    std::vector<float>& diffs, unsigned andFlagMask, unsigned obsOffset);
+                                          std::vector<float>& diffs, unsigned observable);
   bool observableTabTable(HttpServThread* serv, unsigned observable);
 
 private:
   
   // Instance variables - private
-  ClimateYear** climateYears;
+  ClimateYear**       climateYears;
+  ClimateYearSummary* summaries;    // one per year, once summarize() has been called
   
   // Member functions - private
   /// @brief Prevent copy-construction.
@@ -0,0 +1,59 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+
+#ifndef CLIMATE_SUMMARY_H
+#define CLIMATE_SUMMARY_H
+
+#include "ClimateInfo.h"
+
+
+// =======================================================================================
+// Important constants
+
+#define GROWING_BASE_TEMP   10.0f // degrees C, base for growing degree days
+#define FROST_TEMP          0.0f  // degrees C, lows at or below this are a frost
+#define NO_FROST_DAY        -1    // for frost dates in years without one
+
+
+// =======================================================================================
+/// @brief Summary statistics for one ClimateYear, worked out once when the station is
+/// loaded.
+///
+/// This holds the things callers most often want from a year (monthly and annual means,
+/// extremes, precipitation totals, growing degree days, frost dates, and how much of
+/// the year is valid), so that they can be had for the cost of looking them up, rather
+/// than going back through the days.  Only valid days count towards anything, and the
+/// mean of an observable with no valid days in the period is NAN.
+
+class ClimateYearSummary
+{
+public:
+
+  // Instance variables - public
+  int             year;
+  unsigned short  validDays[OBSERVABLES];     // by observable index
+  unsigned short  allValidDays;               // days with all observables valid
+  unsigned char   monthDays[12][OBSERVABLES]; // valid days in each month
+  float           monthMean[12][OBSERVABLES];
+  float           annualMean[OBSERVABLES];
+  float           hiTempMax;                  // hottest high of the year
+  float           lowTempMin;                 // coldest low of the year
+  float           precipMax;                  // wettest day (mm)
+  float           precipTotal;                // mm over the valid days
+  float           monthPrecip[12];            // mm over the valid days of each month
+  float           growingDegreeDays;          // over days with both temps valid
+  short           lastSpringFrost;            // day of year, or NO_FROST_DAY
+  short           firstFallFrost;             // day of year, or NO_FROST_DAY
+
+  // Member functions - public
+  void compute(ClimateYear* climYear);
+  float validFraction(int index);
+};
+
+
+// =======================================================================================
+
+#endif
+
+
+
+
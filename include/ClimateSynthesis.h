@@ -0,0 +1,133 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+
+#ifndef CLIMATE_SYNTHESIS_H
+#define CLIMATE_SYNTHESIS_H
+
+#include "Lockable.h"
+#include "ClimateInfo.h"
+#include <unordered_map>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+
+// =======================================================================================
+// Forward declarations
+
+class GHCNDatabase;
+class GHCNStation;
+class HttpServThread;
+
+
+// =======================================================================================
+// Important constants
+
+#define SYNTH_STATIONS      8       // nearest stations blended for each observable
+#define SYNTH_MAX_STATIONS  64      // furthest we widen the search to find them
+#define SYNTH_GRID_DEGREES  0.05f   // size of the grid cells syntheses are cached by
+#define SYNTH_ELEV_STEP     50.0f   // meters, elevations are rounded to this for caching
+#define SYNTH_ELEV_WEIGHT   10.0f   // km of distance per km of elevation difference
+#define SYNTH_MIN_KM        1.0f    // closer stations are weighted as if this far
+#define SYNTH_LAPSE_RATE    6.5f    // degrees C cooler per km higher (standard lapse)
+#define SYNTH_CACHE_CELLS   256     // most syntheses kept in memory
+
+
+// =======================================================================================
+/// @brief One station's part in a synthesis.
+
+struct ClimateSynthSource
+{
+  char          id[12];
+  GHCNStation*  station;
+  unsigned      fileVersion;  // of the station's file when its data was used
+  float         distance;     // km, including any addition for elevation difference
+  float         weights[OBSERVABLES]; // share of each observable's weight, from 0 to 1
+};
+
+
+// =======================================================================================
+/// @brief A synthesized climate series for one grid cell, as kept in the cache.
+
+struct ClimateSynthCell
+{
+  uint64_t                        key;
+  float                           lat;        // centre of the cell
+  float                           longT;
+  float                           elevation;  // that temperatures are adjusted to
+  unsigned                        yearCount;
+  ClimateInfo*                    climate;
+  std::vector<ClimateSynthSource> sources;
+  unsigned                        obsFlags;   // observables we had station data for
+  unsigned long                   lastUse;
+  unsigned                        refCount;   // callers using it right now
+  bool                            retired;    // out of the cache, free on last release
+};
+
+
+// =======================================================================================
+/// @brief Synthesizes a gap-filled daily climate series for an arbitrary location from
+/// the nearby GHCN stations.
+///
+/// Each observable is blended by inverse distance squared weighting from the nearest
+/// SYNTH_STATIONS stations that have it (preferring ones at a similar elevation), with
+/// the search widened as far as SYNTH_MAX_STATIONS stations to find them, and any 
+/// observable none of those have is reported as unavailable.  Station temperatures
+/// are first moved to the elevation of the place using a standard lapse rate.  Each
+/// day of each observable is the weighted mean of the stations that have a valid value
+/// that day, so one station's gaps are filled by its neighbours; days that no station
+/// has are filled from the blended monthly normals.  The blending works through the
+/// stations one at a time, accumulating into per-day arrays, so the inner loops run
+/// straight along the stations' packed columns and can be vectorized by the compiler.
+///
+/// Syntheses are done for the centre of a SYNTH_GRID_DEGREES grid cell (with the
+/// elevation rounded to SYNTH_ELEV_STEP), and kept in a small LRU cache, so that
+/// requests for nearby parcels are answered without doing any work at all.  Cells
+/// handed out are reference counted, so they can be evicted while still being used.
+
+class ClimateSynthesis: public Lockable
+{
+public:
+
+  // Instance variables - public
+
+  // Member functions - public
+  ClimateSynthesis(GHCNDatabase* ghcnDb);
+  ~ClimateSynthesis(void);
+  ClimateSynthCell* get(float lat, float longT, float elevation, unsigned yearCount,
+                                          unsigned timeoutMs = 0u, bool* timedOut = NULL);
+  void release(ClimateSynthCell* cell);
+  int writeJson(ClimateSynthCell* cell, char* buf, unsigned bufSize);
+  bool diagnosticHTML(HttpServThread* serv);
+
+private:
+
+  // Instance variables - private
+  GHCNDatabase*                                   ghcnDatabase;
+  std::unordered_map<uint64_t, ClimateSynthCell*> cells;
+  unsigned long                                   clock;
+  unsigned long                                   hits;
+  unsigned long                                   misses;
+  unsigned long                                   evictions;
+
+  // Member functions - private
+  bool synthesize(ClimateSynthCell* cell, unsigned timeoutMs, bool* timedOut);
+  bool isCurrent(ClimateSynthCell* cell);
+  static bool stationHasObservable(ClimateInfo* info, unsigned flag);
+  void retire(ClimateSynthCell* cell);
+  void evictIfFull(void);
+
+  /// @brief Prevent copy-construction.
+  ClimateSynthesis(const ClimateSynthesis&);
+  /// @brief Prevent assignment.
+  ClimateSynthesis& operator=(const ClimateSynthesis&);
+};
+
+
+// =======================================================================================
+
+#endif
+
+
+
+
@@ -0,0 +1,96 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+
+#ifndef GHCN_BINARY_CACHE_H
+#define GHCN_BINARY_CACHE_H
+
+#include <stdint.h>
+#include <atomic>
+
+
+// =======================================================================================
+// Important constants
+
+#define GHCN_CACHE_MAGIC    "GHCB"
+#define GHCN_CACHE_VERSION  1u
+#define GHCN_CACHE_SUFFIX   ".ghcnb"
+
+
+// =======================================================================================
+// Forward declarations
+
+class GHCNStation;
+class ClimateInfo;
+
+
+// =======================================================================================
+/// @brief Header at the start of a station's binary cache file.
+///
+/// The header is followed by the year index and then the columns, each covering every
+/// day slot (366 per year) of every year in order:
+/// - int32_t  years[nYears]
+/// - uint32_t yearFlags[nYears]
+/// - int16_t  hiTemp[nYears*366]   (tenths of a degree C, as in the GHCN files)
+/// - int16_t  lowTemp[nYears*366]  (tenths of a degree C)
+/// - int16_t  precip[nYears*366]   (tenths of a mm)
+/// - uint8_t  dayFlags[nYears*366]
+/// All values are in host byte order, as the cache is never shared between machines.
+
+struct GHCNCacheHeader
+{
+  char      magic[4];
+  uint32_t  version;
+  int32_t   startYear;    // the range of years the ClimateInfo was built for
+  int32_t   endYear;
+  int32_t   nYears;
+  uint32_t  pad;
+  int64_t   csvModTime;   // the .csv.gz file this was built from
+  int64_t   csvSize;
+};
+
+
+// =======================================================================================
+/// @brief Compact binary columnar cache of parsed GHCN station data.
+///
+/// Parsing a station's .csv.gz file is slow, so once we've done it we write what we
+/// got to a binary file next to it, which is memory-mapped and turned straight back
+/// into a ClimateInfo on later loads.  The cache is ignored (and later rewritten) if
+/// its version or range of years doesn't match, or if the .csv.gz file has changed
+/// since it was written.
+
+class GHCNBinaryCache
+{
+public:
+
+  // Instance variables - public
+  std::atomic<unsigned long>  hits;
+  std::atomic<unsigned long>  misses;
+  std::atomic<unsigned long>  writes;
+
+  // Member functions - public
+  GHCNBinaryCache(char* path);
+  ~GHCNBinaryCache(void);
+  bool read(GHCNStation* station, ClimateInfo* climInfo);
+  bool write(GHCNStation* station, ClimateInfo* climInfo);
+
+private:
+
+  // Instance variables - private
+  char* dbPath;
+
+  // Member functions - private
+  bool snprintFileNames(GHCNStation* station, char* cacheName, char* csvName, int len);
+
+  /// @brief Prevent copy-construction.
+  GHCNBinaryCache(const GHCNBinaryCache&);
+  /// @brief Prevent assignment.
+  GHCNBinaryCache& operator=(const GHCNBinaryCache&);
+};
+
+
+// =======================================================================================
+
+#endif
+
+
+
+
@@ -4,10 +4,13 @@
 #define GHCN_DATABASE_H
 
 #include "HttpClient.h"
-#include "RTree.h"
+#include "GHCNStationIndex.h"
 #include <vector>
 #include <unordered_map>
 #include <string>
+#include <atomic>
+
+#define GHCN_READ_BLOCK 262144  // bytes of a station file decompressed at a time
 
 
 // =======================================================================================
@@ -16,6 +19,10 @@
 class ClimateInfo;
 class ClimateDatabase;
 class ClimateYear;
+class HttpResponseCache;
+class GHCNPipeline;
+class GHCNBinaryCache;
+class ClimateSynthesis;
 
 
 // =======================================================================================
@@ -31,12 +38,15 @@ public:
   GHCNStation(char* buf);
   
   // Instance variables - public
-  char          id[12];
-  float         latLong[2];   // degrees
-  float         elevation;    // in meters
-  unsigned      fileBufSize;  // in bytes
-  ClimateInfo*  climate; 
-  char          name[32];
+  char                        id[12];
+  float                       latLong[2];   // degrees
+  float                       elevation;    // in meters
+  unsigned                    fileBufSize;  // in bytes
+  std::atomic<ClimateInfo*>   climate;      // only set once fully read in
+  std::atomic<bool>           loadRequested;
+  std::atomic<unsigned long>  lastUse;      // GHCNPipeline's clock when last wanted
+  std::atomic<unsigned>       fileVersion;  // times its file has been replaced
+  char                        name[32];
 };
 
 
@@ -47,43 +57,70 @@ public:
 /// world.  The purpose of this class is to provide the data in a usable form to the
 /// rest of permaserv.  For more on the dataset:
 /// https://www.ncei.noaa.gov/metadata/geoportal/rest/metadata/item/gov.noaa.ncdc:C00861/html.
+///
+/// Searches are re-entrant (results go into storage supplied by the caller), and a 
+/// station's ClimateInfo is never changed once it's published, so any number of HTTP
+/// server threads can look up climate at once without locking.  Stations that aren't
+/// in memory yet are fetched and read in the background by our GHCNPipeline.  If 
+/// memory is tight, the pipeline can evict stations that haven't been used lately, and
+/// reload them when they're wanted again.  Once a station's file has been parsed, the
+/// result is kept in a GHCNBinaryCache so later loads (eg after a restart) don't need
+/// to parse it again.
 
 class GHCNDatabase: public HttpClient
 {
   friend ClimateDatabase;
-  friend bool searchCallback(GHCNStation*, void*);
+  friend GHCNPipeline;
+  friend ClimateSynthesis;
   
 public:
   
   // Instance variables - public
+  float loadAllSpacing;   // for startLoadAll to pass to loadAll
   
   // Member functions - public
   GHCNDatabase(char* path);
   ~GHCNDatabase(void);
   void loadAll(float spacing);
+  void startLoadAll(float spacing);
+  static void benchmarkCSVParsing(char* dirName);
   
 private:
   
   // Instance variables - private
   char* dbPath;
-  RTree<GHCNStation*, float, 2> stationTree;
-  std::vector<GHCNStation*> stationResults;
+  GHCNStationIndex stationIndex;
   std::unordered_map<std::string, GHCNStation*> stationsByName;
-  ClimateYear*  readYear;
+  HttpResponseCache* responseCache; // to invalidate when files are refreshed
+  GHCNPipeline*      pipeline;
+  GHCNBinaryCache*   binaryCache;   // parsed station data, to avoid re-reading csv
   
   // Member functions - private
   bool parseStationFileWithC(char* fileName);
   bool parseStationFileRegEx(char* fileName);
   void readStations(void);
   void checkFileIndex(void);
-  void getStations(float lat, float longT, int hitGoal);
-  void searchStations(float lat, float longT, std::vector<GHCNStation*>& relevantStations,
-                        std::vector<unsigned>& indices, int hitGoal, unsigned andFlagMask, 
-                        unsigned year = 0u);
-  int readOneCSVFile(GHCNStation* station);
-  bool readCSVLine(char* buf, GHCNStation* station, char* fileName, int line);
+  void getStations(float lat, float longT, int hitGoal, 
+                      std::vector<GHCNStation*>& results, 
+                      std::vector<float>* distances = NULL,
+                      float elevation = GHCN_NO_ELEVATION, float elevWeight = 0.0f);
+  bool searchStations(float lat, float longT, std::vector<GHCNStation*>& relevantStations,
+                        std::vector<ClimateInfo*>& infos, std::vector<unsigned>& indices, 
+                        int hitGoal, unsigned andFlagMask, int year = 0, 
+                        unsigned timeoutMs = 0u);
+  ClimateInfo* loadStation(GHCNStation* station);
+  int readStation(GHCNStation* station, ClimateInfo* climInfo, size_t* bytesRead = NULL);
+  int readOneCSVFile(GHCNStation* station, ClimateInfo* climInfo, 
+                                                              size_t* bytesRead = NULL);
+  static int readCSVFile(const char* fileName, const char* stationId, 
+                                      ClimateInfo* climInfo, size_t* bytesRead = NULL);
+  static bool readCSVLine(const char* buf, const char* end, const char* stationId,
+                              ClimateInfo* climInfo, ClimateYear*& readYear, 
+                              const char* fileName, int line);
   bool checkOrFetchCSVFile(GHCNStation* station, float pause = -1.0f);
-  bool checkUpdateFile(char* fileName, char* url, float maxAge, float pause = -1.0f);
+  bool checkUpdateFile(char* fileName, char* url, float maxAge, float pause = -1.0f,
+                                                                  bool* replaced = NULL);
+  void invalidateStation(GHCNStation* station);
   bool snprintCSVFileName(char* fileName, int len, GHCNStation* station);
 
   /// @brief Prevent copy-construction.
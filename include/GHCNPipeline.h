@@ -0,0 +1,151 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+
+#ifndef GHCN_PIPELINE_H
+#define GHCN_PIPELINE_H
+
+#include "Lockable.h"
+#include "Timeval.h"
+#include <vector>
+#include <deque>
+#include <atomic>
+
+#define GHCN_PARSE_THREADS  4     // reader threads if we can't find the number of cores
+#define GHCN_MAX_IN_FLIGHT  256   // bulk requests wait while this many are in the pipeline
+#define GHCN_EVICT_TARGET   0.9   // fraction of the memory budget to evict down to
+
+
+// =======================================================================================
+// Forward declarations
+
+class GHCNDatabase;
+class GHCNStation;
+class ClimateInfo;
+class TaskQueue;
+class TaskQueueFarm;
+class HttpServThread;
+struct GHCNPipelineJob;
+
+
+// =======================================================================================
+/// @brief Background pipeline to get GHCN station files into memory without tying up
+/// the HTTP server threads.
+///
+/// A station that's wanted goes through two stages, each on its own queue:
+/// - fetch: a single thread (as the curl handle can only do one thing at a time) checks
+///   the station's .csv.gz file on disk and downloads it if it's missing or stale.
+/// - read: a TaskQueueFarm (one thread per core) decompresses and parses the file into a
+///   new ClimateInfo, and then publishes it in the station and wakes anyone waiting.
+///
+/// Requests are coalesced, so a station that is already on its way is never queued a
+/// second time, no matter how many requests want it.  The number of stations in the
+/// pipeline is bounded, and bulk requests wait for room when it's full.  Stations that
+/// someone is waiting for (via waitFor and waitForAll) are urgent: they never wait for
+/// room, and are fetched ahead of any bulk requests still queued, so an HTTP request
+/// doesn't sit behind a bulk load.  Callers can either wait for stations indefinitely,
+/// or give up after a while (eg so the HTTP layer can send a page that refreshes until
+/// the data is ready).
+///
+/// Publishing a station is just an atomic store into it, and the lock is only taken
+/// to wake waiters if there are any, so bulk loads (GHCNDatabase::loadAll) don't 
+/// serialize the reader threads.  Progress and throughput are shown by diagnosticHTML.
+///
+/// Optionally, the memory used by loaded stations can be held to a budget.  When a new
+/// station takes us over it, the least recently used stations are evicted (their
+/// ClimateInfo is unpublished, and they go back to being unloaded) till we are 10%
+/// under.  They are transparently loaded again (usually quickly, from the binary cache)
+/// the next time they are wanted.  As readers don't lock, an evicted ClimateInfo can't
+/// be freed straight away.  Instead, readers bracket their use of climate data with
+/// beginRead() and endRead(), which count them in one of two generations, and evicted 
+/// ClimateInfos are only deleted once every reader that might have seen them has 
+/// finished.  Readers must only use the ClimateInfo pointers handed back by waitFor 
+/// and waitForAll, not reload them from the station, as that may since have been 
+/// evicted.
+
+class GHCNPipeline: public Lockable
+{
+public:
+
+  // Instance variables - public
+
+  // Member functions - public
+  GHCNPipeline(GHCNDatabase* db);
+  ~GHCNPipeline(void);
+  void request(GHCNStation* station, bool urgent = false);
+  ClimateInfo* waitFor(GHCNStation* station, unsigned timeoutMs = 0u);
+  bool waitForAll(std::vector<GHCNStation*>& stations, unsigned timeoutMs = 0u,
+                                                  std::vector<ClimateInfo*>* infos = NULL);
+  void waitForIdle(void);
+  void fetchStage(void);
+  void readStage(GHCNPipelineJob* job);
+  void startBulkLoad(unsigned nStations);
+  void endBulkLoad(void);
+  void setMemoryBudget(size_t bytes);
+  unsigned beginRead(void);
+  void endRead(unsigned generation);
+  bool diagnosticHTML(HttpServThread* serv);
+
+  /// @brief Set a pause after each download, to rate limit our impact on the GHCN site.
+  inline void setFetchSpacing(float spacing) {fetchSpacing = spacing;}
+
+private:
+
+  // Instance variables - private
+  GHCNDatabase*               ghcnDb;
+  TaskQueue*                  fetchQueue;
+  TaskQueueFarm*              readFarm;
+  pthread_cond_t              stationReady;   // broadcast whenever a station is published
+  pthread_cond_t              roomAvailable;  // broadcast when inFlight goes down
+  unsigned                    nReadThreads;
+  std::atomic<unsigned>       inFlight;
+  std::atomic<unsigned>       waiters;        // threads waiting on stationReady
+  std::atomic<unsigned>       roomWaiters;    // threads waiting on roomAvailable
+  std::atomic<float>          fetchSpacing;
+  std::deque<GHCNPipelineJob*> urgentJobs;    // awaiting fetch (protected by our lock)
+  std::deque<GHCNPipelineJob*> bulkJobs;      // ditto, only fetched when no urgent ones
+  std::atomic<unsigned long>  requested;
+  std::atomic<unsigned long>  coalesced;      // requests for stations already on the way
+  std::atomic<unsigned long>  published;
+  std::atomic<unsigned long>  bytesParsed;    // decompressed csv, not counting cache hits
+  
+  // Memory budget and eviction
+  size_t                      memoryBudget;   // zero for no limit
+  std::atomic<size_t>         residentBytes;
+  std::atomic<unsigned>       residentCount;
+  std::atomic<unsigned long>  evictions;
+  std::atomic<unsigned long>  evictedBytes;
+  std::atomic<unsigned long>  useClock;       // ticks on every use of a station
+  std::atomic<bool>           evicting;       // only one thread evicts at a time
+  
+  // Deferred freeing of evicted ClimateInfos (the vectors are protected by our lock)
+  std::atomic<unsigned>       readGeneration;
+  std::atomic<unsigned>       activeReaders[2];   // by parity of generation
+  std::vector<ClimateInfo*>   retiredNow;     // evicted in the current generation
+  std::vector<ClimateInfo*>   retiredPrev;    // evicted in the one before
+  std::atomic<unsigned>       retiredCount;
+  
+  // Progress of the latest bulk load (protected by our lock)
+  unsigned                    bulkTotal;
+  unsigned long               bulkPublishedBase;
+  unsigned long               bulkBytesBase;
+  Timeval                     bulkStart;
+  Timeval                     bulkEnd;
+  bool                        bulkRunning;
+
+  // Member functions - private
+  ClimateInfo* waitUntilPublished(GHCNStation* station, struct timespec* deadline);
+  void waitForRoom(void);
+  void promote(GHCNStation* station);
+  void evictIfOverBudget(void);
+  void reclaimRetired(void);
+  void touch(GHCNStation* station);
+  PreventAssignAndCopyConstructor(GHCNPipeline);
+};
+
+
+// =======================================================================================
+
+#endif
+
+
+
+
@@ -0,0 +1,91 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+
+#ifndef GHCN_STATION_INDEX_H
+#define GHCN_STATION_INDEX_H
+
+#include <vector>
+
+#ifndef EARTH_RADIUS_KM
+#define EARTH_RADIUS_KM 6371.0f // In km (as in PmodDesign.h)
+#endif
+#define GHCN_NO_ELEVATION     -999.9f   // the value GHCN uses for a missing elevation
+
+
+// =======================================================================================
+// Forward declarations
+
+class GHCNStation;
+struct GHCNIndexQuery;
+
+
+// =======================================================================================
+/// @brief One station in the index, as a point on the unit sphere.
+
+struct GHCNIndexNode
+{
+  float         xyz[3];
+  GHCNStation*  station;
+  unsigned char axis;     // the axis this node splits its subtree on
+};
+
+
+// =======================================================================================
+/// @brief k-nearest-neighbour index of the GHCN stations by great-circle distance.
+///
+/// Each station is converted to a unit vector (ie earth-centred coordinates on a sphere)
+/// and stored in a k-d tree laid out implicitly in a single array (each subtree is a
+/// range of the array with its root in the middle).  As the straight line (chord)
+/// distance between two points on the sphere goes up with the great-circle distance,
+/// a normal 3D nearest neighbour search finds the nearest stations, with no trouble
+/// at the poles or the antimeridian.  Results come back sorted nearest first.
+///
+/// Distances can optionally be increased in proportion to the difference in elevation
+/// between the station and the place of interest, so that a slightly further station
+/// at a similar altitude is preferred to a close one on top of a mountain.
+///
+/// The index is built once, and after that is only read, so any number of threads can
+/// search it at once.
+
+class GHCNStationIndex
+{
+public:
+
+  // Instance variables - public
+
+  // Member functions - public
+  GHCNStationIndex(void);
+  ~GHCNStationIndex(void);
+  void add(GHCNStation* station);
+  void build(void);
+  void nearest(float lat, float longT, unsigned k, std::vector<GHCNStation*>& results,
+                        std::vector<float>* distances = NULL,
+                        float elevation = GHCN_NO_ELEVATION, float elevWeight = 0.0f);
+  static void unitVector(float lat, float longT, float* xyz);
+  static float greatCircleKm(float* xyz1, float* xyz2);
+
+  /// @brief The number of stations in the index.
+  inline unsigned size(void) {return nodes.size();}
+
+private:
+
+  // Instance variables - private
+  std::vector<GHCNIndexNode> nodes;
+
+  // Member functions - private
+  void buildRange(unsigned lo, unsigned hi);
+  void searchRange(GHCNIndexQuery& query, unsigned lo, unsigned hi);
+
+  /// @brief Prevent copy-construction.
+  GHCNStationIndex(const GHCNStationIndex&);
+  /// @brief Prevent assignment.
+  GHCNStationIndex& operator=(const GHCNStationIndex&);
+};
+
+
+// =======================================================================================
+
+#endif
+
+
+
+
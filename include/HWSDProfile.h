@@ -13,8 +13,8 @@
 // =======================================================================================
 // Forward declarations
 
-class MdbTableReader;
 class SoilDatabase;
+struct HWSDRecord;
 
 
 // =======================================================================================
@@ -35,32 +35,31 @@ public:
   // Instance variables - public
   
   // Member functions - public
-  HWSDProfile(MdbTableReader& hwsdTableReader);
-  HWSDProfile(rapidjson::Document& soilJson);
+  HWSDProfile(rapidjson::Value& soilJson);
+  HWSDProfile(const HWSDRecord& record);
   ~HWSDProfile(void);
-  void columnCheck(int column, char* colName, int expectedType);
   virtual DynamicType getDynamicType(void) {return TypeHWSDProfile;}
   virtual int writeJsonFields(char* buf, unsigned bufSize);
 
 private:
   
   // Instance variables - private.
-  // Note some reordering has been done to improve packing
-  MdbTableReader* hwsdReader;
+  // Note some reordering has been done to improve packing.  Text fields have room
+  // for a nul after the longest string the database allows.
   int             dbId;
   int             muGlobal;
-  char            muSource1[12];
+  char            muSource1[13];
   int             muSource2;
   float           share;
-  char            suSym74[6];
+  char            suSym74[7];
   bool            isSoil;
   unsigned char   seq;
   int             suCode74;
-  char            suSym85[6];
+  char            suSym85[7];
   unsigned char   tTexture;
   unsigned char   awcClass;
   int             suCode85;
-  char            suSym90[6];
+  char            suSym90[7];
   unsigned char   phase1;
   unsigned char   phase2;
   int             suCode90;
@@ -0,0 +1,187 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+
+#ifndef HWSD_SNAPSHOT_H
+#define HWSD_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+
+// =======================================================================================
+// Important constants
+
+#define HWSD_SNAPSHOT_MAGIC   "HWSN"
+#define HWSD_SNAPSHOT_VERSION 2u
+#define HWSD_MAX_MU           65536u  // mapping unit ids fit the 16 bit HWSD raster
+
+
+// =======================================================================================
+/// @brief The fixed size record of one soil horizon (topsoil or subsoil) of an HWSD
+/// row, as kept in an HWSDSnapshot.  See SoilHorizon for the meaning of the fields.
+
+struct HWSDHorizonRecord
+{
+  float     coarseFragmentFraction;
+  float     sandFraction;
+  float     siltFraction;
+  float     clayFraction;
+  float     bulkDensity;
+  float     organicCarbonPercent;
+  float     pH;
+  float     cecClay;
+  float     cecSoil;
+  float     baseSaturation;
+  float     totalExchangeableBases;
+  float     limeContent;
+  float     gypsumContent;
+  float     exchangeableNaPercentage;
+  float     electricalConductivity;
+  uint8_t   usdaTextureClass;
+  uint8_t   pad[3];
+};
+
+
+// =======================================================================================
+/// @brief The fixed size record of one row of the HWSD_DATA table, as kept in an
+/// HWSDSnapshot, and as imported from the database by SoilDatabase::createHWSDSchema().
+/// See HWSDProfile for the meaning of the fields.
+
+struct HWSDRecord
+{
+  int32_t           dbId;
+  int32_t           muGlobal;
+  int32_t           muSource2;
+  int32_t           suCode74;
+  int32_t           suCode85;
+  int32_t           suCode90;
+  int32_t           drainage;
+  int32_t           refDepth;
+  float             share;
+  uint8_t           isSoil;
+  uint8_t           seq;
+  uint8_t           tTexture;
+  uint8_t           awcClass;
+  uint8_t           phase1;
+  uint8_t           phase2;
+  uint8_t           roots;
+  uint8_t           il;
+  uint8_t           swr;
+  uint8_t           addProp;
+  char              muSource1[13];  // nul-terminated
+  char              suSym74[7];
+  char              suSym85[7];
+  char              suSym90[7];
+  HWSDHorizonRecord topSoil;
+  HWSDHorizonRecord subSoil;
+};
+
+
+// =======================================================================================
+/// @brief Header at the start of an HWSD snapshot file.
+///
+/// The header is followed by recordCount HWSDRecords, sorted by muGlobal and then seq.
+/// All values are in host byte order, as the snapshot is built on the machine that
+/// uses it.
+
+struct HWSDSnapshotHeader
+{
+  char      magic[4];
+  uint32_t  version;
+  uint32_t  recordSize;   // sizeof(HWSDRecord), so a change of layout is noticed
+  uint32_t  recordCount;
+  int64_t   mdbModTime;   // the .mdb file this was built from
+  int64_t   mdbSize;
+};
+
+
+// =======================================================================================
+/// @brief A flat binary snapshot of the HWSD_DATA table of the Harmonized World Soil
+/// Database.
+///
+/// Reading the table out of the MS Access database through mdbtools takes a long time,
+/// so it's done once, and the result is written as an array of fixed size records.
+/// After that, the snapshot is just memory-mapped at startup, so there is no parsing
+/// and no per-row heap allocation.  The snapshot is rebuilt if its version or record
+/// layout doesn't match, or if the .mdb file has changed since it was built.
+///
+/// As mapping unit ids are 16 bit, load() also builds a dense table indexed directly
+/// by id, giving the position of the id's record, and a bitmap of which ids are present.
+/// So a lookup is a bit test and an array read rather than a search, and the bitmap
+/// (8KB) stays in cache for a batch of lookups.  Nothing changes after load(), so any
+/// number of threads can look records up at once.
+
+class HWSDSnapshot
+{
+public:
+
+  // Instance variables - public
+
+  // Member functions - public
+  HWSDSnapshot(void);
+  ~HWSDSnapshot(void);
+  bool load(const char* fileName, const char* mdbFileName);
+  static bool build(const char* fileName, const char* mdbFileName, 
+                                                    std::vector<HWSDRecord>& newRecords);
+  unsigned findBatch(unsigned n, const unsigned short* ids, const HWSDRecord** found);
+
+  /// @brief Whether there is a record for a mapping unit.
+  /// @param muGlobal The soil mapping unit id (as found in the HWSD raster).
+  inline bool present(unsigned muGlobal)
+   {
+    return muGlobal < HWSD_MAX_MU 
+                          && (presentBits[muGlobal >> 6] >> (muGlobal & 63)) & 1u;
+   }
+
+  /// @brief Find the record for a mapping unit.  A mapping unit can have several rows
+  /// (one per soil unit in it, numbered by seq), and we give the first, which is the
+  /// dominant soil.
+  /// @returns A pointer to the record (which lives as long as we do), or NULL if there
+  /// isn't one.
+  /// @param muGlobal The soil mapping unit id (as found in the HWSD raster).
+  inline const HWSDRecord* find(unsigned muGlobal)
+   {
+    return present(muGlobal) ? records + recordIndex[muGlobal] : NULL;
+   }
+
+  /// @brief Count the rows of a mapping unit, which follow each other in seq order.
+  /// @returns The number of records for the mapping unit, starting with first.
+  /// @param first The mapping unit's first record, as returned by find or findBatch.
+  inline unsigned rowCount(const HWSDRecord* first)
+   {
+    unsigned n = 1u;
+    while(first + n < records + nRecords && first[n].muGlobal == first->muGlobal)
+      n++;
+    return n;
+   }
+
+  /// @brief The number of records in the snapshot.
+  inline unsigned size(void) {return nRecords;}
+
+private:
+
+  // Instance variables - private
+  void*                 map;
+  size_t                mapSize;
+  const HWSDRecord*     records;
+  unsigned              nRecords;
+  std::vector<uint32_t> recordIndex;  // by muGlobal, valid where presentBits is set
+  uint64_t              presentBits[HWSD_MAX_MU/64];
+
+  // Member functions - private
+  void buildIndex(void);
+
+  /// @brief Prevent copy-construction.
+  HWSDSnapshot(const HWSDSnapshot&);
+  /// @brief Prevent assignment.
+  HWSDSnapshot& operator=(const HWSDSnapshot&);
+};
+
+
+// =======================================================================================
+
+#endif
+
+
+
+
@@ -12,6 +12,7 @@
 class Scene; 
 class InterfaceMainSceneWin; 
 class GLFWApplication;
+class HttpRouteTable;
 
 
 // =======================================================================================
@@ -36,6 +37,7 @@ public:
   HttpDebug(Scene& S, GLFWApplication& winApp, unsigned index, HttpLoadBalancer* parent);
   ~HttpDebug(void);
   bool        carbonSummary(void);
+  static void registerRoutes(HttpRouteTable& routes);
 
 private:
   
@@ -0,0 +1,52 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+
+#ifndef HTTP_EVENT_QUEUE_H
+#define HTTP_EVENT_QUEUE_H
+
+#include "Global.h"
+
+#define HTTP_EVENT_BATCH 64
+
+
+// =======================================================================================
+/// @brief Thin wrapper around the kernel readiness notification mechanism (epoll on
+/// Linux, kqueue on macOS/BSD) used by HttpLoadBalancer to watch its sockets.
+///
+/// Every socket is registered one-shot, with a caller supplied pointer that is handed
+/// back when the socket becomes readable.  After a notification, the socket will not be
+/// reported again until rearm() is called, so whichever thread is working on the
+/// connection has it to itself.  Both epoll_ctl and kevent are safe to call from any
+/// thread, so worker threads can rearm connections directly without going through the
+/// load balancer thread.
+
+class HttpEventQueue
+{
+public:
+
+  // Instance variables - public
+
+  // Member functions - public
+  HttpEventQueue(void);
+  ~HttpEventQueue(void);
+  bool  add(int fd, void* data);
+  bool  rearm(int fd, void* data);
+  void  remove(int fd);
+  int   wait(void** ready, int maxReady, int timeoutMs);
+
+private:
+
+  // Instance variables - private
+  int   queueFd;
+
+  // Member functions - private
+  PreventAssignAndCopyConstructor(HttpEventQueue);
+};
+
+
+// =======================================================================================
+
+#endif
+
+
+
+
@@ -0,0 +1,61 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+
+#ifndef HTTP_GZIP_STREAM_H
+#define HTTP_GZIP_STREAM_H
+
+#include "Global.h"
+#include "MimeTypeMaps.h"
+#include <string>
+
+#define HTTP_GZIP_MIN_SIZE    1024  // not worth compressing responses smaller than this
+#define HTTP_GZIP_LEVEL       6     // for things compressed once and kept
+#define HTTP_GZIP_FAST_LEVEL  1     // for responses compressed as they are sent
+
+
+// =======================================================================================
+// Forward declarations
+
+struct z_stream_s;
+
+
+// =======================================================================================
+/// @brief Wrapper around zlib for gzip Content-Encoding of HTTP responses.
+///
+/// A response can be compressed in one go with compressAll(), or a piece at a time as
+/// it is sent in chunks (with start(), then compress() on each piece, the last one with
+/// finish set).  Either way, the compressed bytes are left in output, which is reused
+/// from one response to the next so each server thread only needs one of these.
+
+class HttpGzipStream
+{
+public:
+  
+  // Instance variables - public
+  std::string output;
+  
+  // Member functions - public
+  HttpGzipStream(void);
+  ~HttpGzipStream(void);
+  bool start(int level = HTTP_GZIP_FAST_LEVEL);
+  bool compress(const char* in, unsigned inSize, bool finish);
+  bool compressAll(const char* in, unsigned inSize, int level = HTTP_GZIP_FAST_LEVEL);
+  static bool compressible(MimeType mimeType);
+  
+private:
+  
+  // Instance variables - private
+  struct z_stream_s*  stream;
+  bool                active;   // between start() and the compress() that finishes
+  
+  // Member functions - private
+  PreventAssignAndCopyConstructor(HttpGzipStream);
+};
+
+
+// =======================================================================================
+
+#endif
+
+
+
+
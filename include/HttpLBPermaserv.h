@@ -16,6 +16,8 @@
 #define PERMASERV_NO_OLDFSERV   0x00000010
 #define PERMASERV_NO_TREES      0x00000020
 
+#define PERMASERV_DEFAULT_CACHE_MB  64  // size of response cache unless configured
+
 
 // =======================================================================================
 // Forward declarations
@@ -39,6 +41,10 @@ class PermaservParams
   time_t          compileTime;
   unsigned        flags;
   float           climateFileSpacing;
+  unsigned        climateMemoryMB; // 0 means no limit on loaded climate stations
+  unsigned        httpThreads;    // 0 means one per CPU core
+  unsigned        responseCacheMB; // 0 means no response cache
+  int             listenBacklog;
   unsigned short  servPort;
 
   PermaservParams(unsigned short port, unsigned flagsIn, float spacing);
@@ -65,6 +71,7 @@ public:
   ~HttpLBPermaserv(void);
   void initializeScriptPages(void);
   void initializeCSSPages(void);
+  void registerRoutes(void);
   
 private:
   
@@ -3,9 +3,13 @@
 #ifndef HTTP_LOAD_BALANCER_H
 #define HTTP_LOAD_BALANCER_H
 
-#define HTTP_THREAD_COUNT 3
+#define HTTP_DEFAULT_BACKLOG  128   // listen() backlog unless configured otherwise
+#define HTTP_LB_WAIT_MS       500   // how often to check for shutdown while idle
+#define HTTP_ACCEPT_PAUSE_MS  100   // stop accepting this long if out of resources
 
 #include "Global.h"
+#include "HttpRouteTable.h"
+#include "Timeval.h"
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -23,6 +27,10 @@ class GLFWApplication;
 class HttpServThread;
 class UserSessionGroup;
 class HttpPageSet;
+class HttpEventQueue;
+class HttpRequestParser;
+class HttpLBWorkUnit;
+class HttpResponseCache;
 
 
 // =======================================================================================
@@ -31,7 +39,10 @@ class HttpPageSet;
 /// This class has a basic load balancer which can accept connections and then hand
 /// them off for processing via TaskQueues to HttpDebug which does the work of 
 /// handling an individual connection.  This allows multiple clients to talk to the 
-/// HTTP interface.
+/// HTTP interface.  All the sockets are owned by a single thread running 
+/// processConnections(), which watches them with an HttpEventQueue and reads from 
+/// them without blocking.  Only once a complete request has arrived on a connection
+/// is it handed to a worker, so idle keep-alive connections cost nothing but a buffer.
 
 
 class HttpLoadBalancer
@@ -42,41 +53,63 @@ public:
   bool                shutDownNow; // Reads/writes on a single bool should be atomic, no lock.
   
   // Member functions - public
-  HttpLoadBalancer(unsigned short servPort, bool haveSessions = false);
+  HttpLoadBalancer(unsigned short servPort, bool haveSessions = false, 
+                              unsigned nThreads = 0u, int backlog = HTTP_DEFAULT_BACKLOG);
   ~HttpLoadBalancer(void);
   void* processConnections(void);
+  void  returnConnection(HttpLBWorkUnit* unit);
+  bool  diagnosticHTML(HttpServThread* serv);
   HttpPageSet*      basicStaticPages;
+  HttpRouteTable    routes;  // filled in by subclass constructor before startServFarm()
+  HttpResponseCache* responseCache; // null unless subclass wants cacheable routes cached
 
 protected:
   TaskQueue**  httpThreads;  // must be initialized by subclass that knows the 
                                   // real type of these
+  unsigned     nHttpThreads;
   UserSessionGroup* userSessions;
   
+  // Member functions - protected
+  void startServFarm(void);
+  
 private:
   
   // Instance variables - private
   TaskQueueFarm*      servFarm;
+  HttpEventQueue*     eventQueue;
   struct sockaddr_in  servaddr;
-  struct sockaddr_in  cliaddr;
   int                 sockfd;
-  int                 connfd;
+  int                 spareFd;      // given up to accept and close when out of fds
+  bool                acceptPaused; // listening socket not rearmed since acceptPausedAt
+  Timeval             acceptPausedAt;
+  int                 listenBacklog;
   unsigned short      port;
   
   // Member functions - private
   void initializeBasicStaticPages(void);
+  void acceptConnections(void);
+  bool acceptFailed(void);
+  void readConnection(HttpLBWorkUnit* unit);
+  void closeConnection(HttpLBWorkUnit* unit);
   PreventAssignAndCopyConstructor(HttpLoadBalancer);
 };
 
 
 // =======================================================================================
 /// @brief Plain old data class for a unit of work for the HttpLoadBalancer.
+///
+/// There is one of these for each open connection, which lives from accept() to 
+/// close(), and carries the connection's request parser (and thus any partially 
+/// received request) back and forth between the load balancer and the workers.
 
 class HttpLBWorkUnit
 {  
   public:
-    TaskQueueFarm*  servFarm;
-    int             fileDescriptor;
-    unsigned short  clientPort;
+    TaskQueueFarm*      servFarm;
+    HttpLoadBalancer*   loadBalancer;
+    HttpRequestParser*  parser;
+    int                 fileDescriptor;
+    unsigned short      clientPort;
 };
 
 
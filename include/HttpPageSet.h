@@ -3,7 +3,6 @@
 #ifndef HTTP_PAGE_SET_H
 #define HTTP_PAGE_SET_H
 
-#include "Lockable.h"
 #include "MimeTypeMaps.h"
 #include <unordered_map>
 #include <string>
@@ -24,10 +23,11 @@ class HttpServThread;
 /// cached in memory.  We do not just serve anything found in a directory, but only
 /// things explicitly coded to be served.  Inherits from and unordered_map from
 /// the paths we should serve to the HttpStaticPage instances that should be served
-/// for that path.  Also inherits from Lockable to mediate access from multiple server
-/// threads.
+/// for that path.  All the pages must be added with addPage() before any server 
+/// threads start, after which the map itself never changes, so lookups are lock-free 
+/// (each page takes care of its own loading on first request).
 
-class HttpPageSet: public std::unordered_map<std::string, HttpStaticPage*>, public Lockable
+class HttpPageSet: public std::unordered_map<std::string, HttpStaticPage*>
 {
 public:
   
@@ -36,6 +36,7 @@ public:
   // Member functions - public
   HttpPageSet(char* path, MimeType mType = NoMimeType);
   ~HttpPageSet(void);
+  void addPage(const char* name);
   bool processPageRequest(HttpServThread* serv, char* url);
   
 private:
@@ -53,6 +54,12 @@ private:
 };
 
 
+// =======================================================================================
+// C function to use as a route handler for an HttpPageSet (passed as the context).
+
+bool pageSetRoute(HttpServThread* serv, char* url, void* context);
+
+
 // =======================================================================================
 
 #endif
@@ -14,6 +14,7 @@ class SoilDatabase;
 class ClimateDatabase;
 class PmodServer;
 class Taxonomy;
+class HttpRouteTable;
 
 
 // =======================================================================================
@@ -35,6 +36,7 @@ public:
                     ClimateDatabase* climateD, PmodServer* pServ, UserSessionGroup* userS, 
                     Taxonomy* taxa, HttpLoadBalancer* parent);
   ~HttpPermaServ(void);
+  static void registerRoutes(HttpRouteTable& routes);
   
 private:
   
@@ -50,7 +52,15 @@ private:
   bool  indexPage(void);
   bool  processDNIRequest(char* url);
   bool  processDIFRequest(char* url);
-  bool  processSoilRequest(char* url);
+  
+  // Route handlers (see registerRoutes)
+  static bool routeIndex(HttpServThread* serv, char* url, void* context);
+  static bool routeAlive(HttpServThread* serv, char* url, void* context);
+  static bool routeCompileTime(HttpServThread* serv, char* url, void* context);
+  static bool routeQuit(HttpServThread* serv, char* url, void* context);
+  static bool routeTaskQueues(HttpServThread* serv, char* url, void* context);
+  static bool routeDIF(HttpServThread* serv, char* url, void* context);
+  static bool routeDNI(HttpServThread* serv, char* url, void* context);
 
   /// @brief Prevent copy-construction.
   HttpPermaServ(const HttpPermaServ&);       
@@ -7,6 +7,12 @@
 #include <unordered_map>
 #include <string>
 
+#define REQ_PARSER_BUF_SIZE   8192
+#define REQ_PARSER_MIN_READ   1024      // compact the buffer if less space than this
+#define REQ_MAX_BODY_SIZE     (16*1024*1024)
+#define REQ_BODY_START_SIZE   65536     // first allocation for a body too big for buf
+#define REQ_READ_TIMEOUT_MS   30000
+
 
 // =======================================================================================
 /// @brief An enum to encapsulate the different types of headers than can show up in HTTP.
@@ -21,6 +27,8 @@ enum HTTPHeaderType
   TransferEncoding,
   Upgrade,
   Cookie,
+  IfNoneMatch,
+  AcceptEncoding,
 };
 
 // =======================================================================================
@@ -47,11 +55,22 @@ class MultipartFile;
 /// 
 /// The purpose of this class is to read from a socket, identify the boundaries of 
 /// whole HTTP request messages, and return pointers to the beginnings of needed fields. 
-/// Right now, it doesn't deal with requests with entity bodies (because it doesn't need 
-/// to).  It also parses the header and stores offsets to key fields, and terminates 
+/// It also parses the header and stores offsets to key fields, and terminates 
 /// each header line with a NULL so higher layers can parse individual headers to 
-/// taste.  We try to minimize extra copying, but there are corner-cases where some 
-/// copying within our buffer is necessary.  
+/// taste.  
+///
+/// Requests are parsed in place wherever they start in the buffer, so a batch of 
+/// pipelined requests that arrive in one read are all handled without any copying.  
+/// Only when the buffer is nearly used up is the start of the next (incomplete) request
+/// moved down to the beginning.  A body too big to fit in the buffer after its header
+/// is read straight into a buffer of its own, which is grown as the body arrives.
+///
+/// There is one of these per connection (owned by the HttpLBWorkUnit for the connection)
+/// and the socket is non-blocking.  The HttpLoadBalancer thread calls readAvailable() 
+/// and requestComplete() as data arrives, and only hands the connection to a worker 
+/// once a whole request is buffered.  The worker then uses getNextRequest(), which will
+/// only wait on the socket in the unusual case of a multipart upload too large for
+/// the buffer.
 
 class HttpRequestParser
 {
@@ -61,6 +80,7 @@ public:
   
   // Instance variables - public
   bool                connectionWillClose;
+  bool                acceptsGzip;  // client said it can take gzip Content-Encoding
   HTTPMethodType      requestMethod;
   DynamicallyTypable* parsedBody;
   char*               unparsedBody;
@@ -72,20 +92,33 @@ public:
   void resetForNewConnection(void);
   ~HttpRequestParser(void);
   bool getNextRequest(void);
+  bool readAvailable(void);
+  bool requestComplete(void);
   inline void setNewConnection(int fd) {connfd = fd;}
-  inline char* getUrl(void) {return buf + urlOffset;}
+  inline int  getConnection(void) {return connfd;}
+  inline bool connectionFinished(void) {return connectionDone;}
+  inline char* getUrl(void) {return reqStart + urlOffset;}
   inline char* getCookieString(void) {return cookieValue;}
-  inline char* getBodyString(void) {return headerEnd;} // Note, not null terminated
-  inline char* getHTTPVersion(void) {return buf + httpVerOffset;}
+  inline char* getIfNoneMatch(void) {return ifNoneMatchValue;}
+  inline char* getBodyString(void) {return bodyStart;} // Note, not null terminated
+  inline char* getHTTPVersion(void) {return reqStart + httpVerOffset;}
     
 private:
   
   // Instance variables - private
-  std::unordered_map<std::string, HTTPHeaderType> headerMap; 
+  static std::unordered_map<std::string, HTTPHeaderType> headerMap; 
   char*               buf;
+  char*               reqStart;   // where the current request begins in buf
   char*               readPoint;
+  char*               scanPoint;
   char*               headerEnd;
+  char*               requestEnd;
   char*               cookieValue;
+  char*               ifNoneMatchValue;
+  char*               bodyStart;
+  char*               bodyBuf;    // only used for bodies that won't fit in buf
+  unsigned long       bodyRead;   // bytes read into bodyBuf so far
+  unsigned long       bodyCap;    // bytes bodyBuf has room for (plus a nul)
   unsigned            bufLeft;
   int                 connfd;
   unsigned            bufSize;
@@ -98,8 +131,13 @@ private:
   
   // Member functions - private
   bool parseRequest(void);
+  static bool acceptEncodingAllowsGzip(char* value);
   bool processBody(void);
   bool readAndCheck(int& nBytes);
+  bool waitForData(void);
+  bool startLargeBody(void);
+  bool growBodyBuffer(void);
+  void compactBuffer(void);
   char* headerEndPresent(char* range, unsigned rangeSize);
   HttpRequestParser(const HttpRequestParser&);                 // Prevent copy-construction
   HttpRequestParser& operator=(const HttpRequestParser&);      // Prevent assignment
@@ -0,0 +1,120 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+
+#ifndef HTTP_RESPONSE_CACHE_H
+#define HTTP_RESPONSE_CACHE_H
+
+#include "Lockable.h"
+#include <unordered_map>
+#include <string>
+#include <atomic>
+
+#define HTTP_ETAG_SIZE  24  // room for a quoted 64 bit hash in hex, "-gz" and the null
+
+
+// =======================================================================================
+// Forward declarations
+
+class HttpServThread;
+class HttpResponseCache;
+
+
+// =======================================================================================
+/// @brief One response held in an HttpResponseCache.
+/// 
+/// Entries are reference counted, so a server thread can send the body straight from
+/// the cache without holding the lock, even if the entry is evicted meanwhile.  Bigger
+/// responses also keep a gzipped copy for clients that accept it, which has its own 
+/// ETag (as it's a different representation).
+
+class HttpCachedResponse
+{
+  friend HttpResponseCache;
+  
+public:
+  
+  // Instance variables - public
+  char*                 body;
+  unsigned              bodySize;
+  char*                 gzBody;         // null if not worth compressing
+  unsigned              gzSize;
+  unsigned              cacheDuration;  // that the handler set on the original response
+  char                  etag[HTTP_ETAG_SIZE];
+  char                  gzEtag[HTTP_ETAG_SIZE];
+
+private:
+  
+  // Instance variables - private
+  std::string           key;
+  HttpCachedResponse*   prev;           // towards most recently used
+  HttpCachedResponse*   next;           // towards least recently used
+  std::atomic<unsigned> refCount;       // one for the cache, plus one per user
+  
+  // Member functions - private
+  HttpCachedResponse(const std::string& url, const char* buf, unsigned size, 
+                                                                    unsigned duration);
+  ~HttpCachedResponse(void);
+  PreventAssignAndCopyConstructor(HttpCachedResponse);
+};
+
+
+// =======================================================================================
+/// @brief An in-memory cache of HTTP responses, bounded by size in bytes and evicting 
+/// the least recently used responses first.
+///
+/// This is for responses which depend only on the URL and the underlying databases, 
+/// such as /soil? and /climate/ requests to permaserv.  Routes in the HttpRouteTable
+/// are marked as cacheable when they are added, and HttpServThread::routeRequest() 
+/// looks them up here before calling the handler.  Each response gets a strong ETag 
+/// (a hash of the body) so clients that already have it can be sent a 304.  When the
+/// data behind some responses changes, whoever changed it calls invalidate() with the
+/// URL prefix of the affected responses.
+
+class HttpResponseCache: public Lockable
+{
+public:
+  
+  // Instance variables - public
+  
+  // Member functions - public
+  HttpResponseCache(unsigned long maxBytes);
+  ~HttpResponseCache(void);
+  HttpCachedResponse* find(const std::string& key);
+  void                release(HttpCachedResponse* entry);
+  HttpCachedResponse* insert(const std::string& key, const char* body, unsigned bodySize, 
+                                          unsigned cacheDuration, unsigned long gen);
+  void                invalidate(const char* prefix);
+  bool                diagnosticHTML(HttpServThread* serv);
+  static void         normaliseUrl(std::string& key, const char* path, bool query, 
+                                                                      const char* rest);
+  static bool         etagMatches(const char* etag, const char* ifNoneMatch);
+  inline unsigned long getGeneration(void) {return generation;}
+  inline unsigned long maxEntrySize(void) {return maxEntryBytes;}
+  
+private:
+  
+  // Instance variables - private
+  std::unordered_map<std::string, HttpCachedResponse*> entries;
+  HttpCachedResponse*         mostRecent;
+  HttpCachedResponse*         leastRecent;
+  unsigned long               maxTotalBytes;
+  unsigned long               maxEntryBytes;
+  unsigned long               totalBytes;
+  std::atomic<unsigned long>  generation;   // bumped on every invalidation
+  unsigned long               hits;
+  unsigned long               misses;
+  unsigned long               evictions;
+  
+  // Member functions - private
+  void unlink(HttpCachedResponse* entry);
+  void remove(HttpCachedResponse* entry);
+  PreventAssignAndCopyConstructor(HttpResponseCache);
+};
+
+
+// =======================================================================================
+
+#endif
+
+
+
+
@@ -0,0 +1,117 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+
+#ifndef HTTP_ROUTE_TABLE_H
+#define HTTP_ROUTE_TABLE_H
+
+#include "Global.h"
+#include <vector>
+
+
+// =======================================================================================
+// Forward declarations
+
+class HttpServThread;
+
+
+// =======================================================================================
+/// @brief The ways in which a route can match a URL.
+
+enum HttpRouteForm
+{
+  RouteExact,   // The whole URL must be the path (eg "/alive/")
+  RoutePrefix,  // The URL starts with the path, the rest goes to the handler
+  RouteQuery,   // The URL is the path followed by '?', the query goes to the handler
+};
+
+
+// =======================================================================================
+/// @brief Function to handle requests that match a route.
+/// 
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv The HTTP server thread that is handling the request.
+/// @param url The balance of the URL after the route's path (the empty string for an 
+/// exact route, or the part after the '?' for a query route).
+/// @param context The pointer supplied when the route was added (eg the database object
+/// that knows how to handle the request).
+
+typedef bool (*HttpRouteHandler)(HttpServThread* serv, char* url, void* context);
+
+
+// =======================================================================================
+/// @brief Plain old data class for one entry in an HttpRouteTable.
+
+class HttpRoute
+{
+  public:
+    const char*       path;
+    HttpRouteHandler  handler;
+    void*             context;
+    unsigned          minExtra;  // prefix/query must be followed by at least this much
+    HttpRouteForm     form;
+    bool              cacheable; // responses depend only on the URL (HttpResponseCache)
+};
+
+
+// =======================================================================================
+/// @brief A declarative table of the URLs an HTTP server responds to.
+///
+/// Routes are added at startup (by the HttpLoadBalancer subclass, and by the objects
+/// that handle particular kinds of request, like ClimateDatabase) and are stored in a
+/// trie keyed on the characters of the path, so finding the route for a URL takes one 
+/// step per character of the URL, however many routes there are.  Where several prefix
+/// routes match, the longest wins, and an exact route beats a prefix route for the 
+/// same path.  Once the servers are running the table never changes, so lookups need
+/// no lock.
+
+class HttpRouteTable
+{
+public:
+  
+  // Instance variables - public
+  
+  // Member functions - public
+  HttpRouteTable(void);
+  ~HttpRouteTable(void);
+  void addRoute(const char* path, HttpRouteForm form, HttpRouteHandler handler, 
+                void* context = nullptr, unsigned minExtra = 0u, bool cacheable = false);
+  void addUnavailableRoute(const char* path, HttpRouteForm form, const char* message,
+                                                                    unsigned minExtra = 0u);
+  const HttpRoute* findRoute(char* url, char*& rest);
+  inline unsigned routeCount(void) {return routes.size();}
+  
+private:
+  
+  /// @brief One node of the trie.  Children are kept as a linked list of siblings, as
+  /// apart from near the root, most nodes have only one child.
+  struct Node
+   {
+    char  label;
+    int   firstChild;
+    int   nextSibling;
+    int   exactRoute;
+    int   prefixRoute;
+   };
+  
+  // Instance variables - private
+  std::vector<Node>       nodes;
+  std::vector<HttpRoute>  routes;
+  
+  // Member functions - private
+  int   findChild(int node, char c);
+  PreventAssignAndCopyConstructor(HttpRouteTable);
+};
+
+
+// =======================================================================================
+// C function to use as handler for routes to services that are not loaded.
+
+bool routeUnavailable(HttpServThread* serv, char* url, void* context);
+
+
+// =======================================================================================
+
+#endif
+
+
+
+
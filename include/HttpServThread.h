@@ -7,17 +7,15 @@
 #include "HttpRequestParser.h"
 #include "PermaservCookie.h"
 #include "MimeTypeMaps.h"
+#include "HttpResponseCache.h"
+#include "HttpGzipStream.h"
 
 
 // =======================================================================================
 // Useful macros
 
-#define httPrintf(...) if((serv->respPtr += snprintf(serv->respPtr, \
-              serv->respEnd-serv->respPtr,  __VA_ARGS__)) >= serv->respEnd) \
-                {serv->respBufOverflow = true; return false;}
-#define internalPrintf(...) if((respPtr += snprintf(respPtr, \
-              respEnd-respPtr,  __VA_ARGS__)) >= respEnd) \
-                {respBufOverflow = true; return false;}
+#define httPrintf(...) do {unless(serv->respPrintf(__VA_ARGS__)) return false;} while(0)
+#define internalPrintf(...) do {unless(respPrintf(__VA_ARGS__)) return false;} while(0)
 
 #define DEV_CACHE_DURATION 20
 #define PROD_CACHE_DURATION 86400
@@ -33,6 +31,10 @@ class UserManager;
 class ClimateDatabase;
 class UserSessionGroup;
 class PmodServer;
+class SoilDatabase;
+class HttpStaticPage;
+class HttpRoute;
+struct iovec;
 
 
 // =======================================================================================
@@ -50,6 +52,7 @@ class HttpServThread: public TaskQueue
   friend UserManager;
   friend ClimateDatabase;
   friend PmodServer;
+  friend SoilDatabase;
   
 public:
   
@@ -57,17 +60,24 @@ public:
   char*               respPtr;
   char*               respEnd;
   bool                respBufOverflow;
+  bool                respStreaming; // set once we've started sending chunks
 
 protected:
   
   // Instance variables - protected
-  HttpRequestParser   reqParser;
+  HttpRequestParser*  reqParser; // belongs to the connection currently being served
   PermaservCookie     cookies;
   unsigned            respBufSize;
   unsigned            headBufSize;
   char*               respBuf;
-  char*               altResp; // used for static pages
-  MimeType            altMimeType;
+  HttpStaticPage*     staticPage; // if set, this is the response instead of respBuf
+  HttpCachedResponse* cachedResp; // likewise, a response from the HttpResponseCache
+  bool                respNotModified; // client has cachedResp already, send a 304
+  bool                respCapturing;   // copying the response to respCapture to cache
+  std::string         respCapture;
+  char                respETag[HTTP_ETAG_SIZE];
+  bool                respGzip;        // body is going out with gzip Content-Encoding
+  HttpGzipStream      gzipStream;
   char*               headBuf;
   unsigned            cacheDuration;                 
   unsigned short      clientP;
@@ -84,7 +94,9 @@ public:
                                                             char* scriptName = nullptr);
   bool  endResponsePage(void);
   bool  errorPage(const char* error);
-  void  processOneHTTP1_1(int connfd, unsigned short clientPort);
+  bool  processOneHTTP1_1(HttpRequestParser* parser, unsigned short clientPort);
+  bool  respPrintf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+  bool  flushChunk(void);
   
   inline void setCacheDuration(int duration) 
    {
@@ -110,11 +122,16 @@ public:
     return true;
    }
     
-  inline void setAltResp(char* buf, unsigned size, MimeType mimeType)
+  inline void setStaticPage(HttpStaticPage* page)
    {
-    altResp     = buf;
-    respPtr     = buf + size;
-    altMimeType = mimeType;
+    staticPage = page;
+   }
+  
+  /// @brief Keep the current response out of the HttpResponseCache (eg because it's 
+  /// only a placeholder until some data is ready).
+  inline void dontCache(void)
+   {
+    respCapturing = false;
    }
   
   const char* getLoggedInUserName(void);
@@ -123,6 +140,7 @@ protected:
   
   // Member functions - protected
   virtual bool  processRequestHeader(void);
+  bool          routeRequest(char* url);
 
 
 private:
@@ -133,14 +151,25 @@ private:
   bool          reallocateResponseBuf(void);
   void          dealWithPossibleCookies(void);
   unsigned      generateHeader(unsigned bodySize, unsigned code, const char* msg, 
-                                                          MimeType mimeType = NoMimeType);
+                                  MimeType mimeType = NoMimeType, bool chunked = false);
+  bool          sendChunk(bool lastChunk);
+  unsigned      generateStaticHeader(void);
+  bool          writevLoop(int fildes, struct iovec* iov, int iovCount);
   bool          writeLoop(int fildes, char *buf, size_t nbyte);
+  bool          sendFileLoop(int fildes, HttpStaticPage* page, unsigned headerLen);
+  bool          cachedRouteRequest(const HttpRoute* route, char* rest);
+  void          useCachedResponse(HttpCachedResponse* entry);
+  void          releaseCachedResponse(void);
   inline void   resetResponse(void)
    {
     respPtr         = respBuf;
     respEnd         = respBuf + respBufSize;
-    altResp         = nullptr;
-    altMimeType     = NoMimeType;
+    respStreaming   = false;
+    staticPage      = nullptr;
+    respNotModified = false;
+    respCapturing   = false;
+    respETag[0]     = '\0';
+    respGzip        = false;
     loggedInUser    = nullptr;
     cacheDuration   = 0u;
    }  
@@ -3,6 +3,12 @@
 #ifndef HTTP_STATIC_PAGE_H
 #define HTTP_STATIC_PAGE_H
 
+#include "Lockable.h"
+#include "MimeTypeMaps.h"
+#include <atomic>
+
+#define STATIC_HEAD_BUF_SIZE 256
+
 
 // =======================================================================================
 // Forward declarations
@@ -15,10 +21,15 @@ class HttpPageSet;
 /// @brief This class is for the storage of static objects that will be served via the 
 /// HTTP servers.
 ///
-/// On construction, we will load our object from disk, but keep it around so we can
-/// be served as needed.
+/// The first time we are requested, we open our object on disk, map it into memory, and
+/// build the unchanging part of the response header.  We keep the file open so that the
+/// body can be sent straight from the page cache to the socket with sendfile(), and the
+/// mapping is there as a fallback (and for logging).  After that, serving us doesn't
+/// take any lock or copy the body through user space.  Text pages that are big enough
+/// are also gzipped once at load time, and the compressed copy is kept in memory (with 
+/// its own header) for clients that accept gzip.
 
-class HttpStaticPage
+class HttpStaticPage: public Lockable
 {
   friend HttpServThread;
   friend HttpPageSet;
@@ -28,18 +39,28 @@ public:
   // Instance variables - public
   
   // Member functions - public
-  HttpStaticPage(char* objectPath);
+  HttpStaticPage(const char* objectPath, MimeType mType);
   ~HttpStaticPage(void);
-  char* getResponse(void);
+  bool load(void);
+  
+  /// @brief Check whether the page is ready to serve (without taking the lock).
+  inline bool isLoaded(void) {return loaded.load(std::memory_order_acquire);}
   
 private:
   
   // Instance variables - private
-  unsigned            respBufSize;
-  unsigned            headBufSize;
-  char*               respBuf;
-  char*               headBuf;
+  std::atomic<bool>   loaded;
+  int                 fileFd;
+  unsigned            bodySize;
+  char*               body;         // mmap'd file contents
+  unsigned            headLen;      // excludes final blank line so cookies can be added
+  char                headBuf[STATIC_HEAD_BUF_SIZE];
+  unsigned            gzSize;
+  char*               gzBody;       // null if we don't have a gzipped copy
+  unsigned            gzHeadLen;
+  char                gzHeadBuf[STATIC_HEAD_BUF_SIZE];
   char*               originalPath;
+  MimeType            mimeType;
   
   // Member functions - private
   /// @brief Prevent copy-construction.
@@ -9,14 +9,26 @@
 
 #include "mdbtools.h"
 #include <vector>
+#include <string>
 
 
 // =======================================================================================
 // Forward declarations
 
-class SoilProfile;
 class SoilDatabase;
-class HWSDProfile;
+class MdbTableReader;
+
+
+// =======================================================================================
+/// @brief The types of structure field that a column can be converted into.
+
+enum MdbFieldType
+{
+  MdbFieldInt,    // int32_t, from integer columns
+  MdbFieldByte,   // uint8_t, from byte or boolean columns
+  MdbFieldFloat,  // float, from numeric columns, divided by the entry's divisor
+  MdbFieldText    // char[fieldSize], always nul-terminated, from text columns
+};
 
 
 // =======================================================================================
@@ -24,27 +36,46 @@ class HWSDProfile;
 /// table and insert it into a structure.
 /// This is handled as byte offsets into a void*.  Note this operation is a fairly 
 /// tricky and trouble prone thing to do, and mistakes will turn the structure into 
-/// binary mush.  Pay careful attention to types.
+/// binary mush.  Pay careful attention to types (and use offsetof() for the offsets).
 
 class MdbTableSchemaEntry
 {
+  friend MdbTableReader;
+  
 public:
-  MdbTableSchemaEntry(int col, int offs);
+  MdbTableSchemaEntry(const char* colName, MdbFieldType type, size_t offs,
+                                                    size_t size = 0u, double div = 1.0);
   
 private:
-  int         colIndex;
-  //MdbColumn*  column;
-  int         offset;
+  std::string   columnName;
+  MdbFieldType  fieldType;
+  int           colIndex;   // in the table, -1 until bound by MdbTableReader::bindSchema
+  size_t        offset;
+  size_t        fieldSize;  // only needed for MdbFieldText
+  double        divisor;    // only used for MdbFieldFloat
 };
 
 
 // =======================================================================================
 /// @brief The information required to extract particular rows from a table and insert
 /// them into a structure (which is handled as byte offsets into a void*).
+///
+/// Columns are named, so the schema doesn't depend on the order of the columns in the
+/// table, and columns not in the schema are just skipped.
 
 class MdbTableSchema: public std::vector<MdbTableSchemaEntry*>
 {
+public:
+  MdbTableSchema(void) {}
+  ~MdbTableSchema(void);
+  void addField(const char* colName, MdbFieldType type, size_t offset,
+                                                    size_t size = 0u, double div = 1.0);
   
+private:
+  /// @brief Prevent copy-construction.
+  MdbTableSchema(const MdbTableSchema&);       
+  /// @brief Prevent assignment.
+  MdbTableSchema& operator=(const MdbTableSchema&);      
 };
 
 
@@ -54,12 +85,32 @@ class MdbTableSchema: public std::vector<MdbTableSchemaEntry*>
 
 class MdbTableReader
 {
-  friend HWSDProfile;
-  
  public:
   MdbTableReader(MdbHandle* mdb, char* table_name, unsigned bindSize);
   ~MdbTableReader(void);
   bool getNextRow(void);
+  bool bindSchema(MdbTableSchema& schema);
+  void convertRow(MdbTableSchema& schema, void* S);
+  
+  /// @brief Read all the remaining rows of the table into a vector of structures, in a
+  /// single pass.
+  /// @returns False if the schema doesn't match the table (in which case nothing is
+  /// read), true otherwise.
+  /// @param schema The MdbTableSchema describing where the columns go in a T.  T must
+  /// be a plain struct, which is zeroed before the columns are put in.
+  /// @param rows The vector to append the rows to.
+  template<class T> bool importAll(MdbTableSchema& schema, std::vector<T>& rows)
+   {
+    if(!bindSchema(schema))
+      return false;
+    rows.reserve(rows.size() + table->num_rows);
+    while(getNextRow())
+     {
+      rows.push_back(T());
+      convertRow(schema, &rows.back());
+     }
+    return true;
+   }
   
  private:
   // Instance variables - private
@@ -88,7 +139,6 @@ public:
   // Member functions - public
   MdbDatabase(char* fileName);
   void logCatalog(void);
-  bool fetchNextRowToStructure(void* S);
   ~MdbDatabase(void);
   
 private:
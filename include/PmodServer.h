@@ -10,6 +10,7 @@
 // Forward declarations
 
 class HttpServThread;
+class HttpRouteTable;
 
 
 // =======================================================================================
@@ -27,6 +28,7 @@ public:
   ~PmodServer(void);
   bool indexPageTable(HttpServThread* serv);
   bool processHttpRequest(HttpServThread* serv, char* url);
+  void registerRoutes(HttpRouteTable& routes);
 
 private:
   
@@ -5,9 +5,17 @@
 
 #include "BILFile.h"
 #include "MdbFile.h"
+#include "HWSDSnapshot.h"
 #include <unordered_map>
 
 
+// =======================================================================================
+// Forward declarations
+
+class HttpServThread;
+class HttpRouteTable;
+
+
 // =======================================================================================
 /// @brief Interface to soil databases.
 ///  
@@ -30,13 +38,14 @@ public:
   unsigned printJsonSoilProfiles(char* buf, unsigned bufSize, 
                                  float loLat, float hiLat, float loLong, float hiLong);
   void createHWSDSchema(void);
+  bool processHttpRequest(HttpServThread* serv, char* url);
+  void registerRoutes(HttpRouteTable& routes);
 
 private:
   
   // Instance variables - private
   BILFile worldSoilBilFile;
-  MdbDatabase worldSoilMdbDatabase;
-  std::unordered_map<unsigned short, SoilProfile*> worldSoilProfiles;
+  HWSDSnapshot worldSoilSnapshot;
   MdbTableSchema hwsdSchema;
   
   // Member functions - private
@@ -41,7 +41,7 @@ public:
   virtual ~SoilProfile(void);
   virtual DynamicType getDynamicType(void) {return TypeSoilProfile;}
   virtual int writeJsonFields(char* buf, unsigned bufSize);
-  void getGroundLayersFromJson(rapidjson::Document& soilJson);
+  void getGroundLayersFromJson(rapidjson::Value& soilJson);
   virtual float getFertility();
   void addCarbonFromAbove(float carbon);
   void timeStepCarbonEvolution(void);
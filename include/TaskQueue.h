@@ -5,6 +5,10 @@
 
 #include "Lockable.h"
 #include <list>
+#include <atomic>
+#include <stdint.h>
+
+#define TASK_RING_SIZE 1024 // must be a power of two
 
 
 // =======================================================================================
@@ -21,13 +25,117 @@ class HttpLoadBalancer;
 class Task
 {
  public:
-  
+
   // public methods
+  Task(void) {}
   Task(void (*work)(void*, TaskQueue*), void* arg);
-  
+
   // member variables
   void (*doWork)(void*, TaskQueue*);
-  void* theArg;  
+  void* theArg;
+};
+
+
+// =======================================================================================
+/// @brief Bounded lock-free ring of tasks that any thread may add to or take from.
+///
+/// This is Dmitry Vyukov's bounded multi-producer/multi-consumer queue.  Each cell
+/// carries a sequence number which tells producers and consumers whether it is their
+/// turn on that cell, so the only contended operations are a compare-and-swap on
+/// the head or tail position.  Used as the per-worker queue in TaskQueue, where the
+/// owning worker and any idle siblings stealing from it are all consumers.
+/// See https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+
+class TaskRing
+{
+ public:
+
+  // Member functions - public
+  TaskRing(void);
+  ~TaskRing(void);
+
+  /// @brief Add a task to the ring.
+  /// @returns True if the task was added, false if the ring is full.
+
+  inline bool push(void (*work)(void*, TaskQueue*), void* arg)
+   {
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    Cell* cell;
+    while(1)
+     {
+      cell = cells + (pos & (TASK_RING_SIZE-1));
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if(diff == 0)
+       {
+        if(enqueuePos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+          break;
+       }
+      else if(diff < 0)
+        return false;
+      else
+        pos = enqueuePos.load(std::memory_order_relaxed);
+     }
+    cell->task.doWork = work;
+    cell->task.theArg = arg;
+    cell->sequence.store(pos+1, std::memory_order_release);
+    return true;
+   }
+
+  /// @brief Take the oldest task from the ring.
+  /// @returns True if a task was removed into task, false if the ring is empty.
+
+  inline bool pop(Task& task)
+   {
+    size_t pos = dequeuePos.load(std::memory_order_relaxed);
+    Cell* cell;
+    while(1)
+     {
+      cell = cells + (pos & (TASK_RING_SIZE-1));
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos+1);
+      if(diff == 0)
+       {
+        if(dequeuePos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+          break;
+       }
+      else if(diff < 0)
+        return false;
+      else
+        pos = dequeuePos.load(std::memory_order_relaxed);
+     }
+    task = cell->task;
+    cell->sequence.store(pos+TASK_RING_SIZE, std::memory_order_release);
+    return true;
+   }
+
+  /// @brief Approximate number of tasks in the ring (exact if nothing is in flight).
+
+  inline unsigned size(void)
+   {
+    size_t tail = enqueuePos.load(std::memory_order_relaxed);
+    size_t head = dequeuePos.load(std::memory_order_relaxed);
+    return tail > head ? (unsigned)(tail - head) : 0u;
+   }
+
+ private:
+
+  struct Cell
+   {
+    std::atomic<size_t> sequence;
+    Task                task;
+   };
+
+  // Instance variables - private (positions on separate cache lines)
+  Cell*                             cells;
+  char                              pad0[64];
+  std::atomic<size_t>               enqueuePos;
+  char                              pad1[64];
+  std::atomic<size_t>               dequeuePos;
+  char                              pad2[64];
+
+  // Member functions - private
+  PreventAssignAndCopyConstructor(TaskRing);
 };
 
 
@@ -36,37 +144,50 @@ class Task
 ///
 /// This is used to manage a worker thread which has a queue of tasks to perform.  Other
 /// threads can add things to the queue, and the worker will get to them.  Uses pthreads.
+/// The queue itself is a lock-free TaskRing, with a locked overflow list that is only
+/// used in the unlikely event of the ring filling up.  When the worker runs out of
+/// its own tasks it will steal from the other queues in its TaskQueueFarm before going
+/// to sleep, so one slow task doesn't hold up everything queued behind it.
 
-class TaskQueue: public Lockable, public std::list<Task*> 
+class TaskQueue: public Lockable
 {
   friend TaskQueueFarm;
   friend HttpLoadBalancer;
-  
+
  public:
-  
+
   // Instance variables - public
-  
+
   // Member functions - public
   TaskQueue(unsigned index);
   ~TaskQueue(void);
   void workLoop(void);
-  inline unsigned queueSize(void) {return tasksQueued;}
-  void addTask(void (*work)(void*, TaskQueue*), void* arg);
-  inline void die(void){timeToDie = true;}
-  
+  inline unsigned queueSize(void) {return ring.size() + overflowCount;}
+  bool addTask(void (*work)(void*, TaskQueue*), void* arg);
+  void die(void);
+
 protected:
-  pthread_cond_t           taskWait;
-  unsigned                 tasksQueued;
-  unsigned                 tasksInProgress; // should only ever be 0 or 1
-  unsigned                 queueIndex;
-  bool                     timeToDie;
-  pthread_t                workerThread;
-  
+  pthread_cond_t              taskWait;
+  std::atomic<unsigned>       tasksInProgress; // should only ever be 0 or 1
+  std::atomic<unsigned>       maxQueued;       // high water mark of queueSize()
+  std::atomic<unsigned long>  tasksDone;
+  std::atomic<unsigned long>  tasksStolen;     // done by us from other queues
+  std::atomic<bool>           sleeping;
+  unsigned                    queueIndex;
+  bool                        timeToDie;
+  pthread_t                   workerThread;
+  std::atomic<TaskQueueFarm*> farm;            // set once our farm is running
+
 private:
-  
+
   // Instance variables - private
-  
+  TaskRing                    ring;
+  std::list<Task>             overflow;        // protected by our lock
+  std::atomic<unsigned>       overflowCount;
+
   // Member functions - private
+  bool takeTask(Task& task);
+  bool wake(void);
   TaskQueue(const TaskQueue&);                 // Prevent copy-construction
   TaskQueue& operator=(const TaskQueue&);      // Prevent assignment
 
@@ -9,20 +9,25 @@
 // =======================================================================================
 // Forward declarations
 
-class HttpDebug;
+class HttpServThread;
 
 
 // =======================================================================================
 /// @brief Manage a group of TaskQueues.
 /// 
 /// This class manages a group of task queues, and provides some convenient methods for
-/// initializing and working with them.
+/// initializing and working with them.  Adding a task is O(1) and lock-free (the farm
+/// no longer inspects every queue to choose one).  Instead, workers that run dry steal
+/// tasks from their siblings, so work that lands on a busy queue still gets done
+/// promptly, while tasks that are deliberately put on the same queue (eg with the same
+/// index to addTask) mostly stay together on one thread.
 
 class TaskQueueFarm: public Lockable
 {
 public:
   
   // Instance variables - public
+  std::atomic<unsigned>   nSleeping;  // approximate count of idle workers
   
   // Member functions - public
   TaskQueueFarm(unsigned nQueues, const char* lName);
@@ -32,19 +37,23 @@ public:
   void loadBalanceTask(void (*work)(void*, TaskQueue*), void* arg);
   void notifyTaskDone(void);
   void waitOnEmptyFarm(void);
-  bool diagnosticHTML(HttpDebug* serv);
+  bool diagnosticHTML(HttpServThread* serv);
+  bool diagnosticTable(HttpServThread* serv);
+  bool stealTask(unsigned thief, Task& task);
+  bool workAvailable(void);
 
 private:
   
   // Instance variables - private
-  pthread_cond_t    tasksUnfinished;
-  unsigned          nQ;
-  unsigned          tasksOutstanding;
-  TaskQueue**       taskQueues;
-  const char*       logName;
+  pthread_cond_t          tasksUnfinished;
+  unsigned                nQ;
+  std::atomic<unsigned>   tasksOutstanding;
+  std::atomic<unsigned>   nextQueue;  // for round-robin in loadBalanceTask
+  TaskQueue**             taskQueues;
+  const char*             logName;
 
   // Member functions - private
-  unsigned findBestQueue(void);
+  void wakeIdleWorker(unsigned skip);
   TaskQueueFarm(const TaskQueueFarm&);                 // Prevent copy-construction
   TaskQueueFarm& operator=(const TaskQueueFarm&);      // Prevent assignment
 };
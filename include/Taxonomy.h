@@ -21,6 +21,7 @@ class Family;
 class BioClass;
 class Order;
 class HttpServThread;
+class HttpRouteTable;
 
 
 // =======================================================================================
@@ -50,6 +51,7 @@ public:
   bool add(char* species, char* genus, char* family, char* order, char* bioClass);
   bool indexPageTable(HttpServThread* serv);
   bool processHttpRequest(HttpServThread* serv, char* url);
+  void registerRoutes(HttpRouteTable& routes);
   bool provideClassList(HttpServThread* serv);
 
 protected:
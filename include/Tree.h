@@ -24,7 +24,7 @@ class TaskQueue;
 class Scene;
 class SoilProfile;
 
-void growOneTree(void* arg);
+void growOneCopse(void* arg, TaskQueue* T);
 
 
 // =======================================================================================
@@ -37,7 +37,7 @@ void growOneTree(void* arg);
 class Tree: public VisualObject
 {
   friend WoodySegment;
-  friend void growOneTree(void* arg, TaskQueue* T);
+  friend void growOneCopse(void* arg, TaskQueue* T);
 
  public:
   
@@ -97,6 +97,7 @@ class Tree: public VisualObject
   vec3      location;
   TreePart* trunk;
   float     yearsToSim;
+  Tree*     nextInCopse;  // the next tree to grow in the same task
   
   // static array used to allow a short index from treeParts
   static Tree** treePtrArray;
@@ -17,6 +17,7 @@
 // Forward declarations
 
 class HttpServThread;
+class HttpRouteTable;
 class HTMLForm;
 class UserManager;
 class UserSessionGroup;
@@ -75,6 +76,7 @@ public:
   ~UserManager(void);
   bool indexPageTable(HttpServThread* serv);
   bool processHttpRequest(HttpServThread* serv, char* url, UserSessionGroup* sessions);
+  void registerRoutes(HttpRouteTable& routes, UserSessionGroup* sessions);
   static UserManager& getUserManager(void) // Get the singleton instance
    { return *theUserManager; }
   UserRecord* getRecord(unsigned long long sessionId, EntryStatus& sessionStatus,   
@@ -8,6 +8,7 @@
 #include "MimeTypeMaps.h"
 #include "ResourceManager.h"
 #include "UserManager.h"
+#include "GHCNDatabase.h"
 #include "Logging.h"
 #include "Global.h"
 #include <cstdio>
@@ -44,14 +45,21 @@ void printUsage(int argc, char* argv[])
 {
   printf("\nUsage:\n\n%s [options]\n\nOptions:\n\n", argv[0]);
   
+  printf("\t-b B\tUse a listen backlog of B on the server socket (default %d).\n",
+                                                                  HTTP_DEFAULT_BACKLOG);
   printf("\t-c\tRun server with no climate database.\n");
   printf("\t-C T\tGet all GHCN climate files with T secs spacing.\n");
+  printf("\t-G D\tBenchmark parsing the GHCN station files in directory D, then exit.\n");
   printf("\t-h\tPrint this message.\n");
+  printf("\t-m M\tUse M megabytes for the response cache (default %d, 0 for none).\n",
+                                                            PERMASERV_DEFAULT_CACHE_MB);
+  printf("\t-M M\tLimit loaded climate stations to M megabytes (default 0, no limit).\n");
   printf("\t-o\tRun server with no OLDF file handling.\n");
   printf("\t-p P\tRun server on port P.\n");
   printf("\t-s\tRun server with no solar database.\n");
   printf("\t-t\tRun server with no tree/plant database.\n");
   printf("\t-u\tRun server with no user sessions/management.\n");
+  printf("\t-w W\tRun W HTTP worker threads (default/0 is one per CPU core).\n");
   printf("Note:\n");
   printf("\t* -u implies -o as OLDF handling depends on user directories.\n");
   printf("\n");
@@ -70,9 +78,15 @@ void processCommandLine(int argc, char* argv[])
 {  
   int optionChar;
 
-  while( (optionChar = getopt(argc, argv, "cC:hop:stu")) != -1)
+  while( (optionChar = getopt(argc, argv, "b:cC:G:hm:M:op:stuw:")) != -1)
     switch (optionChar)
      {
+       case 'b':
+         permaservParams.listenBacklog = atoi(optarg);
+         if(permaservParams.listenBacklog <= 0)
+           err(-1, "Bad listen backlog via -b: %s\n", optarg);
+         break;
+
        case 'c':
         permaservParams.flags |= PERMASERV_NO_CLIMATE;
         break;
@@ -84,10 +98,26 @@ void processCommandLine(int argc, char* argv[])
            err(-1, "Bad climate file spacing via -c: %s\n", optarg);
          break;
 
+       case 'G':
+         GHCNDatabase::benchmarkCSVParsing(optarg);
+         exit(0);
+
        case 'h':
          printUsage(argc, argv);
          exit(0);
 
+       case 'm':
+         if(atoi(optarg) < 0)
+           err(-1, "Bad response cache size via -m: %s\n", optarg);
+         permaservParams.responseCacheMB = atoi(optarg);
+         break;
+
+       case 'M':
+         if(atoi(optarg) < 0)
+           err(-1, "Bad climate memory budget via -M: %s\n", optarg);
+         permaservParams.climateMemoryMB = atoi(optarg);
+         break;
+
        case 'o':
         permaservParams.flags |= PERMASERV_NO_OLDFSERV;
         break;
@@ -110,6 +140,12 @@ void processCommandLine(int argc, char* argv[])
          permaservParams.flags |= PERMASERV_NO_USERS;
          break;
 
+       case 'w':
+         if(atoi(optarg) < 0)
+           err(-1, "Bad HTTP thread count via -w: %s\n", optarg);
+         permaservParams.httpThreads = atoi(optarg);
+         break;
+
        default:
          printUsage(argc, argv);
          exit(0);
@@ -12,6 +12,10 @@
 #include "Logging.h"
 #include <string.h>
 #include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 // =======================================================================================
@@ -20,17 +24,20 @@
 /// @param fileNameStub The path to the directory of the BIL file, together with the 
 /// part of the filename prior to the .extension (such as .hdr)
 
-BILFile::BILFile(char* fileNameStub)
+BILFile::BILFile(char* fileNameStub): byteOrder(LITTLE_ENDIAN),
+                                      nRows(0),
+                                      nCols(0),
+                                      nBands(1),
+                                      nBits(0),
+                                      bandRowBytes(0),
+                                      totalRowBytes(0),
+                                      bandGapBytes(0),
+                                      data(NULL),
+                                      dataSize(0u)
 {
   readHdrFile(fileNameStub);
   readBlwFile(fileNameStub);
-  char fileName[256];
-  snprintf(fileName, 256, "%s.bil", fileNameStub);
-  dataFile = fopen(fileName, "r");
-  unless(dataFile)
-    err(-1, "Couldn't open %s.\n", fileName);
-  else
-    LogBilFileDetails("Opened Bilfile data file %s for reading.\n", fileName);
+  mapDataFile(fileNameStub);
 }
 
 
@@ -39,6 +46,43 @@ BILFile::BILFile(char* fileNameStub)
 
 BILFile::~BILFile(void)
 {
+  if(data)
+    munmap(data, dataSize);
+}
+
+
+// =======================================================================================
+/// @brief Map the .bil file itself read-only into our address space.
+/// 
+/// @returns True if the file was mapped (we exit if it can't be).
+/// @param fileNameStub The path to the directory of the BIL file, together with the 
+/// part of the filename prior to the .extension (such as .hdr)
+
+bool BILFile::mapDataFile(char* fileNameStub)
+{
+  char fileName[256];
+  snprintf(fileName, 256, "%s.bil", fileNameStub);
+  int fd = open(fileName, O_RDONLY);
+  if(fd < 0)
+    err(-1, "Couldn't open %s.\n", fileName);
+  struct stat fileStat;
+  if(fstat(fd, &fileStat) < 0)
+    err(-1, "Couldn't stat %s.\n", fileName);
+  dataSize = fileStat.st_size;
+  if(dataSize < (size_t)nRows*totalRowBytes)
+    err(-1, "File %s is %lu bytes but should be at least %lu.\n", fileName, 
+                                    (unsigned long)dataSize, (unsigned long)nRows*totalRowBytes);
+  void* map = mmap(NULL, dataSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(map == MAP_FAILED)
+    err(-1, "Couldn't mmap %s.\n", fileName);
+  close(fd);  // the mapping stays valid without it
+  
+  // Lookups are scattered all over the world, so read-ahead would be wasted
+  madvise(map, dataSize, MADV_RANDOM);
+  data = (uint8_t*)map;
+  LogBilFileDetails("Mapped Bilfile data file %s (%lu bytes) for reading.\n", fileName,
+                                                                  (unsigned long)dataSize);
+  return true;
 }
 
 
@@ -207,53 +251,288 @@ bool BILFile::readHdrFile(char* fileNameStub)
         err(-1, "Could not get NBITS from file %s.\n", fileName);
       else
         LogBilFileDetails("Bilfile header %s reports nBits = %d.\n", fileName, nBits);        
-      if(nBits != 16)
-        err(-1, "NBITS is %d not 16 in file %s.\n", nBits, fileName);      
+      if(nBits != 8 && nBits != 16)
+        err(-1, "NBITS is %d not 8 or 16 in file %s.\n", nBits, fileName);      
      }
 
     if( (strncmp(line, "BANDROWBYTES", 12) == 0) || (strncmp(line, "bandrowbytes", 12) == 0))
      {
+      if(sscanf(line+12, "%d", &bandRowBytes) != 1)
+        err(-1, "Could not get BANDROWBYTES from file %s.\n", fileName);
       continue;
      }
 
     if( (strncmp(line, "TOTALROWBYTES", 13) == 0) || (strncmp(line, "totalrowbytes", 13) == 0))
      {
+      if(sscanf(line+13, "%d", &totalRowBytes) != 1)
+        err(-1, "Could not get TOTALROWBYTES from file %s.\n", fileName);
       continue;
      }
 
     if( (strncmp(line, "BANDGAPBYTES", 12) == 0) || (strncmp(line, "bandgapbytes", 12) == 0))
      {
+      if(sscanf(line+12, "%d", &bandGapBytes) != 1)
+        err(-1, "Could not get BANDGAPBYTES from file %s.\n", fileName);
       continue;
      }
     
    }
   
+  // Row sizes are optional, and default to the rows being packed
+  unless(nRows > 0 && nCols > 0 && nBits)
+    err(-1, "Missing NROWS, NCOLS, or NBITS in file %s.\n", fileName);
+  unless(bandRowBytes)
+    bandRowBytes = nCols*(nBits/8);
+  unless(totalRowBytes)
+    totalRowBytes = bandRowBytes*nBands;
+  if(bandRowBytes < nCols*(nBits/8) || totalRowBytes < bandRowBytes)
+    err(-1, "Row sizes too small for NCOLS and NBITS in file %s.\n", fileName);
+
   // Clean up and go home.
   fclose(file);
   return true;
 }
 
 
+// =======================================================================================
+/// @brief Find where in the data the pixel for a particular point is.
+/// 
+/// @returns True if the point is within the raster, false otherwise.
+/// @param lat The float latitude of the requested location.
+/// @param longt The The float longtitude of the requested location.
+/// @param byteOffset The offset of the pixel from the start of the data.
+
+inline bool BILFile::pixelOffset(float lat, float longt, size_t& byteOffset)
+{
+  int row = lround((lat - latPixelStart)/latPixelDelta);
+  int col = lround((longt - longPixelStart)/longPixelDelta);
+  unless(row >= 0 && row < nRows && col >= 0 && col < nCols)
+    return false;
+  byteOffset = (size_t)row*totalRowBytes + (size_t)col*(nBits/8);
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Get the value of the pixel at some offset, in whichever byte order the file
+/// is in.
+/// 
+/// @returns The value.
+/// @param byteOffset The offset of the pixel from the start of the data.
+
+inline unsigned short BILFile::valueAtOffset(size_t byteOffset)
+{
+  const uint8_t* pixel = data + byteOffset;
+  if(nBits == 8)
+    return pixel[0];
+  if(byteOrder == LITTLE_ENDIAN)
+    return pixel[0] | (pixel[1] << 8);
+  return (pixel[0] << 8) | pixel[1];
+}
+
+
 // =======================================================================================
 /// @brief Find the value at a particular point from the binary bilFile itself.
 /// 
-/// @returns The value in the bilFile at the given lat,longt.
+/// @returns The value in the bilFile at the given lat,longt, or zero if the point is
+/// outside the raster.
 /// @param lat The float latitude of the requested location.
 /// @param longt The The float longtitude of the requested location.
 
 unsigned short BILFile::valueAtPoint(float lat, float longt)
 {  
-  // Need to fseek in the bilfile.
-  int row = round((lat - latPixelStart)/latPixelDelta);
-  int col = round((longt - longPixelStart)/longPixelDelta);
-  int byteOffset = (row*nCols+col)*(nBits/8);
-  fseek(dataFile, byteOffset, SEEK_SET);
-  unsigned short retVal = 0u;
-  fread(&retVal, nBits/8, 1, dataFile);
-  LogBilFileDetails("Read %u from offset %u (row %u, col %u, lat %.6f, long %.6f.\n", 
-                    retVal, byteOffset, row, col, lat, longt);
+  size_t byteOffset;
+  unless(pixelOffset(lat, longt, byteOffset))
+   {
+    LogBilFileDetails("Point lat %.6f, long %.6f is outside the raster.\n", lat, longt);
+    return 0u;
+   }
+  unsigned short retVal = valueAtOffset(byteOffset);
+  LogBilFileDetails("Read %u from offset %lu (lat %.6f, long %.6f).\n", 
+                    retVal, (unsigned long)byteOffset, lat, longt);
   return retVal;
 }
 
 
+// =======================================================================================
+/// @brief Find the values at a whole batch of points.
+/// 
+/// This does no system calls, takes no locks, and doesn't log per point, so it can 
+/// be used for thousands of points at a time (eg to sample a region).
+/// @param N The number of points.
+/// @param lats The latitudes of the points.
+/// @param longts The longtitudes of the points.
+/// @param values An array (owned by the caller) for the N values found.  Points outside
+/// the raster get zero.
+
+void BILFile::valuesAtPoints(unsigned N, const float* lats, const float* longts, 
+                                                                  unsigned short* values)
+{
+  for(unsigned i=0; i<N; i++)
+   {
+    size_t byteOffset;
+    values[i] = pixelOffset(lats[i], longts[i], byteOffset) ? 
+                                                          valueAtOffset(byteOffset) : 0u;
+   }
+}
+
+
+// =======================================================================================
+/// @brief Work out which pixels along one axis have their centres within a range.
+/// 
+/// If the range is too small to contain any pixel centre, we give the pixel it's in, 
+/// unless told not to.
+/// @returns True if any of the range is within the raster (or, if nearest is false,
+/// if there are any pixel centres in the range), false otherwise.
+/// @param lo The low end of the range (degrees).
+/// @param hi The high end of the range (degrees).
+/// @param start The centre of the first pixel on this axis (degrees).
+/// @param delta The step from one pixel centre to the next (which may be negative).
+/// @param n The number of pixels on this axis.
+/// @param first The first pixel in the range.
+/// @param last The last pixel in the range.
+/// @param nearest If true (the default), give the pixel the range is in when it's too
+/// small to contain any centres.
+
+bool BILFile::pixelRange(float lo, float hi, double start, double delta, int n, 
+                                                        int& first, int& last, bool nearest)
+{
+  double a = (lo - start)/delta;
+  double b = (hi - start)/delta;
+  if(a > b)
+   {
+    double temp = a;
+    a = b;
+    b = temp;
+   }
+  first = (int)ceil(a);
+  last  = (int)floor(b);
+  if(first > last)
+   {
+    unless(nearest)
+      return false;
+    first = last = lround((a + b)/2.0);
+   }
+  if(last < 0 || first >= n)
+    return false;
+  if(first < 0)
+    first = 0;
+  if(last >= n)
+    last = n - 1;
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Find what fraction of the area of a lat/long rectangle has each value.
+/// 
+/// This goes through the rows of the raster covered by the rectangle once, reading
+/// along each row in order (which is how the raster is laid out, so the pages are 
+/// touched once each and in sequence).  Runs of the same value along a row are counted
+/// before being added in, so the hash table is only touched where the value changes.
+/// Rows are weighted by the cosine of their latitude, as pixels get smaller towards 
+/// the poles.  Rectangles of more than BIL_MAX_RECT_PIXELS are sampled on a regular
+/// grid of every so many rows and columns.  A rectangle with loLong > hiLong is taken
+/// to cross the antimeridian, and is read as two spans of columns, one each side.
+/// @returns The number of pixels looked at (zero if the rectangle is outside the 
+/// raster).
+/// @param loLat The low end of the latitude range.
+/// @param hiLat The high end of the latitude range.
+/// @param loLong The low (western) end of the longtitude range.
+/// @param hiLong The high (eastern) end of the longtitude range.
+/// @param areas A map (owned by the caller) from each value found to the fraction of 
+/// the area that has it.  Any previous contents are cleared.
+
+unsigned BILFile::valueAreas(float loLat, float hiLat, float loLong, float hiLong,
+                                          std::unordered_map<unsigned short, float>& areas)
+{
+  areas.clear();
+  int firstRow, lastRow;
+  unless(pixelRange(loLat, hiLat, latPixelStart, latPixelDelta, nRows, firstRow, lastRow))
+    return 0u;
+  
+  // Find the span(s) of columns
+  int firstCols[2], lastCols[2];
+  int nSpans = 0;
+  if(loLong <= hiLong)
+   {
+    if(pixelRange(loLong, hiLong, longPixelStart, longPixelDelta, nCols, 
+                                                          firstCols[0], lastCols[0]))
+      nSpans++;
+   }
+  else
+   {
+    // Either side may be too narrow to hold a pixel centre; if both are, use the pixel
+    // the middle of the rectangle is in
+    if(pixelRange(loLong, 180.0f, longPixelStart, longPixelDelta, nCols, 
+                                              firstCols[nSpans], lastCols[nSpans], false))
+      nSpans++;
+    if(pixelRange(-180.0f, hiLong, longPixelStart, longPixelDelta, nCols, 
+                                              firstCols[nSpans], lastCols[nSpans], false))
+      nSpans++;
+    unless(nSpans)
+     {
+      float midLong = (loLong + hiLong + 360.0f)/2.0f;
+      if(midLong > 180.0f)
+        midLong -= 360.0f;
+      if(pixelRange(midLong, midLong, longPixelStart, longPixelDelta, nCols, 
+                                                                firstCols[0], lastCols[0]))
+        nSpans++;
+     }
+   }
+  unless(nSpans)
+    return 0u;
+  int spanCols = 0;
+  for(int s=0; s<nSpans; s++)
+    spanCols += lastCols[s] - firstCols[s] + 1;
+  
+  // Work out how sparsely to sample, if we must
+  double pixels = (double)(lastRow - firstRow + 1)*spanCols;
+  int step = 1;
+  if(pixels > BIL_MAX_RECT_PIXELS)
+    step = (int)ceil(sqrt(pixels/BIL_MAX_RECT_PIXELS));
+  
+  // Go through the rows, counting runs of the same value
+  std::unordered_map<unsigned short, double> valueWeights;
+  int       pixelBytes  = (nBits/8)*step;
+  double    totalWeight = 0.0;
+  unsigned  looked      = 0u;
+  for(int row=firstRow; row<=lastRow; row+=step)
+   {
+    double rowWeight = cos((latPixelStart + row*latPixelDelta)*M_PI/180.0);
+    if(rowWeight < 0.0)
+      rowWeight = 0.0;
+    for(int s=0; s<nSpans; s++)
+     {
+      int firstCol = firstCols[s];
+      int lastCol  = lastCols[s];
+      size_t offset = (size_t)row*totalRowBytes + (size_t)firstCol*(nBits/8);
+      unsigned short runValue  = valueAtOffset(offset);
+      unsigned       runLength = 0u;
+      for(int col=firstCol; col<=lastCol; col+=step, offset+=pixelBytes)
+       {
+        unsigned short value = valueAtOffset(offset);
+        if(value != runValue)
+         {
+          valueWeights[runValue] += runLength*rowWeight;
+          runValue  = value;
+          runLength = 0u;
+         }
+        runLength++;
+       }
+      valueWeights[runValue] += runLength*rowWeight;
+      totalWeight += (double)((lastCol - firstCol)/step + 1)*rowWeight;
+      looked += (lastCol - firstCol)/step + 1;
+     }
+   }
+  
+  // Turn the weights into fractions
+  for(auto& iter: valueWeights)
+    areas[iter.first] = totalWeight > 0.0 ? iter.second/totalWeight : 0.0f;
+  LogBilFileDetails("Found %lu values in %u pixels of rectangle [%.4f, %.4f] x "
+                    "[%.4f, %.4f].\n", areas.size(), looked, loLat, hiLat, loLong, hiLong);
+  return looked;
+}
+
+
 // =======================================================================================
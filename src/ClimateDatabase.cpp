@@ -5,11 +5,14 @@
 
 #include "ClimateDatabase.h"
 #include "GHCNDatabase.h"
+#include "GHCNPipeline.h"
 #include "ClimateInfo.h"
+#include "ClimateSynthesis.h"
 #include "D3Graph.h"
 #include "HttpServThread.h"
 #include "loadFileToBuf.h"
 #include "Logging.h"
+#include "HttpRouteTable.h"
 
 
 // =======================================================================================
@@ -17,15 +20,24 @@
 
 char* ghcnPath = (char*)"Materials/Climate/GHCN";
 
+#define STATION_WAIT_MS       8000  // before giving a page that refreshes till ready
+#define STATION_WAIT_REFRESH  5     // seconds
+
 
 // =======================================================================================
 /// @brief Constructor
+/// @param fileSpacing If non-negative, load all the GHCN stations in the background,
+/// pausing this many seconds after each download.
+/// @param memoryBudgetMB The most memory (in MB) that loaded stations may use before
+/// the least recently used are evicted.  Zero means no limit.
 
-ClimateDatabase::ClimateDatabase(float fileSpacing)
+ClimateDatabase::ClimateDatabase(float fileSpacing, unsigned memoryBudgetMB)
 {
   ghcnDatabase = new GHCNDatabase(ghcnPath);
+  synthesis    = new ClimateSynthesis(ghcnDatabase);
+  ghcnDatabase->pipeline->setMemoryBudget((size_t)memoryBudgetMB*1024*1024);
   if(fileSpacing >= 0.0f)
-    ghcnDatabase->loadAll(fileSpacing);
+    ghcnDatabase->startLoadAll(fileSpacing);
 }
 
 
@@ -34,6 +46,7 @@ ClimateDatabase::ClimateDatabase(float fileSpacing)
 
 ClimateDatabase::~ClimateDatabase(void)
 {
+  delete synthesis;
 }
 
 
@@ -56,7 +69,8 @@ bool ClimateDatabase::indexPageTable(HttpServThread* serv)
   // Climate data near a particular point
   httPrintf("<tr><td><a href=\"/climate/climate?42.421:-76.347:20:\">"
                  "/climate/climate?lat:long:years:</a></td>");
-  httPrintf("<td>Years of climate information near location.</td></tr>\n");
+  httPrintf("<td>Years of climate information synthesized for location (add elev: "
+                                            "for elevation in meters).</td></tr>\n");
 
   // Climate diagnostics near a particular point
   httPrintf("<tr><td><a href=\"/climate/climateDiagnostic?42.421:-76.347:20:\">"
@@ -84,7 +98,14 @@ bool ClimateDatabase::indexPageTable(HttpServThread* serv)
   httPrintf("<td>Compare stations near location.</td></tr>\n");
   
   // End table
-  httPrintf("</table></center>\n");
+  httPrintf("</table><br>\n");
+
+  // Progress loading stations
+  unless(ghcnDatabase->pipeline->diagnosticHTML(serv))
+    return false;
+  unless(synthesis->diagnosticHTML(serv))
+    return false;
+  httPrintf("</center>\n");
 
   return true;
 }
@@ -94,7 +115,8 @@ bool ClimateDatabase::indexPageTable(HttpServThread* serv)
 /// @brief Gateway to handling all requests coming in under /climate/.  
 /// 
 /// This just routes to the appropriate private method to handle the different specific
-/// cases.
+/// cases.  The whole request is a single read of the climate data, so that no station
+/// data it gets is freed (if evicted) till we are done.
 /// 
 /// @returns True if all was well writing to the buffer.  If false, it indicates the 
 /// buffer was not big enough and the output will have been truncated/incomplete.
@@ -105,6 +127,7 @@ bool ClimateDatabase::processHttpRequest(HttpServThread* serv, char* url)
 {
   int strlenUrl = strlen(url);
   bool retVal = false;
+  unsigned readGeneration = ghcnDatabase->pipeline->beginRead();
   
   // climateDiagnostic
   if(strlenUrl >= 22 && strncmp(url, "climateDiagnostic?", 18) == 0)
@@ -121,6 +144,14 @@ bool ClimateDatabase::processHttpRequest(HttpServThread* serv, char* url)
     retVal = processStationDiagnosticRequest(serv, url+15);
    }
 
+  // stationSummary - yearly summaries and normals at some station
+  // http://127.0.0.1:2091/climate/stationSummary/US1NYTM0018
+  else if( strlenUrl == 26 && strncmp(url, "stationSummary/", 15) == 0)
+   {
+    LogPermaservOpDetails("Processing station summary request for %s.\n", url+15);
+    retVal = processStationSummaryRequest(serv, url+15);
+   }
+
   // maxTempStation - tabbed max temp data at station
   // http://127.0.0.1:2091/climate/maxTempStation/US1NYTM0018
   else if( strlenUrl == 26 && strncmp(url, "maxTempStation/", 15) == 0)
@@ -158,7 +189,7 @@ bool ClimateDatabase::processHttpRequest(HttpServThread* serv, char* url)
     LogPermaservOpDetails("Processing station high temp comparison query for %s.\n", 
                                                                                 url+16);
     retVal = processStationComparisonRequest(serv, url+16, 
-                    (char*)"stationCompHigh", HI_TEMP_VALID, offsetof(ClimateDay, hiTemp));
+                                                  (char*)"stationCompHigh", HI_TEMP_VALID);
    }
 
   // stationCompLow
@@ -167,7 +198,7 @@ bool ClimateDatabase::processHttpRequest(HttpServThread* serv, char* url)
     LogPermaservOpDetails("Processing station low temp comparison query for %s.\n", 
                                                                                 url+15);
     retVal = processStationComparisonRequest(serv, url+15, (char*)"stationCompLow", 
-                                            LOW_TEMP_VALID, offsetof(ClimateDay, lowTemp));
+                                                                          LOW_TEMP_VALID);
    }
 
   // tMinYear
@@ -175,7 +206,7 @@ bool ClimateDatabase::processHttpRequest(HttpServThread* serv, char* url)
    {
     LogPermaservOpDetails("Processing temperature min query for %s.\n", url+9);
     retVal = processObservationCurvesRequest(serv, url+9, (char*)"tMinYear", 
-                LOW_TEMP_VALID, offsetof(ClimateDay, lowTemp), (char*)"Min. Temperature");
+                                              LOW_TEMP_VALID, (char*)"Min. Temperature");
   }
 
   // tMaxYear
@@ -183,7 +214,7 @@ bool ClimateDatabase::processHttpRequest(HttpServThread* serv, char* url)
    {
     LogPermaservOpDetails("Processing temperature max query for %s.\n", url+9);
     retVal = processObservationCurvesRequest(serv, url+9, (char*)"tMaxYear", 
-                HI_TEMP_VALID, offsetof(ClimateDay, hiTemp), (char*)"Max. Temperature");
+                                              HI_TEMP_VALID, (char*)"Max. Temperature");
    }
 
   // Default - failure
@@ -193,13 +224,16 @@ bool ClimateDatabase::processHttpRequest(HttpServThread* serv, char* url)
     retVal = serv->errorPage("Resource not found");
    }
 
+  ghcnDatabase->pipeline->endRead(readGeneration);
   return retVal;
 }
 
 
 // =======================================================================================
 /// @brief Process the case of a request for climate information.
-/// @param url The balance of the URL that we are to deal with (ie after the '?')
+/// @param url The balance of the URL that we are to deal with (ie after the '?').  This
+/// is lat:long:years: optionally followed by the elevation in meters as elev: (which
+/// only the JSON API uses).
 /// @param diagnostic A bool that if true provides HTML diagnostic pages rather than 
 /// the JSON API.  Used for troubleshooting the climate data and the permaserv code 
 /// handling it.
@@ -208,8 +242,13 @@ bool ClimateDatabase::processHttpRequest(HttpServThread* serv, char* url)
 bool ClimateDatabase::processClimateRequest(HttpServThread* serv, char* url, bool diagnostic)
 {
   // Extract the information from the URL
-  float latLongYear[3];
-  unless(extractColonVecN(url, 3, latLongYear))
+  float latLongYear[4];
+  latLongYear[3] = GHCN_NO_ELEVATION;
+  int colons = 0;
+  for(char* p = url; *p; p++)
+    if(*p == ':')
+      colons++;
+  unless(extractColonVecN(url, colons >= 4 ? 4 : 3, latLongYear))
    {
     if(diagnostic)
      {
@@ -249,9 +288,10 @@ bool ClimateDatabase::processClimateRequest(HttpServThread* serv, char* url, boo
    }
   else
    {
-    if( (serv->respPtr += printClimateJson(serv->respPtr, serv->respEnd - serv->respPtr, 
-                                  latLongYear[0], latLongYear[1], (unsigned)latLongYear[2]))
-                    >= serv->respEnd)
+    if( (serv->respPtr += printClimateJson(serv, serv->respPtr, 
+                                  serv->respEnd - serv->respPtr, latLongYear[0],
+                                  latLongYear[1], (unsigned)latLongYear[2],
+                                  latLongYear[3])) >= serv->respEnd)
      {
       LogClimateDbErr("Overflow in json response to climate request /climate?%s.\n", url);
       serv->respBufOverflow = true; 
@@ -270,40 +310,75 @@ bool ClimateDatabase::processClimateRequest(HttpServThread* serv, char* url, boo
 /// Note the current model is we output everything in a big lump on a single request.
 /// There might be an argument for sending it in smaller lumps so the client can get
 /// started without waiting for everything, but that would require a more stateful server.
+/// The series itself is synthesized from the nearby stations by our ClimateSynthesis, 
+/// which keeps it by grid cell, so a retry with a bigger buffer (or a request for a 
+/// neighbouring parcel) doesn't redo the work.
 /// 
 /// @returns The number of bytes written to the buffer.  If greater than or equal to 
 /// the supplied bufSize parameter, it indicates the buffer was not big enough and the
 /// output will have been truncated/incomplete.
+/// @param serv A pointer to the HttpServThread managing the HTTP response (so we can 
+/// keep a response we couldn't complete out of the response cache).
 /// @param buf The char buffer to write the JSON to.
 /// @param bufSize The size of the buffer, which must not be overwritten after the end.
 /// @param lat The latitude selected.
 /// @param longt The longtitude selected.
-/// @param yearCount The number of years of climate data to provide (assumed to start in
-/// the present year).
-/// @todo We currently just return the first remotely viable station result, instead 
-/// of properly analyzing them and picking the best or a suitably adjusted admixture
-/// @todo Most of this function should probably be in GHCN instead of here.
+/// @param yearCount The number of years of climate data to provide (ending in the last
+/// complete year).
+/// @param elevation The elevation of the location in meters, or GHCN_NO_ELEVATION if 
+/// not known.
 /// @todo We do not currently check the age of climateInfo data in memory.
 
-unsigned ClimateDatabase::printClimateJson(char* buf, unsigned bufSize, 
-                                        float lat, float longt, unsigned yearCount)
+unsigned ClimateDatabase::printClimateJson(HttpServThread* serv, char* buf, 
+                      unsigned bufSize, float lat, float longt, unsigned yearCount, 
+                                                                          float elevation)
 {
-  ghcnDatabase->getStations(lat, longt, 10);
-  
-  int N = ghcnDatabase->stationResults.size();
-  
-  for(int i=0; i<N; i++)
+  bool timedOut;
+  ClimateSynthCell* cell = synthesis->get(lat, longt, elevation, yearCount, 
+                                                                STATION_WAIT_MS, &timedOut);
+  if(timedOut)
    {
-    GHCNStation* station = ghcnDatabase->stationResults[i];
-    unless(station->climate)
-     {
-      ghcnDatabase->checkOrFetchCSVFile(station);
-      ghcnDatabase->readOneCSVFile(station);
-     }
-    // lame temp hack
+    // The stations carry on loading in the background, so tell the client to come back
+    serv->dontCache();
+    int written = snprintf(buf, bufSize, "{\n\"error\": \"Climate stations still "
+                                "loading.\",\n\"retryAfter\": %d\n}\n", STATION_WAIT_REFRESH);
+    return written < 0 ? bufSize : (unsigned)written;
    }
-  
-  return 0u;
+  unless(cell)
+   {
+    // Like errorPage(), keep this out of the response cache
+    serv->dontCache();
+    int written = snprintf(buf, bufSize, "{\n\"error\": \"No climate stations with "
+                                                                      "data nearby.\"\n}\n");
+    return written < 0 ? bufSize : (unsigned)written;
+   }
+  int written = synthesis->writeJson(cell, buf, bufSize);
+  synthesis->release(cell);
+  return written < 0 ? bufSize : (unsigned)written;
+}
+
+
+/// =======================================================================================
+/// @brief Output an HTML page saying we are still fetching climate station data, which
+/// will keep refreshing until the stations are in memory and the real page can be given.
+/// 
+/// The page is kept out of the response cache, since it's only good for a few seconds.
+/// @returns True if all was well writing to the buffer, false if it overflowed.
+/// @param serv A pointer to the HttpServThread managing the HTTP response.
+/// @param title The title of the page that will eventually be given.
+/// @param N The number of stations being fetched.
+/// @param lat The latitude selected.
+/// @param longt The longtitude selected.
+
+bool ClimateDatabase::stationsLoadingPage(HttpServThread* serv, const char* title, int N,
+                                                                    float lat, float longt)
+{
+  serv->dontCache();
+  unless(serv->startResponsePage(title, STATION_WAIT_REFRESH))
+    return false;
+  httPrintf("<center>Fetching climate data for %d stations near %.3f, %.3f.  This page "
+                                "will refresh until it's ready.</center>\n", N, lat, longt);
+  return serv->endResponsePage();
 }
 
 
@@ -322,34 +397,40 @@ bool ClimateDatabase::printStationDiagnosticTable(HttpServThread* serv,
                                                 float lat, float longt, unsigned yearCount)
 {
   // Find the relevant stations
-  ghcnDatabase->getStations(lat, longt, 7);
-  int N = ghcnDatabase->stationResults.size();
+  std::vector<GHCNStation*> stationResults;
+  std::vector<float>        distances;
+  std::vector<ClimateInfo*> stationInfos;
+  ghcnDatabase->getStations(lat, longt, 7, stationResults, &distances);
+  int N = stationResults.size();
+  
+  // Get them all loading in the background, and if they aren't all there in a 
+  // reasonable time, send a page that will keep refreshing till they are.
+  unless(ghcnDatabase->pipeline->waitForAll(stationResults, STATION_WAIT_MS, 
+                                                                          &stationInfos))
+    return stationsLoadingPage(serv, "Climate Station Diagnostics", N, lat, longt);
   
   // Start the HTML page and the table header
   unless(serv->startResponsePage("Climate Station Diagnostics"))
     return false;
   unless(serv->startTable((char*)"Stations"))
     return false;
-  httPrintf("<tr><th>Station id</th><th>Name</th><th>Location</th><th>Elevation</th>"
-            "<th>Size</th><th>Days</th><th>Valid Days</th></tr>\n");
+  httPrintf("<tr><th>Station id</th><th>Name</th><th>Location</th><th>Distance (km)</th>"
+            "<th>Elevation</th><th>Size</th><th>Days</th><th>Valid Days</th>"
+            "<th>Summary</th></tr>\n");
 
   // Loop over the rows
   for(int i=0; i<N; i++)
    {
-    GHCNStation* station = ghcnDatabase->stationResults[i];
-    unless(station->climate)
-     {
-      ghcnDatabase->checkOrFetchCSVFile(station);
-      ghcnDatabase->readOneCSVFile(station);
-     }
+    GHCNStation* station = stationResults[i];
+    ClimateInfo* climInfo = stationInfos[i];
     unsigned total, valid;
-    station->climate->countValidDays(total, valid);
+    climInfo->countValidDays(total, valid);
     httPrintf("<tr><td><a href=\"climateStation/%s\">%s</a></td><td>%s</td>", 
                                         station->id,  station->id, station->name);
-    httPrintf("<td>%.3f, %.3f</td><td>%.0f</td>", 
-                            station->latLong[0], station->latLong[1], station->elevation);
-    httPrintf("<td>%d</td><td>%d</td><td>%d</td></tr>\n", 
-                                                    station->fileBufSize, total, valid); 
+    httPrintf("<td>%.3f, %.3f</td><td>%.1f</td><td>%.0f</td>", station->latLong[0], 
+                              station->latLong[1], distances[i], station->elevation);
+    httPrintf("<td>%d</td><td>%d</td><td>%d</td>", station->fileBufSize, total, valid); 
+    httPrintf("<td><a href=\"stationSummary/%s\">Summary</a></td></tr>\n", station->id);
    }
   
   // Finish up the table and the page
@@ -381,10 +462,12 @@ bool ClimateDatabase::processStationDiagnosticRequest(HttpServThread* serv, char
    }
   
   GHCNStation* station = ghcnDatabase->stationsByName[std::string(stationId)];
-  unless(station->climate)
+  ClimateInfo* climInfo = ghcnDatabase->pipeline->waitFor(station, STATION_WAIT_MS);
+  unless(climInfo)
    {
     LogClimateDbErr("Station with no data for %s in processStationDiagnosticRequest.\n",
                       stationId);
+    serv->dontCache();  // it may well be there on the next try
     return serv->errorPage("No climate information for station.");
    }
   
@@ -419,7 +502,56 @@ bool ClimateDatabase::processStationDiagnosticRequest(HttpServThread* serv, char
     return false;
 
   // Main table of the climate info
-  unless(station->climate->diagnosticHTML(serv))
+  unless(climInfo->diagnosticHTML(serv))
+    return false;
+  
+  // Finish up the page
+  unless(serv->endResponsePage())
+    return false;
+
+  return true;
+}
+
+
+/// =======================================================================================
+/// @brief Output HTML tables of the yearly summaries and monthly normals for a 
+/// particular climate station.
+/// 
+/// @returns True if all was well writing to the buffer.  If false, it indicates the 
+/// buffer was not big enough and the output will have been truncated/incomplete.
+/// @param serv A pointer to the HttpServThread managing the HTTP response.
+/// @param stationId A string hopefully indicating a station ID.  At this point in 
+/// processing, it's known to be 11 characters in length, but otherwise could be hostile.
+
+bool ClimateDatabase::processStationSummaryRequest(HttpServThread* serv, char* stationId)
+{
+  // Find the station
+  unless(ghcnDatabase->stationsByName.count(stationId))
+   {
+    LogClimateDbErr("Couldn't find station for %s in processStationSummaryRequest.\n",
+                      stationId);
+    return serv->errorPage("No climate information for station.");
+   }
+  GHCNStation* station = ghcnDatabase->stationsByName[std::string(stationId)];
+  ClimateInfo* climInfo = ghcnDatabase->pipeline->waitFor(station, STATION_WAIT_MS);
+  unless(climInfo)
+   {
+    LogClimateDbErr("Station with no data for %s in processStationSummaryRequest.\n",
+                      stationId);
+    serv->dontCache();  // it may well be there on the next try
+    return serv->errorPage("No climate information for station.");
+   }
+  
+  // Start the HTML page
+  char title[128];
+  snprintf(title, 128, "Climate Summary for %s", stationId);
+  unless(serv->startResponsePage(title))
+    return false;
+  httPrintf("<center><h2>%s (Location: %.3f, %.3f; El: %.0fm)</h2></center>\n", 
+            station->name, station->latLong[0], station->latLong[1], station->elevation);
+
+  // The tables
+  unless(climInfo->summaryHTML(serv))
     return false;
   
   // Finish up the page
@@ -464,15 +596,17 @@ bool ClimateDatabase::processStationDataRequest(HttpServThread* serv, char* stat
   GHCNStation* station = ghcnDatabase->stationsByName[std::string(stationId)];
   
   // Check we actually have any data
-  unless(station->climate)
+  ClimateInfo* climInfo = ghcnDatabase->pipeline->waitFor(station, STATION_WAIT_MS);
+  unless(climInfo)
    {
     LogClimateDbErr("Station with no data for %s in processStationDataRequest.\n",
                       stationId);
+    serv->dontCache();  // it may well be there on the next try
     return serv->errorPage("No climate information for station.");
    }
     
   // Provide the data from the ClimateInfo structure
-  unless(station->climate->observableTabTable(serv, observable))
+  unless(climInfo->observableTabTable(serv, observable))
     return false;
   
   return true;
@@ -509,7 +643,7 @@ bool ClimateDatabase::stationTableHeader(HttpServThread* serv, float* latLong,
   httPrintf("</tr>");
 
   // Row of latitude offset data
-  httPrintf("<tr><td>Lat Offset (deg)</td>")
+  httPrintf("<tr><td>Lat Offset (deg)</td>");
   for(int i=0; i<N; i++)
    {
     if(skipStations[i])
@@ -519,7 +653,7 @@ bool ClimateDatabase::stationTableHeader(HttpServThread* serv, float* latLong,
   httPrintf("</tr>");
 
   // Row of longtitude offset data
-  httPrintf("<tr><td>Long. Offset (deg)</td>")
+  httPrintf("<tr><td>Long. Offset (deg)</td>");
   for(int i=0; i<N; i++)
    {
     if(skipStations[i])
@@ -529,7 +663,7 @@ bool ClimateDatabase::stationTableHeader(HttpServThread* serv, float* latLong,
   httPrintf("</tr>");
 
   // Row of Elevation Data
-  httPrintf("<tr><td>El. (m)</td>")
+  httPrintf("<tr><td>El. (m)</td>");
   for(int i=0; i<N; i++)
    {
     if(skipStations[i])
@@ -539,7 +673,7 @@ bool ClimateDatabase::stationTableHeader(HttpServThread* serv, float* latLong,
   httPrintf("</tr>");
 
   // Row of station names
-  httPrintf("<tr><td>Name</td>")
+  httPrintf("<tr><td>Name</td>");
   for(int i=0; i<N; i++)
    {
     if(skipStations[i])
@@ -561,9 +695,12 @@ bool ClimateDatabase::stationTableHeader(HttpServThread* serv, float* latLong,
 /// @param serv A pointer to the HttpServThread managing the HTTP response.
 /// @param url A string hopefully indicating the latitude, longtitude, and year.  At
 /// this point in processing, it could be hostile.
+/// @param urlStub A string pointing to the part of the URL before this function, needed
+/// for logging.
+/// @param observable Which observable to compare (HI_TEMP_VALID or LOW_TEMP_VALID).
 
 bool ClimateDatabase::processStationComparisonRequest(HttpServThread* serv, char* url,
-                                        char* urlStub, unsigned andMask, unsigned offset)
+                                                      char* urlStub, unsigned observable)
 {
   // Process the URL and extract and check parameters
   float latLong[2]; // (lat, long)
@@ -584,18 +721,30 @@ bool ClimateDatabase::processStationComparisonRequest(HttpServThread* serv, char
   int base;
   int hitsAchieved;
   std::vector<GHCNStation*> relevantStations;
+  std::vector<ClimateInfo*> infos;
   std::vector<unsigned> indices;
   std::vector<bool> skipStations;
   std::vector<std::vector<int>*> years;
   std::vector<std::vector<float>*> diffs;
   std::vector<int> yearIndices;
+  char title[128];
+  snprintf(title, 128, "Comparing temps %s for stations near %.3f, %.3f",
+                                                      urlStub, latLong[0], latLong[1]);
 
-  // Loop finding/analyzing stations till we get enough
+  // Loop finding/analyzing stations till we get enough, all within one overall wait
+  // for stations to load (after which we give a page that refreshes till they have).
+  Timeval started;
+  started.now();
   while(1)
    {
     // Find the relevant stations
-    ghcnDatabase->searchStations(latLong[0], latLong[1], relevantStations, indices, 
-                                 searchHitGoal, andMask, 0u);
+    Timeval current;
+    current.now();
+    double waitedMs = (current - started)*1000.0;
+    unless(waitedMs < STATION_WAIT_MS && ghcnDatabase->searchStations(latLong[0], 
+                              latLong[1], relevantStations, infos, indices, searchHitGoal,
+                              observable, 0, STATION_WAIT_MS - (unsigned)waitedMs))
+      return stationsLoadingPage(serv, title, searchHitGoal, latLong[0], latLong[1]);
     N = relevantStations.size();
     LogClimateCompDetails("Found %d stations after goal of %d.\n", N, searchHitGoal); 
 
@@ -607,7 +756,7 @@ bool ClimateDatabase::processStationComparisonRequest(HttpServThread* serv, char
     LogClimateCompDetails("Finding best base station in %d stations.\n", N); 
     for(int i=0; i<N; i++)
      {
-      ClimateInfo* info = relevantStations[i]->climate;
+      ClimateInfo* info = infos[i];
       unless(info->nYears)
        {
         LogClimateCompDetails("Ignoring base %d:%s as no valid years.\n", i, 
@@ -647,8 +796,8 @@ bool ClimateDatabase::processStationComparisonRequest(HttpServThread* serv, char
       diffs[i] = new std::vector<float>;
       LogClimateCompDetails("About to compare %d:%s to %d:%s.\n", base,             
                                     relevantStations[base]->id, i, relevantStations[i]->id);
-      if(relevantStations[base]->climate->diffObservable(relevantStations[i]->climate,
-                      *(years[i]), *(diffs[i]), andMask, offset)
+      ClimateInfo* baseInfo = infos[base];
+      if(baseInfo->diffObservable(infos[i], *(years[i]), *(diffs[i]), observable)
          && diffs[i]->size() > 5)
        {
         LogClimateCompDetails("Valid comparison of %d:%s to %d:%s.\n", base, 
@@ -673,6 +822,8 @@ TryAgain:
     searchHitGoal *= 1.2;
     if(relevantStations.size())
       relevantStations.clear();
+    if(infos.size())
+      infos.clear();
     if(indices.size())
       indices.clear();
     if(skipStations.size())
@@ -712,9 +863,6 @@ TryAgain:
    }
   
   // Start the HTML page
-  char title[128];
-  snprintf(title, 128, "Comparing temps %s for stations near %.3f, %.3f",
-                                                      urlStub, latLong[0], latLong[1]);
   unless(serv->startResponsePage(title))
     return false;
 
@@ -723,11 +871,11 @@ TryAgain:
     return false;
  
   // Lay out the main table of yearly rows
-  int rows = relevantStations[base]->climate->endYear - 
-                                                relevantStations[base]->climate->startYear;
+  ClimateInfo* baseInfo = infos[base];
+  int rows = baseInfo->endYear - baseInfo->startYear;
   for(int j=0; j < rows; j++)
    {
-    int thisYear = j + relevantStations[base]->climate->startYear;
+    int thisYear = j + baseInfo->startYear;
     httPrintf("<tr><td>%d</td>", thisYear);
     for(int i=0; i<N; i++)
      {
@@ -752,7 +900,7 @@ TryAgain:
    }
   
   // Row of averages
-  httPrintf("<tr><td><b>Averages</b></td>")
+  httPrintf("<tr><td><b>Averages</b></td>");
   for(int i=0; i<N; i++)
    {
     if(skipStations[i])
@@ -762,7 +910,7 @@ TryAgain:
   httPrintf("</tr>");
 
   // Finish up the table and the page
-  httPrintf("</table>")
+  httPrintf("</table>");
   unless(serv->endResponsePage())
     return false;
 
@@ -781,15 +929,12 @@ TryAgain:
 /// this point in processing, it could be hostile.
 /// @param urlStub A string pointing to the part of the URL before this function, needed
 /// for logging (because multiple urls can call this function.
-/// @param andFlagMask An unsigned mask to check which flags we are searching for in
-/// ClimateYears and ClimateDays.
-/// @param obsOffset  The offset within a ClimateDay of the float to use in populating
-/// the table.
+/// @param andFlagMask Which observable to show (eg HI_TEMP_VALID), which is also the
+/// flag we are searching for in ClimateYears and days.
 /// @param titleObsName The name of the variable for use in page title.
 
 bool ClimateDatabase::processObservationCurvesRequest(HttpServThread* serv, char* url,
-                                  char* urlStub, unsigned andFlagMask, unsigned obsOffset,
-                                  char* titleObsName)
+                                  char* urlStub, unsigned andFlagMask, char* titleObsName)
 {
   // Process the URL and extract and check parameters
   float latLongYear[3]; // (lat, long, year) 
@@ -812,18 +957,21 @@ bool ClimateDatabase::processObservationCurvesRequest(HttpServThread* serv, char
     return false;
    }
   
-  // Start the HTML page
+  // Find the relevant stations, giving a refreshing page if they aren't loaded yet
   char title[128];
   snprintf(title, 128, "Available %s Curves for %d near %.3f, %.3f",
                                       titleObsName, year, latLongYear[0], latLongYear[1]);
-  unless(serv->startResponsePage(title))
-    return false;
-
-  // Find the relevant stations
   std::vector<GHCNStation*> relevantStations;
+  std::vector<ClimateInfo*> infos;
   std::vector<unsigned> indices;
-  ghcnDatabase->searchStations(latLongYear[0], latLongYear[1], 
-                                            relevantStations, indices, andFlagMask, year);
+  int hitGoal = 20;
+  unless(ghcnDatabase->searchStations(latLongYear[0], latLongYear[1], relevantStations,
+                              infos, indices, hitGoal, andFlagMask, year, STATION_WAIT_MS))
+    return stationsLoadingPage(serv, title, hitGoal, latLongYear[0], latLongYear[1]);
+
+  // Start the HTML page
+  unless(serv->startResponsePage(title))
+    return false;
 
   // Table header
   std::vector<bool> skipStations;
@@ -834,28 +982,28 @@ bool ClimateDatabase::processObservationCurvesRequest(HttpServThread* serv, char
     return false;
   
   // Main table of the temperature info
+  int index = obsIndex(andFlagMask);
   int days = DaysInYear(year);
   for(int j=0; j<days; j++)
    {
-    httPrintf("<tr><td>%d</td>", j)
+    httPrintf("<tr><td>%d</td>", j);
     for(int s=0; s<N; s++)
      {
-      ClimateInfo* clim = relevantStations[s]->climate;
-      if(clim->climateYears[indices[s]]->climateDays[j].flags & andFlagMask)
+      ClimateYear* climYear = infos[s]->climateYears[indices[s]];
+      if(climYear->isValid(index, j))
        {
-        httPrintf("<td>%.2f</td>",
-                *((float*)((char*)(&(clim->climateYears[indices[s]]->climateDays[j])) + obsOffset)));
+        httPrintf("<td>%.2f</td>", climYear->value(index, j));
        }
       else
        {
         httPrintf("<td></td>");          
        }
      }
-    httPrintf("</tr>")    
+    httPrintf("</tr>");    
    }
   
   // Finish up the table and the page
-  httPrintf("</table>")
+  httPrintf("</table>");
   unless(serv->endResponsePage())
     return false;
 
@@ -863,4 +1011,39 @@ bool ClimateDatabase::processObservationCurvesRequest(HttpServThread* serv, char
 }
 
 
+// =======================================================================================
+/// @brief C function to handle requests routed to us by HttpRouteTable.
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv A pointer to the HttpServThread managing the HTTP response.
+/// @param url A string with the balance of the request url after "/climate/".
+/// @param context A pointer to the ClimateDatabase.
+
+bool climateRoute(HttpServThread* serv, char* url, void* context)
+{
+  LogPermaservOpDetails("Processing climate request for %s.\n", url);
+  return ((ClimateDatabase*)context)->processHttpRequest(serv, url);
+}
+
+
+// =======================================================================================
+/// @brief Add the routes for requests we handle to the route table of the server.
+/// @param routes The HttpRouteTable to add our routes to.
+
+void ClimateDatabase::registerRoutes(HttpRouteTable& routes)
+{
+  routes.addRoute("/climate/", RoutePrefix, climateRoute, this, 1u, true);
+}
+
+
+// =======================================================================================
+/// @brief Tell us about the server's response cache, so cached climate responses can 
+/// be invalidated when the GHCN files they were generated from are refreshed.
+/// @param cache The HttpResponseCache of the server.
+
+void ClimateDatabase::setResponseCache(HttpResponseCache* cache)
+{
+  ghcnDatabase->responseCache = cache;
+}
+
+
 // =======================================================================================
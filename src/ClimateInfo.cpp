@@ -6,13 +6,31 @@
 // projections within permaplan
 
 #include "ClimateInfo.h"
+#include "ClimateSummary.h"
 #include "Global.h"
 #include "HttpServThread.h"
 #include "Logging.h"
 #include <assert.h>
+#include <string.h>
 #include <gsl/gsl_sf_bessel.h>
 
 
+// =======================================================================================
+/// @brief Helper to get the bits of one word of a day bitmap that are real days of a 
+/// year (ie leaving out the leap day in a year that doesn't have one).
+/// @returns The mask of days to use in that word.
+/// @param days The number of days in the year.
+/// @param word Which word of the bitmap.
+
+static inline uint64_t dayMask(int days, int word)
+{
+  int daysInWord = days - 64*word;
+  if(daysInWord >= 64)
+    return ~0ull;
+  return (1ull << daysInWord) - 1u;
+}
+
+
 // =======================================================================================
 /// @brief Constructor
 ///
@@ -24,16 +42,91 @@ ClimateInfo::ClimateInfo(int start, int end): startYear(start),
 {
   assert(endYear > startYear);
   climateYears  = new ClimateYear*[endYear - startYear];
+  summaries     = NULL;
   nYears        = 0;
 }
 
 
 // =======================================================================================
 /// @brief Destructor
+///
+/// The ClimateYears belong to us, so go with us.
 
 ClimateInfo::~ClimateInfo(void)
 {
+  for(int i=0; i<nYears; i++)
+    delete climateYears[i];
   delete[] climateYears;
+  delete[] summaries;
+}
+
+
+// =======================================================================================
+/// @brief Work out roughly how much memory we are taking up.
+/// @returns The number of bytes used by us, our ClimateYears, and their summaries.
+
+size_t ClimateInfo::bytesUsed(void)
+{
+  size_t bytes = sizeof(ClimateInfo) + (endYear - startYear)*sizeof(ClimateYear*) 
+                                                            + nYears*sizeof(ClimateYear);
+  if(summaries)
+    bytes += nYears*sizeof(ClimateYearSummary);
+  return bytes;
+}
+
+
+// =======================================================================================
+/// @brief Work out the summary statistics for all our years.
+///
+/// Should be called once all the years have been read in, and before we are shared 
+/// with other threads.
+
+void ClimateInfo::summarize(void)
+{
+  delete[] summaries;
+  summaries = new ClimateYearSummary[nYears > 0 ? nYears : 1];
+  for(int i=0; i<nYears; i++)
+    summaries[i].compute(climateYears[i]);
+}
+
+
+// =======================================================================================
+/// @brief Work out the average value of each observable for each month over all our 
+/// years (weighted by the number of valid days in each).
+///
+/// This only takes a pass over the years' summaries.  If we haven't been summarized,
+/// temporary summaries are made (rather than our own, as we may be shared).
+/// @param normals The array to put the normals in, by month and observable index.  
+/// Those with no valid days at all are NAN.
+
+void ClimateInfo::monthlyNormals(float normals[12][OBSERVABLES])
+{
+  ClimateYearSummary* yearSums  = summaries;
+  ClimateYearSummary* tempSums  = NULL;
+  unless(yearSums)
+   {
+    yearSums = tempSums = new ClimateYearSummary[nYears > 0 ? nYears : 1];
+    for(int i=0; i<nYears; i++)
+      tempSums[i].compute(climateYears[i]);
+   }
+  
+  for(int m=0; m<12; m++)
+    for(int index=0; index<OBSERVABLES; index++)
+     {
+      double  sum   = 0.0;
+      int     count = 0;
+      for(int i=0; i<nYears; i++)
+       {
+        int days = yearSums[i].monthDays[m][index];
+        if(days)
+         {
+          sum   += (double)yearSums[i].monthMean[m][index]*days;
+          count += days;
+         }
+       }
+      normals[m][index] = count ? sum/count : NAN;
+     }
+  delete[] tempSums;
 }
 
 
@@ -44,7 +137,82 @@ ClimateInfo::~ClimateInfo(void)
 
 ClimateYear::ClimateYear(int inYear):year(inYear), flags(0u)
 {
-  bzero(climateDays, 366*sizeof(ClimateDay));
+  bzero(validDays, sizeof(validDays));
+  bzero(observations, sizeof(observations));
+}
+
+
+// =======================================================================================
+/// @brief Store an observation for one day.
+/// 
+/// @param index Which observable (LOW_TEMP_INDEX, HI_TEMP_INDEX, or PRECIP_INDEX).
+/// @param day The day of the year (0-365).
+/// @param tenths The observation in tenths of a degree C or a mm.  Values too big to 
+/// store are clamped (they will have failed range checks anyway).
+/// @param valid Whether the observation passed our checks.  A day stays valid if it 
+/// already had a valid observation.
+
+void ClimateYear::setObservation(int index, int day, int tenths, bool valid)
+{
+  if(tenths > INT16_MAX)
+    tenths = INT16_MAX;
+  else if(tenths < INT16_MIN)
+    tenths = INT16_MIN;
+  observations[index][day] = (int16_t)tenths;
+  if(valid)
+    validDays[index][day >> 6] |= 1ull << (day & 63);
+}
+
+
+// =======================================================================================
+/// @brief Count the days of the year on which some observable is valid.
+/// 
+/// @returns The number of valid days.
+/// @param index Which observable (LOW_TEMP_INDEX, HI_TEMP_INDEX, or PRECIP_INDEX).
+
+unsigned ClimateYear::countValid(int index)
+{
+  int days = DaysInYear(year);
+  unsigned count = 0u;
+  for(int w=0; w<DAY_MASK_WORDS; w++)
+    count += __builtin_popcountll(validDays[index][w] & dayMask(days, w));
+  return count;
+}
+
+
+// =======================================================================================
+/// @brief Get the validity flags for a day, in the form they would be in a ClimateDay.
+/// 
+/// @returns The flags (some combination of LOW_TEMP_VALID, HI_TEMP_VALID, PRECIP_VALID).
+/// @param day The day of the year (0-365).
+
+unsigned ClimateYear::dayFlags(int day)
+{
+  unsigned dayFlags = 0u;
+  if(isValid(LOW_TEMP_INDEX, day))
+    dayFlags |= LOW_TEMP_VALID;
+  if(isValid(HI_TEMP_INDEX, day))
+    dayFlags |= HI_TEMP_VALID;
+  if(isValid(PRECIP_INDEX, day))
+    dayFlags |= PRECIP_VALID;
+  return dayFlags;
+}
+
+
+// =======================================================================================
+/// @brief Unpack one day's data into a ClimateDay.
+/// 
+/// @returns The ClimateDay.
+/// @param day The day of the year (0-365).
+
+ClimateDay ClimateYear::getDay(int day)
+{
+  ClimateDay climDay;
+  climDay.flags   = dayFlags(day);
+  climDay.lowTemp = value(LOW_TEMP_INDEX, day);
+  climDay.hiTemp  = value(HI_TEMP_INDEX, day);
+  climDay.precip  = value(PRECIP_INDEX, day);
+  return climDay;
 }
 
 
@@ -58,20 +226,9 @@ ClimateYear::ClimateYear(int inYear):year(inYear), flags(0u)
 bool ClimateYear::assessValidity(void)
 {
   int days      = DaysInYear(year);
-  int hiTCount  = 0;
-  int loTCount  = 0;
-  int prcpCount = 0;
-  
-  for(int j=0; j<days; j++)
-   {
-    unsigned dayFlags = climateDays[j].flags;
-    if(dayFlags & LOW_TEMP_VALID)
-      loTCount++;
-    if(dayFlags & HI_TEMP_VALID)
-      hiTCount++;
-    if(dayFlags & PRECIP_VALID)
-      prcpCount++;
-   }
+  int hiTCount  = countValid(HI_TEMP_INDEX);
+  int loTCount  = countValid(LOW_TEMP_INDEX);
+  int prcpCount = countValid(PRECIP_INDEX);
   
   if(days - loTCount <= MISSING_DAYS_ALLOWED)
     flags |= LOW_TEMP_VALID;
@@ -92,13 +249,11 @@ bool ClimateYear::assessValidity(void)
 /// @param otherInfo A pointer to the other ClimateInfo to compare.
 /// @param years A vector of the years found with valid comparison
 /// @param diffs A vector of the differences matching those years.
-/// @param andFlagMask The quantity to and with the flags to determine if a given year/day
-/// is valid.
-/// @param obsOffset The offset in bytes of the observable being computed in a ClimateDay
-/// structure.
+/// @param observable Which observable to compare (one of LOW_TEMP_VALID, HI_TEMP_VALID,
+/// or PRECIP_VALID), which must also be valid for a given year/day to count.
 
 bool ClimateInfo::diffObservable(ClimateInfo* otherInfo, std::vector<int>& years,
-                      std::vector<float>& diffs, unsigned andFlagMask, unsigned obsOffset)
+                                          std::vector<float>& diffs, unsigned observable)
 {
   
   years.clear();
@@ -111,7 +266,7 @@ bool ClimateInfo::diffObservable(ClimateInfo* otherInfo, std::vector<int>& years
   for(int i=0; i<nYears; i++)
    {
     // Make sure this year is valid for us
-    unless(climateYears[i]->flags & andFlagMask)
+    unless(climateYears[i]->flags & observable)
      {
       LogClimateCompDetails("Skipping index:year %d:%d due to flag %X.\n", 
                                         i,  climateYears[i]->year, climateYears[i]->flags);
@@ -142,7 +297,7 @@ bool ClimateInfo::diffObservable(ClimateInfo* otherInfo, std::vector<int>& years
      }
       
     // Skip this year if the other side's year is not valid for our purposes
-    unless(otherInfo->climateYears[j]->flags & andFlagMask)
+    unless(otherInfo->climateYears[j]->flags & observable)
      {
       LogClimateCompDetails("Comparison for index:year %d:%d with %d:%d other not "
                   "valid: %X.\n", i,  climateYears[i]->year, j,
@@ -153,7 +308,7 @@ bool ClimateInfo::diffObservable(ClimateInfo* otherInfo, std::vector<int>& years
     //compute the difference
     float difference;
     unless(climateYears[i]->diffObservable(otherInfo->climateYears[j], difference,
-                                                                  andFlagMask, obsOffset))
+                                                                              observable))
      {
       LogClimateCompDetails("Got false comparing index:year %d:%d with %d:%d.\n", i,        
                                 climateYears[i]->year, j, otherInfo->climateYears[j]->year);
@@ -178,20 +333,22 @@ bool ClimateInfo::diffObservable(ClimateInfo* otherInfo, std::vector<int>& years
 // =======================================================================================
 /// @brief Compute the average difference in some observable of this year and another year
 ///
+/// The days valid in both years are found by anding the bitmaps a word (64 days) at a 
+/// time.  Where all 64 days are valid, as is usual, the differences are summed in a 
+/// simple loop over the packed tenths that the compiler can vectorize, and otherwise we 
+/// just visit the valid days.  Sums are exact, as they are in integer tenths.
 /// @returns true if there is enough data for a comparison, false otherwise.
 /// @param difference A reference to a float to store the average difference.
-/// @param andFlagMask The quantity to and with the flags to determine if a given year/day
-/// is valid.
-/// @param obsOffset The offset in bytes of the observable being computed in a ClimateDay
-/// structure.
+/// @param observable Which observable to compare (one of LOW_TEMP_VALID, HI_TEMP_VALID,
+/// or PRECIP_VALID), which must also be valid for a given year/day to count.
 
 bool ClimateYear::diffObservable(ClimateYear* otherYear, float& difference,
-                                                  unsigned andFlagMask, unsigned obsOffset)
+                                                                      unsigned observable)
 {
   // Go home early unless both years have enough valid data
-  unless(flags & andFlagMask)
+  unless(flags & observable)
     return false;
-  unless(otherYear->flags & andFlagMask)
+  unless(otherYear->flags & observable)
     return false;
 
   // Figure out number of days
@@ -199,26 +356,39 @@ bool ClimateYear::diffObservable(ClimateYear* otherYear, float& difference,
   int days2     = DaysInYear(otherYear->year);
   int days      = days1<days2?days1:days2;
 
-  // Main loop over the days
-  difference = 0.0f;
-  int count = 0;
-  for(int j=0; j<days; j++)
+  // Main loop over the words of the bitmaps
+  int       index   = obsIndex(observable);
+  int16_t*  ours    = observations[index];
+  int16_t*  theirs  = otherYear->observations[index];
+  long      total   = 0;
+  int       count   = 0;
+  for(int w=0; w<DAY_MASK_WORDS; w++)
    {
-    // Validity tests
-    unsigned dayFlags = climateDays[j].flags;
-    unless(dayFlags & andFlagMask)
-      continue;
-    dayFlags = otherYear->climateDays[j].flags;
-    unless(dayFlags & andFlagMask)
+    uint64_t both = validDays[index][w] & otherYear->validDays[index][w] 
+                                                                      & dayMask(days, w);
+    unless(both)
       continue;
-
-    // update the counts/totals
-    difference += *((float*)((char*)(climateDays + j) + obsOffset)) -
-                              *((float*)((char*)(otherYear->climateDays + j) + obsOffset));
-    count++;
+    count += __builtin_popcountll(both);
+    int base = 64*w;
+    if(both == ~0ull)
+     {
+      int wordTotal = 0;
+      for(int j=base; j<base+64; j++)
+        wordTotal += ours[j] - theirs[j];
+      total += wordTotal;
+     }
+    else
+     {
+      while(both)
+       {
+        int j = base + __builtin_ctzll(both);
+        total += ours[j] - theirs[j];
+        both &= both - 1u;
+       }
+     }
    }
    
-  difference /= count;
+  difference = (float)total/count/10.0f;
   return true;
 }
 
@@ -227,6 +397,8 @@ bool ClimateYear::diffObservable(ClimateYear* otherYear, float& difference,
 /// @brief Count how many days have fully valid info
 /// 
 /// This counts the number of days that have high and low temps and precipitation data.
+/// This comes from the summaries if we have them, or else by anding the validity 
+/// bitmaps of the three.
 /// @param totalDays A reference to a counter for the total days in the year range
 /// @param validDays A reference to a counter for the days with valid information
 
@@ -234,12 +406,24 @@ void ClimateInfo::countValidDays(unsigned& totalDays, unsigned& validDays)
 {
   totalDays = validDays = 0u;
   
-  forAllDays(i,j)
+  if(summaries)
+   {
+    for(int i=0; i<nYears; i++)
+     {
+      totalDays += DaysInYear(summaries[i].year);
+      validDays += summaries[i].allValidDays;
+     }
+    return;
+   }
+  for(int i=0; i<nYears; i++)
    {
-    unsigned flags = climateYears[i]->climateDays[j].flags;
-    totalDays++;
-    if((flags & ALL_OBS_VALID) == ALL_OBS_VALID)
-        validDays++;
+    ClimateYear* climYear = climateYears[i];
+    int days = DaysInYear(climYear->year);
+    totalDays += days;
+    for(int w=0; w<DAY_MASK_WORDS; w++)
+      validDays += __builtin_popcountll(climYear->validDays[LOW_TEMP_INDEX][w] 
+                        & climYear->validDays[HI_TEMP_INDEX][w] 
+                        & climYear->validDays[PRECIP_INDEX][w] & dayMask(days, w));
    }
 }
 
@@ -247,9 +431,8 @@ void ClimateInfo::countValidDays(unsigned& totalDays, unsigned& validDays)
 // =======================================================================================
 /// @brief Output JSON format of climate data to a buffer.
 /// 
-/// @returns The number of bytes written to the buffer.  If greater than or equal to 
-/// the supplied bufSize parameter, it indicates the buffer was not big enough and the
-/// output will have been truncated/incomplete.
+/// @returns The number of bytes written to the buffer, or -1 if the buffer was not big
+/// enough (in which case the output will have been truncated/incomplete).
 /// @param buf The char buffer to write the JSON to.
 /// @param bufSize The size of the buffer, which must not be overwritten after the end.
 
@@ -265,25 +448,24 @@ void ClimateInfo::countValidDays(unsigned& totalDays, unsigned& validDays)
     bufprintf("\"endYear\": %d,\n", endYear);
    bufprintf("\"nYears\": %d,\n", nYears);
 
-    // Write the arrays of climate data
-    bufprintf("[\n");
+    // Write the arrays of climate data, a year object at a time
+    bufprintf("\"years\": [\n");
     for(int i = 0; i < nYears; i++)
      {
       if(i)
         bufprintf(",\n");
-      
-      /// @todo Need to turn the year into an object
-      
-      bufprintf("[\n");
-      int days = DaysInYear(i+startYear);
+      bufprintf("{\"year\": %d,\n\"days\": [\n", climateYears[i]->year);
+      int days = DaysInYear(climateYears[i]->year);
       for(int j = 0; j < days; j++)
        {
         if(j)
           bufprintf(",\n");
-        buf += climateYears[i]->climateDays[j].writeJson(buf, bufSize - (end-buf));  
+        int written = climateYears[i]->getDay(j).writeJson(buf, end-buf);
+        if(written < 0 || (buf += written) >= end)
+          return -1;
        }
       
-      bufprintf("\n]"); // no ,\n as we don't know we are last        
+      bufprintf("\n]}"); // no ,\n as we don't know we are last        
      }
    
     bufprintf("\n]"); // no ,\n as we don't know we are last
@@ -306,14 +488,21 @@ void ClimateInfo::countValidDays(unsigned& totalDays, unsigned& validDays)
 
     bufprintf("{\n");
 
+    const char* sep = "";
     if(flags & LOW_TEMP_VALID)
-      bufprintf("\"lowTemp\": %.2f,\n", lowTemp);
+     {
+      bufprintf("\"lowTemp\": %.2f", lowTemp);
+      sep = ",\n";
+     }
     if(flags & HI_TEMP_VALID)
-      bufprintf("\"hiTemp\": %.2f,\n", hiTemp);
-   if(flags & PRECIP_VALID)
-     bufprintf("\"precip\": %.1f\n", precip); // no comma as last
+     {
+      bufprintf("%s\"hiTemp\": %.2f", sep, hiTemp);
+      sep = ",\n";
+     }
+    if(flags & PRECIP_VALID)
+      bufprintf("%s\"precip\": %.1f", sep, precip);
    
-    bufprintf("}"); // no ,\n as we don't know we are last
+    bufprintf("\n}"); // no ,\n as we don't know we are last
     return bufSize - (end-buf);
   }
 
@@ -346,13 +535,13 @@ bool ClimateInfo::diagnosticHTML(HttpServThread* serv)
     for(int i=0; i < nYears; i++)
      {
       httPrintf("<td>");
-      ClimateDay* today = climateYears[i]->climateDays + j;
-      if(today->flags & HI_TEMP_VALID)
-        httPrintf("<span style=\"color:red\">T+:%.1f</span>", today->hiTemp);
-      if(today->flags & LOW_TEMP_VALID)
-        httPrintf("<span style=\"color:green\">T-:%.1f</span>", today->lowTemp);
-      if(today->flags & PRECIP_VALID)
-        httPrintf("<span style=\"color:blue\">P:%.1f</span>", today->precip);
+      ClimateDay today = climateYears[i]->getDay(j);
+      if(today.flags & HI_TEMP_VALID)
+        httPrintf("<span style=\"color:red\">T+:%.1f</span>", today.hiTemp);
+      if(today.flags & LOW_TEMP_VALID)
+        httPrintf("<span style=\"color:green\">T-:%.1f</span>", today.lowTemp);
+      if(today.flags & PRECIP_VALID)
+        httPrintf("<span style=\"color:blue\">P:%.1f</span>", today.precip);
 
       httPrintf("</td>");
      }
@@ -367,6 +556,69 @@ bool ClimateInfo::diagnosticHTML(HttpServThread* serv)
 }
 
 
+/// =======================================================================================
+/// @brief Output HTML tables of our yearly summaries and monthly normals.
+/// 
+/// Everything comes from the summaries, so this doesn't look at the daily data at all 
+/// (unless we have never been summarized).
+/// @returns True if all was well writing to the buffer.  If false, it indicates the 
+/// buffer was not big enough and the output will have been truncated/incomplete.
+/// @param serv A pointer to the HttpServThread managing the HTTP response.
+
+bool ClimateInfo::summaryHTML(HttpServThread* serv)
+{
+  // Monthly normals
+  float normals[12][OBSERVABLES];
+  monthlyNormals(normals);
+  unless(serv->newSection("Monthly normals") && serv->startTable((char*)"Normals"))
+    return false;
+  httPrintf("<tr><th>Month</th><th>Mean low (C)</th><th>Mean high (C)</th>"
+                                                    "<th>Mean daily precip (mm)</th></tr>\n");
+  for(int m=0; m<12; m++)
+    httPrintf("<tr><td>%d</td><td>%.1f</td><td>%.1f</td><td>%.2f</td></tr>\n", m+1,
+                normals[m][LOW_TEMP_INDEX], normals[m][HI_TEMP_INDEX], 
+                normals[m][PRECIP_INDEX]);
+  httPrintf("</table></center>\n");
+
+  // Yearly summaries
+  unless(summaries)
+   {
+    httPrintf("No yearly summaries.\n");
+    return true;
+   }
+  unless(serv->newSection("Yearly summaries") && serv->startTable((char*)"Years"))
+    return false;
+  httPrintf("<tr><th>Year</th><th>Valid (low/high/precip)</th><th>Mean low (C)</th>"
+              "<th>Mean high (C)</th><th>Min low (C)</th><th>Max high (C)</th>"
+              "<th>Precip (mm)</th><th>Wettest day (mm)</th><th>Growing degree days</th>"
+              "<th>Last spring frost</th><th>First fall frost</th></tr>\n");
+  for(int i=0; i<nYears; i++)
+   {
+    ClimateYearSummary* sum = summaries + i;
+    httPrintf("<tr><td>%d</td><td>%.0f%%/%.0f%%/%.0f%%</td>", sum->year, 
+                100.0f*sum->validFraction(LOW_TEMP_INDEX), 
+                100.0f*sum->validFraction(HI_TEMP_INDEX), 
+                100.0f*sum->validFraction(PRECIP_INDEX));
+    httPrintf("<td>%.1f</td><td>%.1f</td><td>%.1f</td><td>%.1f</td>", 
+                sum->annualMean[LOW_TEMP_INDEX], sum->annualMean[HI_TEMP_INDEX],
+                sum->lowTempMin, sum->hiTempMax);
+    httPrintf("<td>%.0f</td><td>%.1f</td><td>%.0f</td>", sum->precipTotal, 
+                                                sum->precipMax, sum->growingDegreeDays);
+    if(sum->lastSpringFrost == NO_FROST_DAY)
+      httPrintf("<td>None</td>");
+    else
+      httPrintf("<td>%d</td>", sum->lastSpringFrost);
+    if(sum->firstFallFrost == NO_FROST_DAY)
+      httPrintf("<td>None</td></tr>\n");
+    else
+      httPrintf("<td>%d</td></tr>\n", sum->firstFallFrost);
+   }
+  httPrintf("</table></center>\n");
+
+  return true;  
+}
+
+
 /// =======================================================================================
 /// @brief Output one of our observables as a tab delimited array.
 /// 
@@ -388,44 +640,19 @@ bool ClimateInfo::observableTabTable(HttpServThread* serv, unsigned observable)
   httPrintf("\n");
   
   // Loop over per-day rows
+  int index = obsIndex(observable);
   for(int j=0; j < 366; j++)
    {
     httPrintf("%d", j);
     for(int i=0; i < nYears; i++)
      {
-      ClimateDay* today = climateYears[i]->climateDays + j;
-      if(observable == HI_TEMP_VALID)
+      if(climateYears[i]->isValid(index, j))
        {
-        if(today->flags & HI_TEMP_VALID)
-         {
-          httPrintf("\t%.1f", today->hiTemp);
-         }
-        else
-         {
-          httPrintf("\t ");
-         }
+        httPrintf("\t%.1f", climateYears[i]->value(index, j));
        }
-      else if(observable == LOW_TEMP_VALID)
+      else
        {
-        if(today->flags & LOW_TEMP_VALID)
-         {
-          httPrintf("\t%.1f", today->lowTemp);
-         }
-        else
-         {
-          httPrintf("\t ");
-         }
-       }        
-      else if(observable == PRECIP_VALID)
-       {
-        if(today->flags & PRECIP_VALID)
-         {
-          httPrintf("\t%.1f", today->precip);
-         }
-        else
-         {
-          httPrintf("\t ");
-         }
+        httPrintf("\t ");
        }
      }
 
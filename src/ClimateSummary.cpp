@@ -0,0 +1,113 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+// Summary statistics for a year of climate data (monthly and annual means, extremes,
+// precipitation totals, growing degree days and frost dates), worked out once when a
+// station is loaded so that they don't have to be recomputed from the days.
+
+#include "ClimateSummary.h"
+#include "Global.h"
+#include <math.h>
+
+
+// =======================================================================================
+/// @brief Work out all the summary statistics for a year.
+///
+/// Sums are accumulated in the integer tenths the year stores, so they are exact.
+/// @param climYear The ClimateYear to summarize.
+/// @todo Frost dates assume the northern hemisphere (spring frosts are before July and
+/// fall frosts after).
+
+void ClimateYearSummary::compute(ClimateYear* climYear)
+{
+  year = climYear->year;
+  int days = DaysInYear(year);
+  int* monthStart = IsLeapYear(year) ? yearDaysLeap : yearDaysNonLeap;
+
+  // Means and valid days of each observable, a month at a time
+  for(int index=0; index<OBSERVABLES; index++)
+   {
+    long  yearSum   = 0;
+    int   yearCount = 0;
+    for(int m=0; m<12; m++)
+     {
+      int monthEnd = (m < 11) ? monthStart[m+1] : days;
+      long  sum   = 0;
+      int   count = 0;
+      for(int j=monthStart[m]; j<monthEnd; j++)
+        if(climYear->isValid(index, j))
+         {
+          sum += climYear->observations[index][j];
+          count++;
+         }
+      monthDays[m][index] = count;
+      monthMean[m][index] = count ? sum/(10.0f*count) : NAN;
+      if(index == PRECIP_INDEX)
+        monthPrecip[m] = sum/10.0f;
+      yearSum   += sum;
+      yearCount += count;
+     }
+    validDays[index]  = yearCount;
+    annualMean[index] = yearCount ? yearSum/(10.0f*yearCount) : NAN;
+    if(index == PRECIP_INDEX)
+      precipTotal = yearSum/10.0f;
+   }
+
+  // Extremes, growing degree days, and frosts
+  int       hiMax       = INT16_MIN;
+  int       lowMin      = INT16_MAX;
+  int       precipBig   = INT16_MIN;
+  long      growingSum  = 0;
+  int       frostTenths = lrintf(FROST_TEMP*10.0f);
+  int       baseTenths  = lrintf(GROWING_BASE_TEMP*20.0f);  // doubled, see below
+  int16_t*  hiTemp      = climYear->observations[HI_TEMP_INDEX];
+  int16_t*  lowTemp     = climYear->observations[LOW_TEMP_INDEX];
+  int16_t*  precip      = climYear->observations[PRECIP_INDEX];
+  allValidDays    = 0u;
+  lastSpringFrost = NO_FROST_DAY;
+  firstFallFrost  = NO_FROST_DAY;
+  for(int j=0; j<days; j++)
+   {
+    bool hiValid  = climYear->isValid(HI_TEMP_INDEX, j);
+    bool lowValid = climYear->isValid(LOW_TEMP_INDEX, j);
+    bool pValid   = climYear->isValid(PRECIP_INDEX, j);
+    if(hiValid && hiTemp[j] > hiMax)
+      hiMax = hiTemp[j];
+    if(lowValid && lowTemp[j] < lowMin)
+      lowMin = lowTemp[j];
+    if(pValid && precip[j] > precipBig)
+      precipBig = precip[j];
+    if(hiValid && lowValid)
+     {
+      // The daily mean is (hi+low)/2, so compare hi+low with twice the base
+      int doubleMean = hiTemp[j] + lowTemp[j];
+      if(doubleMean > baseTenths)
+        growingSum += doubleMean - baseTenths;
+     }
+    if(lowValid && lowTemp[j] <= frostTenths)
+     {
+      if(j < monthStart[6])
+        lastSpringFrost = j;
+      else if(firstFallFrost == NO_FROST_DAY)
+        firstFallFrost = j;
+     }
+    if(hiValid && lowValid && pValid)
+      allValidDays++;
+   }
+  hiTempMax         = (hiMax == INT16_MIN) ? NAN : hiMax/10.0f;
+  lowTempMin        = (lowMin == INT16_MAX) ? NAN : lowMin/10.0f;
+  precipMax         = (precipBig == INT16_MIN) ? NAN : precipBig/10.0f;
+  growingDegreeDays = growingSum/20.0f;
+}
+
+
+// =======================================================================================
+/// @brief The fraction of the year on which some observable is valid.
+/// @returns The fraction, from 0 to 1.
+/// @param index Which observable (LOW_TEMP_INDEX, HI_TEMP_INDEX, or PRECIP_INDEX).
+
+float ClimateYearSummary::validFraction(int index)
+{
+  return (float)validDays[index]/DaysInYear(year);
+}
+
+
+// =======================================================================================
@@ -0,0 +1,593 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+// Synthesizes a gap-filled daily climate series for an arbitrary location by blending
+// the nearby GHCN stations (inverse distance weighted, with temperatures adjusted for
+// elevation), and caches the results by grid cell so nearby requests are instant.
+
+#include "ClimateSynthesis.h"
+#include "GHCNDatabase.h"
+#include "GHCNPipeline.h"
+#include "HttpServThread.h"
+#include "Global.h"
+#include "Logging.h"
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+
+// =======================================================================================
+// Layout of a cache key.  The elevation code is zero when there's no elevation.
+
+#define SYNTH_LAT_CELLS   ((int)(180.0f/SYNTH_GRID_DEGREES + 0.5f))
+#define SYNTH_LONG_CELLS  ((int)(360.0f/SYNTH_GRID_DEGREES + 0.5f))
+#define SYNTH_ELEV_BIAS   2048    // elevation codes are offset by this, 0 is reserved
+
+// Names of the observables, as in ClimateDay JSON, by index
+static const char* obsJsonNames[OBSERVABLES] = {"lowTemp", "hiTemp", "precip"};
+
+
+// =======================================================================================
+/// @brief Constructor
+/// @param ghcnDb The GHCNDatabase to get stations from.
+
+ClimateSynthesis::ClimateSynthesis(GHCNDatabase* ghcnDb): ghcnDatabase(ghcnDb),
+                                                          clock(0ul),
+                                                          hits(0ul),
+                                                          misses(0ul),
+                                                          evictions(0ul)
+{
+}
+
+
+// =======================================================================================
+/// @brief Destructor
+
+ClimateSynthesis::~ClimateSynthesis(void)
+{
+  for(auto& iter: cells)
+   {
+    delete iter.second->climate;
+    delete iter.second;
+   }
+}
+
+
+// =======================================================================================
+/// @brief Get the synthesized climate for a location, working it out if we don't
+/// already have it for that grid cell.
+///
+/// Note this will wait for any of the stations needed that aren't in memory (up to a
+/// timeout, if given), and so should be called between GHCNPipeline::beginRead() and
+/// endRead().
+/// @returns The cell, which must be given back with release() when the caller is done
+/// with it, or NULL if there are no stations with data nearby, or we gave up waiting
+/// for them.
+/// @param lat The latitude of the place in degrees.
+/// @param longT The longitude of the place in degrees.
+/// @param elevation The elevation of the place in meters, or GHCN_NO_ELEVATION if it's
+/// not known (in which case the weighted elevation of the stations is used).
+/// @param yearCount The number of years wanted (ending in the last complete year).
+/// @param timeoutMs How long to wait for stations that aren't in memory yet, in
+/// milliseconds.  Zero (the default) means to wait for as long as it takes.
+/// @param timedOut If supplied, set to whether we returned NULL because we gave up 
+/// waiting (the stations carry on loading, so it's worth asking again shortly).
+
+ClimateSynthCell* ClimateSynthesis::get(float lat, float longT, float elevation,
+                                      unsigned yearCount, unsigned timeoutMs, bool* timedOut)
+{
+  if(timedOut)
+    *timedOut = false;
+
+  // Work out the cell
+  int latCell = (int)floorf((lat + 90.0f)/SYNTH_GRID_DEGREES);
+  if(latCell < 0)
+    latCell = 0;
+  else if(latCell >= SYNTH_LAT_CELLS)
+    latCell = SYNTH_LAT_CELLS - 1;
+  int longCell = (int)floorf((longT + 180.0f)/SYNTH_GRID_DEGREES) % SYNTH_LONG_CELLS;
+  if(longCell < 0)
+    longCell += SYNTH_LONG_CELLS;
+  int elevCode = 0;
+  if(elevation != GHCN_NO_ELEVATION)
+   {
+    elevCode = lrintf(elevation/SYNTH_ELEV_STEP) + SYNTH_ELEV_BIAS;
+    if(elevCode < 1)
+      elevCode = 1;
+    else if(elevCode > 0xffff)
+      elevCode = 0xffff;
+   }
+  uint64_t key = (uint64_t)latCell | ((uint64_t)longCell << 12)
+                          | ((uint64_t)elevCode << 25) | ((uint64_t)(yearCount & 0xff) << 41);
+
+  // See if we have it already
+  lock();
+  if(cells.count(key))
+   {
+    ClimateSynthCell* cell = cells[key];
+    if(isCurrent(cell))
+     {
+      cell->refCount++;
+      cell->lastUse = ++clock;
+      hits++;
+      unlock();
+      return cell;
+     }
+    retire(cell); // made from station files that have since been refreshed
+   }
+  misses++;
+  unlock();
+
+  // Work it out (without the lock, as this may have to wait for stations)
+  ClimateSynthCell* cell  = new ClimateSynthCell;
+  cell->key         = key;
+  cell->lat         = (latCell + 0.5f)*SYNTH_GRID_DEGREES - 90.0f;
+  cell->longT       = (longCell + 0.5f)*SYNTH_GRID_DEGREES - 180.0f;
+  cell->elevation   = elevCode ? (elevCode - SYNTH_ELEV_BIAS)*SYNTH_ELEV_STEP
+                                                                  : GHCN_NO_ELEVATION;
+  cell->yearCount   = yearCount;
+  cell->climate     = NULL;
+  cell->refCount    = 1u;
+  cell->retired     = false;
+  unless(synthesize(cell, timeoutMs, timedOut))
+   {
+    delete cell;
+    return NULL;
+   }
+  LogClimateDbOps("Synthesized climate for [%.3f, %.3f] from %lu stations.\n",
+                                            cell->lat, cell->longT, cell->sources.size());
+
+  // Put it in the cache, unless someone else beat us to it
+  lock();
+  cell->lastUse = ++clock;
+  if(cells.count(key) && isCurrent(cells[key]))
+   {
+    ClimateSynthCell* theirs = cells[key];
+    theirs->refCount++;
+    theirs->lastUse = clock;
+    unlock();
+    delete cell->climate;
+    delete cell;
+    return theirs;
+   }
+  if(cells.count(key))
+    retire(cells[key]);
+  evictIfFull();
+  cells[key] = cell;
+  unlock();
+  return cell;
+}
+
+
+// =======================================================================================
+/// @brief Check whether a cell is still good, ie none of the station files it was made
+/// from have been replaced since.
+/// @returns True if the cell can still be used, false if it should be made again.
+/// @param cell The cell.
+
+bool ClimateSynthesis::isCurrent(ClimateSynthCell* cell)
+{
+  for(unsigned s=0; s<cell->sources.size(); s++)
+    if(cell->sources[s].station->fileVersion.load() != cell->sources[s].fileVersion)
+      return false;
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Give back a cell obtained from get().
+/// @param cell The cell.
+
+void ClimateSynthesis::release(ClimateSynthCell* cell)
+{
+  lock();
+  bool freeIt = (--cell->refCount == 0u) && cell->retired;
+  unlock();
+  if(freeIt)
+   {
+    delete cell->climate;
+    delete cell;
+   }
+}
+
+
+// =======================================================================================
+/// @brief Take a cell out of the cache, freeing it now if no-one is using it, or else
+/// leaving it for the last release().  Must be called with the lock held.
+/// @param cell The cell.
+
+void ClimateSynthesis::retire(ClimateSynthCell* cell)
+{
+  cells.erase(cell->key);
+  if(cell->refCount)
+    cell->retired = true;
+  else
+   {
+    delete cell->climate;
+    delete cell;
+   }
+}
+
+
+// =======================================================================================
+/// @brief Make room for one more cell by evicting the least recently used, if we are
+/// full.  Must be called with the lock held.
+
+void ClimateSynthesis::evictIfFull(void)
+{
+  unless(cells.size() >= SYNTH_CACHE_CELLS)
+    return;
+  ClimateSynthCell* oldest = NULL;
+  for(auto& iter: cells)
+    if(!oldest || iter.second->lastUse < oldest->lastUse)
+      oldest = iter.second;
+  retire(oldest);
+  evictions++;
+}
+
+
+// =======================================================================================
+/// @brief Check whether a station has any data for an observable.
+/// @returns True if some year has the observable, false otherwise.
+/// @param info The ClimateInfo of the station (which may be NULL).
+/// @param flag The observable (eg HI_TEMP_VALID).
+
+bool ClimateSynthesis::stationHasObservable(ClimateInfo* info, unsigned flag)
+{
+  unless(info)
+    return false;
+  for(int i = 0; i < info->nYears; i++)
+    if(info->climateYears[i]->flags & flag)
+      return true;
+  return false;
+}
+
+
+// =======================================================================================
+/// @brief Blend the nearby stations into a climate series for a cell.
+///
+/// First the search for stations is widened until there are SYNTH_STATIONS with data
+/// for each observable (or we reach SYNTH_MAX_STATIONS).  The weights, which are per 
+/// observable, and elevation adjustments are then worked out once per station.  Then, for
+/// each year, the stations' valid observations are accumulated into per-day weighted
+/// sums a station at a time, and each day of the result is the weighted mean of the
+/// stations valid that day, or failing any, the blended normal for the month.
+/// @returns True if all went well, false if there was no station data to use, or we
+/// gave up waiting for it.
+/// @param cell The cell, with the location, elevation, and year count filled in.
+/// @param timeoutMs How long to wait for the stations, or zero to wait indefinitely.
+/// @param timedOut If not NULL, set to true if we gave up waiting for the stations.
+
+bool ClimateSynthesis::synthesize(ClimateSynthCell* cell, unsigned timeoutMs, 
+                                                                          bool* timedOut)
+{
+  // Get the nearest stations, preferring those at a similar elevation, and wait for 
+  // them, searching wider until enough have each observable.  The whole search has to
+  // fit in the one timeout.
+  std::vector<GHCNStation*> stations;
+  std::vector<float>        distances;
+  std::vector<ClimateInfo*> infos;
+  Timeval started;
+  started.now();
+  for(int hitGoal = SYNTH_STATIONS; ; hitGoal *= 2)
+   {
+    unsigned waitMs = 0u;
+    if(timeoutMs)
+     {
+      Timeval current;
+      current.now();
+      double waitedMs = (current - started)*1000.0;
+      waitMs = waitedMs < timeoutMs ? timeoutMs - (unsigned)waitedMs : 0u;
+     }
+    ghcnDatabase->getStations(cell->lat, cell->longT, hitGoal, stations, &distances,
+                                                        cell->elevation, SYNTH_ELEV_WEIGHT);
+    unless((waitMs || !timeoutMs) 
+                            && ghcnDatabase->pipeline->waitForAll(stations, waitMs, &infos))
+     {
+      LogClimateDbOps("Timed out waiting for %d stations for [%.3f, %.3f].\n",
+                                                          hitGoal, cell->lat, cell->longT);
+      if(timedOut)
+        *timedOut = true;
+      return false;
+     }
+    
+    int fewest = SYNTH_STATIONS;
+    for(int index=0; index<OBSERVABLES; index++)
+     {
+      int count = 0;
+      for(unsigned s=0; s<stations.size(); s++)
+        if(stationHasObservable(infos[s], 1u << index))
+          count++;
+      if(count < fewest)
+        fewest = count;
+     }
+    if(fewest >= SYNTH_STATIONS || hitGoal >= SYNTH_MAX_STATIONS 
+                                                        || (int)stations.size() < hitGoal)
+      break;
+    LogClimateDbOps("Only %d of %d stations have some observable for [%.3f, %.3f], "
+                  "searching wider.\n", fewest, hitGoal, cell->lat, cell->longT);
+   }
+
+  // Each observable gets inverse distance squared weights for the nearest SYNTH_STATIONS
+  // stations that have it.  Keep just the stations that are used for something.
+  std::vector<ClimateInfo*> useInfos;
+  std::vector<float>        weights[OBSERVABLES];
+  std::vector<float>        elevations;
+  float totalWeight[OBSERVABLES];
+  int   taken[OBSERVABLES];
+  for(int index=0; index<OBSERVABLES; index++)
+   {
+    totalWeight[index]  = 0.0f;
+    taken[index]        = 0;
+   }
+  cell->obsFlags = 0u;
+  for(unsigned s=0; s<stations.size(); s++)
+   {
+    float km = distances[s] > SYNTH_MIN_KM ? distances[s] : SYNTH_MIN_KM;
+    ClimateSynthSource source;
+    bool used = false;
+    for(int index=0; index<OBSERVABLES; index++)
+     {
+      source.weights[index] = 0.0f;
+      unless(taken[index] < SYNTH_STATIONS && stationHasObservable(infos[s], 1u << index))
+        continue;
+      source.weights[index] = 1.0f/(km*km);
+      totalWeight[index] += source.weights[index];
+      taken[index]++;
+      cell->obsFlags |= 1u << index;
+      used = true;
+     }
+    unless(used)
+      continue;
+    useInfos.push_back(infos[s]);
+    for(int index=0; index<OBSERVABLES; index++)
+      weights[index].push_back(source.weights[index]);
+    elevations.push_back(stations[s]->elevation);
+    strcpy(source.id, stations[s]->id);
+    source.station      = stations[s];
+    source.fileVersion  = stations[s]->fileVersion.load();  // the data we just waited for
+    source.distance     = distances[s];
+    cell->sources.push_back(source);
+   }
+  int N = useInfos.size();
+  unless(N)
+   {
+    LogClimateDbErr("No station data to synthesize climate for [%.3f, %.3f].\n",
+                                                                    cell->lat, cell->longT);
+    return false;
+   }
+  for(int index=0; index<OBSERVABLES; index++)
+   {
+    unless(cell->obsFlags & (1u << index))
+     {
+      LogClimateDbOps("No %s data within %lu stations of [%.3f, %.3f].\n", 
+                        obsJsonNames[index], stations.size(), cell->lat, cell->longT);
+      continue;
+     }
+    for(int s=0; s<N; s++)
+     {
+      weights[index][s] /= totalWeight[index];
+      cell->sources[s].weights[index] = weights[index][s];
+     }
+   }
+
+  // The elevation we adjust to (by default that of the temperature stations), and each
+  // station's adjustment in tenths of a degree
+  float elevation = cell->elevation;
+  if(elevation == GHCN_NO_ELEVATION)
+   {
+    float elevSum = 0.0f;
+    float elevWeight = 0.0f;
+    for(int s=0; s<N; s++)
+      if(elevations[s] != GHCN_NO_ELEVATION)
+       {
+        float weight = weights[LOW_TEMP_INDEX][s] + weights[HI_TEMP_INDEX][s];
+        elevSum     += weight*elevations[s];
+        elevWeight  += weight;
+       }
+    if(elevWeight > 0.0f)
+      elevation = elevSum/elevWeight;
+   }
+  std::vector<float> lapseTenths(N, 0.0f);
+  if(elevation != GHCN_NO_ELEVATION)
+    for(int s=0; s<N; s++)
+      if(elevations[s] != GHCN_NO_ELEVATION)
+        lapseTenths[s] = 10.0f*SYNTH_LAPSE_RATE*(elevations[s] - elevation)/1000.0f;
+
+  // Blended monthly normals, for days that no station has
+  float normals[12][OBSERVABLES];
+  float normalWeights[12][OBSERVABLES];
+  bzero(normals, sizeof(normals));
+  bzero(normalWeights, sizeof(normalWeights));
+  for(int s=0; s<N; s++)
+   {
+    float stationNormals[12][OBSERVABLES];
+    useInfos[s]->monthlyNormals(stationNormals);
+    for(int m=0; m<12; m++)
+      for(int index=0; index<OBSERVABLES; index++)
+       {
+        if(isnan(stationNormals[m][index]) || weights[index][s] == 0.0f)
+          continue;
+        float adjust = (index == PRECIP_INDEX) ? 0.0f : lapseTenths[s]/10.0f;
+        normals[m][index]       += weights[index][s]*(stationNormals[m][index] + adjust);
+        normalWeights[m][index] += weights[index][s];
+       }
+   }
+  for(int m=0; m<12; m++)
+    for(int index=0; index<OBSERVABLES; index++)
+      normals[m][index] = normalWeights[m][index] > 0.0f ?
+                                  10.0f*normals[m][index]/normalWeights[m][index] : NAN;
+
+  // The years to do: yearCount of them, ending with the last complete year we have
+  time_t now = time(NULL);
+  struct tm nowTm;
+  localtime_r(&now, &nowTm);
+  int lastYear = 0;
+  for(int s=0; s<N; s++)
+   {
+    int stationLast = useInfos[s]->climateYears[useInfos[s]->nYears - 1]->year;
+    if(stationLast > lastYear)
+      lastYear = stationLast;
+   }
+  if(lastYear > nowTm.tm_year + 1900 - 1)
+    lastYear = nowTm.tm_year + 1900 - 1;
+  int yearCount = cell->yearCount ? cell->yearCount : 1;
+  ClimateInfo* climate = new ClimateInfo(lastYear - yearCount + 1, lastYear + 1);
+  cell->climate = climate;
+
+  // Now blend the years.  Stations' years are in order, so keep a place in each.
+  std::vector<int> yearIndex(N, 0);
+  float weightSum[OBSERVABLES][366];
+  float valueSum[OBSERVABLES][366];
+  for(int year=climate->startYear; year<climate->endYear; year++)
+   {
+    bzero(weightSum, sizeof(weightSum));
+    bzero(valueSum, sizeof(valueSum));
+    bool anyStation = false;
+    for(int s=0; s<N; s++)
+     {
+      ClimateInfo* info = useInfos[s];
+      while(yearIndex[s] < info->nYears && info->climateYears[yearIndex[s]]->year < year)
+        yearIndex[s]++;
+      unless(yearIndex[s] < info->nYears && info->climateYears[yearIndex[s]]->year == year)
+        continue;
+      anyStation = true;
+      ClimateYear* stationYear = info->climateYears[yearIndex[s]];
+      for(int index=0; index<OBSERVABLES; index++)
+       {
+        float    weight = weights[index][s];
+        unless(weight > 0.0f)
+          continue;
+        float    adjust = (index == PRECIP_INDEX) ? 0.0f : lapseTenths[s];
+        int16_t* obs    = stationYear->observations[index];
+        float*   wSum   = weightSum[index];
+        float*   vSum   = valueSum[index];
+        for(int word=0; word<DAY_MASK_WORDS; word++)
+         {
+          uint64_t bits = stationYear->validDays[index][word];
+          unless(bits)
+            continue;
+          int base  = 64*word;
+          int n     = (366 - base < 64) ? 366 - base : 64;
+          for(int b=0; b<n; b++)
+           {
+            float w = weight*(float)((bits >> b) & 1u);
+            wSum[base + b] += w;
+            vSum[base + b] += w*(obs[base + b] + adjust);
+           }
+         }
+       }
+     }
+    unless(anyStation)
+      continue;  // no data at all for this year, so leave it out
+
+    ClimateYear* climYear = new ClimateYear(year);
+    int  days       = DaysInYear(year);
+    int* monthStart = IsLeapYear(year) ? yearDaysLeap : yearDaysNonLeap;
+    int  m          = 0;
+    for(int j=0; j<days; j++)
+     {
+      while(m < 11 && j >= monthStart[m+1])
+        m++;
+      for(int index=0; index<OBSERVABLES; index++)
+       {
+        float tenths;
+        if(weightSum[index][j] > 0.0f)
+          tenths = valueSum[index][j]/weightSum[index][j];
+        else if(!isnan(normals[m][index]))
+          tenths = normals[m][index];
+        else
+          continue;
+        climYear->setObservation(index, j, lrintf(tenths), true);
+       }
+
+      // Mixing different stations (or normals) could leave the low above the high
+      int16_t& low  = climYear->observations[LOW_TEMP_INDEX][j];
+      int16_t& hi   = climYear->observations[HI_TEMP_INDEX][j];
+      if(climYear->isValid(LOW_TEMP_INDEX, j) && climYear->isValid(HI_TEMP_INDEX, j)
+                                                                              && low > hi)
+        low = hi = (low + hi)/2;
+     }
+    climYear->assessValidity();
+    climate->climateYears[climate->nYears++] = climYear;
+   }
+  climate->summarize();
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Output JSON for a synthesized climate to a buffer.
+///
+/// This gives the location and elevation of the cell, the stations used and their
+/// weights for each observable, the observables we had no station data for (which the
+/// days will never have), and then the climate series itself as a ClimateInfo object.
+/// @returns The number of bytes written to the buffer, or -1 if the buffer was not big
+/// enough.
+/// @param cell The cell (as obtained from get()).
+/// @param buf The char buffer to write the JSON to.
+/// @param bufSize The size of the buffer, which must not be overwritten after the end.
+
+int ClimateSynthesis::writeJson(ClimateSynthCell* cell, char* buf, unsigned bufSize)
+{
+  char* end = buf + bufSize;
+
+  bufprintf("{\n\"latitude\": %.3f,\n\"longitude\": %.3f,\n", cell->lat, cell->longT);
+  if(cell->elevation != GHCN_NO_ELEVATION)
+    bufprintf("\"elevation\": %.0f,\n", cell->elevation);
+  bufprintf("\"gridDegrees\": %.3f,\n", SYNTH_GRID_DEGREES);
+  bufprintf("\"stations\": [\n");
+  for(unsigned s=0; s<cell->sources.size(); s++)
+   {
+    ClimateSynthSource& source = cell->sources[s];
+    bufprintf("{\"id\": \"%s\", \"distance\": %.1f, \"weights\": {", source.id,
+                                                                          source.distance);
+    for(int index=0; index<OBSERVABLES; index++)
+      bufprintf("%s\"%s\": %.4f", index ? ", " : "", obsJsonNames[index], 
+                                                                  source.weights[index]);
+    bufprintf("}}%s\n", s + 1 < cell->sources.size() ? "," : "");
+   }
+  bufprintf("],\n\"unavailable\": [");
+  const char* sep = "";
+  for(int index=0; index<OBSERVABLES; index++)
+    unless(cell->obsFlags & (1u << index))
+     {
+      bufprintf("%s\"%s\"", sep, obsJsonNames[index]);
+      sep = ", ";
+     }
+  bufprintf("],\n\"climate\": {\n");
+  int written = cell->climate->writeJsonFields(buf, end - buf);
+  if(written < 0)
+    return -1;
+  buf += written;
+  bufprintf("\n}\n}\n");
+  return bufSize - (end - buf);
+}
+
+
+// =======================================================================================
+/// @brief Output HTML table of the state of the synthesis cache.
+///
+/// @returns True if all was well writing to the buffer.  If false, it indicates the
+/// buffer was not big enough and the output will have been truncated/incomplete.
+/// @param serv A pointer to the HttpServThread managing the HTTP response.
+
+bool ClimateSynthesis::diagnosticHTML(HttpServThread* serv)
+{
+  lock();
+  unsigned      nCells  = cells.size();
+  unsigned long nHits   = hits;
+  unsigned long nMisses = misses;
+  unsigned long nEvicts = evictions;
+  unlock();
+
+  httPrintf("<br><b>Climate synthesis</b> (cells of %.2f degrees)\n", SYNTH_GRID_DEGREES);
+  unless(serv->startTable())
+    return false;
+  httPrintf("<tr><th>Cached cells</th><th>Hits</th><th>Misses</th><th>Evictions</th>"
+                                                                                "</tr>\n");
+  httPrintf("<tr><td>%u</td><td>%lu</td><td>%lu</td><td>%lu</td></tr>\n</table>\n",
+                                                        nCells, nHits, nMisses, nEvicts);
+  return true;
+}
+
+
+// =======================================================================================
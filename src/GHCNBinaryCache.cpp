@@ -0,0 +1,255 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+// Compact binary columnar cache of parsed GHCN station data.  Once a station's .csv.gz
+// file has been parsed, the result is written out here so that later loads can just
+// map it into memory and copy the columns into the ClimateInfo's years.
+
+#include "GHCNBinaryCache.h"
+#include "GHCNDatabase.h"
+#include "ClimateInfo.h"
+#include "Logging.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+
+
+// =======================================================================================
+// Helper function for the file layout
+
+/// @brief Size of a cache file with a given number of years.
+
+static size_t cacheFileSize(int nYears)
+{
+  size_t slots = (size_t)nYears*366;
+  return sizeof(GHCNCacheHeader) + (size_t)nYears*(sizeof(int32_t) + sizeof(uint32_t))
+                                + slots*(3*sizeof(int16_t) + sizeof(uint8_t));
+}
+
+
+// =======================================================================================
+/// @brief Constructor
+/// @param path The directory in which the GHCN station files (and so our cache files)
+/// live.
+
+GHCNBinaryCache::GHCNBinaryCache(char* path): hits(0u),
+                                              misses(0u),
+                                              writes(0u),
+                                              dbPath(path)
+{
+}
+
+
+// =======================================================================================
+/// @brief Destructor
+
+GHCNBinaryCache::~GHCNBinaryCache(void)
+{
+}
+
+
+// =======================================================================================
+/// @brief Work out the names of a station's cache file and the .csv.gz it comes from.
+/// @returns True if all is well, false if we couldn't fit the names in the space.
+/// @param station The station concerned.
+/// @param cacheName Buffer for the name of the cache file.
+/// @param csvName Buffer for the name of the .csv.gz file.
+/// @param len The size of each buffer.
+
+bool GHCNBinaryCache::snprintFileNames(GHCNStation* station, char* cacheName,
+                                                                  char* csvName, int len)
+{
+  if(snprintf(cacheName, len, "%s/%s%s", dbPath, station->id, GHCN_CACHE_SUFFIX) >= len
+      || snprintf(csvName, len, "%s/%s.csv.gz", dbPath, station->id) >= len)
+   {
+    LogClimateDbErr("Overflow in cache filename for %s in"
+                                    " GHCNBinaryCache::snprintFileNames.\n", station->id);
+    return false;
+   }
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Try to build a station's ClimateInfo from its binary cache file.
+///
+/// The file is memory-mapped and checked against the .csv.gz file it was made from
+/// before being used.
+/// @returns True if the ClimateInfo was filled in from the cache, false if the cache
+/// was missing or out of date (in which case climInfo is untouched).
+/// @param station The station being loaded.
+/// @param climInfo The (new, empty) ClimateInfo to fill in.
+
+bool GHCNBinaryCache::read(GHCNStation* station, ClimateInfo* climInfo)
+{
+  char cacheName[128];
+  char csvName[128];
+  unless(snprintFileNames(station, cacheName, csvName, 128))
+    return false;
+
+  struct stat csvStat;
+  if(stat(csvName, &csvStat))
+   {
+    misses++;
+    return false;
+   }
+  int fd = open(cacheName, O_RDONLY);
+  if(fd < 0)
+   {
+    misses++;
+    return false;
+   }
+  struct stat cacheStat;
+  if(fstat(fd, &cacheStat) || cacheStat.st_size < (off_t)sizeof(GHCNCacheHeader))
+   {
+    close(fd);
+    misses++;
+    return false;
+   }
+  size_t size = cacheStat.st_size;
+  void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED)
+   {
+    LogClimateDbErr("Couldn't map station cache file %s.\n", cacheName);
+    misses++;
+    return false;
+   }
+
+  // Check it's the cache we want
+  GHCNCacheHeader* header = (GHCNCacheHeader*)map;
+  int nYears = header->nYears;
+  unless(memcmp(header->magic, GHCN_CACHE_MAGIC, 4) == 0
+          && header->version == GHCN_CACHE_VERSION
+          && header->startYear == climInfo->startYear
+          && header->endYear == climInfo->endYear
+          && nYears >= 0 && nYears <= climInfo->endYear - climInfo->startYear
+          && size == cacheFileSize(nYears)
+          && header->csvModTime == (int64_t)csvStat.st_mtime
+          && header->csvSize == (int64_t)csvStat.st_size)
+   {
+    LogClimateDbOps("Station cache file %s is stale or mismatched.\n", cacheName);
+    munmap(map, size);
+    misses++;
+    return false;
+   }
+
+  // Find the columns
+  size_t    slots     = (size_t)nYears*366;
+  int32_t*  years     = (int32_t*)(header + 1);
+  uint32_t* yearFlags = (uint32_t*)(years + nYears);
+  int16_t*  hiTemp    = (int16_t*)(yearFlags + nYears);
+  int16_t*  lowTemp   = hiTemp + slots;
+  int16_t*  precip    = lowTemp + slots;
+  uint8_t*  dayFlags  = (uint8_t*)(precip + slots);
+
+  // Build the years
+  for(int i=0; i<nYears; i++)
+   {
+    ClimateYear* climYear = new ClimateYear(years[i]);
+    climYear->flags = yearFlags[i];
+    size_t base = (size_t)i*366;
+    memcpy(climYear->observations[HI_TEMP_INDEX], hiTemp + base, 366*sizeof(int16_t));
+    memcpy(climYear->observations[LOW_TEMP_INDEX], lowTemp + base, 366*sizeof(int16_t));
+    memcpy(climYear->observations[PRECIP_INDEX], precip + base, 366*sizeof(int16_t));
+    for(int j=0; j<366; j++)
+     {
+      uint64_t bit = 1ull << (j & 63);
+      unsigned flags = dayFlags[base + j];
+      if(flags & LOW_TEMP_VALID)
+        climYear->validDays[LOW_TEMP_INDEX][j >> 6] |= bit;
+      if(flags & HI_TEMP_VALID)
+        climYear->validDays[HI_TEMP_INDEX][j >> 6] |= bit;
+      if(flags & PRECIP_VALID)
+        climYear->validDays[PRECIP_INDEX][j >> 6] |= bit;
+     }
+    climInfo->climateYears[climInfo->nYears++] = climYear;
+   }
+  munmap(map, size);
+  hits++;
+  LogClimateDbOps("Read %d years for station %s from cache.\n", nYears, station->id);
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Write out the binary cache file for a station that's just been parsed.
+///
+/// The file is written under a temporary name and then renamed into place, so a reader
+/// never sees a partial file.
+/// @returns True if the cache was written, false if something went wrong.
+/// @param station The station just loaded.
+/// @param climInfo Its freshly parsed ClimateInfo.
+
+bool GHCNBinaryCache::write(GHCNStation* station, ClimateInfo* climInfo)
+{
+  char cacheName[128];
+  char csvName[128];
+  unless(snprintFileNames(station, cacheName, csvName, 128))
+    return false;
+  struct stat csvStat;
+  if(stat(csvName, &csvStat))
+    return false;
+
+  // Lay the whole thing out in memory
+  int nYears  = climInfo->nYears;
+  size_t size = cacheFileSize(nYears);
+  char* buf   = new char[size];
+  GHCNCacheHeader* header = (GHCNCacheHeader*)buf;
+  memset(header, 0, sizeof(GHCNCacheHeader));
+  memcpy(header->magic, GHCN_CACHE_MAGIC, 4);
+  header->version     = GHCN_CACHE_VERSION;
+  header->startYear   = climInfo->startYear;
+  header->endYear     = climInfo->endYear;
+  header->nYears      = nYears;
+  header->csvModTime  = csvStat.st_mtime;
+  header->csvSize     = csvStat.st_size;
+
+  size_t    slots     = (size_t)nYears*366;
+  int32_t*  years     = (int32_t*)(header + 1);
+  uint32_t* yearFlags = (uint32_t*)(years + nYears);
+  int16_t*  hiTemp    = (int16_t*)(yearFlags + nYears);
+  int16_t*  lowTemp   = hiTemp + slots;
+  int16_t*  precip    = lowTemp + slots;
+  uint8_t*  dayFlags  = (uint8_t*)(precip + slots);
+  for(int i=0; i<nYears; i++)
+   {
+    ClimateYear* climYear = climInfo->climateYears[i];
+    years[i]      = climYear->year;
+    yearFlags[i]  = climYear->flags;
+    size_t base   = (size_t)i*366;
+    memcpy(hiTemp + base, climYear->observations[HI_TEMP_INDEX], 366*sizeof(int16_t));
+    memcpy(lowTemp + base, climYear->observations[LOW_TEMP_INDEX], 366*sizeof(int16_t));
+    memcpy(precip + base, climYear->observations[PRECIP_INDEX], 366*sizeof(int16_t));
+    for(int j=0; j<366; j++)
+      dayFlags[base + j]  = (uint8_t)climYear->dayFlags(j);
+   }
+
+  // Write it and swap it into place
+  char tmpName[140];
+  snprintf(tmpName, 140, "%s.tmp", cacheName);
+  FILE* file = fopen(tmpName, "w");
+  unless(file)
+   {
+    LogClimateDbErr("Couldn't open station cache file %s for writing.\n", tmpName);
+    delete[] buf;
+    return false;
+   }
+  bool ok = (fwrite(buf, 1, size, file) == size);
+  if(fclose(file))
+    ok = false;
+  delete[] buf;
+  unless(ok && rename(tmpName, cacheName) == 0)
+   {
+    LogClimateDbErr("Couldn't write station cache file %s.\n", cacheName);
+    unlink(tmpName);
+    return false;
+   }
+  writes++;
+  LogClimateDbOps("Wrote %d years for station %s to cache.\n", nYears, station->id);
+  return true;
+}
+
+
+// =======================================================================================
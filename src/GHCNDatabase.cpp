@@ -9,9 +9,17 @@
 #include "ClimateInfo.h"
 #include "Logging.h"
 #include "loadFileToBuf.h"
+#include "HttpResponseCache.h"
+#include "GHCNPipeline.h"
+#include "GHCNBinaryCache.h"
+#include "Timeval.h"
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <err.h>
 #include <regex>
 #include <zlib.h>
 
@@ -25,10 +33,14 @@ char byStationUrl[] = "https://www.ncei.noaa.gov/pub/data/ghcn/daily/by_station/
 // =======================================================================================
 /// @brief Constructor
 
-GHCNDatabase::GHCNDatabase(char* path): dbPath(path), readYear(NULL)
+GHCNDatabase::GHCNDatabase(char* path): loadAllSpacing(-1.0f),
+                                        dbPath(path),
+                                        responseCache(NULL)
 {
+  binaryCache = new GHCNBinaryCache(path);
   readStations();
   checkFileIndex();
+  pipeline = new GHCNPipeline(this); // must be after our own use of the curl handle
 }
 
 
@@ -37,6 +49,8 @@ GHCNDatabase::GHCNDatabase(char* path): dbPath(path), readYear(NULL)
 
 GHCNDatabase::~GHCNDatabase(void)
 {
+  delete pipeline;
+  delete binaryCache;
 }
 
 
@@ -51,13 +65,19 @@ GHCNDatabase::~GHCNDatabase(void)
 /// @param pause An optional float parameter of a number of seconds to wait after the 
 /// download (if any) to provide basic rate limiting.  A negative value, or a not-supplied
 /// value, will result in no pause.
+/// @param replaced If not NULL, set to whether an existing (stale) copy of the file was
+/// replaced by a fresh download, as opposed to the file being left alone or fetched for
+/// the first time.  Only in the first case can anything derived from it be out of date.
 /// @todo This should probably be consolidated into the ResourceManager and done on a 
 /// queue.
 /// @todo This should download to a temporary filename and then swap only when the download
 /// is done.
 
-bool GHCNDatabase::checkUpdateFile(char* fileName, char* url, float maxAge, float pause)
+bool GHCNDatabase::checkUpdateFile(char* fileName, char* url, float maxAge, float pause,
+                                                                            bool* replaced)
 {
+  if(replaced)
+    *replaced = false;
   float fileAge = getFileAge(fileName);
   if(fileAge < -0.0f || fileAge > maxAge)
    {
@@ -67,6 +87,8 @@ bool GHCNDatabase::checkUpdateFile(char* fileName, char* url, float maxAge, floa
      {
       LogClimateDbOps("Refreshed file %s after %.2f days\n", 
                                                         fileName, fileAge/24.0f/3600.0f);
+      if(replaced && fileAge >= 0.0f)
+        *replaced = true;
      }
     else
      {
@@ -332,8 +354,8 @@ void GHCNDatabase::readStations(void)
       return;
      }
     
-    // Store the GHCNStation in our R-tree data structure
-    stationTree.Insert(station->latLong, station->latLong, station);
+    // Store the GHCNStation in our spatial index
+    stationIndex.add(station);
     
     // Store it also in the index by name
     stationsByName.insert({std::string(station->id), station});
@@ -341,6 +363,8 @@ void GHCNDatabase::readStations(void)
   
   // Close up and go home
   fclose(stationFile);
+  stationIndex.build();
+  LogClimateDbOps("Indexed %u stations.\n", stationIndex.size());
 }
 
 
@@ -348,73 +372,81 @@ void GHCNDatabase::readStations(void)
 /// @brief Function to load all datafiles into memory (called on startup), fetching
 /// them if necessary.  
 /// 
-/// This shouldn't usually be done, but is the guts of the -c option to permaserv.
+/// This shouldn't usually be done, but is the guts of the -C option to permaserv.  All
+/// the stations are put through our GHCNPipeline, so downloads happen one at a time
+/// (and are rate limited), while decompression and parsing run on all cores.  With a
+/// memory budget, not all of them will stay in memory, but they will all end up in
+/// the binary cache.
 /// @param spacing.  A float value for how many seconds to pause between each file (to
 /// rate limit our impact on the GHCN website).
 
 void GHCNDatabase::loadAll(float spacing)
 {
+  std::vector<GHCNStation*> allStations;
+  allStations.reserve(stationsByName.size());
   for (auto iter : stationsByName)
-   {
-    LogClimateDbOps("Checking file index %s.\n", iter.first.c_str());
-    GHCNStation* station = iter.second;
-    unless(station->climate)
-     {
-      checkOrFetchCSVFile(station, spacing);
-      readOneCSVFile(station);
-     }
-   }
+    allStations.push_back(iter.second);
+  LogClimateDbOps("Loading all %lu stations.\n", allStations.size());
+  
+  pipeline->setFetchSpacing(spacing);
+  pipeline->startBulkLoad(allStations.size());
+  for(unsigned i=0; i<allStations.size(); i++)
+    pipeline->request(allStations[i]);
+  pipeline->waitForIdle();
+  pipeline->endBulkLoad();
+  pipeline->setFetchSpacing(-1.0f);
+}
+
+
+// =======================================================================================
+// C function to launder C++ method into pthread_create
+
+void* callLoadAll(void* arg)
+{
+  GHCNDatabase* ghcnDb = (GHCNDatabase*)arg;
+  ghcnDb->loadAll(ghcnDb->loadAllSpacing);
+  return NULL;
 }
 
 
 // =======================================================================================
-/// @brief Callback for use in R-tree search in GHCNDatabase::getStations.
+/// @brief Run loadAll on a thread of its own, so the server can be up (and showing 
+/// progress on its diagnostic pages) while the stations load.
+/// @param spacing.  A float value for how many seconds to pause between each download.
 
-bool searchCallback(GHCNStation* station, void* context)
+void GHCNDatabase::startLoadAll(float spacing)
 {
-  GHCNDatabase* db = (GHCNDatabase*)context;
-  db->stationResults.push_back(station);
-  return true; // keep going  
+  loadAllSpacing = spacing;
+  pthread_t loadThread;
+  if(pthread_create(&loadThread, NULL, callLoadAll, this))
+    err(-1, "Couldn't spawn thread in GHCNDatabase::startLoadAll.\n");
+  pthread_detach(loadThread);
 }
 
 
 // =======================================================================================
 /// @brief Retrieve the closest stations from our data structures.
 ///
+/// Only reads the station index, so is safe to call from several threads at once.
 /// @param lat A float containing the latitude to search for
 /// @param longT A float containing the longtitude to search for
-/// @param hitGoal An integer minimum number of results to return.  Will search wider 
-/// until obtained.
-/// @todo We are searching on raw lat/long squares here, which will tend to get skeevy
-/// towards the poles - might want to add a cos(lat) factor.
-/// @todo We currently just take the first result, rather than examining results for 
-/// altitude etc.
-
-void GHCNDatabase::getStations(float lat, float longT, int hitGoal)
+/// @param hitGoal An integer number of results to return (fewer only if we don't have
+/// that many stations).
+/// @param results A vector (owned by the caller) to place the stations found in, 
+/// nearest (by great-circle distance) first.  Any previous contents are cleared.
+/// @param distances If supplied, the distance in km to each station in results.
+/// @param elevation The elevation (in meters) of the place, if elevation differences
+/// are to count against stations.
+/// @param elevWeight Km of distance to add to a station for each km it is higher or 
+/// lower than the place.  Zero (the default) means to go on distance alone.
+
+void GHCNDatabase::getStations(float lat, float longT, int hitGoal, 
+                                std::vector<GHCNStation*>& results, 
+                                std::vector<float>* distances, float elevation, 
+                                float elevWeight)
 {
-  float searchBound = 0.25f;  // half the side of the search rectangle in degrees.
-  float searchMin[2];
-  float searchMax[2];
-  
-  
-  while(1) // keep adjusting the search rectangle until we get a good result
-   {
-    stationResults.clear();
-    searchMin[0] = lat    - searchBound;
-    searchMin[1] = longT  - searchBound;
-    searchMax[0] = lat    + searchBound;
-    searchMax[1] = longT  + searchBound;
-    
-    int hits = stationTree.Search(searchMin, searchMax, searchCallback, this);
-    LogClimateDbOps("Got %d results in search with %.4f degrees of [%.4f, %.4f].\n",
-                      hits, searchBound, lat, longT);
-    if(hits >= hitGoal)
-     {
-      break; // temp
-     }
-    else
-      searchBound *= 1.2;
-   }
+  stationIndex.nearest(lat, longT, hitGoal, results, distances, elevation, elevWeight);
+  LogClimateDbOps("Got %lu stations nearest [%.4f, %.4f].\n", results.size(), lat, longT);
 }
 
 
@@ -424,36 +456,43 @@ void GHCNDatabase::getStations(float lat, float longT, int hitGoal)
 /// @param lat A float containing the latitude to search for
 /// @param longT A float containing the longtitude to search for
 /// @param stations A reference to the vector of stations to store stations we found
+/// @param infos A reference to a vector to store the ClimateInfo of each station found
+/// (which the caller must use, between GHCNPipeline::beginRead and endRead, rather than
+/// the station's own, as that may be evicted).
 /// @param indices A reference to a vector to store indices of the years for each station
 /// @param hitGoal An integer minimum number of results to return.  Will search wider 
 /// until obtained.
 /// @param andFlagMask A mask which decides whether a given ClimateYear
 /// matches or not.
 /// @param year A year to search for.  Zero will search for any year.
-/// @todo We are searching on raw lat/long squares here, which will tend to get skeevy
-/// towards the poles - might want to add a cos(lat) factor.
+/// @param timeoutMs How long to wait for stations that aren't in memory yet, in 
+/// milliseconds.  Zero (the default) means to wait for as long as it takes.
+/// @returns True if the search was done, false if we gave up waiting for the stations
+/// (in which case nothing is added to the results, but the stations carry on loading,
+/// so the caller can ask again shortly).
 
-void GHCNDatabase::searchStations(float lat, float longT, 
+bool GHCNDatabase::searchStations(float lat, float longT, 
                                       std::vector<GHCNStation*>& relevantStations,
+                                      std::vector<ClimateInfo*>& infos,
                                       std::vector<unsigned>& indices, int hitGoal,
-                                      unsigned andFlagMask, unsigned year)
+                                      unsigned andFlagMask, int year, unsigned timeoutMs)
 {
   // Find close by stations
-  getStations(lat, longT, hitGoal);
-  int N = stationResults.size();
+  std::vector<GHCNStation*> stationResults;
+  std::vector<ClimateInfo*> stationInfos;
+  getStations(lat, longT, hitGoal, stationResults);
+  unless(pipeline->waitForAll(stationResults, timeoutMs, &stationInfos))
+   {
+    LogClimateDbOps("Timed out waiting for stations near [%.4f, %.4f].\n", lat, longT);
+    return false;
+   }
+  int N = stationInfos.size();
 
   for(int s=0; s<N; s++)
    {
     GHCNStation* station = stationResults[s];
     /// @todo We need a mechanism to mark and avoid known useless stations
-    unless(station->climate)
-     {
-      checkOrFetchCSVFile(station);
-      readOneCSVFile(station);
-     }
-    ClimateInfo* clim = station->climate;
-    unless(clim)
-      continue;
+    ClimateInfo* clim = stationInfos[s];
     if(year)
      {
       for(int i=0; i<clim->nYears; i++)
@@ -463,6 +502,7 @@ void GHCNDatabase::searchStations(float lat, float longT,
         unless(clim->climateYears[i]->flags & andFlagMask)
           break;
         relevantStations.push_back(station);
+        infos.push_back(clim);
         indices.push_back(i);
         break; // don't keep searching this station after we found a good year
        }
@@ -474,11 +514,13 @@ void GHCNDatabase::searchStations(float lat, float longT,
         unless(clim->climateYears[i]->flags & andFlagMask)
           continue;
         relevantStations.push_back(station);
+        infos.push_back(clim);
         indices.push_back(i);
         break; // don't keep searching this station after we found a good year
        }      
      }
    }
+  return true;
 }
 
 
@@ -524,25 +566,89 @@ bool GHCNDatabase::checkOrFetchCSVFile(GHCNStation* station, float pause)
     return false;
    };
 
-  return checkUpdateFile(fileName, url, MAX_CSV_FILE_AGE, pause);  
+  bool replaced;
+  unless(checkUpdateFile(fileName, url, MAX_CSV_FILE_AGE, pause, &replaced))
+    return false;
+  if(replaced)
+   {
+    station->fileVersion++;
+    invalidateStation(station);
+   }
+  return true;
 }
 
 
+// =======================================================================================
+/// @brief Remove the cached HTTP responses that could have been made from the old data
+/// of a station whose file has just been refreshed.
+///
+/// That's the pages about that particular station, and the location based queries 
+/// (which could have used any station).  Pages about other stations are left alone.
+/// @param station A pointer to the GHCNStation record whose file was refreshed.
+
+void GHCNDatabase::invalidateStation(GHCNStation* station)
+{
+  unless(responseCache)
+    return;
+
+  const char* stationRoutes[] = {"climateStation/", "stationSummary/", "maxTempStation/",
+                                                      "minTempStation/", "precipStation/"};
+  const char* locationRoutes[] = {"climate?", "climateDiagnostic?", "stationComp", 
+                                                                "tMinYear?", "tMaxYear?"};
+  char prefix[64];
+  for(unsigned i = 0; i < sizeof(stationRoutes)/sizeof(stationRoutes[0]); i++)
+   {
+    snprintf(prefix, 64, "/climate/%s%s", stationRoutes[i], station->id);
+    responseCache->invalidate(prefix);
+   }
+  for(unsigned i = 0; i < sizeof(locationRoutes)/sizeof(locationRoutes[0]); i++)
+   {
+    snprintf(prefix, 64, "/climate/%s", locationRoutes[i]);
+    responseCache->invalidate(prefix);
+   }
+}
+
+
+// =======================================================================================
+/// @brief Helper to turn the four character GHCN element name (eg "TMAX") into an
+/// integer so that a line's element can be checked with a single comparison.
+
+static uint32_t ghcnElementCode(const char* element)
+{
+  uint32_t code;
+  memcpy(&code, element, 4);
+  return code;
+}
+
+static const uint32_t tmaxCode = ghcnElementCode("TMAX");
+static const uint32_t tminCode = ghcnElementCode("TMIN");
+static const uint32_t prcpCode = ghcnElementCode("PRCP");
+
+
 // =======================================================================================
 /// @brief Handle a single line of a .csv file.
 ///
-/// @param buf A char* pointing to buffer with the line.
-/// @param station A pointer to the GHCNStation record for which we are reading.  Note
-/// that it's climate variable should be valid.
+/// The GHCN by_station files have a fixed layout up to the observation value, so we
+/// just check the commas are where they should be rather than searching for them, and
+/// parse the numbers by hand rather than with atoi/atof.
+/// @param buf A char* pointing to the start of the line.
+/// @param end A char* pointing just after the end of the line (not including any 
+/// newline).
+/// @param stationId The id of the station for which we are reading.
+/// @param climInfo The ClimateInfo being built for the station.
+/// @param readYear A reference to the year currently being read in by our caller (NULL
+/// at the start of the file).  When the file moves on to a new year, the old one is 
+/// stored in climInfo (if valid) and a new one is started here.
 /// @param fileName The name of the file (mainly for logging).
 /// @param line An integer line number (mainly for logging).
 /// @returns True if we read the line ok, false if we encountered a fatal error.
 
-bool GHCNDatabase::readCSVLine(char* buf, GHCNStation* station, char* fileName, int line)
+bool GHCNDatabase::readCSVLine(const char* buf, const char* end, const char* stationId,
+                                  ClimateInfo* climInfo, ClimateYear*& readYear, 
+                                  const char* fileName, int line)
 {
   // USC00304174,18930101,TMAX,67,,,6,
-  int strLen = strlen(buf);
-  if(strLen < 32)
+  if(end - buf < 31)
    {
     LogClimateDbErr("Short line %d of csv file %s.\n", line, fileName);
     return false;
@@ -555,39 +661,43 @@ bool GHCNDatabase::readCSVLine(char* buf, GHCNStation* station, char* fileName,
                                                                       line, fileName);
     return false;
    }
-  buf[11] = '\0';
-  unless(strncmp(buf, station->id, 11) == 0)
+  unless(memcmp(buf, stationId, 11) == 0)
    {
-    LogClimateDbErr("Station id %s does not match %s in csv file %s, line %d.\n", 
-                                                  buf, station->id, fileName, line);
+    LogClimateDbErr("Station id %.11s does not match %s in csv file %s, line %d.\n", 
+                                                  buf, stationId, fileName, line);
     return false;
    }
 
-  // Date
+  // Date (converting ASCII values to numbers, and checking they were all digits)
   if(buf[20] != ',')
    {
     LogClimateDbErr("Bad date comma in line %d of csv file %s.\n", line, fileName);
     return false;
    }
-  buf[20] = '\0';
-  char dateBuf[5];
-  int year, month, day, yearDay;
-  for(int i=0;i<4;i++)
-    dateBuf[i] = buf[12+i];
-  dateBuf[4] = '\0';
-  year      = atoi(dateBuf);
-  month     = 10*(buf[16] - '0') + (buf[17] - '0');  // converting ASCII values to numbers
-  day       = 10*(buf[18] - '0') + (buf[19] - '0');
-  yearDay   = yearDays(year, month, day);
+  unsigned digits[8];
+  unsigned notDigit = 0u;
+  for(int i=0; i<8; i++)
+   {
+    digits[i] = (unsigned)(buf[12+i] - '0');
+    notDigit |= (digits[i] > 9u);
+   }
+  int year    = 1000*digits[0] + 100*digits[1] + 10*digits[2] + digits[3];
+  int month   = 10*digits[4] + digits[5];
+  int day     = 10*digits[6] + digits[7];
+  if(notDigit || month < 1 || month > 12 || day < 1 || day > 31)
+   {
+    LogClimateDbErr("Bad date, %.8s, in line %d of csv file %s.\n", buf+12, line, fileName);
+    return false;
+   }
+  int yearDay = yearDays(year, month, day);
   unless(yearDay >= 0 && yearDay < 366)
    {
-    LogClimateDbErr("Out of array range date, %s (%d/%d/%d), in line %d of csv file %s.\n", 
+    LogClimateDbErr("Out of array range date, %.8s (%d/%d/%d), in line %d of csv file %s.\n", 
                                                   buf+12, month, day, year, line, fileName);
     return false;
    }
 
   // Screen out years that are out of range  
-  ClimateInfo* climInfo = station->climate;
   if(year < climInfo->startYear || year >= climInfo->endYear)
     return true;
 
@@ -619,175 +729,334 @@ bool GHCNDatabase::readCSVLine(char* buf, GHCNStation* station, char* fileName,
   // If we don't have a current year's data, get a new one
   unless(readYear)
     readYear = new ClimateYear(year);
-  
-  //Find the right climateDay
-  ClimateDay* climDay = readYear->climateDays + yearDay;
 
-  //if(strcmp(station->id, "US1NYTG0015") == 0)
-  //  printf("Recording data for yearDay %d from date %s.\n", yearDay, buf+12);  
-  
-  // Observation type, observation
+  // Observation type - we only care about a few of them, so go home early otherwise
   if(buf[25] != ',')
    {
     LogClimateDbErr("Bad observation type comma in line %d of csv file %s.\n", 
                                                                     line, fileName);
     return false;
    }
-  buf[25] = '\0'; // comma after observation type
-  char* commaLoc = index(buf + 26, ','); // find the comma after the observation
-  unless(commaLoc)
+  uint32_t element = ghcnElementCode(buf + 21);
+  unless(element == tmaxCode || element == tminCode || element == prcpCode)
+    return true;
+  
+  // Observation (always an integer number of tenths)
+  const char* p = buf + 26;
+  bool negative = (*p == '-');
+  if(negative)
+    p++;
+  int value = 0;
+  while(p < end && (unsigned)(*p - '0') <= 9u)
+    value = 10*value + (*p++ - '0');
+  if(p == end || *p != ',')
    {
     LogClimateDbErr("Couldn't find observation in line %d of csv file %s.\n", 
                                                                     line, fileName);
     return false;
    }
-  *commaLoc = '\0';
-  float observation = atof(buf+26);
+  int tenths = negative ? -value : value;
+  float observation = tenths/10.0f;
 
-  if(strcmp(buf + 21, "TMAX") == 0)
+  if(element == tmaxCode)
    {
-    climDay->hiTemp = observation/10.0f;
-    if(tempInRange(climDay->hiTemp))
-      climDay->flags |= HI_TEMP_VALID;
-    else
+    bool valid = tempInRange(observation);
+    readYear->setObservation(HI_TEMP_INDEX, yearDay, tenths, valid);
+    unless(valid)
      {
       LogClimateOutliers("Ignoring invalid daily high temp observation"
                          " of %.2f in year %d, yearDay %d.\n",
-                           climDay->hiTemp, year, yearDay);
+                           observation, year, yearDay);
      }
    }  
-  else if(strcmp(buf + 21, "TMIN") == 0)
+  else if(element == tminCode)
    {
-    climDay->lowTemp = observation/10.0f;
-    if(tempInRange(climDay->lowTemp))
-      climDay->flags |= LOW_TEMP_VALID;
-    else
+    bool valid = tempInRange(observation);
+    readYear->setObservation(LOW_TEMP_INDEX, yearDay, tenths, valid);
+    unless(valid)
      {
       LogClimateOutliers("Ignoring invalid daily low temp observation"
                          " of %.2f in year %d, yearDay %d.\n",
-                           climDay->lowTemp, year, yearDay);
+                           observation, year, yearDay);
      }
    }  
-  else if(strcmp(buf + 21, "PRCP") == 0)
+  else
    {
-    climDay->precip = observation/10.0f;
-    if(precipInRange(climDay->precip))
-      climDay->flags |= PRECIP_VALID;
-    else
+    bool valid = precipInRange(observation);
+    readYear->setObservation(PRECIP_INDEX, yearDay, tenths, valid);
+    unless(valid)
      {
       LogClimateOutliers("Ignoring invalid precipitation observation"
                          " of %.2f in year %d, yearDay %d.\n",
-                           climDay->precip, year, yearDay);
+                           observation, year, yearDay);
      }
-  }  
-  else if(strcmp(buf + 21, "SNOW") == 0)
-   {
-    ;
    }  
    
   // Flags
   
   return true;
 }
+// =======================================================================================
+/// @brief Make sure a station's climate data is in memory, waiting for our GHCNPipeline
+/// to fetch and read it if necessary.
+///
+/// Stations that are already loaded are returned straight away without locking.  A 
+/// station whose file is missing or bad still gets a (possibly empty) ClimateInfo, so 
+/// we don't keep trying it.  The caller must be between GHCNPipeline::beginRead and 
+/// endRead.
+/// @returns The station's ClimateInfo.
+/// @param station A pointer to the GHCNStation record which is requested.
+
+ClimateInfo* GHCNDatabase::loadStation(GHCNStation* station)
+{
+  return pipeline->waitFor(station);
+}
+
+
+// =======================================================================================
+/// @brief Read a station's data into a new ClimateInfo, from our binary cache if it's
+/// up to date, or else by parsing its .csv.gz file (and then caching the result).
+/// Either way, the ClimateInfo is then summarized, so it's ready to be published.
+///
+/// @param station A pointer to the GHCNStation record for which we are reading.
+/// @param climInfo The ClimateInfo to store the years we read in.
+/// @param bytesRead If supplied, is set to the number of bytes of csv parsed (zero if
+/// we used the cache).
+/// @returns The number of years read, or -1 if the station's file couldn't be read.
+
+int GHCNDatabase::readStation(GHCNStation* station, ClimateInfo* climInfo, 
+                                                                      size_t* bytesRead)
+{
+  if(bytesRead)
+    *bytesRead = 0u;
+  if(binaryCache->read(station, climInfo))
+   {
+    climInfo->summarize();
+    return climInfo->nYears;
+   }
+  int retVal = readOneCSVFile(station, climInfo, bytesRead);
+  if(retVal >= 0)
+    binaryCache->write(station, climInfo);
+  climInfo->summarize();
+  return retVal < 0 ? -1 : climInfo->nYears;
+}
 
 
 // =======================================================================================
-/// @brief Read a single .csv file.
+/// @brief Read a single station's .csv file.
 ///
 /// @param station A pointer to the GHCNStation record for which we are reading
-/// @returns The number of complete records we read
-/// @todo We create the ClimateInfo with hard-coded years that are a temp hack.
+/// @param climInfo The ClimateInfo to store the years we read in.
+/// @param bytesRead If supplied, is set to the number of (decompressed) bytes parsed.
+/// @returns The number of valid days we read, or -1 on failure.
 
 // https://www.ncei.noaa.gov/pub/data/ghcn/daily/readme.txt
 
-int GHCNDatabase::readOneCSVFile(GHCNStation* station)
+int GHCNDatabase::readOneCSVFile(GHCNStation* station, ClimateInfo* climInfo, 
+                                                                      size_t* bytesRead)
 {
-  // Create the climateInfo if needed
-  unless(station->climate)
-    station->climate = new ClimateInfo(2000, 2022);
-  
   // Get the fileName
   char fileName[128];
   unless(snprintCSVFileName(fileName, 128, station))
     return -1;
+  unless(readCSVFile(fileName, station->id, climInfo, bytesRead) >= 0)
+   {
+    LogClimateDbErr("Couldn't read station csv file %s.\n", fileName);
+    return -1;
+   }
+
+  // Close up and go home
+  unsigned total, valid;
+  climInfo->countValidDays(total, valid);
+  LogClimateDbOps("Station %s has %d valid days from %d total.\n", station->id, 
+                                                                            valid, total);
+  return valid;
+}
 
-  // Loop variables
-  char buf[128];
-  int line = 0;
 
-  // Check if we are gzipped or not
-  char* dotLoc = rindex(fileName, '.');
-  if(!dotLoc || strcmp(dotLoc, ".gz"))
+// =======================================================================================
+/// @brief Parse a GHCN by_station .csv file (gzipped or not) into a ClimateInfo.
+///
+/// The file is decompressed in big blocks, which are then split into lines in place,
+/// rather than being read a line at a time.  All the state of the read is local, so 
+/// several files can be read at once.
+/// @param fileName The name of the file to read.
+/// @param stationId The id of the station the file should be for.
+/// @param climInfo The ClimateInfo to store the years we read in.
+/// @param bytesRead If supplied, is set to the number of (decompressed) bytes parsed.
+/// @returns The number of lines read, or -1 on failure.
+
+int GHCNDatabase::readCSVFile(const char* fileName, const char* stationId, 
+                                            ClimateInfo* climInfo, size_t* bytesRead)
+{
+  // zlib reads files that aren't gzipped straight through, so this handles both cases
+  gzFile file = gzopen(fileName, "rb");
+  unless(file)
    {
-    // Open the file which is not gzipped
-    FILE* file = fopen(fileName, "r");
-    unless(file)
+    LogClimateDbErr("Couldn't open station csv file %s.\n", fileName);
+    return -1;
+   }
+  gzbuffer(file, GHCN_READ_BLOCK);
+  
+  char* buf = new char[GHCN_READ_BLOCK];
+  ClimateYear* readYear = NULL;
+  int line      = 0;
+  int retVal    = 0;
+  size_t total  = 0u;
+  unsigned held = 0u;  // bytes of an incomplete line carried over from the last block
+  int got;
+
+  while((got = gzread(file, buf + held, GHCN_READ_BLOCK - held)) != 0 || held)
+   {
+    if(got < 0)
      {
-      LogClimateDbErr("Couldn't open station csv file %s.\n", fileName);
-      return -1;
+      LogClimateDbErr("Decompression error in station csv file %s.\n", fileName);
+      retVal = -1;
+      break;
      }
-  
-    // Loop over the lines in the file
-    while(fgets(buf, 128, file) && ++line)
-      unless(readCSVLine(buf, station, fileName, line))
+    total += got;
+    char* blockEnd  = buf + held + got;
+    char* lineStart = buf;
+    char* newline;
+    while((newline = (char*)memchr(lineStart, '\n', blockEnd - lineStart)))
+     {
+      char* lineEnd = (newline > lineStart && newline[-1] == '\r') ? newline - 1 : newline;
+      unless(readCSVLine(lineStart, lineEnd, stationId, climInfo, readYear, 
+                                                                      fileName, ++line))
        {
-        LogClimateDbErr("Couldn't read station csv file %s.\n", fileName);
-        fclose(file);
-        return -1;
+        retVal = -1;
+        break;
        }
-    if(readYear)
+      lineStart = newline + 1;
+     }
+    if(retVal < 0)
+      break;
+    held = blockEnd - lineStart;
+
+    // Deal with what's left over
+    if(got == 0)
      {
-      if(readYear->assessValidity())
-        // Store the good data away for future use
-        station->climate->climateYears[station->climate->nYears++] = readYear;
-      else
-        delete readYear;
+      // End of file without a final newline
+      unless(readCSVLine(lineStart, blockEnd, stationId, climInfo, readYear, 
+                                                                      fileName, ++line))
+        retVal = -1;
+      break;
      }
-    readYear = NULL;    
-    fclose(file);
-   }
-  else
-   {
-    // Open the gzip file
-    // Code idea borrowed from:
-    // https://stackoverflow.com/questions/35091855/how-to-sequentially-parse-in-\
-    // c-a-gzip-compressed-text-file-without-fully-decompr
-    gzFile file = gzopen(fileName, "rb");
-    unless(file)
+    if(held == GHCN_READ_BLOCK)
      {
-      LogClimateDbErr("Couldn't open station csv.gz file %s.\n", fileName);
-      return -1;
+      LogClimateDbErr("Overlong line %d in station csv file %s.\n", line + 1, fileName);
+      retVal = -1;
+      break;
      }
+    memmove(buf, lineStart, held);
+   }
+  delete[] buf;
+
+  // A truncated or corrupt file can just look like the end of it, so check that's all
+  // it was
+  int zErr = Z_OK;
+  if(retVal >= 0)
+    gzerror(file, &zErr);
+  if(zErr != Z_OK)
+   {
+    LogClimateDbErr("Decompression error in station csv file %s.\n", fileName);
+    retVal = -1;
+   }
+  gzclose(file);
+
+  if(readYear)
+   {
+    if(retVal >= 0 && readYear->assessValidity())
+      // Store the good data away for future use
+      climInfo->climateYears[climInfo->nYears++] = readYear;
+    else
+      delete readYear;
+   }
+  if(bytesRead)
+    *bytesRead = total;
+  return retVal < 0 ? retVal : line;
+}
+
+
+// =======================================================================================
+/// @brief Benchmark our parsing of GHCN station files.
+///
+/// Reads every .csv.gz or .csv file in a directory (eg a copy of some real station 
+/// files) several times over, and reports how fast we went in MB/s of decompressed
+/// data, both for decompression alone and for decompression plus parsing.
+/// @param dirName The directory with the station files.
+
+#define GHCN_BENCH_PASSES 3
 
-    // Loop over the lines in the file
-    while(gzgets(file, buf, 128) && ++line)
-    unless(readCSVLine(buf, station, fileName, line))
+void GHCNDatabase::benchmarkCSVParsing(char* dirName)
+{
+  DIR* dir = opendir(dirName);
+  unless(dir)
+    err(-1, "Couldn't open directory %s to benchmark GHCN parsing.\n", dirName);
+  std::vector<std::string> fileNames;
+  struct dirent* entry;
+  while((entry = readdir(dir)))
+   {
+    int len = strlen(entry->d_name);
+    if((len > 7 && strcmp(entry->d_name + len - 7, ".csv.gz") == 0)
+                          || (len > 4 && strcmp(entry->d_name + len - 4, ".csv") == 0))
+      fileNames.push_back(std::string(dirName) + "/" + entry->d_name);
+   }
+  closedir(dir);
+  unless(fileNames.size())
+    err(-1, "No station csv files in %s to benchmark.\n", dirName);
+  
+  // Decompression alone, as a baseline
+  char* buf = new char[GHCN_READ_BLOCK];
+  size_t bytes = 0u;
+  Timeval start;
+  start.now();
+  for(int pass=0; pass<GHCN_BENCH_PASSES; pass++)
+    for(unsigned i=0; i<fileNames.size(); i++)
      {
-      LogClimateDbErr("Couldn't read station csv.gz file %s.\n", fileName);
+      gzFile file = gzopen(fileNames[i].c_str(), "rb");
+      unless(file)
+        continue;
+      gzbuffer(file, GHCN_READ_BLOCK);
+      int got;
+      while((got = gzread(file, buf, GHCN_READ_BLOCK)) > 0)
+        bytes += got;
       gzclose(file);
-      return -1;
      }
-    if(readYear)
+  Timeval end;
+  end.now();
+  double gzSecs = end - start;
+  delete[] buf;
+  
+  // Decompression and parsing.  The station id is taken from the file name.
+  size_t parsed = 0u;
+  int lines     = 0;
+  int failures  = 0;
+  start.now();
+  for(int pass=0; pass<GHCN_BENCH_PASSES; pass++)
+    for(unsigned i=0; i<fileNames.size(); i++)
      {
-      if(readYear->assessValidity())
-        // Store the good data away for future use
-        station->climate->climateYears[station->climate->nYears++] = readYear;
+      const char* fileName  = fileNames[i].c_str();
+      const char* stationId = strrchr(fileName, '/') + 1;
+      ClimateInfo* climInfo = new ClimateInfo(2000, 2022);
+      size_t fileBytes;
+      int fileLines = readCSVFile(fileName, stationId, climInfo, &fileBytes);
+      if(fileLines < 0)
+        failures++;
       else
-        delete readYear;
+        lines += fileLines;
+      parsed += fileBytes;
+      delete climInfo;
      }
-    readYear = NULL;    
-    gzclose(file);
-  }
-
-  // Close up and go home
-  unsigned total, valid;
-  station->climate->countValidDays(total, valid);
-  LogClimateDbOps("Station %s has %d valid days from %d total.\n", station->id, 
-                                                                            valid, total);
-  return valid;
+  end.now();
+  double parseSecs = end - start;
+
+  printf("Parsed %lu files (%d failures), %d lines, %.1f MB, %d passes.\n", 
+                      fileNames.size(), failures/GHCN_BENCH_PASSES, lines/GHCN_BENCH_PASSES, 
+                      parsed/GHCN_BENCH_PASSES/1.0e6, GHCN_BENCH_PASSES);
+  printf("Decompression alone: %.1f MB/s.\n", bytes/1.0e6/gzSecs);
+  printf("Decompression and parsing: %.1f MB/s.\n", parsed/1.0e6/parseSecs);
 }
-
-
 // =======================================================================================
 /// @brief Create a single station from a line in the file.
 ///
@@ -824,8 +1093,11 @@ GHCNStation::GHCNStation(char* buf)
   elevation   = atof(buf+31);  // in meters, as we are in permaserv
 
   // Make sure variables that will be filled out later are not random garbage
-  fileBufSize = 0u;
-  climate     = NULL;
+  fileBufSize   = 0u;
+  climate       = NULL;
+  loadRequested = false;
+  lastUse       = 0u;
+  fileVersion   = 0u;
   
   LogGHCNExhaustive("Read station %s (%s) at [%.4f, %.4f], el: %.1fm.\n",
                                               id, name, latLong[0], latLong[1], elevation);
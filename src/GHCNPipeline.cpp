@@ -0,0 +1,647 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+// Background pipeline to get GHCN station files into memory without tying up the HTTP
+// server threads.  A single fetch thread downloads files (if needed), and a farm of
+// reader threads decompresses and parses them, publishing each station when it's done.
+// Also keeps the memory used by loaded stations within a budget by evicting the least
+// recently used ones.
+
+#include "GHCNPipeline.h"
+#include "GHCNDatabase.h"
+#include "ClimateInfo.h"
+#include "TaskQueueFarm.h"
+#include "HttpServThread.h"
+#include "Logging.h"
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <err.h>
+#include <algorithm>
+
+
+// =======================================================================================
+// C functions to run the stages as tasks on our queues.
+
+/// @brief A station working its way through the pipeline.
+
+struct GHCNPipelineJob
+{
+  GHCNPipeline* pipeline;
+  GHCNStation*  station;
+};
+
+void ghcnFetchTask(void* arg, TaskQueue* queue)
+{
+  GHCNPipeline* pipeline = (GHCNPipeline*)arg;
+  pipeline->fetchStage();
+}
+
+void ghcnReadTask(void* arg, TaskQueue* queue)
+{
+  GHCNPipelineJob* job = (GHCNPipelineJob*)arg;
+  job->pipeline->readStage(job);
+}
+
+
+// =======================================================================================
+/// @brief Constructor
+///
+/// Should only be called once the GHCNDatabase has finished with its own downloads, as
+/// from here on our fetch thread is the only user of its curl handle.
+/// @param db The GHCNDatabase whose stations we load.
+
+GHCNPipeline::GHCNPipeline(GHCNDatabase* db):
+                                    ghcnDb(db),
+                                    inFlight(0u),
+                                    waiters(0u),
+                                    roomWaiters(0u),
+                                    fetchSpacing(-1.0f),
+                                    requested(0u),
+                                    coalesced(0u),
+                                    published(0u),
+                                    bytesParsed(0u),
+                                    memoryBudget(0u),
+                                    residentBytes(0u),
+                                    residentCount(0u),
+                                    evictions(0u),
+                                    evictedBytes(0u),
+                                    useClock(1u),
+                                    evicting(false),
+                                    readGeneration(0u),
+                                    retiredCount(0u),
+                                    bulkTotal(0u),
+                                    bulkPublishedBase(0u),
+                                    bulkBytesBase(0u),
+                                    bulkRunning(false)
+{
+  activeReaders[0]  = 0u;
+  activeReaders[1]  = 0u;
+  if(pthread_cond_init(&stationReady, NULL) || pthread_cond_init(&roomAvailable, NULL))
+    err(-1, "Couldn't initialize conditions in GHCNPipeline::GHCNPipeline.");
+  long nCores   = sysconf(_SC_NPROCESSORS_ONLN);
+  nReadThreads  = nCores > 0 ? (unsigned)nCores : GHCN_PARSE_THREADS;
+  fetchQueue    = new TaskQueue(0u);
+  readFarm      = new TaskQueueFarm(nReadThreads, "GHCN reading");
+}
+
+
+// =======================================================================================
+/// @brief Destructor
+///
+/// As with TaskQueueFarm, we stop the threads but don't free them, as this lasts the
+/// life of the process.
+
+GHCNPipeline::~GHCNPipeline(void)
+{
+  fetchQueue->die();
+  delete readFarm;
+  for(unsigned i=0; i<urgentJobs.size(); i++)
+    delete urgentJobs[i];
+  for(unsigned i=0; i<bulkJobs.size(); i++)
+    delete bulkJobs[i];
+  for(unsigned i=0; i<retiredNow.size(); i++)
+    delete retiredNow[i];
+  for(unsigned i=0; i<retiredPrev.size(); i++)
+    delete retiredPrev[i];
+  pthread_cond_destroy(&stationReady);
+  pthread_cond_destroy(&roomAvailable);
+}
+
+
+// =======================================================================================
+/// @brief Ask for a station to be brought into memory in the background.
+///
+/// Returns straight away if the station is already loaded or on its way.  Otherwise it
+/// is queued for fetching.  A bulk request first waits for room if the pipeline is full,
+/// while an urgent one goes straight in, and is fetched before any bulk requests that 
+/// are still waiting.  An urgent request for a station already waiting in the bulk 
+/// queue moves it to the urgent one.  This also reloads stations that have been evicted.
+/// @param station The station wanted.
+/// @param urgent True if someone is waiting for this station (eg to answer an HTTP 
+/// request), false (the default) for bulk loading.
+
+void GHCNPipeline::request(GHCNStation* station, bool urgent)
+{
+  if(station->climate.load(std::memory_order_acquire))
+    return;
+  if(station->loadRequested.exchange(true))
+   {
+    coalesced++;
+    if(urgent)
+      promote(station);
+    return;
+   }
+  if(urgent)
+    inFlight++;
+  else
+    waitForRoom();
+
+  requested++;
+  GHCNPipelineJob* job = new GHCNPipelineJob;
+  job->pipeline = this;
+  job->station  = station;
+  lock();
+  if(urgent)
+    urgentJobs.push_back(job);
+  else
+    bulkJobs.push_back(job);
+  unlock();
+  fetchQueue->addTask(ghcnFetchTask, this);
+  LogClimateDbOps("Queued station %s for %s loading.\n", station->id, 
+                                                              urgent ? "urgent" : "bulk");
+}
+
+
+// =======================================================================================
+/// @brief Move a station that is still waiting in the bulk fetch queue to the urgent 
+/// one.  Does nothing if it's not there (eg it's already been fetched).
+/// @param station The station now wanted urgently.
+
+void GHCNPipeline::promote(GHCNStation* station)
+{
+  lock();
+  for(auto iter = bulkJobs.begin(); iter != bulkJobs.end(); iter++)
+   {
+    if((*iter)->station == station)
+     {
+      urgentJobs.push_back(*iter);
+      bulkJobs.erase(iter);
+      break;
+     }
+   }
+  unlock();
+}
+
+
+// =======================================================================================
+/// @brief Take a place in the pipeline, waiting for one to come free if it's full.
+///
+/// Only takes the lock if we have to wait.  We announce ourselves in roomWaiters before
+/// checking again under the lock, so readStage can't miss us.
+
+void GHCNPipeline::waitForRoom(void)
+{
+  while(1)
+   {
+    unsigned count = inFlight.load();
+    if(count < GHCN_MAX_IN_FLIGHT)
+     {
+      if(inFlight.compare_exchange_weak(count, count+1))
+        return;
+      continue;
+     }
+    roomWaiters++;
+    lock();
+    while(inFlight.load() >= GHCN_MAX_IN_FLIGHT)
+      pthread_cond_wait(&roomAvailable, &mutex);
+    unlock();
+    roomWaiters--;
+   }
+}
+
+
+// =======================================================================================
+/// @brief First stage: take the next station waiting to be fetched (urgent ones first),
+/// make sure its file is on disk and fresh, then pass it on to be read.  Runs on our 
+/// single fetch thread.
+///
+/// There is one task on the fetch queue for each station waiting, but the tasks don't
+/// say which station, so that urgent stations can overtake bulk ones.
+
+void GHCNPipeline::fetchStage(void)
+{
+  lock();
+  std::deque<GHCNPipelineJob*>& jobs = urgentJobs.empty() ? bulkJobs : urgentJobs;
+  GHCNPipelineJob* job = jobs.front();
+  jobs.pop_front();
+  unlock();
+  ghcnDb->checkOrFetchCSVFile(job->station, fetchSpacing.load());
+  readFarm->loadBalanceTask(ghcnReadTask, job);
+}
+
+
+// =======================================================================================
+/// @brief Second stage: read the station's data (from the binary cache if possible, or 
+/// else its file) into a new ClimateInfo, and publish it.  Runs on any of our reader 
+/// threads.
+///
+/// The station gets a ClimateInfo even if the file was missing or bad (it will just be
+/// empty), so that we don't keep trying.  Publishing is lock-free unless someone is 
+/// waiting to be woken, or it takes us over our memory budget.
+/// @param job The station on its way through the pipeline (which we are done with).
+/// @todo We create the ClimateInfo with hard-coded years that are a temp hack.
+
+void GHCNPipeline::readStage(GHCNPipelineJob* job)
+{
+  GHCNStation* station = job->station;
+  delete job;
+  ClimateInfo* climInfo = new ClimateInfo(2000, 2022);
+  size_t bytes = 0u;
+  ghcnDb->readStation(station, climInfo, &bytes);
+  bytesParsed += bytes;
+
+  touch(station);
+  residentBytes += climInfo->bytesUsed();
+  residentCount++;
+  station->climate.store(climInfo);
+  published++;
+  inFlight--;
+  if(waiters.load() || roomWaiters.load())
+   {
+    lock();
+    pthread_cond_broadcast(&stationReady);
+    pthread_cond_broadcast(&roomAvailable);
+    unlock();
+   }
+  LogClimateDbOps("Published station %s.\n", station->id);
+  if(memoryBudget && residentBytes.load() > memoryBudget)
+    evictIfOverBudget();
+  readFarm->notifyTaskDone();
+}
+
+
+// =======================================================================================
+/// @brief Set the most memory that loaded stations may use, evicting some straight away
+/// if we are already over it.
+/// @param bytes The budget in bytes, or zero for no limit.
+
+void GHCNPipeline::setMemoryBudget(size_t bytes)
+{
+  memoryBudget = bytes;
+  if(memoryBudget && residentBytes.load() > memoryBudget)
+    evictIfOverBudget();
+}
+
+
+// =======================================================================================
+/// @brief Note that a station is being used, so it's the last to be evicted.
+/// @param station The station concerned.
+
+void GHCNPipeline::touch(GHCNStation* station)
+{
+  station->lastUse.store(useClock++);
+}
+
+
+// =======================================================================================
+/// @brief Evict the least recently used stations till we are comfortably back under our
+/// memory budget.
+///
+/// The evicted ClimateInfos are retired rather than deleted, as readers may still be 
+/// using them.  A reader that loses a station it was waiting for just asks for it again
+/// (which is only likely if the budget is too small for the stations in use at once).
+/// Only one thread evicts at a time; any others just carry on.
+
+void GHCNPipeline::evictIfOverBudget(void)
+{
+  if(evicting.exchange(true))
+    return;
+
+  // Find the candidates, oldest first.  The station map is never changed after startup,
+  // so we can look through it without locking.
+  std::vector<std::pair<unsigned long, GHCNStation*> > candidates;
+  for(auto iter: ghcnDb->stationsByName)
+   {
+    GHCNStation* station = iter.second;
+    if(station->climate.load())
+      candidates.push_back(std::make_pair(station->lastUse.load(), station));
+   }
+  std::sort(candidates.begin(), candidates.end());
+  
+  // Evict them
+  size_t target = memoryBudget*GHCN_EVICT_TARGET;
+  unsigned count = 0u;
+  size_t bytes = 0u;
+  lock();
+  for(unsigned i=0; i<candidates.size() && residentBytes.load() > target; i++)
+   {
+    GHCNStation* station = candidates[i].second;
+    if(station->lastUse.load() != candidates[i].first)
+      continue;  // it's been wanted since we looked
+    station->loadRequested.store(false);
+    ClimateInfo* climInfo = station->climate.exchange(NULL);
+    size_t size = climInfo->bytesUsed();
+    residentBytes -= size;
+    residentCount--;
+    retiredNow.push_back(climInfo);
+    retiredCount++;
+    bytes += size;
+    count++;
+   }
+  unlock();
+  evictions += count;
+  evictedBytes += bytes;
+  evicting.store(false);
+  if(count)
+    LogClimateDbOps("Evicted %u stations (%.1f MB) to stay within memory budget.\n", 
+                                                                      count, bytes/1.0e6);
+  reclaimRetired();
+}
+
+
+// =======================================================================================
+/// @brief Note that a thread is about to use climate data, so that nothing it gets from
+/// us is freed till it's done.
+///
+/// Very cheap, and never blocks.
+/// @returns The read generation the reader is in, to pass to endRead.
+
+unsigned GHCNPipeline::beginRead(void)
+{
+  while(1)
+   {
+    unsigned generation = readGeneration.load();
+    activeReaders[generation & 1u]++;
+    if(readGeneration.load() == generation)
+      return generation;
+    activeReaders[generation & 1u]--;  // it moved on under us, so try again
+   }
+}
+
+
+// =======================================================================================
+/// @brief Note that a thread has finished with all the climate data it got since the
+/// matching beginRead().
+/// @param generation The value returned by beginRead.
+
+void GHCNPipeline::endRead(unsigned generation)
+{
+  activeReaders[generation & 1u]--;
+  if(retiredCount.load())
+    reclaimRetired();
+}
+
+
+// =======================================================================================
+/// @brief Free evicted ClimateInfos that no reader can be using any more, and move on to
+/// the next read generation.
+///
+/// ClimateInfos evicted in the current generation might be in use by readers of the
+/// current or previous generations, so we can only move on once the previous 
+/// generation's readers are done.  At that point the ClimateInfos evicted during the 
+/// previous generation were unpublished before any reader still going began, and can
+/// be freed.
+
+void GHCNPipeline::reclaimRetired(void)
+{
+  lock();
+  unsigned generation = readGeneration.load();
+  if(activeReaders[(generation + 1u) & 1u].load() == 0u)
+   {
+    for(unsigned i=0; i<retiredPrev.size(); i++)
+      delete retiredPrev[i];
+    retiredCount -= retiredPrev.size();
+    retiredPrev.swap(retiredNow);
+    retiredNow.clear();
+    readGeneration.store(generation + 1u);
+   }
+  unlock();
+}
+
+
+// =======================================================================================
+/// @brief Request a station and wait until it has been published, or a deadline passes.
+/// The caller must have counted itself in waiters.
+///
+/// If the station gets evicted again before we see it, we just ask for it again.
+/// @returns The station's ClimateInfo, or NULL if we timed out.
+/// @param station The station wanted.
+/// @param deadline The absolute (CLOCK_REALTIME) time to give up at, or NULL to wait
+/// for as long as it takes.
+
+ClimateInfo* GHCNPipeline::waitUntilPublished(GHCNStation* station, 
+                                                                struct timespec* deadline)
+{
+  ClimateInfo* climInfo;
+  bool timedOut = false;
+  
+  until(timedOut)
+   {
+    request(station, true);
+    lock();
+    until((climInfo = station->climate.load()) || !station->loadRequested.load())
+     {
+      if(deadline)
+       {
+        if(pthread_cond_timedwait(&stationReady, &mutex, deadline) == ETIMEDOUT)
+         {
+          climInfo = station->climate.load();
+          timedOut = true;
+          break;
+         }
+       }
+      else
+        pthread_cond_wait(&stationReady, &mutex);
+     }
+    unlock();
+    if(climInfo)
+      return climInfo;
+   }
+  return NULL;
+}
+
+
+// =======================================================================================
+/// @brief Helper to turn a timeout into a deadline for pthread_cond_timedwait.
+
+static struct timespec* deadlineFromTimeout(struct timespec& deadline, unsigned timeoutMs)
+{
+  unless(timeoutMs)
+    return NULL;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec  += timeoutMs/1000;
+  deadline.tv_nsec += (timeoutMs%1000)*1000000;
+  if(deadline.tv_nsec >= 1000000000)
+   {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+   }
+  return &deadline;
+}
+
+
+// =======================================================================================
+/// @brief Request a station if necessary, and wait for it to be loaded.
+///
+/// The caller must be between beginRead() and endRead(), and should use the ClimateInfo
+/// returned rather than the station's, which could be evicted at any time.
+/// @returns The station's ClimateInfo, or NULL if we gave up waiting.
+/// @param station The station wanted.
+/// @param timeoutMs How long to wait in milliseconds.  Zero (the default) means to wait
+/// for as long as it takes.
+
+ClimateInfo* GHCNPipeline::waitFor(GHCNStation* station, unsigned timeoutMs)
+{
+  touch(station);
+  ClimateInfo* climInfo = station->climate.load();
+  if(climInfo)
+    return climInfo;
+
+  struct timespec deadline;
+  struct timespec* deadlinePtr = deadlineFromTimeout(deadline, timeoutMs);
+  waiters++;
+  climInfo = waitUntilPublished(station, deadlinePtr);
+  waiters--;
+  return climInfo;
+}
+
+
+// =======================================================================================
+/// @brief Request a whole set of stations at once, and wait for all of them to be
+/// loaded.
+///
+/// As they are all requested before we wait for any, their downloads and reading
+/// overlap in the pipeline.  As with waitFor, the caller must be between beginRead() 
+/// and endRead() to use the results.
+/// @returns True if all the stations are loaded, false if we gave up waiting.
+/// @param stations The stations wanted.
+/// @param timeoutMs How long to wait (for all of them together) in milliseconds.  Zero
+/// (the default) means to wait for as long as it takes.
+/// @param infos If supplied, the ClimateInfo of each station, in the same order (any
+/// previous contents are cleared).  Only complete if we return true.
+
+bool GHCNPipeline::waitForAll(std::vector<GHCNStation*>& stations, unsigned timeoutMs,
+                                                          std::vector<ClimateInfo*>* infos)
+{
+  int N = stations.size();
+  for(int i=0; i<N; i++)
+   {
+    touch(stations[i]);
+    request(stations[i], true);
+   }
+  if(infos)
+    infos->clear();
+
+  struct timespec deadline;
+  struct timespec* deadlinePtr = deadlineFromTimeout(deadline, timeoutMs);
+  bool retVal = true;
+  waiters++;
+  for(int i=0; i<N; i++)
+   {
+    ClimateInfo* climInfo = stations[i]->climate.load();
+    unless(climInfo)
+      climInfo = waitUntilPublished(stations[i], deadlinePtr);
+    unless(climInfo)
+     {
+      retVal = false;
+      break;
+     }
+    if(infos)
+      infos->push_back(climInfo);
+   }
+  waiters--;
+  return retVal;
+}
+
+
+// =======================================================================================
+/// @brief Wait till there is nothing left in the pipeline (eg at the end of a bulk 
+/// load).
+
+void GHCNPipeline::waitForIdle(void)
+{
+  roomWaiters++;
+  lock();
+  while(inFlight.load())
+    pthread_cond_wait(&roomAvailable, &mutex);
+  unlock();
+  roomWaiters--;
+}
+
+
+// =======================================================================================
+/// @brief Note the start of a bulk load, so we can report its progress.
+/// @param nStations The number of stations to be loaded.
+
+void GHCNPipeline::startBulkLoad(unsigned nStations)
+{
+  lock();
+  bulkTotal         = nStations;
+  bulkPublishedBase = published;
+  bulkBytesBase     = bytesParsed;
+  bulkRunning       = true;
+  bulkStart.now();
+  unlock();
+}
+
+
+// =======================================================================================
+/// @brief Note the end of a bulk load.
+
+void GHCNPipeline::endBulkLoad(void)
+{
+  lock();
+  bulkRunning = false;
+  bulkEnd.now();
+  double secs = bulkEnd - bulkStart;
+  unsigned long bytes = bytesParsed - bulkBytesBase;
+  unlock();
+  LogClimateDbOps("Bulk load of %u stations took %.1fs (%.1f MB parsed).\n", bulkTotal, 
+                                                                        secs, bytes/1.0e6);
+}
+
+
+// =======================================================================================
+/// @brief Output tables of the pipeline's progress and throughput, its memory use, and
+/// its reader threads.
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv The HttpServThread generating the page.
+
+bool GHCNPipeline::diagnosticHTML(HttpServThread* serv)
+{
+  // Overall counts
+  httPrintf("<b>GHCN station loading</b> (%u reader threads)\n", nReadThreads);
+  unless(serv->startTable())
+    return false;
+  httPrintf("<tr><th>Requested</th><th>Coalesced</th><th>Published</th>"
+                                          "<th>In pipeline</th><th>MB parsed</th></tr>\n");
+  httPrintf("<tr><td>%lu</td><td>%lu</td><td>%lu</td><td>%u</td><td>%.1f</td></tr>\n"
+                "</table>\n", requested.load(), coalesced.load(), published.load(), 
+                inFlight.load(), bytesParsed.load()/1.0e6);
+
+  // Memory use and eviction
+  if(memoryBudget)
+    httPrintf("<br><b>Station memory</b> (budget %.1f MB)\n", memoryBudget/1.0e6);
+  else
+    httPrintf("<br><b>Station memory</b> (no budget)\n");
+  unless(serv->startTable())
+    return false;
+  httPrintf("<tr><th>Resident stations</th><th>Resident MB</th><th>Evictions</th>"
+                                  "<th>MB evicted</th><th>Awaiting free</th></tr>\n");
+  httPrintf("<tr><td>%u</td><td>%.1f</td><td>%lu</td><td>%.1f</td><td>%u</td></tr>\n"
+                "</table>\n", residentCount.load(), residentBytes.load()/1.0e6, 
+                evictions.load(), evictedBytes.load()/1.0e6, retiredCount.load());
+
+  // The latest bulk load, if any
+  lock();
+  unsigned      total     = bulkTotal;
+  unsigned long done      = published - bulkPublishedBase;
+  unsigned long bytes     = bytesParsed - bulkBytesBase;
+  bool          running   = bulkRunning;
+  Timeval       end;
+  if(running)
+    end.now();
+  else
+    end = bulkEnd;
+  double        secs      = end - bulkStart;
+  unlock();
+  if(total)
+   {
+    if(done > total)
+      done = total;  // other requests may have been published during the load
+    httPrintf("<br><b>Bulk load</b> (%s)\n", running ? "running" : "finished");
+    unless(serv->startTable())
+      return false;
+    httPrintf("<tr><th>Stations</th><th>Done</th><th>Progress</th><th>Seconds</th>"
+                                            "<th>Stations/s</th><th>MB/s parsed</th></tr>\n");
+    httPrintf("<tr><td>%u</td><td>%lu</td><td>%.1f%%</td><td>%.1f</td><td>%.1f</td>"
+                    "<td>%.1f</td></tr>\n</table>\n", total, done, 100.0*done/total, secs, 
+                    secs > 0.0 ? done/secs : 0.0, secs > 0.0 ? bytes/1.0e6/secs : 0.0);
+   }
+  
+  // Our reader threads
+  httPrintf("<br>\n");
+  return readFarm->diagnosticTable(serv);
+}
+
+
+// =======================================================================================
@@ -0,0 +1,246 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+// k-nearest-neighbour index of the GHCN stations by great-circle distance.  Stations are
+// stored as unit vectors in a k-d tree, so that a 3D nearest neighbour search gives the
+// closest stations on the sphere, sorted nearest first.
+
+#include "GHCNStationIndex.h"
+#include "GHCNDatabase.h"
+#include "Global.h"
+#include <algorithm>
+#include <math.h>
+
+
+// =======================================================================================
+/// @brief The state of a single search, kept on the caller's stack so that searches are
+/// re-entrant.
+
+struct GHCNIndexQuery
+{
+  float     xyz[3];
+  unsigned  k;
+  float     elevation;
+  float     elevWeight;   // km of distance added per km of elevation difference
+  std::vector<std::pair<float, GHCNStation*> > best;  // max-heap on distance
+};
+
+
+// =======================================================================================
+/// @brief Helper to compare nodes on a particular axis while building.
+
+struct GHCNAxisLess
+{
+  unsigned axis;
+  GHCNAxisLess(unsigned a): axis(a) {}
+  bool operator()(const GHCNIndexNode& a, const GHCNIndexNode& b)
+                                                        {return a.xyz[axis] < b.xyz[axis];}
+};
+
+
+// =======================================================================================
+/// @brief Constructor
+
+GHCNStationIndex::GHCNStationIndex(void)
+{
+}
+
+
+// =======================================================================================
+/// @brief Destructor
+
+GHCNStationIndex::~GHCNStationIndex(void)
+{
+}
+
+
+// =======================================================================================
+/// @brief Convert a latitude and longitude to a unit vector from the centre of the earth
+/// (treated as a sphere).
+/// @param lat The latitude in degrees.
+/// @param longT The longitude in degrees.
+/// @param xyz The unit vector.
+
+void GHCNStationIndex::unitVector(float lat, float longT, float* xyz)
+{
+  double latR   = lat*M_PI/180.0;
+  double longR  = longT*M_PI/180.0;
+  xyz[0] = cos(latR)*cos(longR);
+  xyz[1] = cos(latR)*sin(longR);
+  xyz[2] = sin(latR);
+}
+
+
+// =======================================================================================
+/// @brief Find the great-circle distance between two points given as unit vectors.
+/// @returns The distance in km.
+/// @param xyz1 The first unit vector.
+/// @param xyz2 The second unit vector.
+
+float GHCNStationIndex::greatCircleKm(float* xyz1, float* xyz2)
+{
+  float dx = xyz1[0] - xyz2[0];
+  float dy = xyz1[1] - xyz2[1];
+  float dz = xyz1[2] - xyz2[2];
+  float halfChord = 0.5f*sqrtf(dx*dx + dy*dy + dz*dz);
+  if(halfChord > 1.0f)
+    halfChord = 1.0f;
+  return 2.0f*asinf(halfChord)*EARTH_RADIUS_KM;
+}
+
+
+// =======================================================================================
+/// @brief Add a station to the index.  Must be followed by a call to build() before the
+/// index is searched.
+/// @param station The station to add.
+
+void GHCNStationIndex::add(GHCNStation* station)
+{
+  GHCNIndexNode node;
+  unitVector(station->latLong[0], station->latLong[1], node.xyz);
+  node.station  = station;
+  node.axis     = 0u;
+  nodes.push_back(node);
+}
+
+
+// =======================================================================================
+/// @brief Arrange the stations added into the k-d tree.
+
+void GHCNStationIndex::build(void)
+{
+  buildRange(0u, nodes.size());
+}
+
+
+// =======================================================================================
+/// @brief Arrange one range of the node array into a subtree.
+///
+/// We split on whichever axis the points in the range are most spread out along, which
+/// copes better than cycling through the axes with points that all lie on a sphere.
+/// @param lo The first node of the range.
+/// @param hi One after the last node of the range.
+
+void GHCNStationIndex::buildRange(unsigned lo, unsigned hi)
+{
+  if(hi - lo < 2u)
+    return;
+
+  float minXYZ[3] = {2.0f, 2.0f, 2.0f};
+  float maxXYZ[3] = {-2.0f, -2.0f, -2.0f};
+  for(unsigned i=lo; i<hi; i++)
+    for(int m=0; m<3; m++)
+     {
+      if(nodes[i].xyz[m] < minXYZ[m])
+        minXYZ[m] = nodes[i].xyz[m];
+      if(nodes[i].xyz[m] > maxXYZ[m])
+        maxXYZ[m] = nodes[i].xyz[m];
+     }
+  unsigned axis = 0u;
+  for(unsigned m=1; m<3; m++)
+    if(maxXYZ[m] - minXYZ[m] > maxXYZ[axis] - minXYZ[axis])
+      axis = m;
+
+  unsigned mid = (lo + hi)/2;
+  std::nth_element(nodes.begin() + lo, nodes.begin() + mid, nodes.begin() + hi,
+                                                                    GHCNAxisLess(axis));
+  nodes[mid].axis = axis;
+  buildRange(lo, mid);
+  buildRange(mid + 1, hi);
+}
+
+
+// =======================================================================================
+/// @brief Find the k stations nearest to some place.
+/// @param lat The latitude of the place in degrees.
+/// @param longT The longitude of the place in degrees.
+/// @param k The number of stations wanted.
+/// @param results A vector (owned by the caller) for the stations found, nearest first.
+/// Any previous contents are cleared.
+/// @param distances If supplied, the distance (in km) to each station in results,
+/// including any addition for elevation.
+/// @param elevation The elevation of the place in meters, if elevation is to be taken
+/// into account.
+/// @param elevWeight How many km to add to a station's distance for each km of
+/// difference between its elevation and the place's.  Zero (the default) means to go on
+/// distance alone.
+
+void GHCNStationIndex::nearest(float lat, float longT, unsigned k,
+                                std::vector<GHCNStation*>& results,
+                                std::vector<float>* distances, float elevation,
+                                float elevWeight)
+{
+  GHCNIndexQuery query;
+  unitVector(lat, longT, query.xyz);
+  query.k           = k;
+  query.elevation   = elevation;
+  query.elevWeight  = (elevation == GHCN_NO_ELEVATION) ? 0.0f : elevWeight;
+  query.best.reserve(k + 1);
+  if(k)
+    searchRange(query, 0u, nodes.size());
+
+  std::sort_heap(query.best.begin(), query.best.end());
+  results.clear();
+  if(distances)
+    distances->clear();
+  for(unsigned i=0; i<query.best.size(); i++)
+   {
+    results.push_back(query.best[i].second);
+    if(distances)
+      distances->push_back(query.best[i].first);
+   }
+}
+
+
+// =======================================================================================
+/// @brief Search one subtree for stations closer than the worst we have so far.
+///
+/// The distance from the query point to the splitting plane along the node's axis is a
+/// lower bound on the chord to anything on the far side, and the chord is a lower bound
+/// on the great-circle distance (on a unit sphere), so we can skip the far side when
+/// that bound is already worse than our k-th best.
+/// @param query The state of the search.
+/// @param lo The first node of the range.
+/// @param hi One after the last node of the range.
+
+void GHCNStationIndex::searchRange(GHCNIndexQuery& query, unsigned lo, unsigned hi)
+{
+  if(lo >= hi)
+    return;
+  unsigned mid = (lo + hi)/2;
+  GHCNIndexNode& node = nodes[mid];
+
+  // Consider the node itself
+  float distance = greatCircleKm(query.xyz, node.xyz);
+  if(query.elevWeight > 0.0f && node.station->elevation != GHCN_NO_ELEVATION)
+    distance += query.elevWeight*fabsf(node.station->elevation - query.elevation)/1000.0f;
+  if(query.best.size() < query.k)
+   {
+    query.best.push_back(std::make_pair(distance, node.station));
+    std::push_heap(query.best.begin(), query.best.end());
+   }
+  else if(distance < query.best.front().first)
+   {
+    std::pop_heap(query.best.begin(), query.best.end());
+    query.best.back() = std::make_pair(distance, node.station);
+    std::push_heap(query.best.begin(), query.best.end());
+   }
+  if(hi - lo == 1u)
+    return;
+
+  // Near side first, then the far side if it could have anything better
+  float planeGap = query.xyz[node.axis] - node.xyz[node.axis];
+  if(planeGap < 0.0f)
+   {
+    searchRange(query, lo, mid);
+    if(query.best.size() < query.k || -planeGap*EARTH_RADIUS_KM < query.best.front().first)
+      searchRange(query, mid + 1, hi);
+   }
+  else
+   {
+    searchRange(query, mid + 1, hi);
+    if(query.best.size() < query.k || planeGap*EARTH_RADIUS_KM < query.best.front().first)
+      searchRange(query, lo, mid);
+   }
+}
+
+
+// =======================================================================================
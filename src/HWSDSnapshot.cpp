@@ -0,0 +1,223 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+// A flat binary snapshot of the HWSD_DATA table of the Harmonized World Soil Database.
+// It is built once from the MS Access database, and after that just memory-mapped at
+// startup, with records found through a dense table indexed by the soil mapping unit.
+
+#include "HWSDSnapshot.h"
+#include "Logging.h"
+#include "Global.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+
+
+// =======================================================================================
+// Helper for building the snapshot
+
+/// @brief Order records by mapping unit, and then by sequence within it.
+
+static bool recordLess(const HWSDRecord& a, const HWSDRecord& b)
+{
+  if(a.muGlobal != b.muGlobal)
+    return a.muGlobal < b.muGlobal;
+  return a.seq < b.seq;
+}
+
+
+// =======================================================================================
+/// @brief Constructor
+
+HWSDSnapshot::HWSDSnapshot(void): map(NULL),
+                                  mapSize(0u),
+                                  records(NULL),
+                                  nRecords(0u),
+                                  recordIndex(HWSD_MAX_MU, 0u)
+{
+  memset(presentBits, 0, sizeof(presentBits));
+}
+
+
+// =======================================================================================
+/// @brief Destructor
+
+HWSDSnapshot::~HWSDSnapshot(void)
+{
+  if(map)
+    munmap(map, mapSize);
+}
+
+
+// =======================================================================================
+/// @brief Map a snapshot file into memory, if it's there and up to date.
+///
+/// @returns True if the snapshot is now loaded, false if the file was missing, didn't
+/// match our layout, or is older than the .mdb file (in which case it should be
+/// rebuilt with build()).
+/// @param fileName The path to the snapshot file.
+/// @param mdbFileName The path to the .mdb file the snapshot should have been built
+/// from.  If that's not there, any snapshot of the right layout is accepted.
+
+bool HWSDSnapshot::load(const char* fileName, const char* mdbFileName)
+{
+  int fd = open(fileName, O_RDONLY);
+  if(fd < 0)
+   {
+    LogSoilDbOps("No HWSD snapshot file %s.\n", fileName);
+    return false;
+   }
+  struct stat snapStat;
+  if(fstat(fd, &snapStat) || snapStat.st_size < (off_t)sizeof(HWSDSnapshotHeader))
+   {
+    close(fd);
+    LogSoilDbErr("HWSD snapshot file %s is too short.\n", fileName);
+    return false;
+   }
+  size_t size = snapStat.st_size;
+  void* newMap = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(newMap == MAP_FAILED)
+   {
+    LogSoilDbErr("Couldn't map HWSD snapshot file %s.\n", fileName);
+    return false;
+   }
+
+  // Check it's the snapshot we want
+  HWSDSnapshotHeader* header = (HWSDSnapshotHeader*)newMap;
+  struct stat mdbStat;
+  bool haveMdb = (stat(mdbFileName, &mdbStat) == 0);
+  unless(memcmp(header->magic, HWSD_SNAPSHOT_MAGIC, 4) == 0
+          && header->version == HWSD_SNAPSHOT_VERSION
+          && header->recordSize == sizeof(HWSDRecord)
+          && size == sizeof(HWSDSnapshotHeader) 
+                                  + (size_t)header->recordCount*sizeof(HWSDRecord)
+          && (!haveMdb || (header->mdbModTime == (int64_t)mdbStat.st_mtime
+                                  && header->mdbSize == (int64_t)mdbStat.st_size)))
+   {
+    LogSoilDbOps("HWSD snapshot file %s is stale or mismatched.\n", fileName);
+    munmap(newMap, size);
+    return false;
+   }
+
+  if(map)
+    munmap(map, mapSize);
+  map       = newMap;
+  mapSize   = size;
+  records   = (const HWSDRecord*)(header + 1);
+  nRecords  = header->recordCount;
+  buildIndex();
+  LogSoilDbOps("Loaded %u HWSD records from snapshot %s.\n", nRecords, fileName);
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Write the rows of the HWSD_DATA table as a snapshot file.
+///
+/// The file is written under a temporary name and then renamed into place, so a reader
+/// never sees a partial file.
+/// @returns True if the snapshot was written, false if something went wrong.
+/// @param fileName The path to write the snapshot file to.
+/// @param mdbFileName The path to the .mdb file (for noting its time and size).
+/// @param newRecords The rows as imported from the .mdb file (these get sorted).
+
+bool HWSDSnapshot::build(const char* fileName, const char* mdbFileName, 
+                                                    std::vector<HWSDRecord>& newRecords)
+{
+  struct stat mdbStat;
+  if(stat(mdbFileName, &mdbStat))
+   {
+    LogSoilDbErr("Couldn't stat HWSD database %s.\n", mdbFileName);
+    return false;
+   }
+
+  std::sort(newRecords.begin(), newRecords.end(), recordLess);
+
+  // Write it and swap it into place
+  HWSDSnapshotHeader header;
+  memset(&header, 0, sizeof(HWSDSnapshotHeader));
+  memcpy(header.magic, HWSD_SNAPSHOT_MAGIC, 4);
+  header.version      = HWSD_SNAPSHOT_VERSION;
+  header.recordSize   = sizeof(HWSDRecord);
+  header.recordCount  = newRecords.size();
+  header.mdbModTime   = mdbStat.st_mtime;
+  header.mdbSize      = mdbStat.st_size;
+  char tmpName[256];
+  snprintf(tmpName, 256, "%s.tmp", fileName);
+  FILE* file = fopen(tmpName, "w");
+  unless(file)
+   {
+    LogSoilDbErr("Couldn't open HWSD snapshot file %s for writing.\n", tmpName);
+    return false;
+   }
+  bool ok = (fwrite(&header, sizeof(HWSDSnapshotHeader), 1, file) == 1);
+  if(ok && newRecords.size())
+    ok = (fwrite(newRecords.data(), sizeof(HWSDRecord), newRecords.size(), file)
+                                                                    == newRecords.size());
+  if(fclose(file))
+    ok = false;
+  unless(ok && rename(tmpName, fileName) == 0)
+   {
+    LogSoilDbErr("Couldn't write HWSD snapshot file %s.\n", fileName);
+    unlink(tmpName);
+    return false;
+   }
+  LogSoilDbOps("Wrote %lu HWSD records to snapshot %s.\n", newRecords.size(), fileName);
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Set up the dense table of record positions by mapping unit id, and the bitmap
+/// of which ids are present.
+///
+/// The records are sorted by muGlobal and then seq, so the first record seen for each
+/// id is the one with the lowest seq (the dominant soil).
+
+void HWSDSnapshot::buildIndex(void)
+{
+  memset(presentBits, 0, sizeof(presentBits));
+  for(unsigned i=0; i<nRecords; i++)
+   {
+    unsigned mu = records[i].muGlobal;
+    if(mu >= HWSD_MAX_MU)
+     {
+      LogSoilDbErr("HWSD record %u has out of range muGlobal %d.\n", i, 
+                                                                  records[i].muGlobal);
+      continue;
+     }
+    if(present(mu))
+      continue;
+    recordIndex[mu] = i;
+    presentBits[mu >> 6] |= 1ull << (mu & 63);
+   }
+}
+
+
+// =======================================================================================
+/// @brief Find the records for a whole batch of mapping units at once.
+///
+/// @returns The number of ids that had a record.
+/// @param n The number of ids to look up.
+/// @param ids The mapping unit ids (as found in the HWSD raster).
+/// @param found An array of n pointers to be filled in with the records (which live as
+/// long as we do), or NULL where an id has no record.
+
+unsigned HWSDSnapshot::findBatch(unsigned n, const unsigned short* ids, 
+                                                                const HWSDRecord** found)
+{
+  unsigned count = 0u;
+  for(unsigned i=0; i<n; i++)
+   {
+    found[i] = find(ids[i]);
+    if(found[i])
+      count++;
+   }
+  return count;
+}
+
+
+// =======================================================================================
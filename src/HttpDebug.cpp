@@ -16,6 +16,7 @@
 #include "Window3D.h"
 #include "Species.h"
 #include "GLFWApplication.h"
+#include "HttpRouteTable.h"
 #include <stdio.h>
 
 
@@ -137,127 +138,211 @@ bool HttpDebug::carbonSummary(void)
 
 
 // =======================================================================================
-/// @brief Process a single header, and construct the response.
-/// 
-/// Calls the HTTRequestParser instance to extract the URL, and then routes the request
-/// to whatever the apppropriate other object is to handle it.
+/// @brief Helper to queue a user interface action for the main thread to perform.
 /// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv The HttpDebug handling the request.
+/// @param url The balance of the URL, which describes the action.
+/// @param type The type of InterfaceAction to create.
 
-bool HttpDebug::processRequestHeader(void)
+bool debugInterfaceAction(HttpServThread* serv, char* url, ActionType type)
 {
-  char* url = reqParser.getUrl();
-  
-  if( (strlen(url) == 1 && url[0] == '/') || strncmp(url, "/index.", 7) == 0)
-    return indexPage();
-
-  scene.lock();
-  bool retVal = false;
-
-  // Possible paths (in alphabetical order  
-  if( strlen(url) == 7 && strncmp(url, "/alive/", 7) == 0)
-   {
-    internalPrintf("OK\n");
-    retVal = true;
-   }
-  
-  else if( strlen(url) >= 8 && strncmp(url, "/camera/", 8) == 0)
+  InterfaceAction* action = new InterfaceAction(type, url);
+  unless(action->valid)
    {
-    Window3D& win = windowApp.getActiveWin();
-    retVal =  win.camera.diagnosticHTML(this, url+8, scene);
+    LogRequestErrors("Couldn't create valid action of type %d from %s\n", type, url);
+    return false;
    }
-  
-  else if( strlen(url) == 8 && strncmp(url, "/carbon/", 8) == 0)
-    retVal =  carbonSummary();
+  ((HttpDebug*)serv)->scene.actions.push_back(action);
+  httPrintf("OK\n");
+  return true;
+}
 
-  else if( strlen(url) >= 7 && strncmp(url, "/click/", 7) == 0)
-   {
-    InterfaceAction* action = new InterfaceAction(Click, url+7);
-    if(action->valid)
-     {
-      scene.actions.push_back(action);
-      internalPrintf("OK\n");
-      retVal = true;
-     }
-    else
-      LogRequestErrors("Couldn't create valid click action from %s\n", url+7);
-  }
-
-  else if( strlen(url) >= 13 && strncmp(url, "/doubleclick/", 13) == 0)
-   {
-    InterfaceAction* action = new InterfaceAction(DoubleClick, url+13);
-    if(action->valid)
-     {
-      scene.actions.push_back(action);
-      internalPrintf("OK\n");
-      retVal = true;
-     }
-    else
-      LogRequestErrors("Couldn't create valid double click action from %s\n", url+13);
-   }
-    
-  else if( strlen(url) == 6 && strncmp(url, "/land/", 6) == 0)
-    retVal =  scene.land.diagnosticHTML(this);
 
-  else if( strlen(url) >= 8 && strncmp(url, "/logset/", 8) == 0)
-    retVal =  LogControlHTML(this, url+8);
+// =======================================================================================
+// Route handlers for HttpDebug.  All of these are called with the scene locked, and 
+// take the HttpDebug handling the request, the balance of the URL after the route, and
+// an unused context pointer (see HttpRouteTable).  They return true if all went well, 
+// false if we couldn't correctly write a good page.
+
+/// @brief Confirm the server is up.
+bool debugAliveRoute(HttpServThread* serv, char* url, void* context)
+{
+  httPrintf("OK\n");
+  return true;
+}
+
+/// @brief Diagnostics for the camera of the active window.
+bool debugCameraRoute(HttpServThread* serv, char* url, void* context)
+{
+  HttpDebug* debug = (HttpDebug*)serv;
+  Window3D& win = debug->windowApp.getActiveWin();
+  return win.camera.diagnosticHTML(serv, url, debug->scene);
+}
 
-  else if( strlen(url) == 10 && strncmp(url, "/memtrack/", 10) == 0)
-    retVal =  MemoryTracker::diagnosticHTML(this);
+/// @brief Summary of the carbon in the scene.
+bool debugCarbonRoute(HttpServThread* serv, char* url, void* context)
+{
+  return ((HttpDebug*)serv)->carbonSummary();
+}
 
-  else if( strlen(url) >=6 && strncmp(url, "/menu/", 6) == 0)
-    retVal =  menuInterface->HTTPAPi(this, url+6);
+/// @brief Simulate a mouse click.
+bool debugClickRoute(HttpServThread* serv, char* url, void* context)
+{
+  return debugInterfaceAction(serv, url, Click);
+}
 
-  else if( strlen(url) > 8 && strncmp(url, "/object/", 8) == 0)
-    retVal =  VisualObject::diagnosticHTMLSelection(this, url+8);
+/// @brief Simulate a mouse double click.
+bool debugDoubleClickRoute(HttpServThread* serv, char* url, void* context)
+{
+  return debugInterfaceAction(serv, url, DoubleClick);
+}
 
-  else if( strlen(url) == 7 && strncmp(url, "/otbuf/", 7) == 0)
-    retVal =  scene.sceneObjectTbuf->diagnosticHTML(this);
+/// @brief Diagnostics for the land surface.
+bool debugLandRoute(HttpServThread* serv, char* url, void* context)
+{
+  return ((HttpDebug*)serv)->scene.land.diagnosticHTML(serv);
+}
 
-  else if( strlen(url) >= 8 && strncmp(url, "/plants/", 8) == 0)
-    retVal =  Tree::treePageGateway(this, url+8);
+/// @brief Turn logging options on and off.
+bool debugLogSetRoute(HttpServThread* serv, char* url, void* context)
+{
+  return LogControlHTML(serv, url);
+}
 
-  else if( strlen(url) >= 6 && strncmp(url, "/quad/", 6) == 0)
-    retVal = scene.qtree->diagnosticHTML(this, url+6);
+/// @brief Memory usage by type of object.
+bool debugMemTrackRoute(HttpServThread* serv, char* url, void* context)
+{
+  return MemoryTracker::diagnosticHTML(serv);
+}
 
-  else if( strlen(url) > 12 && strncmp(url, "/quadsearch/", 12) == 0)
-    retVal = scene.qtree->quadSearchHTML(this, url+12);
+/// @brief Operate the menus.
+bool debugMenuRoute(HttpServThread* serv, char* url, void* context)
+{
+  return ((HttpDebug*)serv)->menuInterface->HTTPAPi(serv, url);
+}
 
-  else if( strlen(url) == 6 && strncmp(url, "/quit/", 6) == 0)
-   {
-    InterfaceAction* action = new InterfaceAction(QuitProgram, url+6);
-    if(action->valid)
-     {
-      scene.actions.push_back(action);
-      retVal = true;
-     }
-    else
-      LogRequestErrors("Couldn't create valid QuitProgram action from %s\n", url+7);
-   }
+/// @brief Diagnostics for a selected object.
+bool debugObjectRoute(HttpServThread* serv, char* url, void* context)
+{
+  return VisualObject::diagnosticHTMLSelection(serv, url);
+}
 
-  else if( strlen(url) == 12 && strncmp(url, "/skysamples/", 12) == 0)
-   {
-    SkySampleModel& sky = SkySampleModel::getSkySampleModel();
-    retVal =  sky.diagnosticHTML(this);
-   }
-  
-  else if( strlen(url) > 14 && strncmp(url, "/species/", 9) == 0)
-    retVal =  Species::findSpeciesForHTTPDebug(this, url+9);
+/// @brief Diagnostics for the scene object triangle buffer.
+bool debugOtBufRoute(HttpServThread* serv, char* url, void* context)
+{
+  return ((HttpDebug*)serv)->scene.sceneObjectTbuf->diagnosticHTML(serv);
+}
+
+/// @brief Pages about the plants in the scene.
+bool debugPlantsRoute(HttpServThread* serv, char* url, void* context)
+{
+  return Tree::treePageGateway(serv, url);
+}
 
-  else if( strlen(url) == 7 && strncmp(url, "/stbuf/", 7) == 0)
-    retVal =  scene.indicatorTbuf->diagnosticHTML(this);  
+/// @brief Diagnostics for the quadtree.
+bool debugQuadRoute(HttpServThread* serv, char* url, void* context)
+{
+  return ((HttpDebug*)serv)->scene.qtree->diagnosticHTML(serv, url);
+}
 
-  else if( strlen(url) == 12 && strncmp(url, "/taskqueues/", 12) == 0)
-    retVal =  threadFarm->diagnosticHTML(this);
+/// @brief Search the quadtree.
+bool debugQuadSearchRoute(HttpServThread* serv, char* url, void* context)
+{
+  return ((HttpDebug*)serv)->scene.qtree->quadSearchHTML(serv, url);
+}
 
-  else if( strlen(url) > 8 && strncmp(url, "/window/", 8) == 0)
-    retVal =  windowApp.HTTPGateway(this, url+8);
-  
-  else
+/// @brief Shut the program down.
+bool debugQuitRoute(HttpServThread* serv, char* url, void* context)
+{
+  HttpDebug* debug = (HttpDebug*)serv;
+  InterfaceAction* action = new InterfaceAction(QuitProgram, url);
+  unless(action->valid)
    {
-    LogRequestErrors("Request for unknown resource %s\n", url);
-    errorPage("Resource not found");
+    LogRequestErrors("Couldn't create valid QuitProgram action from %s\n", url);
+    return false;
    }
+  debug->scene.actions.push_back(action);
+  return true;
+}
+
+/// @brief Diagnostics for the sky sample model.
+bool debugSkySamplesRoute(HttpServThread* serv, char* url, void* context)
+{
+  SkySampleModel& sky = SkySampleModel::getSkySampleModel();
+  return sky.diagnosticHTML(serv);
+}
+
+/// @brief Find a species.
+bool debugSpeciesRoute(HttpServThread* serv, char* url, void* context)
+{
+  return Species::findSpeciesForHTTPDebug(serv, url);
+}
+
+/// @brief Diagnostics for the indicator triangle buffer.
+bool debugStBufRoute(HttpServThread* serv, char* url, void* context)
+{
+  return ((HttpDebug*)serv)->scene.indicatorTbuf->diagnosticHTML(serv);
+}
+
+/// @brief Load on the task queues of the main thread farm.
+bool debugTaskQueuesRoute(HttpServThread* serv, char* url, void* context)
+{
+  return threadFarm->diagnosticHTML(serv);
+}
+
+/// @brief Operate on the application windows.
+bool debugWindowRoute(HttpServThread* serv, char* url, void* context)
+{
+  return ((HttpDebug*)serv)->windowApp.HTTPGateway(serv, url);
+}
+
+
+// =======================================================================================
+/// @brief Add the routes of the debug interface to the route table of our load balancer.
+/// @param routes The HttpRouteTable of the HttpLBDebug we are serving for.
+
+void HttpDebug::registerRoutes(HttpRouteTable& routes)
+{
+  routes.addRoute("/alive/",      RouteExact,   debugAliveRoute);
+  routes.addRoute("/camera/",     RoutePrefix,  debugCameraRoute);
+  routes.addRoute("/carbon/",     RouteExact,   debugCarbonRoute);
+  routes.addRoute("/click/",      RoutePrefix,  debugClickRoute);
+  routes.addRoute("/doubleclick/", RoutePrefix, debugDoubleClickRoute);
+  routes.addRoute("/land/",       RouteExact,   debugLandRoute);
+  routes.addRoute("/logset/",     RoutePrefix,  debugLogSetRoute);
+  routes.addRoute("/memtrack/",   RouteExact,   debugMemTrackRoute);
+  routes.addRoute("/menu/",       RoutePrefix,  debugMenuRoute);
+  routes.addRoute("/object/",     RoutePrefix,  debugObjectRoute, nullptr, 1u);
+  routes.addRoute("/otbuf/",      RouteExact,   debugOtBufRoute);
+  routes.addRoute("/plants/",     RoutePrefix,  debugPlantsRoute);
+  routes.addRoute("/quad/",       RoutePrefix,  debugQuadRoute);
+  routes.addRoute("/quadsearch/", RoutePrefix,  debugQuadSearchRoute, nullptr, 1u);
+  routes.addRoute("/quit/",       RouteExact,   debugQuitRoute);
+  routes.addRoute("/skysamples/", RouteExact,   debugSkySamplesRoute);
+  routes.addRoute("/species/",    RoutePrefix,  debugSpeciesRoute, nullptr, 6u);
+  routes.addRoute("/stbuf/",      RouteExact,   debugStBufRoute);
+  routes.addRoute("/taskqueues/", RouteExact,   debugTaskQueuesRoute);
+  routes.addRoute("/window/",     RoutePrefix,  debugWindowRoute, nullptr, 1u);
+}
+
+
+// =======================================================================================
+/// @brief Process a single header, and construct the response.
+/// 
+/// Calls the HTTRequestParser instance to extract the URL, and then looks it up in the
+/// route table of our HttpLBDebug to find the handler (which runs with the scene 
+/// locked).
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+
+bool HttpDebug::processRequestHeader(void)
+{
+  char* url = reqParser->getUrl();
   
+  if( (strlen(url) == 1 && url[0] == '/') || strncmp(url, "/index.", 7) == 0)
+    return indexPage();
+
+  scene.lock();
+  bool retVal = routeRequest(url);
   scene.unlock();
 
   return retVal;
@@ -0,0 +1,146 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+// Thin wrapper around the kernel readiness notification mechanism (epoll on Linux,
+// kqueue on macOS/BSD) used by HttpLoadBalancer to watch all of its sockets from a
+// single thread.  Sockets are registered one-shot, so that once a socket has been
+// reported it stays quiet until whoever is working on it calls rearm().
+
+#include "HttpEventQueue.h"
+#include "Logging.h"
+#include <unistd.h>
+#include <err.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+
+// =======================================================================================
+/// @brief Constructor
+
+HttpEventQueue::HttpEventQueue(void)
+{
+#ifdef __linux__
+  queueFd = epoll_create1(0);
+#else
+  queueFd = kqueue();
+#endif
+  if(queueFd < 0)
+    err(-1, "Couldn't create event queue in HttpEventQueue::HttpEventQueue.\n");
+}
+
+
+// =======================================================================================
+/// @brief Destructor
+
+HttpEventQueue::~HttpEventQueue(void)
+{
+  close(queueFd);
+}
+
+
+// =======================================================================================
+/// @brief Start watching a new file descriptor for readability.
+/// @returns True if the descriptor was registered, false on error.
+/// @param fd The file descriptor (socket) to watch.
+/// @param data A pointer that will be returned by wait() when fd is readable.
+
+bool HttpEventQueue::add(int fd, void* data)
+{
+#ifdef __linux__
+  struct epoll_event event;
+  event.events    = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+  event.data.ptr  = data;
+  if(epoll_ctl(queueFd, EPOLL_CTL_ADD, fd, &event) < 0)
+#else
+  struct kevent event;
+  EV_SET(&event, fd, EVFILT_READ, EV_ADD | EV_DISPATCH, 0, 0, data);
+  if(kevent(queueFd, &event, 1, NULL, 0, NULL) < 0)
+#endif
+   {
+    LogRequestErrors("Couldn't add fd %d to event queue.\n", fd);
+    return false;
+   }
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Resume watching a file descriptor after it was reported by wait().
+/// @returns True if the descriptor was rearmed, false on error.
+/// @param fd The file descriptor (socket) to watch.
+/// @param data A pointer that will be returned by wait() when fd is readable.
+
+bool HttpEventQueue::rearm(int fd, void* data)
+{
+#ifdef __linux__
+  struct epoll_event event;
+  event.events    = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+  event.data.ptr  = data;
+  if(epoll_ctl(queueFd, EPOLL_CTL_MOD, fd, &event) < 0)
+#else
+  struct kevent event;
+  EV_SET(&event, fd, EVFILT_READ, EV_ENABLE | EV_DISPATCH, 0, 0, data);
+  if(kevent(queueFd, &event, 1, NULL, 0, NULL) < 0)
+#endif
+   {
+    LogRequestErrors("Couldn't rearm fd %d in event queue.\n", fd);
+    return false;
+   }
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Stop watching a file descriptor.
+///
+/// Should be called before the descriptor is closed.
+
+void HttpEventQueue::remove(int fd)
+{
+#ifdef __linux__
+  epoll_ctl(queueFd, EPOLL_CTL_DEL, fd, NULL);
+#else
+  struct kevent event;
+  EV_SET(&event, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+  kevent(queueFd, &event, 1, NULL, 0, NULL);
+#endif
+}
+
+
+// =======================================================================================
+/// @brief Wait for some of our file descriptors to become readable.
+/// @returns The number of entries written into ready (0 on timeout or interruption).
+/// @param ready An array into which the data pointers of ready descriptors are placed.
+/// @param maxReady The size of the ready array.
+/// @param timeoutMs How long to wait (in milliseconds) before giving up.
+
+int HttpEventQueue::wait(void** ready, int maxReady, int timeoutMs)
+{
+  int n;
+
+  if(maxReady > HTTP_EVENT_BATCH)
+    maxReady = HTTP_EVENT_BATCH;
+#ifdef __linux__
+  struct epoll_event events[HTTP_EVENT_BATCH];
+  n = epoll_wait(queueFd, events, maxReady, timeoutMs);
+  for(int i=0; i<n; i++)
+    ready[i] = events[i].data.ptr;
+#else
+  struct kevent   events[HTTP_EVENT_BATCH];
+  struct timespec timeout;
+  timeout.tv_sec  = timeoutMs/1000;
+  timeout.tv_nsec = (timeoutMs%1000)*1000000;
+  n = kevent(queueFd, NULL, 0, events, maxReady, &timeout);
+  for(int i=0; i<n; i++)
+    ready[i] = events[i].udata;
+#endif
+  if(n < 0)
+    return 0; // most likely EINTR, caller will just go round again
+  return n;
+}
+
+
+// =======================================================================================
@@ -0,0 +1,140 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+// Wrapper around zlib for gzip Content-Encoding of HTTP responses, either in one go or
+// a chunk at a time as a response is streamed.
+
+#include "HttpGzipStream.h"
+#include "Logging.h"
+#include <zlib.h>
+#include <err.h>
+
+#define GZIP_WINDOW_BITS  (15+16) // maximum window, plus 16 for a gzip wrapper
+
+
+// =======================================================================================
+/// @brief Constructor
+
+HttpGzipStream::HttpGzipStream(void):
+                                  active(false)
+{
+  stream = new z_stream;
+  stream->zalloc  = Z_NULL;
+  stream->zfree   = Z_NULL;
+  stream->opaque  = Z_NULL;
+  if(deflateInit2(stream, HTTP_GZIP_FAST_LEVEL, Z_DEFLATED, GZIP_WINDOW_BITS, 8, 
+                                                          Z_DEFAULT_STRATEGY) != Z_OK)
+    err(-1, "Couldn't initialize zlib in HttpGzipStream::HttpGzipStream.\n");
+}
+
+
+// =======================================================================================
+/// @brief Destructor
+
+HttpGzipStream::~HttpGzipStream(void)
+{
+  deflateEnd(stream);
+  delete stream;
+}
+
+
+// =======================================================================================
+/// @brief Check whether responses of some type are worth compressing.
+/// @returns True for text types, false for already compressed things like images.
+/// @param mimeType The MimeType of the response (NoMimeType means text/html).
+
+bool HttpGzipStream::compressible(MimeType mimeType)
+{
+  switch(mimeType)
+   {
+    case NoMimeType:
+    case TextHtml:
+    case TextJavascript:
+    case TextCss:
+    case TextPlain:
+    case ApplicationJson:
+      return true;
+    default:
+      return false;
+   }
+}
+
+
+// =======================================================================================
+/// @brief Begin compressing a new response.
+/// @returns True if all went well, false on a zlib error.
+/// @param level The zlib compression level to use.
+
+bool HttpGzipStream::start(int level)
+{
+  if(deflateReset(stream) != Z_OK || deflateParams(stream, level, Z_DEFAULT_STRATEGY) 
+                                                                              != Z_OK)
+   {
+    LogResponseErrors("Couldn't reset zlib stream in HttpGzipStream::start.\n");
+    return false;
+   }
+  output.clear();
+  active = true;
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Compress the next piece of the response.
+/// 
+/// The output is cleared first, so after this it has only the compressed bytes for this
+/// piece (which may be none, as zlib holds on to data until it has enough to be worth
+/// emitting).
+/// @returns True if all went well, false on a zlib error.
+/// @param in The next bytes of the response.
+/// @param inSize The number of bytes in.
+/// @param finish True if this is the end of the response.
+
+bool HttpGzipStream::compress(const char* in, unsigned inSize, bool finish)
+{
+  unless(active)
+    return false;
+  output.clear();
+  
+  stream->next_in   = (Bytef*)in;
+  stream->avail_in  = inSize;
+  int flush = finish ? Z_FINISH : Z_NO_FLUSH;
+  int result;
+  do
+   {
+    // Make sure there's a decent amount of room, then let zlib fill it
+    unsigned used = output.size();
+    output.resize(used + deflateBound(stream, stream->avail_in) + 64);
+    stream->next_out  = (Bytef*)&output[used];
+    stream->avail_out = output.size() - used;
+    result = deflate(stream, flush);
+    output.resize(output.size() - stream->avail_out);
+    if(result == Z_STREAM_ERROR)
+     {
+      LogResponseErrors("zlib error in HttpGzipStream::compress.\n");
+      active = false;
+      return false;
+     }
+   }
+  while(stream->avail_in || (finish && result != Z_STREAM_END));
+  
+  if(finish)
+    active = false;
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Compress a whole response in one go.
+/// @returns True if all went well, false on a zlib error.
+/// @param in The response body.
+/// @param inSize The number of bytes in the body.
+/// @param level The zlib compression level to use.
+
+bool HttpGzipStream::compressAll(const char* in, unsigned inSize, int level)
+{
+  unless(start(level))
+    return false;
+  return compress(in, inSize, true);
+}
+
+
+// =======================================================================================
@@ -15,8 +15,10 @@ HttpLBDebug::HttpLBDebug(unsigned short servPort, Scene& S, GLFWApplication& win
                     HttpLoadBalancer(servPort),
                     scene(S)
 {
-  for(unsigned i=0; i<HTTP_THREAD_COUNT;i++)
+  for(unsigned i=0; i<nHttpThreads;i++)
     httpThreads[i] = (TaskQueue*) new HttpDebug(scene, winApp, i, (HttpLoadBalancer*)this);
+  HttpDebug::registerRoutes(routes);
+  startServFarm();
 }
 
 
@@ -11,6 +11,8 @@
 #include "ClimateDatabase.h"
 #include "iTreeList.h"
 #include "PmodServer.h"
+#include "UserManager.h"
+#include "HttpResponseCache.h"
 #include "Logging.h"
 
 
@@ -20,6 +22,10 @@
 PermaservParams::PermaservParams(unsigned short port, unsigned flagsIn, float spacing):
                                             flags(flagsIn),
                                             climateFileSpacing(spacing),
+                                            climateMemoryMB(0u),
+                                            httpThreads(0u),
+                                            responseCacheMB(PERMASERV_DEFAULT_CACHE_MB),
+                                            listenBacklog(HTTP_DEFAULT_BACKLOG),
                                             servPort(port)
 {
   
@@ -30,9 +36,20 @@ PermaservParams::PermaservParams(unsigned short port, unsigned flagsIn, float sp
 
 HttpLBPermaserv::HttpLBPermaserv(PermaservParams& permaservParams):
                                     HttpLoadBalancer(permaservParams.servPort,
-                                            !(permaservParams.flags & PERMASERV_NO_USERS)),
+                                            !(permaservParams.flags & PERMASERV_NO_USERS),
+                                            permaservParams.httpThreads,
+                                            permaservParams.listenBacklog),
                                     params(permaservParams)
 {
+  // Cache for responses to the more expensive requests
+  if(params.responseCacheMB)
+   {
+    responseCache = new HttpResponseCache(params.responseCacheMB*1024ul*1024ul);
+    LogPermaservOps("Response cache of %u MB created.\n", params.responseCacheMB);
+   }
+  else
+    LogPermaservOps("Initializing without response cache.\n");
+  
   // Set up our component database objects
   
   // Solar Database
@@ -71,12 +88,14 @@ HttpLBPermaserv::HttpLBPermaserv(PermaservParams& permaservParams):
    }
   else if(params.flags & PERMASERV_CLIMATE_FILES)
    {
-    climateDatabase = new ClimateDatabase(params.climateFileSpacing);
-    LogPermaservOps("Full initialization of climate database complete.\n");
+    climateDatabase = new ClimateDatabase(params.climateFileSpacing, 
+                                                                params.climateMemoryMB);
+    LogPermaservOps("Initialization of climate database complete, loading all "
+                                                      "stations in background.\n");
    }
   else
    {
-    climateDatabase = new ClimateDatabase;
+    climateDatabase = new ClimateDatabase(-1.0f, params.climateMemoryMB);
     LogPermaservOps("Basic initialization of climate database complete.\n");
    }
 
@@ -96,11 +115,15 @@ HttpLBPermaserv::HttpLBPermaserv(PermaservParams& permaservParams):
   initializeScriptPages();
   initializeCSSPages();
   
+  // Routes to everything
+  registerRoutes();
+  
   // Run the threads to service requests
-  for(unsigned i=0; i<HTTP_THREAD_COUNT;i++)
+  for(unsigned i=0; i<nHttpThreads;i++)
     httpThreads[i] = (TaskQueue*) new HttpPermaServ(i, solarDatabase, soilDatabase, 
                                 climateDatabase, pmodServer, userSessions, treeList,
                                 (HttpLoadBalancer*)this);
+  startServFarm();
 }
 
 
@@ -112,33 +135,75 @@ HttpLBPermaserv::~HttpLBPermaserv(void)
 }
 
 
+// =======================================================================================
+/// @brief Set up the route table that maps URLs to whichever object will handle them.
+/// 
+/// Each database registers its own routes.  Where one isn't loaded, we register a route 
+/// that explains that to the client, rather than leaving them with "not found".
+
+void HttpLBPermaserv::registerRoutes(void)
+{
+  HttpPermaServ::registerRoutes(routes);
+  soilDatabase->registerRoutes(routes);
+
+  if(climateDatabase)
+   {
+    climateDatabase->registerRoutes(routes);
+    climateDatabase->setResponseCache(responseCache);
+   }
+  else
+    routes.addUnavailableRoute("/climate/", RoutePrefix, "Climate Database not loaded", 1u);
+  
+  if(pmodServer)
+    pmodServer->registerRoutes(routes);
+  else
+    routes.addUnavailableRoute("/oldf/", RoutePrefix, "PmodServer not loaded", 1u);
+
+  if(treeList)
+    treeList->registerRoutes(routes);
+  else
+    routes.addUnavailableRoute("/taxonomy/", RoutePrefix, "Taxonomy not available", 1u);
+
+  if(userSessions)
+    UserManager::getUserManager().registerRoutes(routes, userSessions);
+  else
+    routes.addUnavailableRoute("/user/", RoutePrefix, "User Management not enabled.", 1u);
+
+  // Static pages, with anything else of sufficient length tried in basicStaticPages
+  routes.addRoute("/css/",      RoutePrefix, pageSetRoute, cssPages, 5u);
+  routes.addRoute("/scripts/",  RoutePrefix, pageSetRoute, scriptPages, 4u);
+  routes.addRoute("/",          RoutePrefix, pageSetRoute, basicStaticPages, 7u);
+  LogPermaservOps("Route table set up with %u routes.\n", routes.routeCount());
+}
+
+
 // =======================================================================================
 /// @brief Function to set up static script pages that we serve.
 /// 
-/// Any script that we want to serve should be included in here and set to nullptr.  It will
-/// be loaded the first time it's requested.
+/// Any script that we want to serve should be added in here.  It will be loaded the 
+/// first time it's requested.
 
 void HttpLBPermaserv::initializeScriptPages(void)
 {
   scriptPages = new HttpPageSet((char*)"scripts/", TextJavascript);
   
-  scriptPages->insert({"test.js", nullptr});
-  scriptPages->insert({"graphs.js", nullptr});
-  scriptPages->insert({"checkUserPass.js", nullptr});
+  scriptPages->addPage("test.js");
+  scriptPages->addPage("graphs.js");
+  scriptPages->addPage("checkUserPass.js");
 }
 
 
 // =======================================================================================
 /// @brief Function to set up static css pages that we serve.
 /// 
-/// Any CSS file that we want to serve should be included in here and set to nullptr.  It will
-/// be loaded the first time it's requested.
+/// Any CSS file that we want to serve should be added in here.  It will be loaded the 
+/// first time it's requested.
 
 void HttpLBPermaserv::initializeCSSPages(void)
 {
   cssPages = new HttpPageSet((char*)"css/", TextCss);
   
-  cssPages->insert({"permaplan.css", nullptr});
+  cssPages->addPage("permaplan.css");
 }
 
 
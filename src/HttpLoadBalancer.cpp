@@ -2,6 +2,8 @@
 // This class has a basic load balancer which can accept connections and then hand
 // them off for processing via TaskQueues to HttpDebug which does the work of handling
 // an individual connection.  This allows multiple clients to talk to the HTTP interface.
+// All sockets are watched by a single event queue, and a connection is only handed to 
+// a worker when a whole request has arrived on it.
 
 #include "HttpLoadBalancer.h"
 #include "HttpDebug.h"
@@ -9,9 +11,18 @@
 #include "UserSession.h"
 #include "Logging.h"
 #include "HttpPageSet.h"
+#include "HttpEventQueue.h"
+#include "HttpRequestParser.h"
+#include "HttpResponseCache.h"
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
 
 #define SA struct sockaddr
 
@@ -22,14 +33,24 @@
 /// Creates the socket, binds to the port, and fires up a TaskQueueFarm of HttpServThread
 /// instances to handle future requests.
 /// @param servPort The server port to open up
-/// @param S A reference to the scene (pass through to the HttpDebug instances, which
-/// will need to interact with it.
-/// @param windowApp A reference to the GLFWApplication.
+/// @param haveSessions Whether to create a UserSessionGroup for logged in users.
+/// @param nThreads The number of HttpServThread workers in the farm.  If zero (the 
+/// default) we use one per online CPU core.
+/// @param backlog The backlog to pass to listen() on our socket.
 
-HttpLoadBalancer::HttpLoadBalancer(unsigned short servPort, bool haveSessions):
+HttpLoadBalancer::HttpLoadBalancer(unsigned short servPort, bool haveSessions,
+                                                          unsigned nThreads, int backlog):
                                     shutDownNow(false),
+                                    responseCache(nullptr),
+                                    nHttpThreads(nThreads),
+                                    acceptPaused(false),
+                                    listenBacklog(backlog),
                                     port(servPort)
 {
+  // A client hanging up while we are writing to it should be a failed write (which we 
+  // handle), not a signal that kills the whole server.
+  signal(SIGPIPE, SIG_IGN);
+  
   // Get a socket
   if((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
     err(-1, "Couldn't create socket in __func__\n");
@@ -45,9 +66,22 @@ HttpLoadBalancer::HttpLoadBalancer(unsigned short servPort, bool haveSessions):
     err(-1, "Couldn't bind socket on port %u in __func__\n", port);
 
   // Make our socket a server that will listen
-  if ((listen(sockfd, 6)) != 0)
+  if ((listen(sockfd, listenBacklog)) != 0)
     err(-1, "Listen failed on socket %d in __func__\n", sockfd);
 
+  // All our sockets are non-blocking and watched by the event queue.  The listening 
+  // socket is registered with a null data pointer to distinguish it from connections.
+  if(fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK) < 0)
+    err(-1, "Couldn't make socket %d non-blocking in __func__\n", sockfd);
+  eventQueue = new HttpEventQueue;
+  unless(eventQueue->add(sockfd, nullptr))
+    err(-1, "Couldn't watch socket %d in __func__\n", sockfd);
+  
+  // Hold a descriptor in reserve, so if we run out we can still accept a connection 
+  // and close it, rather than leave it pending (which would wake us over and over).
+  if((spareFd = open("/dev/null", O_RDONLY)) < 0)
+    LogRequestErrors("Couldn't open spare file descriptor.\n");
+
   // User session group
   if(haveSessions)
    {
@@ -62,8 +96,28 @@ HttpLoadBalancer::HttpLoadBalancer(unsigned short servPort, bool haveSessions):
 
   initializeBasicStaticPages();
   
-  httpThreads = new TaskQueue*[HTTP_THREAD_COUNT];  
-  servFarm = new TaskQueueFarm(HTTP_THREAD_COUNT, (TaskQueue**)httpThreads, (char*)"httpFarm");
+  // Size the farm (the threads themselves are created by our subclass)
+  unless(nHttpThreads)
+   {
+    long nCores = sysconf(_SC_NPROCESSORS_ONLN);
+    nHttpThreads = nCores > 0 ? (unsigned)nCores : 3u;
+   }
+  LogPermaservOps("HTTP farm on port %u sized at %u threads with listen backlog %d.\n",
+                                                      port, nHttpThreads, listenBacklog);
+  httpThreads = new TaskQueue*[nHttpThreads];  
+  servFarm = NULL;
+}
+
+
+// =======================================================================================
+/// @brief Put the worker threads to work in a farm.
+/// 
+/// Must be called by our subclass constructor once it has filled in httpThreads, as 
+/// the farm needs all the queues to exist so they can steal work from each other.
+
+void HttpLoadBalancer::startServFarm(void)
+{
+  servFarm = new TaskQueueFarm(nHttpThreads, (TaskQueue**)httpThreads, (char*)"httpFarm");
 }
 
 
@@ -73,54 +127,224 @@ HttpLoadBalancer::HttpLoadBalancer(unsigned short servPort, bool haveSessions):
 HttpLoadBalancer::~HttpLoadBalancer(void)
 {
   close(sockfd);
+  if(spareFd >= 0)
+    close(spareFd);
+  delete eventQueue;
 }
 
 
 // =======================================================================================
 /// @brief C function to pass to TaskQueue.
+///
+/// Processes the complete request(s) buffered on a connection and then hands the 
+/// connection back to the load balancer.
 
 void processOneConnection(void* arg, TaskQueue* T)
 {
   HttpServThread* http = (HttpServThread*)T;
   HttpLBWorkUnit* unit = (HttpLBWorkUnit*)arg;
-  int connfd = unit->fileDescriptor;
-  http->processOneHTTP1_1(connfd, unit->clientPort);
-  close(connfd);
+  
+  // A false return means the connection is finished with
+  unless(http->processOneHTTP1_1(unit->parser, unit->clientPort))
+    unit->parser->connectionWillClose = true;
   
   unit->servFarm->notifyTaskDone();   
+  unit->loadBalancer->returnConnection(unit);
+}
+
+
+// =======================================================================================
+/// @brief Called by workers when they have finished with a connection.
+/// 
+/// Either closes the connection, or puts it back in the event queue to wait for the
+/// next request.  Note this is called from the worker threads, not the load balancer 
+/// thread, which is fine as nothing else can be touching the connection while its 
+/// event is disarmed.
+/// @param unit The HttpLBWorkUnit for the connection.
+
+void HttpLoadBalancer::returnConnection(HttpLBWorkUnit* unit)
+{
+  if(unit->parser->connectionWillClose || unit->parser->connectionFinished() || shutDownNow)
+    closeConnection(unit);
+  else unless(eventQueue->rearm(unit->fileDescriptor, unit))
+    closeConnection(unit);
+}
+
+
+// =======================================================================================
+/// @brief Close a connection and free its resources.
+/// @param unit The HttpLBWorkUnit for the connection.
+
+void HttpLoadBalancer::closeConnection(HttpLBWorkUnit* unit)
+{
+  LogHTTPLoadBalance("Closing connection from client on port %u.\n", unit->clientPort);
+  eventQueue->remove(unit->fileDescriptor);
+  close(unit->fileDescriptor);
+  delete unit->parser;
   delete unit;
 }
 
 
 // =======================================================================================
-/// @brief Main connection processing loop.
+/// @brief Accept all the connections waiting on our listening socket.
 /// 
-/// Loop sitting on the socket accepting connections and handing them off to one of our
-/// TaskQueue instances to process.
+/// Each one is made non-blocking, given a work unit and request parser, and added to 
+/// the event queue.  If we are out of resources, the listening socket is left disarmed
+/// for a little while (see processConnections), so that the pending connections wait
+/// in the backlog.
 
-void* HttpLoadBalancer::processConnections(void)
+void HttpLoadBalancer::acceptConnections(void)
 {
+  struct sockaddr_in  cliaddr;
+  int                 connfd;
+
   while(1)
    {
-    // Accept a connection
-    unsigned len = sizeof(cliaddr);
+    socklen_t len = sizeof(cliaddr);
     if((connfd = accept(sockfd, (SA*)&cliaddr, &len)) < 0)
      {
-      if(shutDownNow)
+      if(errno == EAGAIN || errno == EWOULDBLOCK || shutDownNow)
         break;
-      else
-        err(-1, "Accept failed on socket %d in __func__\n", sockfd);
+      if(errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if(acceptFailed())
+        continue;
+      return;  // paused, so don't rearm
      }
     LogHTTPLoadBalance("Accepted connection from client on port %u.\n", cliaddr.sin_port);
     
+    if(fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL, 0) | O_NONBLOCK) < 0)
+     {
+      LogRequestErrors("Couldn't make connection %d non-blocking.\n", connfd);
+      close(connfd);
+      continue;
+     }
+    
+    // Responses are always sent in a single write (or corked around sendfile), so 
+    // there's nothing for Nagle to coalesce and it only adds delayed-ACK stalls.
+    int flag = 1;
+    if(setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag)) < 0)
+      LogRequestErrors("Couldn't set TCP_NODELAY on connection %d.\n", connfd);
+    
     HttpLBWorkUnit* unit  = new HttpLBWorkUnit;
     unit->fileDescriptor  = connfd;
     unit->servFarm        = servFarm;
+    unit->loadBalancer    = this;
     unit->clientPort      = cliaddr.sin_port;
+    unit->parser          = new HttpRequestParser(REQ_PARSER_BUF_SIZE);
+    unit->parser->setNewConnection(connfd);
     
+    unless(eventQueue->add(connfd, unit))
+     {
+      close(connfd);
+      delete unit->parser;
+      delete unit;
+     }
+   }
+  eventQueue->rearm(sockfd, nullptr);
+}
+
+
+// =======================================================================================
+/// @brief Deal with accept() failing on our listening socket for some reason other 
+/// than there being nothing to accept.
+/// 
+/// Running out of file descriptors or memory is logged and survived.  When out of 
+/// descriptors, we use our spare one to accept the connection at the head of the 
+/// queue and close it straight away, so the client gets an answer rather than a hang.
+/// Otherwise (or if that fails too) we pause accepting.  Anything else is a bug, and 
+/// is fatal.
+/// @returns True if it's worth trying accept() again now, false if we have paused
+/// accepting.
+
+bool HttpLoadBalancer::acceptFailed(void)
+{
+  int error = errno;
+  unless(error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM)
+    err(-1, "Accept failed on socket %d in __func__\n", sockfd);
+  
+  if((error == EMFILE || error == ENFILE) && spareFd >= 0)
+   {
+    close(spareFd);
+    int connfd = accept(sockfd, NULL, NULL);
+    if(connfd >= 0)
+      close(connfd);
+    spareFd = open("/dev/null", O_RDONLY);
+    if(connfd >= 0)
+     {
+      LogRequestErrors("Out of file descriptors: closed new connection.\n");
+      return true;
+     }
+   }
+  LogRequestErrors("Accept failed on socket %d (%s), pausing for %dms.\n", sockfd, 
+                                                  strerror(error), HTTP_ACCEPT_PAUSE_MS);
+  acceptPaused = true;
+  acceptPausedAt.now();
+  return false;
+}
+
+
+// =======================================================================================
+/// @brief Deal with data arriving on a connection.
+/// 
+/// Reads whatever is there, and if that completes a request, hands the connection to
+/// a worker.  Otherwise the connection goes back in the event queue to wait for more.
+/// @param unit The HttpLBWorkUnit for the connection.
+
+void HttpLoadBalancer::readConnection(HttpLBWorkUnit* unit)
+{
+  HttpRequestParser* parser = unit->parser;
+  
+  unless(parser->readAvailable())
+   {
+    closeConnection(unit);
+    return;
+   }
+  if(parser->requestComplete())
     servFarm->loadBalanceTask(processOneConnection, unit);
+  else if(parser->connectionFinished())
+    closeConnection(unit);
+  else unless(eventQueue->rearm(unit->fileDescriptor, unit))
+    closeConnection(unit);
+}
+
+
+// =======================================================================================
+/// @brief Main connection processing loop.
+/// 
+/// Loop waiting on the event queue for new connections or new data on existing ones,
+/// and handing complete requests off to one of our TaskQueue instances to process.
+
+void* HttpLoadBalancer::processConnections(void)
+{
+  void* ready[HTTP_EVENT_BATCH];
+  
+  while(1)
+   {
+    int nReady = eventQueue->wait(ready, HTTP_EVENT_BATCH, 
+                                acceptPaused ? HTTP_ACCEPT_PAUSE_MS : HTTP_LB_WAIT_MS);
+    
+    for(int i=0; i<nReady; i++)
+     {
+      if(ready[i])
+        readConnection((HttpLBWorkUnit*)ready[i]);
+      else
+        acceptConnections();
+     }
+    
+    // Start accepting again after a pause for lack of resources
+    if(acceptPaused)
+     {
+      Timeval timeNow;
+      timeNow.now();
+      if((timeNow - acceptPausedAt)*1000.0 >= HTTP_ACCEPT_PAUSE_MS)
+       {
+        acceptPaused = false;
+        eventQueue->rearm(sockfd, nullptr);
+       }
+     }
         
-    for(int i=0; i<HTTP_THREAD_COUNT; i++)
+    for(unsigned i=0; i<nHttpThreads; i++)
      {
       //fprintf(stderr, "Checking timeToDie on %d: %d.\n", i, httpThreads[i]->timeToDie);
       if(httpThreads[i]->timeToDie)
@@ -135,6 +359,36 @@ void* HttpLoadBalancer::processConnections(void)
 }
 
 
+// =======================================================================================
+/// @brief Provide a diagnostic page about the HTTP worker farm.
+/// 
+/// Shows how the farm is configured and the current queue depth on each thread, so 
+/// that the thread count can be sized from data.
+/// @returns True if the desired HTML was written correctly, false if we ran out of space.
+/// @param serv The HTTP server thread that is handling this request
+
+bool HttpLoadBalancer::diagnosticHTML(HttpServThread* serv)
+{
+  unless(serv->startResponsePage("HTTP Task Queues", 5u))
+    return false;
+  
+  httPrintf("<center>\n");
+  httPrintf("<b>Port:</b> %u <b>Threads:</b> %u <b>Listen backlog:</b> %d<br>\n", 
+                                                    port, nHttpThreads, listenBacklog);
+  unless(servFarm->diagnosticTable(serv))
+    return false;
+  if(responseCache)
+   {
+    httPrintf("<br>\n");
+    unless(responseCache->diagnosticHTML(serv))
+      return false;
+   }
+  httPrintf("</center>\n");
+  
+  return serv->endResponsePage();
+}
+
+
 // =======================================================================================
 /// @brief Function to set up static images etc that we serve.
 /// 
@@ -144,13 +398,13 @@ void HttpLoadBalancer::initializeBasicStaticPages(void)
 {
   basicStaticPages = new HttpPageSet((char*)"");
   
-  basicStaticPages->insert({"favicon-16x16.png", NULL});
-  basicStaticPages->insert({"favicon-32x32.png", NULL});
-  basicStaticPages->insert({"favicon.ico", NULL});
-  basicStaticPages->insert({"site.webmanifest", NULL});
-  basicStaticPages->insert({"android-chrome-192x192.png", NULL});
-  basicStaticPages->insert({"android-chrome-512x512.png", NULL});
-  basicStaticPages->insert({"apple-touch-icon.png", NULL});
+  basicStaticPages->addPage("favicon-16x16.png");
+  basicStaticPages->addPage("favicon-32x32.png");
+  basicStaticPages->addPage("favicon.ico");
+  basicStaticPages->addPage("site.webmanifest");
+  basicStaticPages->addPage("android-chrome-192x192.png");
+  basicStaticPages->addPage("android-chrome-512x512.png");
+  basicStaticPages->addPage("apple-touch-icon.png");
 }
 
 
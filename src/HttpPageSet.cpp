@@ -36,70 +36,85 @@ HttpPageSet::~HttpPageSet(void)
 
 
 // =======================================================================================
-/// @brief Provide a page, if we have it
+/// @brief Add a page to the set of those we will serve.
 /// 
-/// @returns true if all went well, false if we ran out of space or other problem.
-/// @param serv pointer to the HTTP serv thread object we need to send our page too.
-/// @param url A char* pointer to the url being requested (relative to the path of this
-/// particular HttpPageSet).  Note only urls we have been preconfigured to serve will be
-/// served, so we don't need to explicitly check for "../" and the like.
-/// @todo The result of the strlen could be cached to make this a tiny bit more efficient.
+/// The file isn't touched until the first time the page is requested.  This must only 
+/// be called during setup, before any server threads are using the set.
+/// @param name A C-string of the url of the page (relative to the path of this 
+/// particular HttpPageSet).  This is also the name of the file within our path.
 
-bool HttpPageSet::processPageRequest(HttpServThread* serv, char* url)
+void HttpPageSet::addPage(const char* name)
 {
-  lock();
-  if(count(url))
+  // Determine the mime type if necessary
+  MimeType mType;
+  unless(mimeType == NoMimeType)
+    mType = mimeType;
+  else
    {
-    HttpStaticPage* page = at(url);
-    
-    // Load the page if necessary
-    if(!page)
-     {
-      strncpy(urlBufPtr, url, STAT_URL_BUF_SIZE - (urlBufPtr-urlBuf));
-      page = new HttpStaticPage(urlBuf);
-      (*this)[url] = page;
-     }
-    
-    // Determine the mime type if necessary
-    MimeType mType;
-    unless(mimeType == NoMimeType)
-      mType = mimeType;
-    else
+    // Try to get it from extension
+    const char* ptr = rindex(name, '.');
+    if(ptr && *(++ptr) != '\0')
      {
-      // Try to get it from extension
-      const char* ptr = rindex(url, '.');
-      if(ptr && *(++ptr) != '\0')
-       {
-        ExtensionMimeTypeMap& map = ExtensionMimeTypeMap::getMap();
-        unless(map.count(ptr))
-         {
-          mType = ApplicationOctetStream; // may not be a great solution
-          LogResponseErrors("Delivering response with default mime type "
-                                              "for unknown extension %s.\n", ptr);
-         }
-        else
-          mType = map[ptr];
-       }
-      else
+      ExtensionMimeTypeMap& map = ExtensionMimeTypeMap::getMap();
+      unless(map.count(ptr))
        {
         mType = ApplicationOctetStream; // may not be a great solution
         LogResponseErrors("Delivering response with default mime type "
-                                                          "to request for %s.\n", url);
+                                            "for unknown extension %s.\n", ptr);
        }
+      else
+        mType = map[ptr];
+     }
+    else
+     {
+      mType = ApplicationOctetStream; // may not be a great solution
+      LogResponseErrors("Delivering response with default mime type "
+                                                        "to request for %s.\n", name);
      }
-    
-    // Set up the response for delivery to the client
-    char* response = page->getResponse();
-    serv->setAltResp(response, page->respBufSize, mType); 
-    serv->setCacheDuration(CACHE_DURATION);
-    unlock();
-    return true;
    }
-  else
-   {
-    unlock();
+  
+  strncpy(urlBufPtr, name, STAT_URL_BUF_SIZE - (urlBufPtr-urlBuf));
+  (*this)[name] = new HttpStaticPage(urlBuf, mType);
+}
+
+
+// =======================================================================================
+/// @brief Provide a page, if we have it
+/// 
+/// No locking is needed here as the map doesn't change once we are serving.  The page 
+/// will be sent by the server thread directly from the file (see HttpStaticPage).
+/// @returns true if all went well, false if we ran out of space or other problem.
+/// @param serv pointer to the HTTP serv thread object we need to send our page too.
+/// @param url A char* pointer to the url being requested (relative to the path of this
+/// particular HttpPageSet).  Note only urls we have been preconfigured to serve will be
+/// served, so we don't need to explicitly check for "../" and the like.
+
+bool HttpPageSet::processPageRequest(HttpServThread* serv, char* url)
+{
+  auto iter = find(url);
+  if(iter == end())
     return serv->errorPage("Resource Not Found.");
-   }
+  
+  HttpStaticPage* page = iter->second;
+  unless(page->load())
+    return serv->errorPage("Resource Not Available.");
+  
+  serv->setStaticPage(page);
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief C function to use as an HttpRouteTable handler for the pages in a set.
+/// @returns true if all went well, false if we ran out of space or other problem.
+/// @param serv pointer to the HTTP serv thread object we need to send our page too.
+/// @param url The balance of the url after the route (ie relative to the page set).
+/// @param context A pointer to the HttpPageSet.
+
+bool pageSetRoute(HttpServThread* serv, char* url, void* context)
+{
+  LogPermaservOpDetails("Processing static page request for %s.\n", url);
+  return ((HttpPageSet*)context)->processPageRequest(serv, url);
 }
 
 
@@ -1,5 +1,7 @@
 // Copyright Staniford Systems.  All Rights Reserved.  January 2022 -
-// This class ..... is a template for real classes
+// Http processing for requests to the permaserv server.  Requests are dispatched via
+// the route table of our HttpLBPermaserv, to which we add the handful of routes that
+// we handle ourselves.
 
 #include "HttpPermaServ.h"
 #include "Logging.h"
@@ -12,6 +14,7 @@
 #include "UserManager.h"
 #include "UserSession.h"
 #include "Taxonomy.h"
+#include "HttpRouteTable.h"
 
 
 // =======================================================================================
@@ -76,6 +79,10 @@ bool HttpPermaServ::indexPage(void)
                                               "soil?loLat:hiLat:loLong:hiLong:</a></td>");
   internalPrintf("<td>Soil Profiles in region (json).</td></tr>\n");
 
+  // Task queues (load on the HTTP worker threads)
+  internalPrintf("<tr><td><a href=\"/taskqueues/\">taskqueues/</a></td>");
+  internalPrintf("<td>Queue depth on each HTTP worker thread.</td></tr>\n");
+
   // End table
   internalPrintf("</table></center>\n");
 
@@ -207,203 +214,141 @@ bool HttpPermaServ::processDNIRequest(char* url)
 
 
 // =======================================================================================
-/// @brief Process the case of a request for the soil profiles available in some specific
-/// region of lat/long space.
-/// @param url The balance of the URL that we are to deal with (ie after the '?')
+/// @brief Add the routes that HttpPermaServ handles itself to a route table.
+/// 
+/// Routes to the various databases are added by those objects themselves (see eg
+/// ClimateDatabase::registerRoutes), and static pages by HttpLBPermaserv.
+/// @param routes The HttpRouteTable of the HttpLBPermaserv we are serving for.
+
+void HttpPermaServ::registerRoutes(HttpRouteTable& routes)
+{
+  routes.addRoute("/",             RouteExact,   routeIndex);
+  routes.addRoute("/index.",       RoutePrefix,  routeIndex);
+  routes.addRoute("/alive/",       RouteExact,   routeAlive);
+  routes.addRoute("/compileTime/", RouteExact,   routeCompileTime);
+  routes.addRoute("/dif",          RouteQuery,   routeDIF, nullptr, 4, true);
+  routes.addRoute("/dni",          RouteQuery,   routeDNI, nullptr, 4, true);
+  routes.addRoute("/quit/",        RouteExact,   routeQuit);
+  routes.addRoute("/taskqueues/",  RouteExact,   routeTaskQueues);
+}
+
+
+// =======================================================================================
+/// @brief Route handler for the index page (see indexPage).
 /// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv The HttpPermaServ handling the request.
+/// @param url The balance of the URL after the route (ignored).
+/// @param context Unused.
 
-bool HttpPermaServ::processSoilRequest(char* url)
+bool HttpPermaServ::routeIndex(HttpServThread* serv, char* url, void* context)
 {
-  float latLongRegion[4]; // (loLat, hiLat, loLong, hiLong) 
-  unless(extractColonVecN(url, 4, latLongRegion))
-   {
-    LogRequestErrors("Bad soil request: soil?%s\n", url);
-    return false;
-   }
-  unless(checkLatLongRegion(latLongRegion))
-   {
-    LogRequestErrors("Bad parameters in soil request: soil?%s\n", url);
-    return false;
-   }
-  
-  if( (respPtr += soilDatabase->printJsonSoilProfiles(respPtr, respEnd-respPtr, 
-                    latLongRegion[0], latLongRegion[1], latLongRegion[2], latLongRegion[3]))
-          >= respEnd)
-   {
-    LogSoilDbErr("Overflow in json response to soil request %s.\n", url);
-    respBufOverflow = true; 
-    return false;
-   }
-  LogPermaservOps("Serviced soil request for %f,%f,%f,%f from client on port %u.\n", 
-                  latLongRegion[0], latLongRegion[1], latLongRegion[2], latLongRegion[3],
-                  clientP);
+  LogPermaservOpDetails("Processing index request.\n");
+  return ((HttpPermaServ*)serv)->indexPage();
+}
+
+
+// =======================================================================================
+/// @brief Route handler for /alive/ to confirm the server is up.
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv The HttpPermaServ handling the request.
+/// @param url The balance of the URL after the route (ignored).
+/// @param context Unused.
+
+bool HttpPermaServ::routeAlive(HttpServThread* serv, char* url, void* context)
+{
+  LogPermaservOpDetails("Processing alive check request.\n");
+  httPrintf("OK at time %ld\n", time(NULL));
   return true;
 }
 
 
 // =======================================================================================
-/// @brief Process a single header, and construct the response.
-/// 
-/// Calls the HTTRequestParser instance to extract the URL, and then routes the request
-/// to whatever the apppropriate other object is to handle it.
+/// @brief Route handler for /compileTime/ to report when the server was compiled.
 /// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv The HttpPermaServ handling the request.
+/// @param url The balance of the URL after the route (ignored).
+/// @param context Unused.
 
-bool HttpPermaServ::processRequestHeader(void)
+bool HttpPermaServ::routeCompileTime(HttpServThread* serv, char* url, void* context)
 {
-  bool retVal   = false;
-  char* url     = reqParser.getUrl();
-  int strlenUrl = strlen(url);
-  
-  LogPermaservOpDetails("Got request for url %s.\n", url);
+  LogPermaservOpDetails("Processing compileTime request.\n");
+  HttpLBPermaserv* parent = (HttpLBPermaserv*)((HttpPermaServ*)serv)->parentLB;
+  httPrintf("compileTime: %ld\n", parent->params.compileTime);
+  return true;
+}
 
-  // Possible paths (in alphabetical order
 
-  // / or index
-  if( (strlenUrl == 1 && url[0] == '/') || strncmp(url, "/index.", 7) == 0)
-   {
-    LogPermaservOpDetails("Processing index request.\n");
-    return indexPage();
-   }
-  
-  // alive
-  else if( strlenUrl == 7 && strncmp(url, "/alive/", 7) == 0)
-   {
-    LogPermaservOpDetails("Processing alive check request.\n");
-    internalPrintf("OK at time %ld\n", time(NULL));
-    retVal = true;
-   }
-  
-  // climate
-  else if( strlenUrl > 9 && strncmp(url, "/climate/", 9) == 0)
-   {
-    unless(climateDatabase)
-     {
-      LogRequestErrors("Climate Database not loaded for %s\n", url);
-      errorPage("Climate Database not loaded");
-     }
-    else
-     {
-      LogPermaservOpDetails("Processing climate request for %s.\n", url+9);
-      retVal = climateDatabase->processHttpRequest(this, url+9);
-     }
-   }
+// =======================================================================================
+/// @brief Route handler for /quit/ to shut the server down.
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv The HttpPermaServ handling the request.
+/// @param url The balance of the URL after the route (ignored).
+/// @param context Unused.
 
-  // compileTime
-  else if( strlenUrl == 13 && strncmp(url, "/compileTime/", 13) == 0)
-   {
-    LogPermaservOpDetails("Processing compileTime request.\n");
-    internalPrintf("compileTime: %ld\n", ((HttpLBPermaserv*)parentLB)->params.compileTime);
-    retVal = true;
-   }
+bool HttpPermaServ::routeQuit(HttpServThread* serv, char* url, void* context)
+{
+  LogPermaservOpDetails("Processing quit request.\n");
+  httPrintf("Quitting at time %ld\n", time(NULL));
+  ((HttpPermaServ*)serv)->timeToDie = true;
+  return true;
+}
 
-  // css
-  else if( strlenUrl >= 10 && strncmp(url, "/css/", 5) == 0)
-    {
-     LogPermaservOpDetails("Processing css request for %s.\n", url+5);
-     HttpPageSet& cssPages = *(((HttpLBPermaserv*)parentLB)->cssPages);
-     retVal = cssPages.processPageRequest(this, url+5);
-    }
-  
-  // dif
-  else if( strlenUrl >= 9 && strncmp(url, "/dif?", 5) == 0)
-   {
-    LogPermaservOpDetails("Processing DIF request for %s.\n", url+5);
-    retVal = processDIFRequest(url+5);
-   }
 
-  // dni
-  else if( strlenUrl >= 9 && strncmp(url, "/dni?", 5) == 0)
-   {
-    LogPermaservOpDetails("Processing DNI request for %s.\n", url+5);
-    retVal = processDNIRequest(url+5);
-   }
+// =======================================================================================
+/// @brief Route handler for /taskqueues/ to show the load on the HTTP worker threads.
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv The HttpPermaServ handling the request.
+/// @param url The balance of the URL after the route (ignored).
+/// @param context Unused.
 
-  // oldf
-  else if( strlenUrl > 6 && strncmp(url, "/oldf/", 6) == 0)
-   {
-    unless(pmodServer)
-     {
-      LogRequestErrors("PmodServer not loaded for OLDF on %s\n", url);
-      errorPage("PmodServer not loaded");
-     }
-    else
-     {
-      LogPermaservOpDetails("Processing pmodserver request for %s.\n", url+6);
-      retVal = pmodServer->processHttpRequest(this, url+6);
-     }
-   }
+bool HttpPermaServ::routeTaskQueues(HttpServThread* serv, char* url, void* context)
+{
+  LogPermaservOpDetails("Processing taskqueues request.\n");
+  return ((HttpPermaServ*)serv)->parentLB->diagnosticHTML(serv);
+}
 
-  // quit
-  else if( strlenUrl == 6 && strncmp(url, "/quit/", 6) == 0)
-   {
-    LogPermaservOpDetails("Processing quit request.\n");
-    internalPrintf("Quitting at time %ld\n", time(NULL));
-    timeToDie = true;
-    retVal = true;
-   }
 
-   // scripts
-   else if( strlenUrl >= 13 && strncmp(url, "/scripts/", 9) == 0)
-    {
-     LogPermaservOpDetails("Processing scripts request for %s.\n", url+9);
-     HttpPageSet& scripts = *(((HttpLBPermaserv*)parentLB)->scriptPages);
-     retVal = scripts.processPageRequest(this, url+9);
-    }
+// =======================================================================================
+/// @brief Route handler for /dif? requests (see processDIFRequest).
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv The HttpPermaServ handling the request.
+/// @param url The balance of the URL after the '?'.
+/// @param context Unused.
 
-  // soil
-  else if( strlenUrl >= 14 && strncmp(url, "/soil?", 6) == 0)
-   {
-    LogPermaservOpDetails("Processing soil request for %s.\n", url+6);
-    retVal = processSoilRequest(url+6);
-   }
+bool HttpPermaServ::routeDIF(HttpServThread* serv, char* url, void* context)
+{
+  LogPermaservOpDetails("Processing DIF request for %s.\n", url);
+  return ((HttpPermaServ*)serv)->processDIFRequest(url);
+}
 
-  // taxonomy
-  else if( strlenUrl > 10 && strncmp(url, "/taxonomy/", 10) == 0)
-   {
-    unless(taxonomy)
-     {
-      LogRequestErrors("Taxonomy not loaded on %s\n", url);
-      errorPage("Taxonomy not available");
-     }
-    else
-     {
-      LogPermaservOpDetails("Processing taxonomy request for %s.\n", url+10);
-      retVal = taxonomy->processHttpRequest(this, url+10);
-     }
-   }
 
-  // user/
-  else if( strlenUrl > 6 && strncmp(url, "/user/", 6) == 0)
-   {
-    unless(userSessions)
-     {
-      LogRequestErrors("User Management not enabled for %s\n", url);
-      errorPage("User Management not enabled.");
-     }
-    else
-     {
-      UserManager& userManager = UserManager::getUserManager();
-      LogPermaservOpDetails("Processing user manager request for %s.\n", url+6);
-      retVal = userManager.processHttpRequest(this, url+6, userSessions);
-     }
-   }
+// =======================================================================================
+/// @brief Route handler for /dni? requests (see processDNIRequest).
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv The HttpPermaServ handling the request.
+/// @param url The balance of the URL after the '?'.
+/// @param context Unused.
 
-  // basic objects from parent (eg favicon.ico)
-  else if( strlenUrl >= 8 && *url == '/' )
-   {
-    LogPermaservOpDetails("Processing / request for %s.\n", url+1);
-    HttpPageSet& basic = *(parentLB->basicStaticPages);
-    retVal = basic.processPageRequest(this, url+1);
-   }
+bool HttpPermaServ::routeDNI(HttpServThread* serv, char* url, void* context)
+{
+  LogPermaservOpDetails("Processing DNI request for %s.\n", url);
+  return ((HttpPermaServ*)serv)->processDNIRequest(url);
+}
 
- //Default - failure
- else
-  {
-   LogRequestErrors("Request for unknown resource %s\n", url);
-   errorPage("Resource not found");
-  }
-    
-  return retVal;
+
+// =======================================================================================
+/// @brief Process a single header, and construct the response.
+/// 
+/// Calls the HTTRequestParser instance to extract the URL, and then looks it up in the
+/// route table of our HttpLBPermaserv to find the object that should handle it.
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+
+bool HttpPermaServ::processRequestHeader(void)
+{
+  char* url = reqParser->getUrl();
+  
+  LogPermaservOpDetails("Got request for url %s.\n", url);
+  return routeRequest(url);
 }
 
 
@@ -1,11 +1,11 @@
 // Copyright Staniford Systems.  All Rights Reserved.  May 2021 -
 // The purpose of this class is to read from a socket, identify the boundaries of
 // whole HTTP request messages, and return a pointer to the beginning of such
-// messages.  Right now, it doesn't deal with requests with entity bodies (because
-// it doesn't need to).  It null terminates the header so that higher layers that
-// call on this one can treat the request header as a single string if they wish.
-// We try to minimize extra copying, but there may be situations where some copying
-// within our buffer is necessary.
+// messages.  It null terminates the header so that higher layers that call on this 
+// one can treat the request header as a single string if they wish.  There is one
+// of these per connection, and it is fed non-blocking reads by the HttpLoadBalancer
+// until a complete request is present.  Requests are parsed in place wherever they 
+// fall in the buffer, and bodies too large for the buffer get a buffer of their own.
 
 #include "HttpRequestParser.h"
 #include "HTMLForm.h"
@@ -17,13 +17,37 @@
 #include <netinet/in.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
 #include <err.h>
 #include <assert.h>
 
 
+// =======================================================================================
+// Static variables
+
+// Map for recognizing HTTP header strings (which are case insensitive).  This is 
+// shared by all parsers (one per connection), so is only ever read after startup.
+// https://stackoverflow.com/questions/5258977/are-http-headers-case-sensitive
+
+std::unordered_map<std::string, HTTPHeaderType> HttpRequestParser::headerMap = 
+{
+  {"connection",        Connection},
+  {"user-agent",        UserAgent},
+  {"content-length",    ContentLength},
+  {"content-type",      ContentType},
+  {"transfer-encoding", TransferEncoding},
+  {"upgrade",           Upgrade},
+  {"cookie",            Cookie},
+  {"if-none-match",     IfNoneMatch},
+  {"accept-encoding",   AcceptEncoding},
+};
+
+
 // =======================================================================================
 /// @brief Constructor
 /// @param size The number of bytes to use in the request parsing buffer (currently we 
@@ -42,20 +66,12 @@ HttpRequestParser::HttpRequestParser(unsigned size):
   // Zero out ptrs that we wouldn't want to accidentally delete on random initial state
   parsedBody  = nullptr;
   multiFile   = nullptr;
+  bodyBuf     = nullptr;
+  connfd      = -1;
 
   // Non buffer initialization in here:
   resetForNewConnection();  
-  
-  // Set up the map for recognizing HTTP header strings (which are case insensitive)
-  // https://stackoverflow.com/questions/5258977/are-http-headers-case-sensitive
   LogRequestParsing("Request parser initialized with buffer size %u.\n", bufSize);
-  headerMap["connection"]         = Connection;
-  headerMap["user-agent"]         = UserAgent;
-  headerMap["content-length"]     = ContentLength;
-  headerMap["content-type"]       = ContentType;
-  headerMap["transfer-encoding"]  = TransferEncoding;
-  headerMap["upgrade"]            = Upgrade;
-  headerMap["cookie"]             = Cookie;
 }
 
 
@@ -63,12 +79,36 @@ HttpRequestParser::HttpRequestParser(unsigned size):
 /// @brief Reset the parser for a new request within an existing connection.
 /// 
 /// Function to reset without throwing away the buffer, and possibly preserving left over
-/// data from the last read that belongs in this request we are about to work on.  
+/// data from the last read that belongs in this request we are about to work on.  That
+/// data is left where it is, and parsed in place.
 
 void HttpRequestParser::resetForNewRequest(void)
 {
+  if(requestEnd)
+   {
+    if(requestEnd < readPoint)
+     {
+      // There is leftover data from a pipelined request after the one we just did.
+      LogRequestParsing("Next request starts at position %lu in buffer\n", 
+                                                                      requestEnd-buf);
+      reqStart  = requestEnd;
+     }
+    else
+     {
+      // Buffer is empty, so we can start at the beginning again
+      reqStart  = buf;
+      readPoint = buf;
+      bufLeft   = bufSize;
+     }
+    requestEnd  = nullptr;
+   }
+  scanPoint           = reqStart;
   headerEnd           = nullptr;
   cookieValue         = nullptr;
+  ifNoneMatchValue    = nullptr;
+  acceptsGzip         = false;
+  bodyStart           = nullptr;
+  bodyRead            = 0u;
   urlOffset           = 0u;
   httpVerOffset       = 0u;
   requestMethod       = NoMethod;
@@ -85,6 +125,12 @@ void HttpRequestParser::resetForNewRequest(void)
     delete multiFile;
     multiFile = nullptr;
    }
+  if(bodyBuf)
+   {
+    free(bodyBuf);
+    bodyBuf = nullptr;
+   }
+  bodyCap             = 0u;
 }
 
 
@@ -95,15 +141,17 @@ void HttpRequestParser::resetForNewRequest(void)
 
 void HttpRequestParser::resetForNewConnection(void)
 {  
-  // This will take care of of most state
-  resetForNewRequest();
-  
   // Initialize things that might maintain important state across requests, but not
   // across connections
-  readPoint           = nullptr;
-  bufLeft             = 0u;
+  reqStart            = buf;
+  readPoint           = buf;
+  requestEnd          = nullptr;
+  bufLeft             = bufSize;
   connectionDone      = false;
   connectionWillClose = false;
+  
+  // This will take care of of most state
+  resetForNewRequest();
 }
 
 
@@ -112,6 +160,8 @@ void HttpRequestParser::resetForNewConnection(void)
 
 HttpRequestParser::~HttpRequestParser(void)
 {
+  if(bodyBuf)
+    free(bodyBuf);
   buf-=4;
   delete[] buf;
 }
@@ -128,46 +178,43 @@ bool HttpRequestParser::parseRequest(void)
   char* h, *url, *lastToken;
   
   // Deal with method
-  if(strncmp(buf, "GET ", 4) == 0)
+  if(strncmp(reqStart, "GET ", 4) == 0)
    {
     requestMethod = GET;
     urlOffset = 4u;
    }
-  else if(strncmp(buf, "POST ", 5) == 0)
+  else if(strncmp(reqStart, "POST ", 5) == 0)
    {
     requestMethod = POST;
     urlOffset = 5u;
    }
   else
    {
-    buf[20] = '\0';
-    LogRequestErrors("Unsupported method in HTTP request %s.\n", buf);
+    // Don't write into the buffer, as the request may end right at the end of it
+    int logLen = headerEnd - reqStart < 20 ? headerEnd - reqStart : 20;
+    LogRequestErrors("Unsupported method in HTTP request %.*s.\n", logLen, reqStart);
     goto badParseRequestExit;
    }
   
-  // Deal with URL
-  url = buf + urlOffset;
-  lastToken = index(url, ' ');
-  if(lastToken)
-    *(lastToken++) = '\0';
-  else
+  // Deal with URL, which must be followed on the same line by the HTTP version.  We
+  // only look within the header we have received, as after it may be the next request.
+  url = reqStart + urlOffset;
+  lastToken = (char*)memchr(url, ' ', headerEnd - url);
+  unless(lastToken && headerEnd - (lastToken + 1) >= 12) // "HTTP/1.1\r\n\r\n"
    {
-    // This happens when we are rerunning a prior request after growing the buffer
-    lastToken = url+strlen(url)+1;
+    LogRequestErrors("Malformed request line in HTTP request.\n");
+    goto badParseRequestExit;
    }
+  *(lastToken++) = '\0';
   LogRequestParsing("Found Url of length %lu: %s.\n", strlen(url), url);
   
   // Deal with HTTP version
-  if(lastToken - buf + 256 > bufSize)
-   {
-    LogRequestErrors("Header too large in HTTP request.\n");
-    goto badParseRequestExit;
-   }
   if( (strncmp(lastToken, "HTTP/1.1", 8) != 0) && (strncmp(lastToken, "HTTP/1.0", 8) != 0) )
    {
-    LogRequestErrors("Unsupported HTTP version %s\n", lastToken);
+    LogRequestErrors("Unsupported HTTP version %.8s\n", lastToken);
     goto badParseRequestExit;
    }
+  httpVerOffset = lastToken - reqStart;
   
   // Parse rest of the header lines
   h = lastToken + 10;
@@ -187,7 +234,7 @@ bool HttpRequestParser::parseRequest(void)
     toLowerCase(h); // HTTP headers are case-insensitive
     if(headerMap.count(h)) // A header we recognize
      {
-      switch(headerMap[h])
+      switch(headerMap.at(h))
        {
           case Connection:
             LogRequestParsing("Found Connection header %s.\n", value);
@@ -243,6 +290,16 @@ bool HttpRequestParser::parseRequest(void)
            cookieValue = value;
            break;
 
+         case IfNoneMatch:
+           LogRequestParsing("Found If-None-Match header (%s) in HTTP request.\n", value);
+           ifNoneMatchValue = value;
+           break;
+
+         case AcceptEncoding:
+           LogRequestParsing("Found Accept-Encoding header (%s) in HTTP request.\n", value);
+           acceptsGzip = acceptEncodingAllowsGzip(value);
+           break;
+
          case TransferEncoding:
             LogRequestErrors("Unsupported Transfer-Encoding header in HTTP request.\n");
             goto badParseRequestExit;
@@ -269,6 +326,48 @@ badParseRequestExit:
 }
    
 
+// =======================================================================================
+/// @brief Check whether the value of an Accept-Encoding header allows gzip.
+/// 
+/// The header is a comma separated list of codings, each optionally with a quality, eg
+/// "gzip, deflate;q=0.5, *;q=0".  A quality of zero means the coding is unacceptable.
+/// @returns True if gzip (or failing that "*") is listed with a non-zero quality.
+/// @param value The value of the header (which is not modified).
+
+bool HttpRequestParser::acceptEncodingAllowsGzip(char* value)
+{
+  float gzipQuality = -1.0f;
+  float starQuality = -1.0f;
+  char* p = value;
+  while(*p)
+   {
+    while(*p == ' ' || *p == ',')
+      p++;
+    char* coding = p;
+    while(*p && *p != ',' && *p != ';' && *p != ' ')
+      p++;
+    unsigned len = p - coding;
+    
+    // Look for a quality parameter before the next coding
+    float quality = 1.0f;
+    while(*p && *p != ',')
+     {
+      if(*p == 'q' && p[1] == '=')
+        quality = atof(p+2);
+      p++;
+     }
+    if(len == 4 && strncasecmp(coding, "gzip", 4) == 0)
+      gzipQuality = quality;
+    else if(len == 1 && *coding == '*')
+      starQuality = quality;
+   }
+  
+  if(gzipQuality >= 0.0f)
+    return gzipQuality > 0.0f;
+  return starQuality > 0.0f;
+}
+
+
 // =======================================================================================
 /// @brief State machine to check a range of bytes looking for \r\n\r\n.  
 /// 
@@ -323,130 +422,277 @@ char* HttpRequestParser::headerEndPresent(char* range, unsigned rangeSize)
 
 
 // =======================================================================================
-/// @brief Read some data into the buffer and check if all is well.
-/// @returns true if we successfully read some data and didn't overflow, false otherwise.
-/// @param nBytes A reference to int used to record the number of bytes we read.
+/// @brief Read whatever data is available on the (non-blocking) socket into the buffer.
+/// 
+/// This never blocks, and is what the HttpLoadBalancer calls when the event queue tells
+/// it the connection is readable.
+/// @returns true if the connection is still healthy (even if there was nothing to read),
+/// false if the client has gone away, there was a read error, or the request is too
+/// big for our buffer.
 
-bool HttpRequestParser::readAndCheck(int& nBytes)
+bool HttpRequestParser::readAvailable(void)
 {
-  // Read some data
-  if((nBytes = read(connfd, readPoint, bufLeft)) <= 0)
+  int nBytes;
+  
+  // Body going into its own buffer, which we grow as the data actually arrives
+  if(bodyBuf && bodyRead < bodySize)
    {
-    // No data, so give up on this particular connection
-    close(connfd);
-    LogRequestErrors("Couldn't read data from socket.\n");
+    if(bodyRead == bodyCap)
+      unless(growBodyBuffer())
+        return false;
+    if((nBytes = read(connfd, bodyBuf + bodyRead, bodyCap - bodyRead)) < 0)
+     {
+      if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return true;
+      LogRequestErrors("Couldn't read body data from socket.\n");
+      connectionDone = true;
+      return false;
+     }
+    if(nBytes == 0)
+     {
+      LogHTTPLoadBalance("Client closed connection on fd %d during body.\n", connfd);
+      connectionDone = true;
+      return false;
+     }
+    LogRequestParsing("Read %u bytes into position %lu in body buffer\n", nBytes, bodyRead);
+    bodyRead += nBytes;
+    bodyBuf[bodyRead] = '\0';
+    return true;
+   }
+  
+  if(bufLeft < REQ_PARSER_MIN_READ)
+    compactBuffer();
+  unless(bufLeft)
+   {
+    LogRequestErrors("Request too big for buffer of %u bytes.\n", bufSize);
     connectionDone = true;
     return false;
    }
-  if(nBytes <= bufLeft)
+  if((nBytes = read(connfd, readPoint, bufLeft)) < 0)
    {
-    // Got some data, read it into buffer
-    readPoint[nBytes] = '\0';
-    LogRequestParsing("Read %u bytes into position %lu in buffer\n", nBytes, readPoint-buf);
+    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      return true;
+    LogRequestErrors("Couldn't read data from socket.\n");
+    connectionDone = true;
+    return false;
    }
-  else // damn big request
+  if(nBytes == 0)
    {
-    LogRequestErrors("Request of %u bytes too big for remaining buffer of %u bytes.\n",
-                        nBytes, bufLeft);
+    // Orderly shutdown by the client
+    LogHTTPLoadBalance("Client closed connection on fd %d.\n", connfd);
     connectionDone = true;
     return false;
    }
+  
+  // Got some data, read it into buffer
+  readPoint[nBytes] = '\0';
+  LogRequestParsing("Read %u bytes into position %lu in buffer\n", nBytes, readPoint-buf);
   LogHTTPDetails("Got from client:\n%s", readPoint);
+  readPoint += nBytes;
+  bufLeft   -= nBytes;
   return true;
 }
 
 
 // =======================================================================================
-/// @brief Get the next request by reading from the socket.
-/// @returns true if we successfully read a request, false otherwise.
+/// @brief Move a partial request at the end of the buffer down to the beginning to make
+/// room to read the rest of it.
+/// 
+/// This is the only copying we do within the buffer, and it only happens when a request
+/// is split across the end of the buffer, so the cost is spread over all the requests 
+/// that were parsed in place before that.  We only do this before the header has been
+/// parsed (after that, the body either fits where it is, or has its own buffer).
 
-bool HttpRequestParser::getNextRequest(void)
-{ 
-  bool  leftOverDataPresent;
-  int   nBytes;
+void HttpRequestParser::compactBuffer(void)
+{
+  if(reqStart == buf || headerEnd)
+    return;
   
-  if(readPoint)
+  unsigned nBytes = readPoint - reqStart;
+  unsigned shift  = reqStart - buf;
+  LogRequestParsing("Moving %u bytes from position %u in buffer\n", nBytes, shift);
+  memmove(buf, reqStart, nBytes);
+  reqStart  = buf;
+  scanPoint -= shift;
+  readPoint -= shift;
+  bufLeft   += shift;
+}
+
+
+// =======================================================================================
+/// @brief Set up a separate buffer for a body which won't fit in the main buffer after 
+/// its header.
+/// 
+/// Whatever part of the body came in with the header is copied over, and from then on
+/// body data is read directly into place.  The buffer starts small and is grown by
+/// growBodyBuffer() as the data comes in, so a client can't tie up memory just by 
+/// declaring a big Content-Length.
+/// @returns True if all is well, false if the body is unreasonably large.
+
+bool HttpRequestParser::startLargeBody(void)
+{
+  if(bodySize > REQ_MAX_BODY_SIZE)
    {
-    // There is leftover data from a prior call.
-    //XX note if performance became an issue, we could have a bigger buffer and
-    //XX more complex book-keeping to reduce these copies.
-    nBytes = bufLeft;
-    LogRequestParsing("Moving %u bytes from position %lu in buffer\n", nBytes, readPoint-buf);
-    memcpy(buf, readPoint, nBytes);
-    readPoint = buf;
-    bufLeft = bufSize;
-    leftOverDataPresent = true;
+    LogRequestErrors("Request body of %lu bytes is too large.\n", bodySize);
+    connectionDone = true;
+    return false;
    }
-  else
-   { 
-    LogRequestParsing("getNextRequest with no leftover data.\n");
-    readPoint = buf;
-    bufLeft = bufSize;
-    leftOverDataPresent = false;
+  
+  bodyRead  = readPoint - headerEnd;
+  bodyCap   = bodyRead > REQ_BODY_START_SIZE ? bodyRead : REQ_BODY_START_SIZE;
+  if(bodyCap > bodySize)
+    bodyCap = bodySize;
+  unless((bodyBuf = (char*)malloc(bodyCap+1)))
+   {
+    LogRequestErrors("Couldn't allocate %lu byte body buffer.\n", bodyCap);
+    connectionDone = true;
+    return false;
    }
+  memcpy(bodyBuf, headerEnd, bodyRead);
+  bodyBuf[bodyRead] = '\0';
   
-  while(1) // until we've read enough data for a complete header
-   {    
-    if(leftOverDataPresent)
-      leftOverDataPresent = false;
-    else 
-     {
-      unless(readAndCheck(nBytes))
-        return false;     
-     }
-     
-    // Compute parameters for header end checking before we update readPoint etc 
-    char* checkStart = readPoint-3; // in case of \r\n\r\n across last read boundary
-    unsigned checkSize = nBytes + 3;
-    if(checkStart < buf)
-     {
-      checkSize -= buf - checkStart;
-      checkStart = buf;
-     }
-      
-    // About to go round again, so update the paramters for where/how much to read
-    unless(nBytes <= bufLeft && readPoint+nBytes <= buf+bufSize && nBytes > 0)
-     {
-      assert(1==0);
-     }
-    readPoint += nBytes;
-    bufLeft -= nBytes;
+  // Anything else that shows up in the main buffer will be a following request
+  readPoint = headerEnd;
+  bufLeft   = bufSize - (readPoint - buf);
+  LogRequestParsing("Allocated %lu byte body buffer with %lu bytes already present.\n", 
+                                                                    bodyCap, bodyRead);
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Double the size of the separate body buffer (up to the size of the body) when
+/// it has filled up.
+/// @returns True if all is well, false if we couldn't get the memory.
+
+bool HttpRequestParser::growBodyBuffer(void)
+{
+  unsigned long newCap = 2*bodyCap < bodySize ? 2*bodyCap : bodySize;
+  char* newBuf = (char*)realloc(bodyBuf, newCap+1);
+  unless(newBuf)
+   {
+    LogRequestErrors("Couldn't grow body buffer to %lu bytes.\n", newCap);
+    connectionDone = true;
+    return false;
+   }
+  bodyBuf = newBuf;
+  bodyCap = newCap;
+  LogRequestParsing("Grew body buffer to %lu bytes.\n", bodyCap);
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Check whether we have a complete request in the buffer.
+/// 
+/// Scans any newly arrived data for the end of the header, parses the header when it 
+/// is found, and then checks that any body is also present.  Multipart uploads are 
+/// considered complete once the header is here, as the body is streamed by processBody.
+/// Note that a parse failure will set connectionDone, so callers should check 
+/// connectionFinished() when this returns false.
+/// @returns true if getNextRequest can be called without needing to read the socket.
+
+bool HttpRequestParser::requestComplete(void)
+{
+  if(connectionDone)
+    return false;
   
-     // Now check to see if there's a header-end present in this latest read
-    if((headerEnd = headerEndPresent(checkStart, checkSize)))
+  unless(headerEnd)
+   {
+    // in case of \r\n\r\n across last read boundary
+    char* checkStart = scanPoint - 3 < reqStart ? reqStart : scanPoint - 3;
+    if(readPoint <= checkStart)
+      return false;
+    unless((headerEnd = headerEndPresent(checkStart, readPoint - checkStart)))
      {
-      // This is good, we get to go home, 
-      break;
+      scanPoint = readPoint;
+      return false;
      }
-     
-   } // while(1) over reads
+    unless(parseRequest())
+      return false;
+    if(bodyPresent && !multiFile && headerEnd + bodySize > buf + bufSize)
+      unless(startLargeBody())
+        return false;
+   }
   
-  // If we get here, we have at least a complete header, possibly 
-  // also a body and/or part of next request. 
+  if(bodyPresent && !multiFile)
+   {
+    if(bodyBuf)
+      return (bodyRead >= bodySize);
+    return (readPoint >= headerEnd + bodySize);
+   }
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Wait for the socket to become readable.
+/// 
+/// Only used by worker threads in the rare cases where they have to read beyond what 
+/// the HttpLoadBalancer has buffered for them (eg large multipart uploads).
+/// @returns true if there is data to read, false on timeout or error.
+
+bool HttpRequestParser::waitForData(void)
+{
+  struct pollfd pfd;
+  pfd.fd      = connfd;
+  pfd.events  = POLLIN;
   
-  unless(parseRequest())
+  if(poll(&pfd, 1, REQ_READ_TIMEOUT_MS) <= 0)
    {
-    readPoint = nullptr;
+    LogRequestErrors("Timed out waiting for data from client.\n");
+    connectionDone = true;
     return false;
    }
+  return true;
+}
 
-  if(bodyPresent)
-    return processBody();
-  else
+
+// =======================================================================================
+/// @brief Read some data into the buffer and check if all is well.
+/// @returns true if we successfully read some data and didn't overflow, false otherwise.
+/// @param nBytes A reference to int used to record the number of bytes we read.
+
+bool HttpRequestParser::readAndCheck(int& nBytes)
+{
+  char* oldReadPoint = readPoint;
+  
+  while(readPoint == oldReadPoint)
    {
-    // We keep track of any unused data from the last read
-    if(headerEnd && readPoint > headerEnd)
-     {
-      bufLeft = readPoint - headerEnd;
-      readPoint = headerEnd;
-      LogRequestParsing("Buf: %p; readPoint: %p; headerEnd: %p;\n", 
-                                                              buf, readPoint, headerEnd);
-      LogRequestParsing("Leftover %u bytes at position %lu in buffer\n", 
-                                                              bufLeft, readPoint-buf);
-     }
-    else
-      readPoint = nullptr;
+    unless(waitForData() && readAvailable())
+      return false;
+   }
+  nBytes = readPoint - oldReadPoint;
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Get the next request, reading from the socket if necessary.
+/// @returns true if we successfully read a request, false otherwise.
+
+bool HttpRequestParser::getNextRequest(void)
+{ 
+  int nBytes;
+  
+  until(requestComplete())
+   {
+    if(connectionDone)
+      return false;
+    unless(readAndCheck(nBytes))
+      return false;
    }
+  
+  // If we get here, we have at least a complete header, and a complete body if it 
+  // fits in the buffer, and possibly part of the next request. 
+  
+  if(bodyPresent)
+    return processBody();
+  
+  // We keep track of where this request ends, so any unused data can be kept
+  requestEnd = headerEnd;
+  LogRequestParsing("Request at position %lu; readPoint: %lu; headerEnd: %lu;\n", 
+                                  reqStart-buf, readPoint-buf, headerEnd-buf);
   return true;
 }
 
@@ -460,57 +706,70 @@ bool HttpRequestParser::processBody(void)
   int   nBytes;
   LogRequestErrors("Attempting to process request body.\n");
 
-  while(readPoint < headerEnd + bodySize) // until we've read enough data for body
-   {    
-    unless(readAndCheck(nBytes))
-     {
-      LogRequestParsing("readAndCheck returned false.\n");
-      return false;
-     }
-    if(multiFile)
+  if(multiFile)
+   {
+    // Special handling for big uploads which won't fit in buffer.  Whatever arrived 
+    // with the header is passed on first, then we stream the rest through the buffer.
+    unsigned long bodyDone  = readPoint - headerEnd;
+    char*         chunk     = headerEnd;
+    nBytes                  = bodyDone;
+    while(1)
      {
-      // Special handling for big uploads which won't fit in buffer
-      unsigned consumed;
-      unless((consumed = multiFile->gotNewData(readPoint, nBytes)) == nBytes)
+      if(nBytes > 0)
        {
-        LogRequestParsing("Only consumed %u bytes of %u in Multifile-gotNewData\n",
-                                                    consumed, nBytes);
-        
-        // XXX more book-keeping needed here if there is left over data
+        unsigned consumed;
+        unless((consumed = multiFile->gotNewData(chunk, nBytes)) == (unsigned)nBytes)
+         {
+          LogRequestParsing("Only consumed %u bytes of %u in Multifile-gotNewData\n",
+                                                      consumed, nBytes);
+          
+          // XXX more book-keeping needed here if there is left over data
+          break;
+         }
+        LogRequestParsing("Sent %u bytes to multiFile->gotNewData.\n", nBytes); 
+       }
+      if(bodyDone >= bodySize)
         break;
+      
+      // Reuse the buffer space after the header for the next chunk
+      readPoint = headerEnd;
+      bufLeft   = bufSize - (headerEnd - buf);
+      unless(readAndCheck(nBytes))
+       {
+        LogRequestParsing("readAndCheck returned false.\n");
+        return false;
        }
-      LogRequestParsing("Sent %u bytes to multiFile->gotNewData.\n", nBytes); 
+      chunk     = headerEnd;
+      bodyDone  += nBytes;
      }
-    else
-     {
-      // About to go round again, so update the paramters for where/how much to read
-      readPoint += nBytes;
-      bufLeft -= nBytes;
-      LogRequestParsing("Going round again in processBody after %u bytes, %u in buffer\n",
-                        nBytes, bufLeft);
-     }
-     
-   } // while(1) over reads
-
-  if(readPoint > headerEnd + bodySize)
+    
+    // Any pipelined data after a streamed body is discarded
+    requestEnd = readPoint;
+    bodyStart  = headerEnd;
+   }
+  else if(bodyBuf)
    {
-    // This is good, we get to go home, but first we keep track of unused data
-    bufLeft = readPoint - headerEnd - bodySize;
-    readPoint = headerEnd + bodySize;
-    LogRequestParsing("Leftover %u bytes after body at position %lu in buffer\n", 
-                                                                bufLeft, readPoint-buf);
+    // The HttpLoadBalancer only hands us the request once the body is all here, and
+    // anything in the main buffer belongs to the next request.
+    assert(bodyRead >= bodySize);
+    requestEnd = headerEnd;
+    bodyStart  = bodyBuf;
    }
   else
    {
-    // We read exactly to the end of the body
-    readPoint = nullptr;
+    // The HttpLoadBalancer only hands us the request once the body is all here
+    assert(readPoint >= headerEnd + bodySize);
+    requestEnd = headerEnd + bodySize;
+    bodyStart  = headerEnd;
+    LogRequestParsing("Leftover %lu bytes after body at position %lu in buffer\n", 
+                                              readPoint - requestEnd, requestEnd-buf);
    }
 
   LogHTTPDetails("Successfully read body of size %lu.\n", bodySize);
   
   if(contentType == ApplicationXWWWFormUrlEncoded)
    {
-    parsedBody = (DynamicallyTypable*)new HTMLForm(headerEnd, bodySize);
+    parsedBody = (DynamicallyTypable*)new HTMLForm(bodyStart, bodySize);
     unless(parsedBody)
     {
      LogRequestErrors("Failed memory allocation for parsedBody.\n");
@@ -521,7 +780,7 @@ bool HttpRequestParser::processBody(void)
    }
   else
    {
-    unparsedBody = headerEnd;
+    unparsedBody = bodyStart;
     parsedBody    = nullptr;
     LogRequestErrors("Couldn't parse body of this content type.\n");
    }
@@ -0,0 +1,339 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+// An in-memory cache of HTTP responses that depend only on their URL, bounded in bytes
+// and evicting the least recently used responses first.  Each response gets a strong 
+// ETag so that clients which already have it can be told it's not modified.
+
+#include "HttpResponseCache.h"
+#include "HttpServThread.h"
+#include "HttpGzipStream.h"
+#include "Logging.h"
+#include <string.h>
+#include <stdio.h>
+
+
+// =======================================================================================
+/// @brief Constructor for a cached response, which takes a copy of the body.
+/// @param url The normalised URL of the response.
+/// @param buf The body of the response.
+/// @param size The number of bytes in the body.
+/// @param duration The cache duration that the handler set on the response.
+
+HttpCachedResponse::HttpCachedResponse(const std::string& url, const char* buf, 
+                                                        unsigned size, unsigned duration):
+                                          bodySize(size),
+                                          gzBody(nullptr),
+                                          gzSize(0u),
+                                          cacheDuration(duration),
+                                          key(url),
+                                          prev(nullptr),
+                                          next(nullptr),
+                                          refCount(1u)
+{
+  body = new char[bodySize];
+  memcpy(body, buf, bodySize);
+  
+  // FNV-1a hash of the body
+  unsigned long long hash = 0xcbf29ce484222325ull;
+  for(unsigned i=0; i<bodySize; i++)
+   {
+    hash ^= (unsigned char)body[i];
+    hash *= 0x100000001b3ull;
+   }
+  snprintf(etag, HTTP_ETAG_SIZE, "\"%016llx\"", hash);
+  
+  // Compressed copy (all our cacheable responses are text).  This uses its own stream,
+  // as the server thread's may still be in the middle of sending this response.
+  HttpGzipStream gzip;
+  if(bodySize >= HTTP_GZIP_MIN_SIZE && gzip.compressAll(body, bodySize, HTTP_GZIP_LEVEL)
+                                                        && gzip.output.size() < bodySize)
+   {
+    gzSize = gzip.output.size();
+    gzBody = new char[gzSize];
+    memcpy(gzBody, gzip.output.data(), gzSize);
+    snprintf(gzEtag, HTTP_ETAG_SIZE, "\"%016llx-gz\"", hash);
+   }
+}
+
+
+// =======================================================================================
+/// @brief Destructor
+
+HttpCachedResponse::~HttpCachedResponse(void)
+{
+  delete[] body;
+  if(gzBody)
+    delete[] gzBody;
+}
+
+
+// =======================================================================================
+/// @brief Constructor
+/// @param maxBytes The most bytes of response bodies to keep.  No single response 
+/// bigger than an eighth of this will be cached.
+
+HttpResponseCache::HttpResponseCache(unsigned long maxBytes):
+                                          mostRecent(nullptr),
+                                          leastRecent(nullptr),
+                                          maxTotalBytes(maxBytes),
+                                          maxEntryBytes(maxBytes/8),
+                                          totalBytes(0u),
+                                          generation(0u),
+                                          hits(0u),
+                                          misses(0u),
+                                          evictions(0u)
+{
+}
+
+
+// =======================================================================================
+/// @brief Destructor
+
+HttpResponseCache::~HttpResponseCache(void)
+{
+  while(leastRecent)
+    remove(leastRecent);
+}
+
+
+// =======================================================================================
+/// @brief Turn a URL into the key we cache it under, so that trivially different ways
+/// of asking for the same thing share an entry.
+/// 
+/// The route's own path is used for the front of the key.  In the rest, percent-encoded
+/// characters that didn't need encoding are decoded, and trailing separators (eg the
+/// final ':' in "/soil?42.4:42.5:-76.5:-76.4:") are dropped.
+/// @param key The string to put the key in.
+/// @param path The path of the route that matched the URL.
+/// @param query True if the route was a query route (so there's a '?' after path).
+/// @param rest The balance of the URL after the route's path.
+
+void HttpResponseCache::normaliseUrl(std::string& key, const char* path, bool query,
+                                                                      const char* rest)
+{
+  key.assign(path);
+  if(query)
+    key.push_back('?');
+  
+  for(const char* p = rest; *p; p++)
+   {
+    char c = *p;
+    if(c == '%' && isxdigit(p[1]) && isxdigit(p[2]))
+     {
+      char hex[3] = {p[1], p[2], '\0'};
+      char decoded = (char)strtol(hex, NULL, 16);
+      if(isalnum(decoded) || strchr("-._~", decoded))
+       {
+        c = decoded;
+        p += 2;
+       }
+     }
+    key.push_back(c);
+   }
+  
+  while(key.size() && strchr(":&", key.back()))
+    key.pop_back();
+}
+
+
+// =======================================================================================
+/// @brief Check whether an If-None-Match header matches an ETag of ours.
+/// @returns True if it matches, in which case the client already has the response.
+/// @param etag The ETag of our response (including the quotes).
+/// @param ifNoneMatch The value of the If-None-Match header from the request.
+
+bool HttpResponseCache::etagMatches(const char* etag, const char* ifNoneMatch)
+{
+  if(strcmp(ifNoneMatch, "*") == 0)
+    return true;
+  return strstr(ifNoneMatch, etag) != NULL;
+}
+
+
+// =======================================================================================
+/// @brief Take an entry out of the recently used list (must be called with the lock).
+/// @param entry The entry to unlink.
+
+void HttpResponseCache::unlink(HttpCachedResponse* entry)
+{
+  if(entry->prev)
+    entry->prev->next = entry->next;
+  else
+    mostRecent = entry->next;
+  if(entry->next)
+    entry->next->prev = entry->prev;
+  else
+    leastRecent = entry->prev;
+  entry->prev = entry->next = nullptr;
+}
+
+
+// =======================================================================================
+/// @brief Remove an entry from the cache (must be called with the lock).  
+/// 
+/// The entry is only freed once any server threads still using it have released it.
+/// @param entry The entry to remove.
+
+void HttpResponseCache::remove(HttpCachedResponse* entry)
+{
+  unlink(entry);
+  entries.erase(entry->key);
+  totalBytes -= entry->bodySize + entry->gzSize;
+  release(entry);
+}
+
+
+// =======================================================================================
+/// @brief Look for a response in the cache.
+/// @returns A pointer to the cached response, or nullptr if it isn't there.  If not 
+/// null, the caller must call release() on it when done with it.
+/// @param key The normalised URL (see normaliseUrl).
+
+HttpCachedResponse* HttpResponseCache::find(const std::string& key)
+{
+  lock();
+  auto iter = entries.find(key);
+  if(iter == entries.end())
+   {
+    misses++;
+    unlock();
+    return nullptr;
+   }
+  
+  // Move to the front of the recently used list
+  HttpCachedResponse* entry = iter->second;
+  if(entry != mostRecent)
+   {
+    unlink(entry);
+    entry->next = mostRecent;
+    mostRecent->prev = entry;
+    mostRecent = entry;
+   }
+  entry->refCount++;
+  hits++;
+  unlock();
+  
+  return entry;
+}
+
+
+// =======================================================================================
+/// @brief Finish using a response obtained from find().
+/// @param entry The entry that is no longer needed.
+
+void HttpResponseCache::release(HttpCachedResponse* entry)
+{
+  if(--entry->refCount == 0u)
+    delete entry;
+}
+
+
+// =======================================================================================
+/// @brief Add a response to the cache, evicting older ones if necessary to make room.
+/// @returns A pointer to the new entry, on which the caller must call release() when 
+/// done with it, or nullptr if the response was too big, or the cache has been 
+/// invalidated since the response started being generated.
+/// @param key The normalised URL (see normaliseUrl).
+/// @param body The body of the response (which will be copied).
+/// @param bodySize The number of bytes in the body.
+/// @param cacheDuration The cache duration that the handler set on the response.
+/// @param gen The value of getGeneration() from before the response was generated.
+
+HttpCachedResponse* HttpResponseCache::insert(const std::string& key, const char* body, 
+                            unsigned bodySize, unsigned cacheDuration, unsigned long gen)
+{
+  if(bodySize > maxEntryBytes)
+    return nullptr;
+  HttpCachedResponse* entry = new HttpCachedResponse(key, body, bodySize, cacheDuration);
+  unsigned entrySize = bodySize + entry->gzSize;
+  
+  lock();
+  if(gen != generation)
+   {
+    unlock();
+    LogHTTPDetails("Not caching response for %s generated before invalidation.\n", 
+                                                                          key.c_str());
+    delete entry;
+    return nullptr;
+   }
+  
+  // Another thread may have beaten us to it
+  auto iter = entries.find(key);
+  if(iter != entries.end())
+    remove(iter->second);
+  
+  while(leastRecent && totalBytes + entrySize > maxTotalBytes)
+   {
+    remove(leastRecent);
+    evictions++;
+   }
+  entries[key] = entry;
+  entry->next = mostRecent;
+  if(mostRecent)
+    mostRecent->prev = entry;
+  mostRecent = entry;
+  unless(leastRecent)
+    leastRecent = entry;
+  totalBytes += entrySize;
+  entry->refCount++; // for the caller
+  unlock();
+  
+  LogHTTPDetails("Cached response of %u bytes (%u gzipped) for %s.\n", bodySize, 
+                                                          entry->gzSize, key.c_str());
+  return entry;
+}
+
+
+// =======================================================================================
+/// @brief Remove all the responses whose URLs start with some prefix, because the data
+/// they were generated from has changed.
+/// @param prefix The prefix of the URLs to remove (eg "/climate/").
+
+void HttpResponseCache::invalidate(const char* prefix)
+{
+  unsigned len = strlen(prefix);
+  unsigned count = 0u;
+  
+  lock();
+  generation++;
+  HttpCachedResponse* entry = mostRecent;
+  while(entry)
+   {
+    HttpCachedResponse* next = entry->next;
+    if(entry->key.compare(0, len, prefix) == 0)
+     {
+      remove(entry);
+      count++;
+     }
+    entry = next;
+   }
+  unlock();
+  
+  LogHTTPDetails("Invalidated %u cached responses under %s.\n", count, prefix);
+}
+
+
+// =======================================================================================
+/// @brief Output a table of statistics about the cache.
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv The HttpServThread generating the page.
+
+bool HttpResponseCache::diagnosticHTML(HttpServThread* serv)
+{
+  lock();
+  unsigned long nEntries  = entries.size();
+  unsigned long bytes     = totalBytes;
+  unsigned long nHits     = hits;
+  unsigned long nMisses   = misses;
+  unsigned long nEvicted  = evictions;
+  unlock();
+  
+  httPrintf("<table>\n<tr><th>Cached responses</th><th>Bytes</th><th>Limit</th>"
+                                  "<th>Hits</th><th>Misses</th><th>Evictions</th></tr>\n");
+  httPrintf("<tr><td>%lu</td><td>%lu</td><td>%lu</td><td>%lu</td><td>%lu</td>"
+                                    "<td>%lu</td></tr>\n</table>\n", nEntries, bytes, 
+                                    maxTotalBytes, nHits, nMisses, nEvicted);
+  return true;
+}
+
+
+// =======================================================================================
@@ -0,0 +1,173 @@
+// Copyright Staniford Systems.  All Rights Reserved.  October 2026 -
+// A declarative table of the URLs an HTTP server responds to, stored as a trie so that
+// finding the route for a URL costs one step per character of the URL.  Routes are 
+// added at startup, and the table is read-only (and so lock-free) after that.
+
+#include "HttpRouteTable.h"
+#include "HttpServThread.h"
+#include "Logging.h"
+#include <string.h>
+#include <err.h>
+
+
+// =======================================================================================
+/// @brief Constructor
+
+HttpRouteTable::HttpRouteTable(void)
+{
+  Node root = {'\0', -1, -1, -1, -1};
+  nodes.push_back(root);
+}
+
+
+// =======================================================================================
+/// @brief Destructor
+
+HttpRouteTable::~HttpRouteTable(void)
+{
+}
+
+
+// =======================================================================================
+/// @brief Find the child of a trie node with a particular label.
+/// @returns The index of the child node, or -1 if there is none.
+/// @param node The index of the parent node.
+/// @param c The character labelling the child.
+
+int HttpRouteTable::findChild(int node, char c)
+{
+  for(int child = nodes[node].firstChild; child >= 0; child = nodes[child].nextSibling)
+    if(nodes[child].label == c)
+      return child;
+  return -1;
+}
+
+
+// =======================================================================================
+/// @brief Add a route to the table.
+/// 
+/// Must only be called during setup, before any server threads are using the table.
+/// @param path The path of the route (eg "/climate/").  For a query route, this should
+/// not include the '?'.  Must be a string constant (or otherwise live forever).
+/// @param form Whether the route matches exactly, as a prefix, or as a query.
+/// @param handler The function to call for requests matching the route.
+/// @param context A pointer to be passed to the handler (eg the object to handle it).
+/// @param minExtra For prefix and query routes, the minimum number of characters that 
+/// must follow the path for the route to match.
+/// @param cacheable True if the response depends only on the URL (and not on cookies,
+/// the request body, etc), so that it can be kept in the server's HttpResponseCache.
+
+void HttpRouteTable::addRoute(const char* path, HttpRouteForm form, 
+          HttpRouteHandler handler, void* context, unsigned minExtra, bool cacheable)
+{
+  int node = 0;
+  unsigned len = strlen(path);
+  for(unsigned i=0; i<=len; i++)
+   {
+    char c;
+    if(i < len)
+      c = path[i];
+    else if(form == RouteQuery)
+      c = '?';
+    else
+      break;
+    int child = findChild(node, c);
+    if(child < 0)
+     {
+      Node newNode = {c, -1, nodes[node].firstChild, -1, -1};
+      child = nodes.size();
+      nodes.push_back(newNode);
+      nodes[node].firstChild = child;
+     }
+    node = child;
+   }
+  
+  int& slot = (form == RouteExact) ? nodes[node].exactRoute : nodes[node].prefixRoute;
+  if(slot >= 0)
+    err(-1, "Duplicate HTTP route for %s in HttpRouteTable::addRoute.\n", path);
+  slot = routes.size();
+  
+  HttpRoute route;
+  route.path      = path;
+  route.handler   = handler;
+  route.context   = context;
+  route.minExtra  = minExtra;
+  route.form      = form;
+  route.cacheable = cacheable;
+  routes.push_back(route);
+  LogPermaservOpDetails("Added HTTP route %s (form %d).\n", path, form);
+}
+
+
+// =======================================================================================
+/// @brief Add a route for a service that isn't available in this server, so that 
+/// requests get a helpful error.
+/// @param path The path of the route (see addRoute).
+/// @param form Whether the route matches exactly, as a prefix, or as a query.
+/// @param message A C-string to show the client (must live forever).
+/// @param minExtra The minimum number of characters after the path (see addRoute).
+
+void HttpRouteTable::addUnavailableRoute(const char* path, HttpRouteForm form, 
+                                                const char* message, unsigned minExtra)
+{
+  addRoute(path, form, routeUnavailable, (void*)message, minExtra);
+}
+
+
+// =======================================================================================
+/// @brief Find the route that should handle a URL.
+/// @returns A pointer to the route, or nullptr if no route matches.
+/// @param url The URL requested.
+/// @param rest A reference to a char* which will be set to the part of the url after
+/// the route's path (and after the '?' for query routes).
+
+const HttpRoute* HttpRouteTable::findRoute(char* url, char*& rest)
+{
+  const HttpRoute* best = nullptr;
+  unsigned urlLen = strlen(url);
+  int node = 0;
+  char* p = url;
+  
+  while(1)
+   {
+    int prefix = nodes[node].prefixRoute;
+    if(prefix >= 0 && urlLen - (p - url) >= routes[prefix].minExtra)
+     {
+      best = &routes[prefix];
+      rest = p;
+     }
+    unless(*p)
+     {
+      if(nodes[node].exactRoute >= 0)
+       {
+        rest = p;
+        return &routes[nodes[node].exactRoute];
+       }
+      break;
+     }
+    if((node = findChild(node, *p)) < 0)
+      break;
+    p++;
+   }
+  
+  return best;
+}
+
+
+// =======================================================================================
+/// @brief Route handler for services that are not loaded in this server.
+/// @returns False, to signal an error response.
+/// @param serv The HTTP server thread that is handling the request.
+/// @param url The balance of the URL after the route's path.
+/// @param context The message for the client, as a const char*.
+
+bool routeUnavailable(HttpServThread* serv, char* url, void* context)
+{
+  const char* message = (const char*)context;
+  LogRequestErrors("%s for %s\n", message, url);
+  serv->errorPage(message);
+  return false;
+}
+
+
+// =======================================================================================
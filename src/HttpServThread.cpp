@@ -8,8 +8,21 @@
 #include "HttpServThread.h"
 #include "UserSession.h"
 #include "UserManager.h"
+#include "HttpStaticPage.h"
+#include "HttpLoadBalancer.h"
 #include "Logging.h"
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#else
+#include <sys/socket.h>
+#endif
 
 
 // =======================================================================================
@@ -19,9 +32,11 @@ HttpServThread::HttpServThread(unsigned index, HttpLoadBalancer* parent,
                                                                 UserSessionGroup* userS):
                                     TaskQueue(index),
                                     respBufOverflow(false),
-                                    reqParser(8192),
+                                    respStreaming(false),
+                                    reqParser(nullptr),
                                     respBufSize(16384),
                                     headBufSize(4096),
+                                    cachedResp(nullptr),
                                     clientP(0),
                                     parentLB(parent),
                                     userSessions(userS)
@@ -68,9 +83,11 @@ const char* HttpServThread::getLoggedInUserName(void)
 /// @param msg A C-string of message on the status line ("OK", "ERROR", etc).
 /// @param mimeType A C-string of the mime type for the content.  If nullptr (the default)
 /// then "text/html" will be used.
+/// @param chunked If true, the body will be sent with chunked transfer encoding, and
+/// bodySize is ignored.  A 304 response has no body and so neither is sent.
 
 unsigned HttpServThread::generateHeader(unsigned bodySize, unsigned code, 
-                                        const char* msg, MimeType mimeType)
+                                        const char* msg, MimeType mimeType, bool chunked)
 {
   char* ptr = headBuf;
   if(strlen(msg) > headBufSize-1024)
@@ -79,19 +96,32 @@ unsigned HttpServThread::generateHeader(unsigned bodySize, unsigned code,
   // Initial response line
   ptr += sprintf(ptr, "HTTP/1.1 %u %s\r\n", code, msg);
   
-  // Mime type of body
-  if(mimeType != NoMimeType)
+  // Mime type of body (a 304 has no body, so no Content-Type or Content-Length)
+  bool hasBody = (code != 304);
+  if(hasBody && mimeType != NoMimeType)
    {
     ptr += sprintf(ptr, "Content-Type: %s\r\n", MimeTypeMap::inverseMap[mimeType]);
    }
-  else
+  else if(hasBody)
     ptr += sprintf(ptr, "Content-Type: text/html\r\n");
   
   // Cookies
   ptr += cookies.sprint(ptr);
   
   // Content length
-  ptr += sprintf(ptr, "Content-Length: %u\r\n", bodySize);
+  if(hasBody && chunked)
+    ptr += sprintf(ptr, "Transfer-Encoding: chunked\r\n");
+  else if(hasBody)
+    ptr += sprintf(ptr, "Content-Length: %u\r\n", bodySize);
+  
+  // Content encoding (any dynamic response may be compressed, depending on the client)
+  if(respGzip)
+    ptr += sprintf(ptr, "Content-Encoding: gzip\r\n");
+  ptr += sprintf(ptr, "Vary: Accept-Encoding\r\n");
+  
+  // Strong validator for responses from (or going into) the response cache
+  if(respETag[0])
+    ptr += sprintf(ptr, "ETag: %s\r\n", respETag);
 
   // Caching
   if(cacheDuration > 0u)
@@ -101,10 +131,168 @@ unsigned HttpServThread::generateHeader(unsigned bodySize, unsigned code,
   ptr += sprintf(ptr, "\r\n");
   return (ptr-headBuf);
 }
+
+
+// =======================================================================================
+/// @brief Generate the response header for a static page into the header buffer.
+///
+/// Most of the header was built when the page was loaded (in two versions if the page 
+/// has a gzipped copy), so we only need to add any cookies and the final blank line.
+/// @returns The number of bytes generated.
+
+unsigned HttpServThread::generateStaticHeader(void)
+{
+  char* ptr = headBuf;
+  if(respGzip)
+   {
+    memcpy(ptr, staticPage->gzHeadBuf, staticPage->gzHeadLen);
+    ptr += staticPage->gzHeadLen;
+   }
+  else
+   {
+    memcpy(ptr, staticPage->headBuf, staticPage->headLen);
+    ptr += staticPage->headLen;
+   }
+  ptr += cookies.sprint(ptr);
+  ptr += sprintf(ptr, "\r\n");
+  return (ptr-headBuf);
+}
+
+
+
+// =======================================================================================
+/// @brief Print into the response buffer, sending what's there already to the client if
+/// we run out of space.
+/// 
+/// This is what httPrintf and internalPrintf use, so big pages are generated once, and
+/// go out in chunks of at most respBufSize while they are being generated, rather than
+/// having to fit in the buffer.  Note that this means a handler may be writing to the 
+/// network in the middle of generating its page, so it had better not be holding any
+/// lock that other server threads need for long.
+/// @returns True if we successfully printed, false if the output of this one call 
+/// won't fit in the buffer, or we couldn't send to the client.
+/// @param format A printf style format string, followed by the arguments for it.
+
+bool HttpServThread::respPrintf(const char* format, ...)
+{
+  va_list args;
+  
+  for(int tries=0; tries<2; tries++)
+   {
+    va_start(args, format);
+    int size = vsnprintf(respPtr, respEnd-respPtr, format, args);
+    va_end(args);
+    if(size < 0)
+      break;
+    if(respPtr + size < respEnd)
+     {
+      respPtr += size;
+      return true;
+     }
+    unless(respPtr > respBuf && flushChunk())
+      break;
+   }
   
+  respBufOverflow = true;
+  return false;
+}
+
+
+// =======================================================================================
+/// @brief Send what's in the response buffer to the client as a chunk, and make the 
+/// whole buffer available again.
+/// 
+/// The first call sends the response header (marked for chunked transfer encoding), so
+/// after this the response has to succeed - there's no going back to an error page.  
+/// Not for use with static pages.
+/// @returns True if all went well, false if we couldn't send.
+
+bool HttpServThread::flushChunk(void)
+{
+  if(staticPage)
+    return false;
+  if(respCapturing)
+   {
+    if(respCapture.size() + (respPtr - respBuf) 
+                                    > parentLB->responseCache->maxEntrySize())
+     {
+      respCapturing = false;
+      respCapture.clear();
+     }
+    else
+      respCapture.append(respBuf, respPtr - respBuf);
+   }
+  unless(sendChunk(false))
+    return false;
+  respPtr = respBuf;
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Send the contents of the response buffer as one chunk of a chunked response,
+/// preceded by the response header if this is the first one.
+/// 
+/// Everything goes out in a single gather write.  If the client accepts gzip, the whole
+/// stream of chunks is compressed as it goes (in which case zlib may hold on to a chunk
+/// until it has enough to be worth sending).
+/// @returns True if all went well, false if we couldn't send.
+/// @param lastChunk If true, the terminating zero length chunk is sent too.
+
+bool HttpServThread::sendChunk(bool lastChunk)
+{
+  struct iovec  iov[4];
+  int           iovCount = 0;
+  char          sizeLine[16];
+  unsigned      bodySize = respPtr - respBuf;
+  
+  unless(respStreaming)
+   {
+    respGzip = reqParser->acceptsGzip && gzipStream.start();
+    unsigned headerLen = generateHeader(0u, 200, "OK", NoMimeType, true);
+    LogHTTPDetails("Sending chunked response header:\n%s", headBuf);
+    iov[iovCount].iov_base  = headBuf;
+    iov[iovCount++].iov_len = headerLen;
+    respStreaming = true;
+   }
+  
+  char*     data      = respBuf;
+  unsigned  dataSize  = bodySize;
+  if(respGzip)
+   {
+    unless(gzipStream.compress(respBuf, bodySize, lastChunk))
+      return false;
+    data      = (char*)gzipStream.output.data();
+    dataSize  = gzipStream.output.size();
+   }
+  if(dataSize)
+   {
+    LogHTTPBufferOps("Sending response chunk of %u bytes (%u before compression).\n", 
+                                                                    dataSize, bodySize);
+    LogResponseBodies("With attached chunk:\n%.*s\n", bodySize, respBuf);
+    iov[iovCount].iov_base  = sizeLine;
+    iov[iovCount++].iov_len = sprintf(sizeLine, "%X\r\n", dataSize);
+    iov[iovCount].iov_base  = data;
+    iov[iovCount++].iov_len = dataSize;
+    iov[iovCount].iov_base  = (char*)(lastChunk ? "\r\n0\r\n\r\n" : "\r\n");
+    iov[iovCount++].iov_len = lastChunk ? 7 : 2;
+   }
+  else if(lastChunk)
+   {
+    iov[iovCount].iov_base  = (char*)"0\r\n\r\n";
+    iov[iovCount++].iov_len = 5;
+   }
+  
+  return writevLoop(reqParser->getConnection(), iov, iovCount);
+}
+
 
 // ======================================================================================
 /// @brief Grow the response buf when it's not big enough
+/// 
+/// Now only needed for handlers that write directly into the buffer (rather than with
+/// httPrintf, which sends the buffer as a chunk when it fills up) and overflow it before
+/// anything has been sent.
 /// @returns True if we successfully grew it, false if we ran up against the limit.
 
 bool HttpServThread::reallocateResponseBuf(void)
@@ -174,10 +362,15 @@ bool HttpServThread::endResponsePage(void)
 
 // =======================================================================================
 /// @brief Generate an Error Page.
+/// 
+/// Error pages are never put in the HttpResponseCache, as the error is usually 
+/// transient (eg a station whose data hasn't been loaded yet), and otherwise would be
+/// served from the cache until the route is next invalidated.
 /// @param error A C string with the specific error to tell the user.
 
 bool HttpServThread::errorPage(const char* error)
 {
+  dontCache();
   unless(startResponsePage("Error"))
     return false;
   internalPrintf("Sorry, an error has occurred: <b>");
@@ -191,6 +384,54 @@ bool HttpServThread::errorPage(const char* error)
 
 // =======================================================================================
 /// @brief Utility function to keep writing till we've gotten it done, or encounter error
+/// 
+/// Writes a whole list of buffers in one gather write (so eg a response header and 
+/// body go out in the same syscall, and usually the same packet).  Sockets are 
+/// non-blocking (as they are managed by the HttpLoadBalancer's event queue) so if the 
+/// client is slow to drain its receive window we poll until we can write.
+/// @returns true if success, false if there's a write failure.
+/// @param fildes The file descriptor of the socket to write to.
+/// @param iov The array of buffers to write (will be modified as we go).
+/// @param iovCount The number of buffers in iov.
+
+bool HttpServThread::writevLoop(int fildes, struct iovec* iov, int iovCount)
+{
+  while(iovCount > 0)
+   {
+    ssize_t bytesWritten = writev(fildes, iov, iovCount);
+    if(bytesWritten < 0)
+     {
+      if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+       {
+        struct pollfd pfd;
+        pfd.fd      = fildes;
+        pfd.events  = POLLOUT;
+        if(poll(&pfd, 1, REQ_READ_TIMEOUT_MS) > 0)
+          continue;
+       }
+      LogRequestErrors("Write call failed in writevLoop\n");
+      return false;
+     }
+    
+    // Skip past whatever got written
+    while(iovCount > 0 && (size_t)bytesWritten >= iov->iov_len)
+     {
+      bytesWritten -= iov->iov_len;
+      iov++;
+      iovCount--;
+     }
+    if(iovCount > 0)
+     {
+      iov->iov_base = (char*)iov->iov_base + bytesWritten;
+      iov->iov_len -= bytesWritten;
+     }
+   }
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Utility function to write a single buffer till we've gotten it done.
 /// @returns true if success, false if there's a write failure.
 /// @param fildes The file descriptor of the socket to write to.
 /// @param buf The char buffer to write from
@@ -198,20 +439,103 @@ bool HttpServThread::errorPage(const char* error)
 
 bool HttpServThread::writeLoop(int fildes, char *buf, size_t nbyte)
 {
-  char* p = buf;
-  int bytesWritten;
+  struct iovec iov;
+  iov.iov_base  = buf;
+  iov.iov_len   = nbyte;
+  return writevLoop(fildes, &iov, 1);
+}
+
+
+// =======================================================================================
+/// @brief Send the header (already in headBuf) and body of a static page, letting the
+/// kernel copy the body directly from the file to the socket.
+/// 
+/// On macOS, sendfile() can send the header with the body.  On Linux, we cork the 
+/// socket so the header waits for the start of the body rather than going out in a 
+/// packet of its own.  If sendfile() isn't supported for this file/socket 
+/// combination, we fall back to writing from the page's memory mapping.
+/// @returns true if success, false if there's a write failure.
+/// @param fildes The file descriptor of the socket to write to.
+/// @param page The static page to send.
+/// @param headerLen The number of bytes of header in headBuf.
+
+bool HttpServThread::sendFileLoop(int fildes, HttpStaticPage* page, unsigned headerLen)
+{
+  off_t offset = 0;
+  bool  retVal = true;
   
-  while(p-buf < nbyte)
+#ifdef __linux__
+  int flag = 1;
+  setsockopt(fildes, IPPROTO_TCP, TCP_CORK, &flag, sizeof(flag));
+  unless(writeLoop(fildes, headBuf, headerLen))
+    retVal = false;
+#else
+  struct iovec   headIov;
+  struct sf_hdtr hdtr;
+  headIov.iov_base  = headBuf;
+  headIov.iov_len   = headerLen;
+  hdtr.headers      = &headIov;
+  hdtr.hdr_cnt      = 1;
+  hdtr.trailers     = NULL;
+  hdtr.trl_cnt      = 0;
+  off_t len = 0; // zero means to end of file
+  if(sendfile(page->fileFd, fildes, 0, &len, &hdtr, 0) == 0)
+    return true;
+  
+  // Didn't get it all done in one go, so sort out where we got to
+  if(len < headerLen)
    {
-    bytesWritten = write(fildes, p, nbyte - (p-buf));
-    if(bytesWritten < 0)
-     {
-      LogRequestErrors("Write call failed in writeLoop\n");
+    unless(writeLoop(fildes, headBuf + len, headerLen - len))
       return false;
+   }
+  else
+    offset = len - headerLen;
+#endif
+  
+  while(retVal && offset < page->bodySize)
+   {
+#ifdef __linux__
+    ssize_t sent = sendfile(fildes, page->fileFd, &offset, page->bodySize - offset);
+    if(sent == 0)
+     {
+      LogRequestErrors("Static page %s truncated in sendFileLoop\n", page->originalPath);
+      retVal = false;
+      break;
+     }
+    if(sent > 0)
+      continue;
+#else
+    len = page->bodySize - offset;
+    int result = sendfile(page->fileFd, fildes, offset, &len, NULL, 0);
+    offset += len; // set to what was sent even on EAGAIN
+    if(result == 0)
+      continue;
+#endif
+    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+     {
+      struct pollfd pfd;
+      pfd.fd      = fildes;
+      pfd.events  = POLLOUT;
+      if(poll(&pfd, 1, REQ_READ_TIMEOUT_MS) > 0)
+        continue;
+     }
+    else if(errno == EINVAL || errno == ENOSYS || errno == ENOTSUP)
+     {
+      LogHTTPBufferOps("sendfile unavailable, writing %s from memory.\n", 
+                                                                    page->originalPath);
+      retVal = writeLoop(fildes, page->body + offset, page->bodySize - offset);
+      break;
      }
-    p += bytesWritten;
+    LogRequestErrors("Sendfile call failed in sendFileLoop\n");
+    retVal = false;
    }
-  return true;
+  
+#ifdef __linux__
+  // Uncorking sends whatever is still held back
+  flag = 0;
+  setsockopt(fildes, IPPROTO_TCP, TCP_CORK, &flag, sizeof(flag));
+#endif
+  return retVal;
 }
 
 
@@ -228,13 +552,120 @@ bool HttpServThread::processRequestHeader(void)
 }
 
 
+// =======================================================================================
+/// @brief Hand a request to whichever handler our load balancer's route table has for 
+/// its URL.
+/// 
+/// Subclasses will normally call this from processRequestHeader() once they have done
+/// anything special of their own.
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param url The URL of the request.
+
+bool HttpServThread::routeRequest(char* url)
+{
+  char* rest;
+  const HttpRoute* route = parentLB->routes.findRoute(url, rest);
+  unless(route)
+   {
+    LogRequestErrors("Request for unknown resource %s\n", url);
+    errorPage("Resource not found");
+    return false;
+   }
+  
+  LogHTTPDetails("Routing request for %s to handler for %s.\n", url, route->path);
+  if(route->cacheable && parentLB->responseCache && reqParser->requestMethod == GET)
+    return cachedRouteRequest(route, rest);
+  return route->handler(this, rest, route->context);
+}
+
+
+// =======================================================================================
+/// @brief Handle a request on a cacheable route, either from the HttpResponseCache or 
+/// by calling the route's handler and then putting the response in the cache.
+/// 
+/// If the response comes from the cache, it's left in cachedResp rather than being 
+/// copied into respBuf, and if the client already has it (according to its 
+/// If-None-Match header) we note that a 304 should be sent instead.
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param route The route that matched the request.
+/// @param rest The balance of the URL after the route's path.
+
+bool HttpServThread::cachedRouteRequest(const HttpRoute* route, char* rest)
+{
+  HttpResponseCache* cache = parentLB->responseCache;
+  std::string key;
+  HttpResponseCache::normaliseUrl(key, route->path, route->form == RouteQuery, rest);
+  
+  releaseCachedResponse(); // in case we are being retried after an overflow
+  HttpCachedResponse* entry = cache->find(key);
+  if(entry)
+   {
+    useCachedResponse(entry);
+    LogHTTPDetails("Serving %s from response cache%s.\n", key.c_str(), 
+                                              respNotModified ? " (not modified)" : "");
+    return true;
+   }
+  
+  // Not there, so generate it, keeping a copy of anything sent out in chunks
+  unsigned long generation = cache->getGeneration();
+  respCapture.clear();
+  respCapturing = true;
+  bool retVal = route->handler(this, rest, route->context);
+  if(retVal && respCapturing && !staticPage)
+   {
+    respCapture.append(respBuf, respPtr - respBuf);
+    entry = cache->insert(key, respCapture.data(), respCapture.size(), cacheDuration, 
+                                                                            generation);
+    if(entry && respStreaming)
+      cache->release(entry); // too late to send it from the cache
+    else if(entry)
+      useCachedResponse(entry);
+   }
+  respCapturing = false;
+  return retVal;
+}
+
+
+// =======================================================================================
+/// @brief Arrange for the response to be sent from an entry in the HttpResponseCache.
+/// 
+/// Picks the gzipped version if the client accepts it and the entry has one, and notes
+/// that a 304 should be sent if the client already has that version (according to its 
+/// If-None-Match header).
+/// @param entry The cache entry, which we now own a reference to (released by 
+/// releaseCachedResponse()).
+
+void HttpServThread::useCachedResponse(HttpCachedResponse* entry)
+{
+  cachedResp    = entry;
+  respGzip      = reqParser->acceptsGzip && entry->gzBody;
+  strcpy(respETag, respGzip ? entry->gzEtag : entry->etag);
+  cacheDuration = entry->cacheDuration;
+  char* ifNoneMatch = reqParser->getIfNoneMatch();
+  respNotModified = ifNoneMatch && HttpResponseCache::etagMatches(respETag, ifNoneMatch);
+}
+
+
+// =======================================================================================
+/// @brief Let the HttpResponseCache know we are done with our cached response (if any).
+
+void HttpServThread::releaseCachedResponse(void)
+{
+  if(cachedResp)
+   {
+    parentLB->responseCache->release(cachedResp);
+    cachedResp = nullptr;
+   }
+}
+
+
 // =======================================================================================
 /// @brief Function to break out request Cookie handling from processOneHTTP1_1.
 /// 
 
 void HttpServThread::dealWithPossibleCookies(void)
 {
-  char* cookieVal = reqParser.getCookieString();
+  char* cookieVal = reqParser->getCookieString();
   if(cookieVal)
      cookies.processRequestCookies(cookieVal);
   if(cookies.flags & VALID_SESSION_ID)
@@ -272,19 +703,30 @@ void HttpServThread::dealWithPossibleCookies(void)
 // =======================================================================================
 /// @brief Process one HTTP/1.1 connection, looping over the request headers and 
 /// arranging for them to be dealt with individually.
-/// @param connfd The socket file descriptor
+/// 
+/// We are handed the connection by the HttpLoadBalancer once it has a complete request
+/// buffered.  We deal with that, and with any further pipelined requests that are 
+/// already complete in the buffer, and then return so the connection can go back to 
+/// the load balancer to wait for more data without tying up this thread.
+/// @returns True if the connection should be kept open for further requests, false if
+/// it should be closed.
+/// @param parser The request parser belonging to the connection (which also knows the
+/// socket file descriptor).
 /// @param clientPort The client port of the underlying TCP connection (mainly for 
 /// logging purposes).
 
-void HttpServThread::processOneHTTP1_1(int connfd, unsigned short clientPort)
+bool HttpServThread::processOneHTTP1_1(HttpRequestParser* parser, 
+                                                            unsigned short clientPort)
 {
   LogHTTPLoadBalance("HTTPDebug %d handling client on port %u.\n", queueIndex, clientPort);
   clientP = clientPort; // make this available for logging by subclasses.
-  
-  reqParser.setNewConnection(connfd);
+  reqParser = parser;
+  int connfd = reqParser->getConnection();
+  bool keepAlive = false;
 
-  while(reqParser.getNextRequest())
+  while(reqParser->getNextRequest())
    {
+    releaseCachedResponse();
     resetResponse();
     dealWithPossibleCookies();
         
@@ -295,8 +737,8 @@ void HttpServThread::processOneHTTP1_1(int connfd, unsigned short clientPort)
      {
       returnOK = processRequestHeader();
       LogHTTPLoadBalance("HTTPDebug %d: client port %u, request %s.\n", 
-                          queueIndex, clientPort, reqParser.getUrl());
-      if(returnOK)
+                          queueIndex, clientPort, reqParser->getUrl());
+      if(returnOK || respStreaming)
         break;
       unless(respBufOverflow)
        {
@@ -307,61 +749,116 @@ void HttpServThread::processOneHTTP1_1(int connfd, unsigned short clientPort)
         break;
      }
     
-    // Generate the correct response header
-    if(returnOK)
+    // If we already started sending the response in chunks, we just finish it.  If 
+    // something went wrong partway, it's too late for an error page, so the best we 
+    // can do is drop the connection so the client knows the response is incomplete.
+    if(respStreaming)
      {
-      if(altResp)
-       {
-        headerLen = generateHeader(respPtr-altResp, 200, "OK", altMimeType);
-       }
-      else
+      unless(returnOK)
        {
-        headerLen = generateHeader(respPtr-respBuf, 200, "OK");
+        LogRequestErrors("Failure partway through chunked response, closing.\n");
+        break;
        }
+      unless(sendChunk(true))
+        break;
      }
     else
      {
-      LogRequestErrors("500 error being returned on HTTP request.\n");
-      headerLen = generateHeader(0u, 500, "ERROR");
-     }
+      // Figure out the body, and generate the correct response header
+      char*     body      = respBuf;
+      unsigned  bodySize  = respPtr-respBuf;
+      if(returnOK)
+       {
+        if(staticPage)
+         {
+          if(reqParser->acceptsGzip && staticPage->gzBody)
+           {
+            respGzip  = true;
+            body      = staticPage->gzBody;
+            bodySize  = staticPage->gzSize;
+           }
+          headerLen = generateStaticHeader();
+         }
+        else if(respNotModified)
+         {
+          bodySize  = 0u;
+          headerLen = generateHeader(0u, 304, "Not Modified");
+         }
+        else if(cachedResp)
+         {
+          body      = respGzip ? cachedResp->gzBody : cachedResp->body;
+          bodySize  = respGzip ? cachedResp->gzSize : cachedResp->bodySize;
+          headerLen = generateHeader(bodySize, 200, "OK");
+         }
+        else
+         {
+          if(reqParser->acceptsGzip && bodySize >= HTTP_GZIP_MIN_SIZE 
+                                            && gzipStream.compressAll(respBuf, bodySize))
+           {
+            respGzip  = true;
+            body      = (char*)gzipStream.output.data();
+            bodySize  = gzipStream.output.size();
+           }
+          headerLen = generateHeader(bodySize, 200, "OK");
+         }
+       }
+      else
+       {
+        LogRequestErrors("500 error being returned on HTTP request.\n");
+        bodySize  = 0u;
+        headerLen = generateHeader(0u, 500, "ERROR");
+       }
 
-    // Detailed logging of what we did
-    LogHTTPDetails("Sending response header:\n%s", headBuf);
-    if(altResp)
-     {
-      LogResponseBodies("With attached body:\n%s\n", altResp);
-     }
-    else
-     {
-      LogResponseBodies("With attached body:\n%s\n", respBuf);
-     }
-    
-    // Respond to the client
-    unless(writeLoop(connfd, headBuf, headerLen))
-      break;
-    if(returnOK)
-     {
-      if(altResp)
+      // Detailed logging of what we did
+      LogHTTPDetails("Sending response header:\n%s", headBuf);
+      if(staticPage)
+       {
+        LogResponseBodies("With attached static page %s.\n", staticPage->originalPath);
+       }
+      else if(cachedResp)
+       {
+        LogResponseBodies("With attached cached body:\n%.*s\n", 
+                    respNotModified ? 0 : cachedResp->bodySize, cachedResp->body);
+       }
+      else
+       {
+        LogResponseBodies("With attached body:\n%s\n", respBuf);
+       }
+      
+      // Respond to the client (uncompressed static pages straight from the file)
+      if(returnOK && staticPage && !respGzip)
        {
-        unless(writeLoop(connfd, altResp, respPtr-altResp))
-          break;        
+        unless(sendFileLoop(connfd, staticPage, headerLen))
+          break;
        }
       else
        {
-        unless(writeLoop(connfd, respBuf, respPtr-respBuf))
+        struct iovec iov[2];
+        iov[0].iov_base = headBuf;
+        iov[0].iov_len  = headerLen;
+        iov[1].iov_base = body;
+        iov[1].iov_len  = bodySize;
+        unless(writevLoop(connfd, iov, 2))
           break;
        }
      }
     
     // Check for loop termination conditions
-    if(timeToDie || reqParser.connectionWillClose)
-     {
+    if(timeToDie || reqParser->connectionWillClose)
       break;      
+    reqParser->resetForNewRequest();
+    
+    // If another pipelined request is already here, go round again, otherwise the 
+    // connection goes back to the load balancer to wait.
+    unless(reqParser->requestComplete())
+     {
+      keepAlive = !reqParser->connectionFinished();
+      break;
      }
-    else
-      reqParser.resetForNewRequest();      
    }
-  reqParser.resetForNewConnection();
+  releaseCachedResponse();
+  reqParser = nullptr;
+  return keepAlive;
 }
 
 
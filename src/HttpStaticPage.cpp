@@ -1,18 +1,40 @@
 // Copyright Staniford Systems.  All Rights Reserved.  December 2022 -
 // This class is for the storage of static objects that will be served via the HTTP 
-// servers.  On construction, we will load our object from disk, but keep it around 
-// so we can be served as needed 
+// servers.  The first time we are requested, we map our object into memory and 
+// precompute our response header (and a gzipped copy of text objects), and keep them 
+// around so we can be served as needed.
 
 #include "HttpStaticPage.h"
-#include "loadFileToBuf.h"
+#include "HttpServThread.h"
+#include "HttpGzipStream.h"
+#include "Logging.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
 
 
 // =======================================================================================
 /// @brief Constructor
+///
+/// Doesn't touch the disk - that happens in load() on the first request.
+/// @param objectPath The path to the file (relative to the server's working directory).
+/// We take a copy.
+/// @param mType The mime type to serve the object as.
 
-HttpStaticPage::HttpStaticPage(char* objectPath):originalPath(objectPath)
+HttpStaticPage::HttpStaticPage(const char* objectPath, MimeType mType):
+                                          loaded(false),
+                                          fileFd(-1),
+                                          bodySize(0u),
+                                          body(NULL),
+                                          headLen(0u),
+                                          gzSize(0u),
+                                          gzBody(NULL),
+                                          gzHeadLen(0u),
+                                          mimeType(mType)
 {
-  respBuf = loadFileToBuf(objectPath, &respBufSize);
+  originalPath = strdup(objectPath);
 }
 
 
@@ -21,16 +43,87 @@ HttpStaticPage::HttpStaticPage(char* objectPath):originalPath(objectPath)
 
 HttpStaticPage::~HttpStaticPage(void)
 {
+  if(body)
+    munmap(body, bodySize);
+  if(fileFd >= 0)
+    close(fileFd);
+  if(gzBody)
+    delete[] gzBody;
+  free(originalPath);
 }
 
 
 // =======================================================================================
-/// @brief Provide a pointer to our assembled page on request
-/// @returns The char* pointer to the page
+/// @brief Open and map our file, and build the unchanging part of the response header.
+/// 
+/// Safe to call from several server threads at once - only the first does the work.
+/// @returns True if the page is ready to serve, false if the file couldn't be loaded.
 
-char* HttpStaticPage::getResponse(void)
+bool HttpStaticPage::load(void)
 {
-  return respBuf;
+  if(isLoaded())
+    return true;
+  
+  lock();
+  if(isLoaded())
+   {
+    unlock();
+    return true;
+   }
+  
+  struct stat params;
+  int fd = open(originalPath, O_RDONLY);
+  if(fd < 0 || fstat(fd, &params) < 0 || !S_ISREG(params.st_mode))
+   {
+    LogResponseErrors("Couldn't open static page %s.\n", originalPath);
+    if(fd >= 0)
+      close(fd);
+    unlock();
+    return false;
+   }
+  bodySize = params.st_size;
+  if(bodySize)
+   {
+    void* map = mmap(NULL, bodySize, PROT_READ, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+     {
+      LogResponseErrors("Couldn't map static page %s.\n", originalPath);
+      close(fd);
+      unlock();
+      return false;
+     }
+    body = (char*)map;
+   }
+  fileFd = fd;
+  
+  // Keep a gzipped copy if it's text and compresses usefully
+  if(bodySize >= HTTP_GZIP_MIN_SIZE && HttpGzipStream::compressible(mimeType))
+   {
+    HttpGzipStream gzip;
+    if(gzip.compressAll(body, bodySize, HTTP_GZIP_LEVEL) && gzip.output.size() < bodySize)
+     {
+      gzSize = gzip.output.size();
+      gzBody = new char[gzSize];
+      memcpy(gzBody, gzip.output.data(), gzSize);
+      gzHeadLen = snprintf(gzHeadBuf, STATIC_HEAD_BUF_SIZE, "HTTP/1.1 200 OK\r\n"
+                      "Content-Type: %s\r\nContent-Length: %u\r\n"
+                      "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n"
+                      "Cache-Control: public, max-age=%u\r\n", 
+                      MimeTypeMap::inverseMap[mimeType], gzSize, CACHE_DURATION);
+     }
+   }
+  
+  headLen = snprintf(headBuf, STATIC_HEAD_BUF_SIZE, "HTTP/1.1 200 OK\r\n"
+                      "Content-Type: %s\r\nContent-Length: %u\r\n%s"
+                      "Cache-Control: public, max-age=%u\r\n", 
+                      MimeTypeMap::inverseMap[mimeType], bodySize, 
+                      gzBody ? "Vary: Accept-Encoding\r\n" : "", CACHE_DURATION);
+  
+  LogHTTPBufferOps("Static page %s mapped with %u bytes (%u gzipped).\n", originalPath, 
+                                                                    bodySize, gzSize);
+  loaded.store(true, std::memory_order_release);
+  unlock();
+  return true;
 }
 
 
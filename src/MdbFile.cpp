@@ -12,19 +12,76 @@
 
 #include "MdbFile.h"
 //#include "mdbver.h"
-#include "SoilProfile.h"
 #include "Global.h"
 #include "Logging.h"
 #include <err.h>
+#include <string.h>
+#include <stdlib.h>
 
 
 // =======================================================================================
 /// @brief Constructor
-/// @param mdb Pointer to the MdbHandle for the database (which should be open already).
+/// @param colName The name of the column in the table.
+/// @param type The type of the field the column goes into in the structure.
+/// @param offs The offset of the field in the structure (use offsetof()).
+/// @param size The size of the field (only needed for MdbFieldText, where it must
+/// include room for the terminating nul).
+/// @param div For MdbFieldFloat, a number to divide the column value by (eg 100.0 to
+/// turn a percentage into a fraction).
+
+MdbTableSchemaEntry::MdbTableSchemaEntry(const char* colName, MdbFieldType type, 
+                                                size_t offs, size_t size, double div):
+                                                          columnName(colName),
+                                                          fieldType(type),
+                                                          colIndex(-1),
+                                                          offset(offs),
+                                                          fieldSize(size),
+                                                          divisor(div)
+{
+}
+
+
+// =======================================================================================
+/// @brief Destructor
 
-MdbTableSchemaEntry::MdbTableSchemaEntry(int col, int offs): colIndex(col), offset(offs)
+MdbTableSchema::~MdbTableSchema(void)
 {
-  printf("%d %d\n", colIndex, offset);
+  for(MdbTableSchemaEntry* entry: *this)
+    delete entry;
+}
+
+
+// =======================================================================================
+/// @brief Add a field to the schema.  See MdbTableSchemaEntry::MdbTableSchemaEntry for
+/// the parameters.
+
+void MdbTableSchema::addField(const char* colName, MdbFieldType type, size_t offset,
+                                                                size_t size, double div)
+{
+  push_back(new MdbTableSchemaEntry(colName, type, offset, size, div));
+}
+
+
+// =======================================================================================
+/// @brief Helper function to check that a column of some type in the database can be 
+/// converted into a particular type of field.
+
+static bool columnFitsField(int colType, MdbFieldType fieldType)
+{
+  switch(fieldType)
+   {
+    case MdbFieldInt:
+      return colType == MDB_BOOL || colType == MDB_BYTE || colType == MDB_INT 
+                                                              || colType == MDB_LONGINT;
+    case MdbFieldByte:
+      return colType == MDB_BOOL || colType == MDB_BYTE;
+    case MdbFieldFloat:
+      return colType == MDB_BYTE || colType == MDB_INT || colType == MDB_LONGINT 
+                                    || colType == MDB_FLOAT || colType == MDB_DOUBLE;
+    case MdbFieldText:
+      return colType == MDB_TEXT;
+   }
+  return false;
 }
 
 
@@ -84,6 +141,84 @@ bool MdbTableReader::getNextRow(void)
 }
 
 
+// =======================================================================================
+/// @brief Look up the columns of a schema in our table, ready for convertRow().  This 
+/// is done once, so that converting the rows needs no name lookups.
+/// @returns True if all the columns were found and are of types that fit their fields,
+/// false otherwise.
+/// @param schema The MdbTableSchema to bind.
+
+bool MdbTableReader::bindSchema(MdbTableSchema& schema)
+{
+  bool retVal = true;
+  for(MdbTableSchemaEntry* entry: schema)
+   {
+    entry->colIndex = -1;
+    for(int i=0; i<table->num_cols; i++)
+     {
+      MdbColumn *col = (MdbColumn*)g_ptr_array_index(table->columns, i);
+      if(entry->columnName == col->name)
+       {
+        if(columnFitsField(col->col_type, entry->fieldType))
+          entry->colIndex = i;
+        else
+          LogSoilDbErr("Column %s has type %d, which doesn't fit field type %d.\n", 
+                        entry->columnName.c_str(), col->col_type, entry->fieldType);
+        break;
+       }
+     }
+    if(entry->colIndex < 0)
+     {
+      LogSoilDbErr("Couldn't bind column %s in schema.\n", entry->columnName.c_str());
+      retVal = false;
+     }
+    else if(entry->fieldType == MdbFieldText && entry->fieldSize == 0u)
+     {
+      LogSoilDbErr("No room for text of column %s.\n", entry->columnName.c_str());
+      retVal = false;
+     }
+   }
+  return retVal;
+}
+
+
+// =======================================================================================
+/// @brief Convert the current row (read by getNextRow()) into a structure.
+/// @param schema The MdbTableSchema, which must have been bound by bindSchema().
+/// @param S Pointer to the structure to fill in.
+
+void MdbTableReader::convertRow(MdbTableSchema& schema, void* S)
+{
+  char* base = (char*)S;
+  for(MdbTableSchemaEntry* entry: schema)
+   {
+    char* value = boundValues[entry->colIndex];
+    char* field = base + entry->offset;
+    switch(entry->fieldType)
+     {
+      case MdbFieldInt:
+        *(int32_t*)field = (int32_t)strtol(value, NULL, 10);
+        break;
+      case MdbFieldByte:
+        *(uint8_t*)field = (uint8_t)strtol(value, NULL, 10);
+        break;
+      case MdbFieldFloat:
+        *(float*)field = strtod(value, NULL)/entry->divisor;
+        break;
+      case MdbFieldText:
+       {
+        size_t len = strnlen(value, entry->fieldSize - 1);
+        memcpy(field, value, len);
+        field[len] = '\0';
+        break;
+       }
+     }
+    LogHSWDExhaustive("%s len: %d; val: %s\n", entry->columnName.c_str(), 
+                                        boundLens[entry->colIndex], value);
+   }
+}
+
+
 // =======================================================================================
 /// @brief Constructor
 
@@ -127,15 +262,6 @@ void MdbDatabase::logCatalog(void)
 }
 
 
-// =======================================================================================
-/// @brief Fetch a particular soil profile.
-
-bool MdbDatabase::fetchNextRowToStructure(void* S)
-{
-  return false;
-}
-
-
 // =======================================================================================
 /// @brief Destructor
 
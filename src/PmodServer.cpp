@@ -6,6 +6,7 @@
 #include "HttpServThread.h"
 #include "loadFileToBuf.h"
 #include "Logging.h"
+#include "HttpRouteTable.h"
 
 
 // =======================================================================================
@@ -85,7 +86,7 @@ bool PmodServer::processHttpRequest(HttpServThread* serv, char* url)
    }
 
   // fileUpload
-  else if(serv->reqParser.requestMethod == POST && strlenUrl == 10 
+  else if(serv->reqParser->requestMethod == POST && strlenUrl == 10 
                                                 && strncmp(url, "fileUpload", 10) == 0)
    {
     LogPermaservOpDetails("Processing upload of file from user %s.\n", loginName);
@@ -164,4 +165,28 @@ bool PmodServer::provideManualUploadForm(HttpServThread* serv)
 }
 
 
+// =======================================================================================
+/// @brief C function to handle requests routed to us by HttpRouteTable.
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv A pointer to the HttpServThread managing the HTTP response.
+/// @param url A string with the balance of the request url after "/oldf/".
+/// @param context A pointer to the PmodServer.
+
+bool pmodServerRoute(HttpServThread* serv, char* url, void* context)
+{
+  LogPermaservOpDetails("Processing pmodserver request for %s.\n", url);
+  return ((PmodServer*)context)->processHttpRequest(serv, url);
+}
+
+
+// =======================================================================================
+/// @brief Add the routes for requests we handle to the route table of the server.
+/// @param routes The HttpRouteTable to add our routes to.
+
+void PmodServer::registerRoutes(HttpRouteTable& routes)
+{
+  routes.addRoute("/oldf/", RoutePrefix, pmodServerRoute, this, 1u);
+}
+
+
 // =======================================================================================
@@ -9,21 +9,26 @@
 #include "SoilDatabase.h"
 #include "SoilProfile.h"
 #include "Logging.h"
+#include "HttpServThread.h"
+#include "HttpRouteTable.h"
 #include "HWSDProfile.h"
 #include "Global.h"
 
 #include <stdio.h>
+#include <stddef.h>
+#include <algorithm>
 
 char* worldSoilBilFileName = (char*)"Materials/Soil/hwsd";
 
 char* worldSoilMdbDBName = (char*)"Materials/Soil/HWSD.mdb";
 
+char* worldSoilSnapshotName = (char*)"Materials/Soil/HWSD.snapshot";
+
 // =======================================================================================
 /// @brief Constructor
 
 SoilDatabase::SoilDatabase(void):
-                              worldSoilBilFile(worldSoilBilFileName),
-                              worldSoilMdbDatabase(worldSoilMdbDBName)
+                              worldSoilBilFile(worldSoilBilFileName)
 {
   loadHWSDProfiles();
 }
@@ -34,47 +39,143 @@ SoilDatabase::SoilDatabase(void):
 
 SoilDatabase::~SoilDatabase(void)
 {
-  for(auto profile: worldSoilProfiles)
-    delete profile.second;
 }
 
 
 // =======================================================================================
-/// @brief Create the schema for the HWSD table 
+/// @brief The columns for one soil horizon in the HWSD table.  The topsoil columns are 
+/// named with a T_ prefix, and the subsoil with S_.  
+
+struct HWSDHorizonColumn
+{
+  const char*   suffix;
+  MdbFieldType  type;
+  size_t        offset;   // in HWSDHorizonRecord
+  double        divisor;
+};
+
+#define HORIZON_FIELD(f) offsetof(HWSDHorizonRecord, f)
+
+static const HWSDHorizonColumn hwsdHorizonColumns[] = 
+{
+  {"GRAVEL",          MdbFieldFloat,  HORIZON_FIELD(coarseFragmentFraction),    100.0},
+  {"SAND",            MdbFieldFloat,  HORIZON_FIELD(sandFraction),              100.0},
+  {"SILT",            MdbFieldFloat,  HORIZON_FIELD(siltFraction),              100.0},
+  {"CLAY",            MdbFieldFloat,  HORIZON_FIELD(clayFraction),              100.0},
+  {"USDA_TEX_CLASS",  MdbFieldByte,   HORIZON_FIELD(usdaTextureClass),          1.0},
+  {"OC",              MdbFieldFloat,  HORIZON_FIELD(organicCarbonPercent),      1.0},
+  {"PH_H2O",          MdbFieldFloat,  HORIZON_FIELD(pH),                        1.0},
+  {"CEC_CLAY",        MdbFieldFloat,  HORIZON_FIELD(cecClay),                   1.0},
+  {"CEC_SOIL",        MdbFieldFloat,  HORIZON_FIELD(cecSoil),                   1.0},
+  {"BS",              MdbFieldFloat,  HORIZON_FIELD(baseSaturation),            1.0},
+  {"TEB",             MdbFieldFloat,  HORIZON_FIELD(totalExchangeableBases),    1.0},
+  {"CACO3",           MdbFieldFloat,  HORIZON_FIELD(limeContent),               1.0},
+  {"CASO4",           MdbFieldFloat,  HORIZON_FIELD(gypsumContent),             1.0},
+  {"ESP",             MdbFieldFloat,  HORIZON_FIELD(exchangeableNaPercentage),  1.0},
+  {"ECE",             MdbFieldFloat,  HORIZON_FIELD(electricalConductivity),    1.0},
+  // Tacked on the end of the database schema but not documented in the tech report.
+  // (We use this rather than the documented REF_BULK_DENSITY.)
+  {"BULK_DENSITY",    MdbFieldFloat,  HORIZON_FIELD(bulkDensity),               1.0},
+};
+
+#undef HORIZON_FIELD
+
+
+// =======================================================================================
+/// @brief Create the schema for the HWSD table, mapping its columns to the fields of 
+/// HWSDRecord.
+///
+/// See the technical report at https://www.fao.org/3/aq361e/aq361e.pdf for the 
+/// semantics of the different columns.
 
 void SoilDatabase::createHWSDSchema(void)
 {
+  if(hwsdSchema.size())
+    return;
+  
+  // Global information about the profile
+  hwsdSchema.addField("ID",         MdbFieldInt,   offsetof(HWSDRecord, dbId));
+  hwsdSchema.addField("MU_GLOBAL",  MdbFieldInt,   offsetof(HWSDRecord, muGlobal));
+  hwsdSchema.addField("MU_SOURCE1", MdbFieldText,  offsetof(HWSDRecord, muSource1),
+                                                        sizeof(HWSDRecord::muSource1));
+  hwsdSchema.addField("MU_SOURCE2", MdbFieldInt,   offsetof(HWSDRecord, muSource2));
+  hwsdSchema.addField("ISSOIL",     MdbFieldByte,  offsetof(HWSDRecord, isSoil));
+  hwsdSchema.addField("SHARE",      MdbFieldFloat, offsetof(HWSDRecord, share));
+  hwsdSchema.addField("SEQ",        MdbFieldByte,  offsetof(HWSDRecord, seq));
+  hwsdSchema.addField("SU_SYM74",   MdbFieldText,  offsetof(HWSDRecord, suSym74),
+                                                        sizeof(HWSDRecord::suSym74));
+  hwsdSchema.addField("SU_CODE74",  MdbFieldInt,   offsetof(HWSDRecord, suCode74));
+  hwsdSchema.addField("SU_SYM85",   MdbFieldText,  offsetof(HWSDRecord, suSym85),
+                                                        sizeof(HWSDRecord::suSym85));
+  hwsdSchema.addField("SU_CODE85",  MdbFieldInt,   offsetof(HWSDRecord, suCode85));
+  hwsdSchema.addField("SU_SYM90",   MdbFieldText,  offsetof(HWSDRecord, suSym90),
+                                                        sizeof(HWSDRecord::suSym90));
+  hwsdSchema.addField("SU_CODE90",  MdbFieldInt,   offsetof(HWSDRecord, suCode90));
+  hwsdSchema.addField("T_TEXTURE",  MdbFieldByte,  offsetof(HWSDRecord, tTexture));
+  hwsdSchema.addField("DRAINAGE",   MdbFieldInt,   offsetof(HWSDRecord, drainage));
+  hwsdSchema.addField("REF_DEPTH",  MdbFieldInt,   offsetof(HWSDRecord, refDepth));
+  hwsdSchema.addField("AWC_CLASS",  MdbFieldByte,  offsetof(HWSDRecord, awcClass));
+  hwsdSchema.addField("PHASE1",     MdbFieldByte,  offsetof(HWSDRecord, phase1));
+  hwsdSchema.addField("PHASE2",     MdbFieldByte,  offsetof(HWSDRecord, phase2));
+  hwsdSchema.addField("ROOTS",      MdbFieldByte,  offsetof(HWSDRecord, roots));
+  hwsdSchema.addField("IL",         MdbFieldByte,  offsetof(HWSDRecord, il));
+  hwsdSchema.addField("SWR",        MdbFieldByte,  offsetof(HWSDRecord, swr));
+  hwsdSchema.addField("ADD_PROP",   MdbFieldByte,  offsetof(HWSDRecord, addProp));
+  
+  // The topsoil and subsoil qualities
+  char colName[32];
+  for(const HWSDHorizonColumn& column: hwsdHorizonColumns)
+   {
+    snprintf(colName, 32, "T_%s", column.suffix);
+    hwsdSchema.addField(colName, column.type, 
+                    offsetof(HWSDRecord, topSoil) + column.offset, 0u, column.divisor);
+    snprintf(colName, 32, "S_%s", column.suffix);
+    hwsdSchema.addField(colName, column.type, 
+                    offsetof(HWSDRecord, subSoil) + column.offset, 0u, column.divisor);
+   }
 }
 
 
 // =======================================================================================
-/// @brief Read the table of all the soil profiles at startup.
+/// @brief Get the table of all the soil profiles at startup.
 /// 
-/// Reads them from the MS Access database worldSoilMdbDBName and stores them all in 
-/// the worldSoilProfiles unordered_map in memory for later efficient retrieval (a single
-/// hash look-up).
+/// Normally this just maps the HWSDSnapshot file worldSoilSnapshotName into memory.  If
+/// that's missing or out of date, the snapshot is first rebuilt from the MS Access
+/// database worldSoilMdbDBName (which is slow, but only needs doing once).
 
 void SoilDatabase::loadHWSDProfiles(void)
 {
-  MdbTableReader hwsdTable(worldSoilMdbDatabase.mdb, (char*)"HWSD_DATA", 2048);
-  HWSDProfile* soil;
+  if(worldSoilSnapshot.load(worldSoilSnapshotName, worldSoilMdbDBName))
+    return;
   
-  while(hwsdTable.getNextRow())
-   {
-    soil = new HWSDProfile(hwsdTable);
-    worldSoilProfiles[soil->muGlobal] = soil;
-    LogSoilDbOps("Got HWSD profile for soil index %u.\n",  soil->muGlobal);
-   }
+  LogSoilDbOps("Rebuilding HWSD snapshot %s from %s.\n", worldSoilSnapshotName, 
+                                                                    worldSoilMdbDBName);
+  createHWSDSchema();
+  std::vector<HWSDRecord> rows;
+  MdbDatabase worldSoilMdbDatabase(worldSoilMdbDBName);
+  MdbTableReader hwsdTable(worldSoilMdbDatabase.mdb, (char*)"HWSD_DATA", 2048);
+  unless(hwsdTable.importAll(hwsdSchema, rows))
+    err(-1, "Couldn't import HWSD_DATA from %s.\n", worldSoilMdbDBName);
+  LogSoilDbOps("Imported %lu rows of HWSD_DATA.\n", rows.size());
+  unless(HWSDSnapshot::build(worldSoilSnapshotName, worldSoilMdbDBName, rows)
+                    && worldSoilSnapshot.load(worldSoilSnapshotName, worldSoilMdbDBName))
+    err(-1, "Couldn't build HWSD snapshot %s.\n", worldSoilSnapshotName);
 }
 
 
 /// =======================================================================================
 /// @brief Output JSON soil profile format for a particular location to a buffer.
 ///
-/// Note this function does not itself write out JSON, but rather is a gateway which
-/// selects the right database (based on the location), retrieves a SoilProfile object
-/// from that database, and then delegates actually generating the correct JSON output 
-/// to the SoilProfile class.
+/// Note this function does not itself write out the profiles, but rather is a gateway
+/// which selects the right database (based on the location), finds all the soil 
+/// mapping units in the rectangle and what fraction of its area each covers, and then
+/// delegates generating the JSON for each to the SoilProfile class.  A mapping unit is
+/// a mix of soils (one HWSD row each, numbered by seq, with the share of the unit each
+/// makes up).  The result is a JSON array with an object for every soil of every 
+/// mapping unit that has a profile, giving its muGlobal id, the unit's areaFraction, 
+/// its seq and share, and the profile itself.  Mapping units come largest area first, 
+/// and within each, the soils in seq order (so the dominant soil comes first).  (Areas
+/// with no profile, such as water, are left out, so the fractions may not add to one.)
 /// 
 /// @returns The number of bytes written to the buffer.  If greater than or equal to 
 /// the supplied bufSize parameter, it indicates the buffer was not big enough and the
@@ -83,38 +184,138 @@ void SoilDatabase::loadHWSDProfiles(void)
 /// @param bufSize The size of the buffer, which must not be overwritten after the end.
 /// @param loLat The low end of the latitude range requested.
 /// @param hiLat The high end of the latitude range requested.
-/// @param hiLong The low end of the longtitude range requested.
-/// @param longt The high end of the longtitude range requested.
+/// @param loLong The low end of the longtitude range requested.
+/// @param hiLong The high end of the longtitude range requested.
 /// @todo Currently we always pull from the Harmonized World Soil Database, but ultimately
 /// we should select the best database for a given location.
-/// @todo Currently we only accommodate finding and returning a single profile, even if
-/// there were actually more to find (we are given lat/long intervals and would ideally
-/// return all profile data from that rectangle).
 
 unsigned SoilDatabase::printJsonSoilProfiles(char* buf, unsigned bufSize, 
                                       float loLat, float hiLat, float loLong, float hiLong)
 {
-  float lat = (loLat + hiLat)/2.0f;
-  float longt = (loLong + hiLong)/2.0f;
+  // Find the mapping units in the rectangle, and keep those we have profiles for
+  std::unordered_map<unsigned short, float> areas;
+  worldSoilBilFile.valueAreas(loLat, hiLat, loLong, hiLong, areas);
+  std::vector<unsigned short> ids;
+  std::vector<float>          fractions;
+  for(auto& iter: areas)
+   {
+    unless(iter.first)
+      continue; // no soil
+    ids.push_back(iter.first);
+    fractions.push_back(iter.second);
+   }
+  std::vector<const HWSDRecord*> records(ids.size());
+  worldSoilSnapshot.findBatch(ids.size(), ids.data(), records.data());
+  std::vector<std::pair<float, const HWSDRecord*> > found;
+  for(unsigned i=0; i<ids.size(); i++)
+   {
+    if(records[i])
+      found.push_back(std::make_pair(fractions[i], records[i]));
+    else
+      LogSoilDbErr("Could not get profile for soilIndex %u in [%.3f, %.3f] x "
+                        "[%.3f, %.3f].\n", ids[i], loLat, hiLat, loLong, hiLong);
+   }
+  std::sort(found.begin(), found.end(), 
+                              std::greater<std::pair<float, const HWSDRecord*> >());
+  if(found.size())
+    LogSoilDbOps("Obtained %lu soil indices for [%.3f, %.3f] x [%.3f, %.3f].\n", 
+                                          found.size(), loLat, hiLat, loLong, hiLong);
+  else
+    LogSoilDbErr("Could not get any soil profile for [%.3f, %.3f] x [%.3f, %.3f].\n", 
+                                                            loLat, hiLat, loLong, hiLong);
   
-  unsigned short soilIndex = worldSoilBilFile.valueAtPoint(lat, longt);
-  unless(soilIndex)
+  // Write out the array, with every soil (row) in each mapping unit
+  char* end = buf + bufSize;
+  char* out = buf;
+  bool  firstEntry = true;
+  out += snprintf(out, end-out, "[\n");
+  for(unsigned i=0; i<found.size() && out < end; i++)
    {
-    LogSoilDbErr("Could not get soil index for lat,long: %.3f, %.3f.\n", lat, longt);
-    return 0u;    
+    const HWSDRecord* rows = found[i].second;
+    unsigned nRows = worldSoilSnapshot.rowCount(rows);
+    for(unsigned j=0; j<nRows && out < end; j++)
+     {
+      out += snprintf(out, end-out, "%s{\"muGlobal\": %u,\n\"areaFraction\": %.4f,\n"
+                          "\"seq\": %u,\n\"share\": %.3f,\n\"profile\": ", 
+                          firstEntry ? "" : ",\n", (unsigned)rows[j].muGlobal, found[i].first,
+                          (unsigned)rows[j].seq, rows[j].share);
+      firstEntry = false;
+      if(out >= end)
+        break;
+      HWSDProfile profile(rows[j]);
+      profile.latitude    = (loLat + hiLat)/2.0f;
+      profile.longtitude  = (loLong + hiLong)/2.0f;
+      int written = profile.writeJson(out, end-out);
+      if(written < 0)
+        return bufSize;
+      out += written;
+      if(out < end)
+        out += snprintf(out, end-out, "}");
+     }
    }
-  LogSoilDbOps("Obtained soil index %u for lat,long: %.3f, %.3f.\n", 
-                                                                  soilIndex, lat, longt);
-  unless(worldSoilProfiles.count(soilIndex))
+  if(out < end)
+    out += snprintf(out, end-out, "\n]\n");
+  return out < end ? out - buf : bufSize;
+}
+
+
+// =======================================================================================
+/// @brief Process the case of a request for the soil profiles available in some specific
+/// region of lat/long space.
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv A pointer to the HttpServThread managing the HTTP response.
+/// @param url The balance of the URL that we are to deal with (ie after the '?')
+
+bool SoilDatabase::processHttpRequest(HttpServThread* serv, char* url)
+{
+  float latLongRegion[4]; // (loLat, hiLat, loLong, hiLong) 
+  unless(extractColonVecN(url, 4, latLongRegion))
    {
-    LogSoilDbErr("Could not get profile for soilIndex %u at lat,long: %.3f, %.3f.\n", 
-                                                                    soilIndex, lat, longt);
-    return 0u;    
+    LogRequestErrors("Bad soil request: soil?%s\n", url);
+    return false;
+   }
+  unless(checkLatLongRegion(latLongRegion))
+   {
+    LogRequestErrors("Bad parameters in soil request: soil?%s\n", url);
+    return false;
    }
   
-  SoilProfile* soilProfile = worldSoilProfiles[soilIndex];
-  unsigned retVal = soilProfile->writeJson(buf, bufSize);
-  return retVal;
+  if( (serv->respPtr += printJsonSoilProfiles(serv->respPtr, serv->respEnd-serv->respPtr, 
+                    latLongRegion[0], latLongRegion[1], latLongRegion[2], latLongRegion[3]))
+          >= serv->respEnd)
+   {
+    LogSoilDbErr("Overflow in json response to soil request %s.\n", url);
+    serv->respBufOverflow = true; 
+    return false;
+   }
+  LogPermaservOps("Serviced soil request for %f,%f,%f,%f from client on port %u.\n", 
+                  latLongRegion[0], latLongRegion[1], latLongRegion[2], latLongRegion[3],
+                  serv->clientP);
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief C function to handle requests routed to us by HttpRouteTable.
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv A pointer to the HttpServThread managing the HTTP response.
+/// @param url A string with the balance of the request url after "/soil?".
+/// @param context A pointer to the SoilDatabase.
+
+bool soilRoute(HttpServThread* serv, char* url, void* context)
+{
+  LogPermaservOpDetails("Processing soil request for %s.\n", url);
+  return ((SoilDatabase*)context)->processHttpRequest(serv, url);
+}
+
+
+// =======================================================================================
+/// @brief Add the routes for requests we handle to the route table of the server.
+/// @param routes The HttpRouteTable to add our routes to.
+
+void SoilDatabase::registerRoutes(HttpRouteTable& routes)
+{
+  routes.addRoute("/soil", RouteQuery, soilRoute, this, 8u, true);
 }
 
 
@@ -67,26 +67,44 @@ bool SoilDatabaseClient::getProfilesFromSoilDatabase(void)
   // Parse the returned document to extract the soil profiles.  Note we are a friend
   // of HttpPermaservClient so we can access it's private doc variable - makes more 
   // sense to keep the detailed knowledge of soil profile JSON structure here.
+  // The document is an array of the soils of each mapping unit in our area, largest
+  // unit first and then in seq order, each with its areaFraction, share, and profile.
   Document& soilJson = httpPermClient.doc;
-
-  unless(soilJson.HasMember("dynamicType") && soilJson["dynamicType"].IsString())
+  unless(soilJson.IsArray())
    {
-    LogPermaservClientErrors("Bad or missing dynamicType in soil json.\n");
+    LogPermaservClientErrors("Soil json is not an array of profiles.\n");
     return false;
    }
-  const char* dType = soilJson["dynamicType"].GetString();
-  if(strcmp(dType, "TypeHWSDProfile") == 0)
-   {
-    HWSDProfile* soilProf = new HWSDProfile(soilJson);
-    soilSamples.push_back((SoilProfile*)soilProf);
-   }
-  else
+  
+  int N = soilJson.Size();
+  for(int i=0; i<N; i++)
    {
-    // No other soil profile types supported at present
-    LogPermaservClientErrors("Unsupported dynamicType %s in soil json.\n", dType);
-    return false;    
+    unless(soilJson[i].IsObject() && soilJson[i].HasMember("profile") 
+                                                    && soilJson[i]["profile"].IsObject())
+     {
+      LogPermaservClientErrors("Bad or missing profile %d in soil json.\n", i);
+      continue;
+     }
+    Value& profileJson = soilJson[i]["profile"];
+    unless(profileJson.HasMember("dynamicType") && profileJson["dynamicType"].IsString())
+     {
+      LogPermaservClientErrors("Bad or missing dynamicType in soil json profile %d.\n", i);
+      continue;
+     }
+    const char* dType = profileJson["dynamicType"].GetString();
+    if(strcmp(dType, "TypeHWSDProfile") == 0)
+     {
+      HWSDProfile* soilProf = new HWSDProfile(profileJson);
+      soilSamples.push_back((SoilProfile*)soilProf);
+     }
+    else
+     {
+      // No other soil profile types supported at present
+      LogPermaservClientErrors("Unsupported dynamicType %s in soil json profile %d.\n", 
+                                                                                dType, i);
+     }
    }
-  return true;
+  return soilSamples.size() > 0;
 }
 
 
@@ -121,16 +121,16 @@ int SoilProfile::writeJsonFields(char* buf, unsigned bufSize)
 /// 
 /// Note the convention here is that groundLayers are indexed from the top down.
 /// 
-/// @param soilJson A rapidjson::Document reference with the parsed json received from
-/// permaserv.  By the time we get here, we are guaranteed that it's valid JSON, but 
-/// otherwise we need to validate.
+/// @param soilJson A rapidjson::Value reference with the parsed json for the profile
+/// received from permaserv.  By the time we get here, we are guaranteed that it's valid
+/// JSON, but otherwise we need to validate.
 /// 
 /// See the technical report at
 /// https://www.fao.org/3/aq361e/aq361e.pdf for the semantics of the different fields.
 
 using namespace rapidjson;
 
-void SoilProfile::getGroundLayersFromJson(Document& soilJson)
+void SoilProfile::getGroundLayersFromJson(Value& soilJson)
 {
   // Check we have a valid array at all
   unless(soilJson.HasMember("groundLayers") && soilJson["groundLayers"].IsArray())
@@ -1,7 +1,10 @@
 // Copyright Staniford Systems.  All Rights Reserved.  Apr 2021 -
-// Task queue class for use in multi-threaded version.
+// Task queue class for use in multi-threaded version.  Each queue has a worker thread
+// and a lock-free ring of tasks.  A worker that runs out of its own tasks steals from
+// the other queues in its farm before going to sleep.
 
 #include "TaskQueue.h"
+#include "TaskQueueFarm.h"
 #include "Logging.h"
 #include <err.h>
 
@@ -20,6 +23,31 @@ Task::Task(void (*work)(void*, TaskQueue*), void* arg):
 }
 
 
+// =======================================================================================
+/// @brief Constructor for the lock-free ring of tasks.
+///
+/// Each cell starts with its sequence number equal to its index, which marks it as
+/// free for the producer whose enqueue position matches.
+
+TaskRing::TaskRing(void):
+                      enqueuePos(0u),
+                      dequeuePos(0u)
+{
+  cells = new Cell[TASK_RING_SIZE];
+  for(size_t i=0; i<TASK_RING_SIZE; i++)
+    cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+
+// =======================================================================================
+/// @brief Destructor for the ring.
+
+TaskRing::~TaskRing(void)
+{
+  delete[] cells;
+}
+
+
 // =======================================================================================
 // C wrapper for pthread_create
 
@@ -35,10 +63,15 @@ void* startWorkThread(void* arg)
 // Constructor for entire task queue
 
 TaskQueue::TaskQueue(unsigned index):
-                    tasksQueued(0u),
                     tasksInProgress(0u),
+                    maxQueued(0u),
+                    tasksDone(0u),
+                    tasksStolen(0u),
+                    sleeping(false),
                     queueIndex(index),
-                    timeToDie(false)
+                    timeToDie(false),
+                    farm(NULL),
+                    overflowCount(0u)
 {
   if(pthread_cond_init(&taskWait, NULL))
     err(-1, "Couldn't initialize taskWait in TaskQueue::TaskQueue.");
@@ -64,48 +97,134 @@ TaskQueue::~TaskQueue(void)
 
 
 // =======================================================================================
-// This is the main loop of the thread servicing this TaskQueue.  When there's no work,
-// it waits on a condition variable.  When there are tasks in the queue, it does them one
-// by one.
+// Take the oldest task from this queue (called by our own worker, or by a worker on
+// another queue that is stealing from us).  Returns false if there was nothing to take.
+
+bool TaskQueue::takeTask(Task& task)
+{
+  if(ring.pop(task))
+    return true;
+  
+  // Rare case that the ring filled up at some point
+  unless(overflowCount.load())
+    return false;
+  bool gotOne = false;
+  lock();
+  unless(overflow.empty())
+   {
+    task = overflow.front();
+    overflow.pop_front();
+    overflowCount--;
+    gotOne = true;
+   }
+  unlock();
+  return gotOne;
+}
+
+
+// =======================================================================================
+// This is the main loop of the thread servicing this TaskQueue.  We do our own tasks 
+// in order, and when there are none, look for work on other queues in the farm.  When 
+// there's no work anywhere, we wait on a condition variable.  
+// 
+// To avoid lost wakeups, we announce we are sleeping *before* having a last look for
+// work, and whoever adds work checks the sleeping flag *after* adding it, so at 
+// least one of us will see the other.  As the ring is published with relaxed and 
+// release/acquire operations, each side needs a full fence between its store and its 
+// check for that to hold (otherwise both loads could be satisfied before either store
+// is visible).
 
 void TaskQueue::workLoop(void)
 {
+  Task task;
+  
   until(timeToDie)
    {
-    lock();
-    until(tasksQueued > 0)
-      pthread_cond_wait(&taskWait, &mutex);
-
-    // remove a task from the queue
-    Task* task = back();
-    pop_back();
-    tasksQueued--;
-    tasksInProgress++;
-    unlock();
+    bool stolen = false;
+    unless(takeTask(task))
+     {
+      TaskQueueFarm* F = farm;
+      unless(F && (stolen = F->stealTask(queueIndex, task)))
+       {
+        lock();
+        sleeping = true;
+        if(F)
+          F->nSleeping++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(queueSize() > 0 || (F && F->workAvailable()))
+          sleeping = false;
+        while(sleeping && !timeToDie)
+          pthread_cond_wait(&taskWait, &mutex);
+        if(F)
+          F->nSleeping--;
+        unlock();
+        continue;
+       }
+     }
     
-    // perform the task (having released the taskqueue lock)
-    task->doWork(task->theArg, this);
-    lock();
+    // perform the task (no locks held)
+    tasksInProgress++;
+    task.doWork(task.theArg, this);
     tasksInProgress--;
-    unlock();
-    delete task;
+    tasksDone++;
+    if(stolen)
+      tasksStolen++;
    }
 }
 
 
 // =======================================================================================
-// Function called to add a task to this particular queue.
+// Wake up our worker if it is asleep.  Returns true if it was asleep.
 
-void TaskQueue::addTask(void (*work)(void*, TaskQueue*), void* arg)
+bool TaskQueue::wake(void)
 {
-  Task* task = new Task(work, arg);
-
+  unless(sleeping.load())
+    return false;
+  
   lock();
+  bool wasSleeping = sleeping.exchange(false);
+  if(wasSleeping)
+    pthread_cond_signal(&taskWait);
+  unlock();
+  return wasSleeping;
+}
+
+
+// =======================================================================================
+// Function called to add a task to this particular queue.  This is lock-free unless 
+// our ring is full.  Returns true if we had to wake our worker to do it (if not, the 
+// caller might want to wake some other idle worker that can steal it).
+
+bool TaskQueue::addTask(void (*work)(void*, TaskQueue*), void* arg)
+{
+  unless(ring.push(work, arg))
+   {
+    lock();
+    overflow.push_back(Task(work, arg));
+    overflowCount++;
+    unlock();
+    LogTaskQueueFarmOps("Task queue %u ring full, using overflow.\n", queueIndex);
+   }
   
-  // add a task to the queue
-  push_front(task);  
-  tasksQueued++;
+  // Racy, but this is just a diagnostic high water mark
+  unsigned size = queueSize();
+  if(size > maxQueued.load(std::memory_order_relaxed))
+    maxQueued.store(size, std::memory_order_relaxed);
   
+  // Make sure the task is visible before we look at the sleeping flag (see workLoop)
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return wake();
+}
+
+
+// =======================================================================================
+// Tell the worker to stop (after the task it is on, if any).
+
+void TaskQueue::die(void)
+{
+  lock();
+  timeToDie = true;
+  sleeping  = false;
   pthread_cond_signal(&taskWait);
   unlock();
 }
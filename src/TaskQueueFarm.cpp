@@ -4,7 +4,7 @@
 
 #include "TaskQueueFarm.h"
 #include "Logging.h"
-#include "HttpDebug.h"
+#include "HttpServThread.h"
 #include <assert.h>
 
 
@@ -18,8 +18,10 @@
 /// TaskQueueFarm.
 
 TaskQueueFarm::TaskQueueFarm(unsigned nQueues, const char* lName):
+                                        nSleeping(0u),
                                         nQ(nQueues), 
                                         tasksOutstanding(0u),
+                                        nextQueue(0u),
                                         logName(lName)
 {
   if(pthread_cond_init(&tasksUnfinished, NULL))
@@ -27,8 +29,11 @@ TaskQueueFarm::TaskQueueFarm(unsigned nQueues, const char* lName):
   taskQueues = new TaskQueue*[nQ];
   assert(taskQueues);
   
+  // All the queues must exist before any worker finds out about us and starts stealing.
   for(unsigned s=0; s<nQ; s++)
     taskQueues[s] = new TaskQueue(s);
+  for(unsigned s=0; s<nQ; s++)
+    taskQueues[s]->farm = this;
   LogTaskQueueFarmOps("Task farm %s has initialized %u task queues.\n", logName, nQ);
 }
 
@@ -39,6 +44,8 @@ TaskQueueFarm::TaskQueueFarm(unsigned nQueues, const char* lName):
 /// This constructor takes a pointer to a set of taskqueue pointers initialized by 
 /// someone else.  The typical use case for this is the objects are really some 
 /// subclass of TaskQueue with extra state/behavior that we don't need to know about.
+/// The queues must all exist by the time this is called.  Any of their workers that 
+/// went to sleep before they knew about us are woken so they can start stealing.
 /// @param nQueues The number of pointers to TaskQueue being supplied to us.
 /// @param tQ A pointer to an array of pointers to TaskQueue (or a subclass thereof).  We
 /// will be assigning tasks to these queues going forward.
@@ -46,13 +53,20 @@ TaskQueueFarm::TaskQueueFarm(unsigned nQueues, const char* lName):
 /// TaskQueueFarm.
 
 TaskQueueFarm::TaskQueueFarm(unsigned nQueues, TaskQueue** tQ, const char* lName):
+                                        nSleeping(0u),
                                         nQ(nQueues), 
                                         tasksOutstanding(0u),
+                                        nextQueue(0u),
                                         taskQueues(tQ),
                                         logName(lName)
 {
   if(pthread_cond_init(&tasksUnfinished, NULL))
     err(-1, "Couldn't initialize tasksUnfinished in TaskQueueFarm::TaskQueueFarm.");
+  for(unsigned s=0; s<nQ; s++)
+   {
+    taskQueues[s]->farm = this;
+    taskQueues[s]->wake();
+   }
   LogTaskQueueFarmOps("Task farm %s started with %u supplied task queues.\n", logName, nQ);
 }
 
@@ -62,7 +76,7 @@ TaskQueueFarm::TaskQueueFarm(unsigned nQueues, TaskQueue** tQ, const char* lName
 
 TaskQueueFarm::~TaskQueueFarm(void)
 {
-  for(int s=0; s<nQ; s++)
+  for(unsigned s=0; s<nQ; s++)
     taskQueues[s]->die();
   if(pthread_cond_destroy(&tasksUnfinished))
     err(-1, "Couldn't destroy tasksUnfinished in Scene::~Scene.");
@@ -81,6 +95,10 @@ TaskQueueFarm::~TaskQueueFarm(void)
 
 // =======================================================================================
 /// @brief Function to add work to one of the queues
+/// 
+/// Tasks given the same index go on the same queue and will be done in order by its
+/// worker unless an idle worker steals some of them.  Lock-free except when the 
+/// target queue's worker (or some other idle worker) needs waking.
 /// @param i An index for which queue to use (will have modulus taken to fit in right
 /// range).
 /// @param work A C-style function pointer for the task function to be run.
@@ -88,69 +106,95 @@ TaskQueueFarm::~TaskQueueFarm(void)
 
 void TaskQueueFarm::addTask(unsigned i, void (*work)(void*, TaskQueue*), void* arg)
 {
-  lock();
   tasksOutstanding++;
-  taskQueues[i%nQ]->addTask(work, arg);
-  unlock();
+  i %= nQ;
+  unless(taskQueues[i]->addTask(work, arg))
+    wakeIdleWorker(i);
 }
 
 
 // =======================================================================================
-/// @brief Function to implement load balancing.  
+/// @brief loadBalance a task without an index to use as in addTask
 /// 
-/// Currently this works by finding the queue with the least number of waiting items in.
-/// Note this is called with the lock already held.
-/// @returns An unsigned with our estimate of the best queue to use.
+/// This just deals tasks out round-robin; any imbalance gets fixed by work stealing.
+/// @param work A C-style function pointer for the task function to be run.
+/// @param arg A void* pointer to the data to be supplied to the task function
 
-unsigned TaskQueueFarm::findBestQueue(void)
+void TaskQueueFarm::loadBalanceTask(void (*work)(void*, TaskQueue*), void* arg)
 {
-  unsigned lowestCount = 0xffffffff;
-  int bestI = -1;
-  
-  for(int i=0; i< nQ; i++)
+  unsigned i = nextQueue++;
+  LogTaskQueueFarmOps("Task farm %s assigning task to queue %u.\n", logName, i%nQ);
+  addTask(i, work, arg);
+}
+
+
+// =======================================================================================
+/// @brief If any worker is asleep, wake one up so it can steal work.  
+/// 
+/// Called when a task has been added to a queue whose own worker is busy.
+/// @param skip The index of the queue the task went on (we start looking after it).
+
+void TaskQueueFarm::wakeIdleWorker(unsigned skip)
+{
+  unless(nSleeping.load())
+    return;
+  for(unsigned j=1; j<nQ; j++)
+    if(taskQueues[(skip+j)%nQ]->wake())
+      return;
+}
+
+
+// =======================================================================================
+/// @brief Called by an idle worker to try and take a task from one of the other queues.
+/// @returns True if a task was stolen, false if there was nothing available.
+/// @param thief The index of the queue whose worker is looking for work.
+/// @param task A reference to a Task which will be filled in if we succeed.
+
+bool TaskQueueFarm::stealTask(unsigned thief, Task& task)
+{
+  for(unsigned j=1; j<nQ; j++)
    {
-    taskQueues[i]->lock();
-    if(taskQueues[i]->tasksQueued + taskQueues[i]->tasksInProgress < lowestCount)
+    TaskQueue* victim = taskQueues[(thief+j)%nQ];
+    if(victim->queueSize() && victim->takeTask(task))
      {
-      lowestCount = taskQueues[i]->tasksQueued + taskQueues[i]->tasksInProgress;
-      bestI = i;
+      LogTaskQueueFarmOps("Task farm %s queue %u stole task from queue %u.\n", logName, 
+                                                              thief, victim->queueIndex);
+      return true;
      }
-    taskQueues[i]->unlock();
-   } 
-  
-  if(lowestCount == 0xffffffff || bestI < 0)
-    err(-1, "Craziness in TaskQueueFarm::findBestQueue");
-  LogTaskQueueFarmOps("Task farm %s assigning task to queue %d.\n", logName, bestI);
- 
-  return bestI;
+   }
+  return false;
 }
 
 
 // =======================================================================================
-/// @brief loadBalance a task without an index to use as in addTask
-/// @param work A C-style function pointer for the task function to be run.
-/// @param arg A void* pointer to the data to be supplied to the task function
+/// @brief Check whether any queue has tasks waiting.  
+/// 
+/// Used by a worker as a last check before going to sleep.
+/// @returns True if at least one queue is non-empty.
 
-void TaskQueueFarm::loadBalanceTask(void (*work)(void*, TaskQueue*), void* arg)
+bool TaskQueueFarm::workAvailable(void)
 {
-  lock();
-  tasksOutstanding++;
-  taskQueues[findBestQueue()]->addTask(work, arg);
-  unlock();
+  for(unsigned j=0; j<nQ; j++)
+    if(taskQueues[j]->queueSize())
+      return true;
+  return false;
 }
 
 
 // =======================================================================================
 /// @brief Function to let us know that a piece of work is finished.
 /// 
-/// This should generally called from within the work function at the end).
+/// This should generally called from within the work function at the end).  We only 
+/// need the lock when the last task finishes and waitOnEmptyFarm might need waking.
 
 void TaskQueueFarm::notifyTaskDone(void)
 {
-  lock();
-  tasksOutstanding--;
-  pthread_cond_signal(&tasksUnfinished);
-  unlock();
+  if(--tasksOutstanding == 0u)
+   {
+    lock();
+    pthread_cond_broadcast(&tasksUnfinished);
+    unlock();
+   }
 }
 
 
@@ -169,30 +213,54 @@ void TaskQueueFarm::waitOnEmptyFarm(void)
 // =======================================================================================
 /// @brief Provide a diagnostic page with a table about all the task queues
 /// @returns True if the desired HTML was written correctly, false if we ran out of space.
-/// @param serv The HTTP Debug server
+/// @param serv The HTTP server thread that is handling this request
 
-bool TaskQueueFarm::diagnosticHTML(HttpDebug* serv)
+bool TaskQueueFarm::diagnosticHTML(HttpServThread* serv)
 {
-  serv->startResponsePage("Task Queues");
+  unless(serv->startResponsePage("Task Queues"))
+    return false;
   
   httPrintf("<center>\n");
-  lock();
-  httPrintf("<b>Overall tasks:</b> %u\n", tasksOutstanding);
-  unlock();
+  unless(diagnosticTable(serv))
+    return false;
+  httPrintf("</center><hr>\n");
+  if(!serv->endResponsePage())
+    return false;
+  return true;
+}
+
+
+// =======================================================================================
+/// @brief Provide a table of the depth and history of each of our task queues.
+/// 
+/// Note that the numbers for the different queues are read at slightly different times,
+/// so may not add up exactly to the overall total if the farm is busy.
+/// @returns True if the desired HTML was written correctly, false if we ran out of space.
+/// @param serv The HTTP server thread that is handling this request
+
+bool TaskQueueFarm::diagnosticTable(HttpServThread* serv)
+{
+  unsigned outstanding = tasksOutstanding;
+  httPrintf("<b>Overall tasks (%s):</b> %u\n", logName, outstanding);
   
-  serv->startTable();
-  httPrintf("<tr><th>Index</th><th>Task Count</th></tr>\n");
+  unless(serv->startTable())
+    return false;
+  httPrintf("<tr><th>Index</th><th>Queued</th><th>In Progress</th>"
+                      "<th>Max Queued</th><th>Completed</th><th>Stolen</th></tr>\n");
   
-  for(int i=0; i < nQ; i++)
+  for(unsigned i=0; i < nQ; i++)
    {
-    taskQueues[i]->lock();
-    httPrintf("<tr><td>%d</td><td>%u</td></tr>\n", i, taskQueues[i]->queueSize());
-    taskQueues[i]->unlock();
+    TaskQueue* Q = taskQueues[i];
+    unsigned      queued      = Q->queueSize();
+    unsigned      inProgress  = Q->tasksInProgress;
+    unsigned      maxQueued   = Q->maxQueued;
+    unsigned long done        = Q->tasksDone;
+    unsigned long stolen      = Q->tasksStolen;
+    httPrintf("<tr><td>%u</td><td>%u</td><td>%u</td><td>%u</td><td>%lu</td>"
+                    "<td>%lu</td></tr>\n", i, queued, inProgress, maxQueued, done, stolen);
    }
   
-  httPrintf("</table></center><hr>\n");
-  if(!serv->endResponsePage())
-    return false;
+  httPrintf("</table>\n");
   return true;
 }
 
@@ -5,6 +5,7 @@
 
 #include "Taxonomy.h"
 #include "Logging.h"
+#include "HttpRouteTable.h"
 #include "BioClass.h"
 #include "Order.h"
 #include "Family.h"
@@ -219,4 +220,28 @@ bool Taxonomy::processHttpRequest(HttpServThread* serv, char* url)
 }
 
 
+// =======================================================================================
+/// @brief C function to handle requests routed to us by HttpRouteTable.
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv A pointer to the HttpServThread managing the HTTP response.
+/// @param url A string with the balance of the request url after "/taxonomy/".
+/// @param context A pointer to the Taxonomy.
+
+bool taxonomyRoute(HttpServThread* serv, char* url, void* context)
+{
+  LogPermaservOpDetails("Processing taxonomy request for %s.\n", url);
+  return ((Taxonomy*)context)->processHttpRequest(serv, url);
+}
+
+
+// =======================================================================================
+/// @brief Add the routes for requests we handle to the route table of the server.
+/// @param routes The HttpRouteTable to add our routes to.
+
+void Taxonomy::registerRoutes(HttpRouteTable& routes)
+{
+  routes.addRoute("/taxonomy/", RoutePrefix, taxonomyRoute, this, 1u);
+}
+
+
 // =======================================================================================
@@ -44,7 +44,8 @@ Tree::Tree(Species* S, vec3 loc, float age, float now):
                           ageNow(age),
                           commonName(NULL),
                           taxonomyLink(NULL),
-                          trunk(NULL)
+                          trunk(NULL),
+                          nextInCopse(NULL)
 {
   glm_vec3_copy(loc, location);
   location[2] = 0.0f;
@@ -73,7 +74,8 @@ Tree::Tree(Species* S, vec3 loc, float age, float now):
 
 Tree::Tree(Value& plantObject):
                           VisualObject(false),
-                          trunk(NULL)
+                          trunk(NULL),
+                          nextInCopse(NULL)
 {
   // species/genus/var
   char speciesPath[MAX_SPECIES_PATH];
@@ -237,14 +239,15 @@ float Tree::estimateOpacity(vec3 direction)
 
 
 // =======================================================================================
-// C function to pass to TaskQueue.
+// C function to pass to TaskQueue.  Grows all the trees of one copse, in order, 
+// starting with the one passed and following nextInCopse.
 
 #ifdef MULTI_THREADED_SIMULATION
 
-void growOneTree(void* arg, TaskQueue* T)
+void growOneCopse(void* arg, TaskQueue* T)
 {
-  Tree* tree = (Tree*)arg;
-  tree->growStep(tree->yearsToSim);
+  for(Tree* tree = (Tree*)arg; tree; tree = tree->nextInCopse)
+    tree->growStep(tree->yearsToSim);
   
   threadFarm->notifyTaskDone();   
 }
@@ -311,13 +314,22 @@ void Tree::analyzeTreeGraph(float years, Scene& scene)
      }
    }  
 
-  // Now apportion the work to the threads
-
-  for(int i=0; i<treeCount;i++)  
+  // Now apportion the work to the threads.  Each copse is a single task that grows its
+  // trees in order, so they are never grown by different threads at once, even when 
+  // idle threads steal work from a queue that ends up with more than its share.
+  
+  Tree* copseHeads[nextTaskId];
+  for(unsigned c=0; c<nextTaskId; c++)
+    copseHeads[c] = NULL;
+  for(int i=treeCount-1; i>=0; i--)  
    {
-    treePtrArray[i]->yearsToSim = years;
-    threadFarm->addTask(i, growOneTree, treePtrArray[i]);
+    Tree* tree = treePtrArray[i];
+    tree->yearsToSim  = years;
+    tree->nextInCopse = copseHeads[tree->taskId];
+    copseHeads[tree->taskId] = tree;
    }
+  for(unsigned c=0; c<nextTaskId; c++)
+    threadFarm->addTask(c, growOneCopse, copseHeads[c]);
   
   threadFarm->waitOnEmptyFarm();
 }
@@ -680,7 +692,7 @@ bool Tree::diagnosticHTML(HttpDebug* serv)
 bool Tree::diagnosticHTMLSummary(HttpDebug* serv)
 {
   httPrintf("<tr><td><a href=\"/plants/%d\">Tree %d</a></td>", treePtrArrayIndex,
-                                                                    treePtrArrayIndex)
+                                                                    treePtrArrayIndex);
   httPrintf("<td><a href=\"/species/%s/%s/\">%s %s</a></td>", species->genusName,
                             species->speciesName, species->genusName, species->speciesName);  
   httPrintf("</tr>\n");
@@ -696,7 +708,7 @@ bool Tree::diagnosticHTMLSummary(HttpDebug* serv)
 bool Tree::diagnosticHTMLRow(HttpDebug* serv)
 {
   httPrintf("<tr><td><a href=\"/plants/%d\">%d</a></td>", treePtrArrayIndex,
-                                                                    treePtrArrayIndex)
+                                                                    treePtrArrayIndex);
   httPrintf("<td><a href=\"/species/%s/%s/\">%s %s</a></td>", species->genusName,
                             species->speciesName, species->genusName, species->speciesName);
   httPrintf("<td>[%.2f, %.2f]</td>\n", location[0], location[1]);
@@ -8,6 +8,7 @@
 #include <string.h>
 #include "UserManager.h"
 #include "Logging.h"
+#include "HttpRouteTable.h"
 #include "HttpServThread.h"
 #include "HTMLForm.h"
 #include "CryptoAlgorithms.h"
@@ -277,7 +278,7 @@ bool UserManager::indexPageTable(HttpServThread* serv)
 bool UserManager::processHttpRequest(HttpServThread* serv, char* url, 
                                                                 UserSessionGroup* sessions)
 {
-  HttpRequestParser& reqParser = serv->reqParser;
+  HttpRequestParser& reqParser = *(serv->reqParser);
   int strlenUrl = strlen(url);
   bool retVal = false;
 
@@ -1041,4 +1042,30 @@ bool UserManager::getUserListPage(HttpServThread* serv)
 }
 
 
+// =======================================================================================
+/// @brief C function to handle requests routed to us by HttpRouteTable.
+/// @returns True if all went well, false if we couldn't correctly write a good page.
+/// @param serv A pointer to the HttpServThread managing the HTTP response.
+/// @param url A string with the balance of the request url after "/user/".
+/// @param context A pointer to the UserSessionGroup of the server.
+
+bool userManagerRoute(HttpServThread* serv, char* url, void* context)
+{
+  UserManager& userManager = UserManager::getUserManager();
+  LogPermaservOpDetails("Processing user manager request for %s.\n", url);
+  return userManager.processHttpRequest(serv, url, (UserSessionGroup*)context);
+}
+
+
+// =======================================================================================
+/// @brief Add the routes for requests we handle to the route table of the server.
+/// @param routes The HttpRouteTable to add our routes to.
+/// @param sessions The UserSessionGroup of the server the routes are for.
+
+void UserManager::registerRoutes(HttpRouteTable& routes, UserSessionGroup* sessions)
+{
+  routes.addRoute("/user/", RoutePrefix, userManagerRoute, sessions, 1u);
+}
+
+
 // =======================================================================================
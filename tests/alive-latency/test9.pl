@@ -0,0 +1,51 @@
+#!/usr/bin/perl -w
+
+# Micro-benchmark of permaserv request latency.  Sends /alive/ requests one after 
+# another over a single keep-alive connection and reports the median and 99th 
+# percentile round trip times.  Small responses like this are the ones that suffer 
+# if the header and body go out in separate writes and get held up by Nagle's 
+# algorithm.  Use -L N to set the number of requests (default 1000).
+
+require './testSupport.pl';
+use IO::Socket::INET;
+use Time::HiRes qw(gettimeofday tv_interval);
+
+my($loopLimit, $simLimit) = processArgs(@ARGV);
+$loopLimit = 1000 if $loopLimit == 1;
+
+checkPermaserv();
+
+my $sock = IO::Socket::INET->new(PeerAddr => '127.0.0.1', PeerPort => $servPort,
+                                  Proto => 'tcp') || die("Couldn't connect to permaserv.\n");
+my $request = "GET /alive/ HTTP/1.1\r\nHost: 127.0.0.1:$servPort\r\n\r\n";
+my @times = ();
+
+foreach(1..$loopLimit)
+ {
+  my $start = [gettimeofday];
+  print $sock $request;
+  $sock->flush();
+  
+  # Read the header, then however much body it says there is
+  my $response = '';
+  until($response =~ /\r\n\r\n/s)
+   {
+    my $got = sysread($sock, $response, 4096, length $response);
+    die("Connection closed by permaserv.\n") unless $got;
+   }
+  $response =~ /Content-Length:\s*(\d+)/i || die("No Content-Length in response.\n");
+  my $total = index($response, "\r\n\r\n") + 4 + $1;
+  while(length $response < $total)
+   {
+    my $got = sysread($sock, $response, 4096, length $response);
+    die("Connection closed by permaserv.\n") unless $got;
+   }
+  push @times, tv_interval($start)*1000.0;
+  die("Bad response: $response\n") unless $response =~ /\r\n\r\nOK/;
+ }
+close($sock);
+
+@times = sort {$a <=> $b} @times;
+printf("%d requests: p50 %.3f ms, p99 %.3f ms, max %.3f ms.\n", scalar(@times),
+          $times[int($#times*0.50)], $times[int($#times*0.99)], $times[$#times]);
+